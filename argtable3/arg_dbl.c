@@ -77,6 +77,39 @@ static int arg_dbl_scanfn(struct arg_dbl* parent, const char* argval) {
     return errorcode;
 }
 
+/* Same as arg_dbl_scanfn(), but the value is a comma separated list, */
+/* each of its doubles taking one entry of parent->dval[].            */
+static int arg_dbl_list_scanfn(struct arg_dbl* parent, const char* argval) {
+    const int count = parent->count;
+    char* ptr = (char*)argval;
+
+    if (!argval)
+        return arg_dbl_scanfn(parent, argval);
+    for (;;) {
+        const char* start = ptr;
+        double val = 0;
+        int errorcode = 0;
+
+        if (parent->count == parent->hdr.maxcount) {
+            errorcode = ARG_ERR_MAXCOUNT;
+        } else {
+            val = strtod(start, &ptr);
+            while (*ptr == ' ' || *ptr == '\t')
+                ptr++;
+            if (ptr == start || (*ptr != '\0' && *ptr != ','))
+                errorcode = ARG_ERR_BADDOUBLE;
+        }
+        if (errorcode) {
+            /* none of the list is kept */
+            parent->count = count;
+            return errorcode;
+        }
+        parent->dval[parent->count++] = val;
+        if (*ptr++ == '\0')
+            return 0;
+    }
+}
+
 static int arg_dbl_checkfn(struct arg_dbl* parent) {
     int errorcode = (parent->count < parent->hdr.mincount) ? ARG_ERR_MINCOUNT : 0;
 
@@ -119,7 +152,14 @@ struct arg_dbl* arg_dbl1(const char* shortopts, const char* longopts, const char
     return arg_dbln(shortopts, longopts, datatype, 1, 1, glossary);
 }
 
-struct arg_dbl* arg_dbln(const char* shortopts, const char* longopts, const char* datatype, int mincount, int maxcount, const char* glossary) {
+static struct arg_dbl* arg_dbl_create(const char* shortopts,
+                                      const char* longopts,
+                                      const char* datatype,
+                                      double* dval,
+                                      int mincount,
+                                      int maxcount,
+                                      const char* glossary,
+                                      arg_scanfn* scanfn) {
     size_t nbytes;
     struct arg_dbl* result;
     size_t addr;
@@ -128,8 +168,9 @@ struct arg_dbl* arg_dbln(const char* shortopts, const char* longopts, const char
     /* foolproof things by ensuring maxcount is not less than mincount */
     maxcount = (maxcount < mincount) ? mincount : maxcount;
 
-    nbytes = sizeof(struct arg_dbl)             /* storage for struct arg_dbl */
-             + (size_t)(maxcount + 1) * sizeof(double); /* storage for dval[maxcount] array plus one extra for padding to memory boundary */
+    nbytes = sizeof(struct arg_dbl); /* storage for struct arg_dbl */
+    if (dval == NULL)
+        nbytes += (size_t)(maxcount + 1) * sizeof(double); /* storage for dval[maxcount] array plus one extra for padding to memory boundary */
 
     result = (struct arg_dbl*)xmalloc(nbytes);
 
@@ -143,22 +184,42 @@ struct arg_dbl* arg_dbln(const char* shortopts, const char* longopts, const char
     result->hdr.maxcount = maxcount;
     result->hdr.parent = result;
     result->hdr.resetfn = (arg_resetfn*)arg_dbl_resetfn;
-    result->hdr.scanfn = (arg_scanfn*)arg_dbl_scanfn;
+    result->hdr.scanfn = scanfn;
     result->hdr.checkfn = (arg_checkfn*)arg_dbl_checkfn;
     result->hdr.errorfn = (arg_errorfn*)arg_dbl_errorfn;
 
-    /* Store the dval[maxcount] array on the first double boundary that
-     * immediately follows the arg_dbl struct. We do the memory alignment
-     * purely for SPARC and Motorola systems. They require floats and
-     * doubles to be aligned on natural boundaries.
-     */
-    addr = (size_t)(result + 1);
-    rem = addr % sizeof(double);
-    result->dval = (double*)(addr + sizeof(double) - rem);
-    ARG_TRACE(("addr=%p, dval=%p, sizeof(double)=%d rem=%d\n", addr, result->dval, (int)sizeof(double), (int)rem));
+    if (dval) {
+        /* array provided by the caller */
+        result->dval = dval;
+    } else {
+        /* Store the dval[maxcount] array on the first double boundary that
+         * immediately follows the arg_dbl struct. We do the memory alignment
+         * purely for SPARC and Motorola systems. They require floats and
+         * doubles to be aligned on natural boundaries.
+         */
+        addr = (size_t)(result + 1);
+        rem = addr % sizeof(double);
+        result->dval = (double*)(addr + sizeof(double) - rem);
+        ARG_TRACE(("addr=%p, dval=%p, sizeof(double)=%d rem=%d\n", addr, result->dval, (int)sizeof(double), (int)rem));
+    }
 
     result->count = 0;
 
-    ARG_TRACE(("arg_dbln() returns %p\n", result));
+    ARG_TRACE(("arg_dbl_create() returns %p\n", result));
     return result;
 }
+
+struct arg_dbl* arg_dbln(const char* shortopts, const char* longopts, const char* datatype, int mincount, int maxcount, const char* glossary) {
+    return arg_dbl_create(shortopts, longopts, datatype, NULL, mincount, maxcount, glossary, (arg_scanfn*)arg_dbl_scanfn);
+}
+
+struct arg_dbl* arg_dbl_list(const char* shortopts,
+                             const char* longopts,
+                             const char* datatype,
+                             double* dval,
+                             int mincount,
+                             int maxcount,
+                             const char* glossary) {
+    return arg_dbl_create(shortopts, longopts, datatype ? datatype : "<double>[,<double>]...", dval, mincount, maxcount, glossary,
+                          (arg_scanfn*)arg_dbl_list_scanfn);
+}
@@ -113,6 +113,9 @@ struct arg_end* arg_end(int maxcount) {
     /* store argval[maxcount] array immediately after parent[] array */
     result->argval = (const char**)(result->parent + maxcount);
 
+    /* no option tables until arg_compile() */
+    result->compiled = NULL;
+
     ARG_TRACE(("arg_end(%d) returns %p\n", maxcount, result));
     return result;
 }
@@ -39,7 +39,6 @@
 #include "argtable3_private.h"
 #endif
 
-#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -81,98 +80,105 @@
  */
 
 /*
- * Credit for primes table: Aaron Krowne
- * http://br.endernet.org/~akrowne/
- * http://planetmath.org/encyclopedia/GoodHashTablePrimes.html
+ * The table is open addressing with Robin Hood hashing: the entries live in a
+ * single array whose size is a power of two, and an entry is moved forward
+ * when a new one is further from the slot it hashes to. Probe sequences stay
+ * short and sorted by distance, so a search stops as soon as it meets an
+ * entry closer to its home slot than the key would be. Removal shifts the
+ * following entries back instead of leaving tombstones.
+ *
+ * The home slot is taken from the high bits of the hash multiplied by the
+ * golden ratio, which mixes poor hash functions well enough and avoids a
+ * division. The hash of each entry is kept in its slot, so that most
+ * mismatches are found without calling eqfn, and zero marks empty slots.
  */
-static const unsigned int primes[] = {53,       97,       193,      389,       769,       1543,      3079,      6151,      12289,
-                                      24593,    49157,    98317,    196613,    393241,    786433,    1572869,   3145739,   6291469,
-                                      12582917, 25165843, 50331653, 100663319, 201326611, 402653189, 805306457, 1610612741};
-const unsigned int prime_table_length = sizeof(primes) / sizeof(primes[0]);
-const float max_load_factor = (float)0.65;
+#define ARG_HASHTABLE_MIN_SIZE 16u
+#define ARG_HASHTABLE_MAX_SIZE (1u << 30)
 
-static unsigned int enhanced_hash(arg_hashtable_t* h, const void* k) {
-    /*
-     * Aim to protect against poor hash functions by adding logic here.
-     * The logic is taken from Java 1.4 hash table source.
-     */
+static unsigned int entry_hash(arg_hashtable_t* h, const void* k) {
     unsigned int i = h->hashfn(k);
-    i += ~(i << 9);
-    i ^= ((i >> 14) | (i << 18)); /* >>> */
-    i += (i << 4);
-    i ^= ((i >> 10) | (i << 22)); /* >>> */
-    return i;
+    return i ? i : 1;
 }
 
-static unsigned int index_for(unsigned int tablelength, unsigned int hashvalue) {
-    return (hashvalue % tablelength);
+static unsigned int home_slot(const arg_hashtable_t* h, unsigned int hashvalue) {
+    return (unsigned int)((hashvalue * 2654435769u) >> h->hashshift);
+}
+
+/* Distance of the entry in slot i from its home slot */
+static unsigned int probe_distance(const arg_hashtable_t* h, unsigned int i) {
+    return (i - home_slot(h, h->table[i].h)) & (h->tablelength - 1);
+}
+
+/* Keep the load factor at or below 3/4 */
+static void set_size(arg_hashtable_t* h, unsigned int size) {
+    unsigned int shift = 32;
+    unsigned int n;
+    for (n = size; n > 1; n >>= 1)
+        shift--;
+    h->tablelength = size;
+    h->hashshift = shift;
+    h->loadlimit = size / 4 * 3;
 }
 
 arg_hashtable_t* arg_hashtable_create(unsigned int minsize, unsigned int (*hashfn)(const void*), int (*eqfn)(const void*, const void*)) {
     arg_hashtable_t* h;
-    unsigned int pindex;
-    unsigned int size = primes[0];
+    unsigned int size = ARG_HASHTABLE_MIN_SIZE;
 
     /* Check requested hash table isn't too large */
-    if (minsize > (1u << 30))
+    if (minsize > ARG_HASHTABLE_MAX_SIZE / 2)
         return NULL;
 
-    /*
-     * Enforce size as prime. The reason is to avoid clustering of values
-     * into a small number of buckets (yes, distribution). A more even
-     *  distributed hash table will perform more consistently.
-     */
-    for (pindex = 0; pindex < prime_table_length; pindex++) {
-        if (primes[pindex] > minsize) {
-            size = primes[pindex];
-            break;
-        }
-    }
+    /* Room for minsize entries without expanding */
+    while (size / 4 * 3 < minsize)
+        size <<= 1;
 
     h = (arg_hashtable_t*)xmalloc(sizeof(arg_hashtable_t));
-    h->table = (struct arg_hashtable_entry**)xmalloc(sizeof(struct arg_hashtable_entry*) * size);
-    memset(h->table, 0, size * sizeof(struct arg_hashtable_entry*));
-    h->tablelength = size;
-    h->primeindex = pindex;
+    h->table = (struct arg_hashtable_entry*)xcalloc(size, sizeof(struct arg_hashtable_entry));
     h->entrycount = 0;
     h->hashfn = hashfn;
     h->eqfn = eqfn;
-    h->loadlimit = (unsigned int)ceil(size * (double)max_load_factor);
+    set_size(h, size);
     return h;
 }
 
+/* Put the entry in the table, which has room for it. Entries further from
+ * their home slot take the place of the ones closer to theirs. */
+static void place_entry(arg_hashtable_t* h, struct arg_hashtable_entry e) {
+    unsigned int mask = h->tablelength - 1;
+    unsigned int i = home_slot(h, e.h);
+    unsigned int dist = 0;
+
+    while (h->table[i].h != 0) {
+        unsigned int d = probe_distance(h, i);
+        if (d < dist) {
+            struct arg_hashtable_entry tmp = h->table[i];
+            h->table[i] = e;
+            e = tmp;
+            dist = d;
+        }
+        i = (i + 1) & mask;
+        dist++;
+    }
+    h->table[i] = e;
+}
+
 static int arg_hashtable_expand(arg_hashtable_t* h) {
     /* Double the size of the table to accommodate more entries */
-    struct arg_hashtable_entry** newtable;
-    struct arg_hashtable_entry* e;
-    unsigned int newsize;
+    struct arg_hashtable_entry* oldtable = h->table;
+    unsigned int oldsize = h->tablelength;
     unsigned int i;
-    unsigned int index;
 
     /* Check we're not hitting max capacity */
-    if (h->primeindex == (prime_table_length - 1))
+    if (oldsize >= ARG_HASHTABLE_MAX_SIZE)
         return 0;
-    newsize = primes[++(h->primeindex)];
 
-    newtable = (struct arg_hashtable_entry**)xmalloc(sizeof(struct arg_hashtable_entry*) * newsize);
-    memset(newtable, 0, newsize * sizeof(struct arg_hashtable_entry*));
-    /*
-     * This algorithm is not 'stable': it reverses the list
-     * when it transfers entries between the tables
-     */
-    for (i = 0; i < h->tablelength; i++) {
-        while (NULL != (e = h->table[i])) {
-            h->table[i] = e->next;
-            index = index_for(newsize, e->h);
-            e->next = newtable[index];
-            newtable[index] = e;
-        }
+    h->table = (struct arg_hashtable_entry*)xcalloc(oldsize * 2, sizeof(struct arg_hashtable_entry));
+    set_size(h, oldsize * 2);
+    for (i = 0; i < oldsize; i++) {
+        if (oldtable[i].h != 0)
+            place_entry(h, oldtable[i]);
     }
-
-    xfree(h->table);
-    h->table = newtable;
-    h->tablelength = newsize;
-    h->loadlimit = (unsigned int)ceil(newsize * (double)max_load_factor);
+    xfree(oldtable);
     return -1;
 }
 
@@ -182,42 +188,57 @@ unsigned int arg_hashtable_count(arg_hashtable_t* h) {
 
 void arg_hashtable_insert(arg_hashtable_t* h, void* k, void* v) {
     /* This method allows duplicate keys - but they shouldn't be used */
-    unsigned int index;
-    struct arg_hashtable_entry* e;
+    struct arg_hashtable_entry e;
     if ((h->entrycount + 1) > h->loadlimit) {
         /*
-         * Ignore the return value. If expand fails, we should
-         * still try cramming just this value into the existing table
-         * -- we may not have memory for a larger table, but one more
-         * element may be ok. Next time we insert, we'll try expanding again.
+         * Ignore the return value. Expanding only fails once the table has
+         * its maximum size, and it still has free slots then.
          */
         arg_hashtable_expand(h);
     }
-    e = (struct arg_hashtable_entry*)xmalloc(sizeof(struct arg_hashtable_entry));
-    e->h = enhanced_hash(h, k);
-    index = index_for(h->tablelength, e->h);
-    e->k = k;
-    e->v = v;
-    e->next = h->table[index];
-    h->table[index] = e;
+    e.k = k;
+    e.v = v;
+    e.h = entry_hash(h, k);
+    place_entry(h, e);
     h->entrycount++;
 }
 
-void* arg_hashtable_search(arg_hashtable_t* h, const void* k) {
-    struct arg_hashtable_entry* e;
-    unsigned int hashvalue;
-    unsigned int index;
-
-    hashvalue = enhanced_hash(h, k);
-    index = index_for(h->tablelength, hashvalue);
-    e = h->table[index];
-    while (e != NULL) {
+/* Return the slot of the key, or -1 if it isn't in the table */
+static long find_slot(arg_hashtable_t* h, const void* k) {
+    unsigned int mask = h->tablelength - 1;
+    unsigned int hashvalue = entry_hash(h, k);
+    unsigned int i = home_slot(h, hashvalue);
+    unsigned int dist = 0;
+
+    /* An entry closer to its home slot than the key would be ends the search */
+    while (h->table[i].h != 0 && dist <= probe_distance(h, i)) {
         /* Check hash value to short circuit heavier comparison */
-        if ((hashvalue == e->h) && (h->eqfn(k, e->k)))
-            return e->v;
-        e = e->next;
+        if ((hashvalue == h->table[i].h) && (h->eqfn(k, h->table[i].k)))
+            return (long)i;
+        i = (i + 1) & mask;
+        dist++;
+    }
+    return -1;
+}
+
+void* arg_hashtable_search(arg_hashtable_t* h, const void* k) {
+    long i = find_slot(h, k);
+    return (i < 0) ? NULL : h->table[i].v;
+}
+
+/* Empty slot i, shifting back the entries which follow it until one is
+ * empty or in its home slot */
+static void remove_slot(arg_hashtable_t* h, unsigned int i) {
+    unsigned int mask = h->tablelength - 1;
+    unsigned int next = (i + 1) & mask;
+
+    while (h->table[next].h != 0 && probe_distance(h, next) != 0) {
+        h->table[i] = h->table[next];
+        i = next;
+        next = (next + 1) & mask;
     }
-    return NULL;
+    memset(&h->table[i], 0, sizeof(h->table[i]));
+    h->entrycount--;
 }
 
 void arg_hashtable_remove(arg_hashtable_t* h, const void* k) {
@@ -225,81 +246,62 @@ void arg_hashtable_remove(arg_hashtable_t* h, const void* k) {
      * TODO: consider compacting the table when the load factor drops enough,
      *       or provide a 'compact' method.
      */
-
-    struct arg_hashtable_entry* e;
-    struct arg_hashtable_entry** pE;
-    unsigned int hashvalue;
-    unsigned int index;
-
-    hashvalue = enhanced_hash(h, k);
-    index = index_for(h->tablelength, hashvalue);
-    pE = &(h->table[index]);
-    e = *pE;
-    while (NULL != e) {
-        /* Check hash value to short circuit heavier comparison */
-        if ((hashvalue == e->h) && (h->eqfn(k, e->k))) {
-            *pE = e->next;
-            h->entrycount--;
-            xfree(e->k);
-            xfree(e->v);
-            xfree(e);
-            return;
-        }
-        pE = &(e->next);
-        e = e->next;
-    }
+    long i = find_slot(h, k);
+    if (i < 0)
+        return;
+    xfree(h->table[i].k);
+    xfree(h->table[i].v);
+    remove_slot(h, (unsigned int)i);
 }
 
 void arg_hashtable_destroy(arg_hashtable_t* h, int free_values) {
     unsigned int i;
-    struct arg_hashtable_entry *e, *f;
-    struct arg_hashtable_entry** table = h->table;
-    if (free_values) {
-        for (i = 0; i < h->tablelength; i++) {
-            e = table[i];
-            while (NULL != e) {
-                f = e;
-                e = e->next;
-                xfree(f->k);
-                xfree(f->v);
-                xfree(f);
-            }
-        }
-    } else {
-        for (i = 0; i < h->tablelength; i++) {
-            e = table[i];
-            while (NULL != e) {
-                f = e;
-                e = e->next;
-                xfree(f->k);
-                xfree(f);
-            }
-        }
+    for (i = 0; i < h->tablelength; i++) {
+        if (h->table[i].h == 0)
+            continue;
+        xfree(h->table[i].k);
+        if (free_values)
+            xfree(h->table[i].v);
     }
     xfree(h->table);
     xfree(h);
 }
 
-arg_hashtable_itr_t* arg_hashtable_itr_create(arg_hashtable_t* h) {
-    unsigned int i;
-    unsigned int tablelength;
-
-    arg_hashtable_itr_t* itr = (arg_hashtable_itr_t*)xmalloc(sizeof(arg_hashtable_itr_t));
+/*
+ * Iterators go once around the table from an empty slot, which removals
+ * never fill: the entries they shift back are always ahead of the iterator.
+ */
+static void itr_start(arg_hashtable_itr_t* itr, arg_hashtable_t* h) {
+    unsigned int i = 0;
+    while (h->table[i].h != 0)
+        i++;
     itr->h = h;
+    itr->end = i;
+    itr->index = i;
     itr->e = NULL;
-    itr->parent = NULL;
-    tablelength = h->tablelength;
-    itr->index = tablelength;
-    if (0 == h->entrycount)
-        return itr;
-
-    for (i = 0; i < tablelength; i++) {
-        if (h->table[i] != NULL) {
-            itr->e = h->table[i];
-            itr->index = i;
-            break;
+}
+
+/* Move to the first entry at or after slot index, unless the end is reached */
+static int itr_seek(arg_hashtable_itr_t* itr, unsigned int index) {
+    unsigned int mask = itr->h->tablelength - 1;
+    while (index != itr->end) {
+        if (itr->h->table[index].h != 0) {
+            itr->index = index;
+            itr->e = &itr->h->table[index];
+            return -1;
         }
+        index = (index + 1) & mask;
     }
+    itr->index = itr->end;
+    itr->e = NULL;
+    return 0;
+}
+
+arg_hashtable_itr_t* arg_hashtable_itr_create(arg_hashtable_t* h) {
+    arg_hashtable_itr_t* itr = (arg_hashtable_itr_t*)xmalloc(sizeof(arg_hashtable_itr_t));
+    itr_start(itr, h);
+    if (0 != h->entrycount)
+        itr_seek(itr, (itr->end + 1) & (h->tablelength - 1));
     return itr;
 }
 
@@ -316,113 +318,35 @@ void* arg_hashtable_itr_value(arg_hashtable_itr_t* i) {
 }
 
 int arg_hashtable_itr_advance(arg_hashtable_itr_t* itr) {
-    unsigned int j;
-    unsigned int tablelength;
-    struct arg_hashtable_entry** table;
-    struct arg_hashtable_entry* next;
-
     if (itr->e == NULL)
         return 0; /* stupidity check */
 
-    next = itr->e->next;
-    if (NULL != next) {
-        itr->parent = itr->e;
-        itr->e = next;
-        return -1;
-    }
-
-    tablelength = itr->h->tablelength;
-    itr->parent = NULL;
-    if (tablelength <= (j = ++(itr->index))) {
-        itr->e = NULL;
-        return 0;
-    }
-
-    table = itr->h->table;
-    while (NULL == (next = table[j])) {
-        if (++j >= tablelength) {
-            itr->index = tablelength;
-            itr->e = NULL;
-            return 0;
-        }
-    }
-
-    itr->index = j;
-    itr->e = next;
-    return -1;
+    return itr_seek(itr, (itr->index + 1) & (itr->h->tablelength - 1));
 }
 
 int arg_hashtable_itr_remove(arg_hashtable_itr_t* itr) {
-    struct arg_hashtable_entry* remember_e;
-    struct arg_hashtable_entry* remember_parent;
-    int ret;
-
-    /* Do the removal */
-    if ((itr->parent) == NULL) {
-        /* element is head of a chain */
-        itr->h->table[itr->index] = itr->e->next;
-    } else {
-        /* element is mid-chain */
-        itr->parent->next = itr->e->next;
-    }
-    /* itr->e is now outside the hashtable */
-    remember_e = itr->e;
-    itr->h->entrycount--;
-    xfree(remember_e->k);
-    xfree(remember_e->v);
-
-    /* Advance the iterator, correcting the parent */
-    remember_parent = itr->parent;
-    ret = arg_hashtable_itr_advance(itr);
-    if (itr->parent == remember_e) {
-        itr->parent = remember_parent;
-    }
-    xfree(remember_e);
-    return ret;
+    xfree(itr->e->k);
+    xfree(itr->e->v);
+    /* The next entry, if it was shifted back, is now in the current slot */
+    remove_slot(itr->h, itr->index);
+    return itr_seek(itr, itr->index);
 }
 
 int arg_hashtable_itr_search(arg_hashtable_itr_t* itr, arg_hashtable_t* h, void* k) {
-    struct arg_hashtable_entry* e;
-    struct arg_hashtable_entry* parent;
-    unsigned int hashvalue;
-    unsigned int index;
-
-    hashvalue = enhanced_hash(h, k);
-    index = index_for(h->tablelength, hashvalue);
-
-    e = h->table[index];
-    parent = NULL;
-    while (e != NULL) {
-        /* Check hash value to short circuit heavier comparison */
-        if ((hashvalue == e->h) && (h->eqfn(k, e->k))) {
-            itr->index = index;
-            itr->e = e;
-            itr->parent = parent;
-            itr->h = h;
-            return -1;
-        }
-        parent = e;
-        e = e->next;
-    }
-    return 0;
+    long i = find_slot(h, k);
+    if (i < 0)
+        return 0;
+    itr_start(itr, h);
+    itr->index = (unsigned int)i;
+    itr->e = &h->table[i];
+    return -1;
 }
 
 int arg_hashtable_change(arg_hashtable_t* h, void* k, void* v) {
-    struct arg_hashtable_entry* e;
-    unsigned int hashvalue;
-    unsigned int index;
-
-    hashvalue = enhanced_hash(h, k);
-    index = index_for(h->tablelength, hashvalue);
-    e = h->table[index];
-    while (e != NULL) {
-        /* Check hash value to short circuit heavier comparison */
-        if ((hashvalue == e->h) && (h->eqfn(k, e->k))) {
-            xfree(e->v);
-            e->v = v;
-            return -1;
-        }
-        e = e->next;
-    }
-    return 0;
+    long i = find_slot(h, k);
+    if (i < 0)
+        return 0;
+    xfree(h->table[i].v);
+    h->table[i].v = v;
+    return -1;
 }
@@ -41,7 +41,6 @@
 #include "argtable3_private.h"
 #endif
 
-#include <ctype.h>
 #include <limits.h>
 #include <stdlib.h>
 
@@ -50,95 +49,102 @@ static void arg_int_resetfn(struct arg_int* parent) {
     parent->count = 0;
 }
 
-/* strtol0x() is like strtol() except that the numeric string is    */
-/* expected to be prefixed by "0X" where X is a user supplied char. */
-/* The string may optionally be prefixed by white space and + or -  */
-/* as in +0X123 or -0X123.                                          */
-/* Once the prefix has been scanned, the remainder of the numeric   */
-/* string is converted using strtol() with the given base.          */
-/* eg: to parse hex str="-0X12324", specify X='X' and base=16.      */
-/* eg: to parse oct str="+0o12324", specify X='O' and base=8.       */
-/* eg: to parse bin str="-0B01010", specify X='B' and base=2.       */
-/* Failure of conversion is indicated by result where *endptr==str. */
-static long int strtol0X(const char* str, const char** endptr, char X, int base) {
-    long int val;          /* stores result */
-    int s = 1;             /* sign is +1 or -1 */
-    const char* ptr = str; /* ptr to current position in str */
-
-    /* skip leading whitespace */
-    while (isspace((int)(*ptr)))
-        ptr++;
-    /* printf("1) %s\n",ptr); */
-
-    /* scan optional sign character */
-    switch (*ptr) {
-        case '+':
-            ptr++;
-            s = 1;
-            break;
-        case '-':
-            ptr++;
-            s = -1;
-            break;
-        default:
-            s = 1;
-            break;
-    }
-    /* printf("2) %s\n",ptr); */
-
-    /* '0X' prefix */
-    if ((*ptr++) != '0') {
-        /* printf("failed to detect '0'\n"); */
-        *endptr = str;
-        return 0;
-    }
-    /* printf("3) %s\n",ptr); */
-    if (toupper(*ptr++) != toupper(X)) {
-        /* printf("failed to detect '%c'\n",X); */
-        *endptr = str;
-        return 0;
-    }
-    /* printf("4) %s\n",ptr); */
-
-    /* attempt conversion on remainder of string using strtol() */
-    val = strtol(ptr, (char**)endptr, base);
-    if (*endptr == ptr) {
-        /* conversion failed */
-        *endptr = str;
-        return 0;
-    }
-
-    /* success */
-    return s * val;
+static int arg_isspace(char c) {
+    return c == ' ' || (c >= '\t' && c <= '\r');
 }
 
-/* Returns 1 if str matches suffix (case insensitive).    */
-/* Str may contain trailing whitespace, but nothing else. */
-static int detectsuffix(const char* str, const char* suffix) {
-    /* scan pairwise through strings until mismatch detected */
-    while (toupper(*str) == toupper(*suffix)) {
-        /* printf("'%c' '%c'\n", *str, *suffix); */
-
-        /* return 1 (success) if match persists until the string terminator */
-        if (*str == '\0')
-            return 1;
+/* Value of the digit c, or a value not smaller than any base if c is not a digit */
+static unsigned arg_digit(char c) {
+    if (c >= '0' && c <= '9')
+        return (unsigned)(c - '0');
+    c |= 0x20; /* lower case */
+    if (c >= 'a' && c <= 'z')
+        return (unsigned)(c - 'a') + 10;
+    return 36;
+}
 
-        /* next chars */
-        str++;
-        suffix++;
+/* Scans an integer in a single pass: optional white space and + or - sign, */
+/* optional 0X (hex), 0O (octal) or 0B (binary) prefix, the digits, then an */
+/* optional KB, MB or GB suffix followed by optional white space.           */
+/* Prefixes and suffixes are case insensitive, overflow of int is detected  */
+/* while the digits are accumulated. *endptr is set to the first character  */
+/* which isn't part of the number, the caller checks that it is what may    */
+/* follow. Returns 0, ARG_ERR_BADINT or ARG_ERR_OVERFLOW.                  */
+static int arg_int_scan(const char* str, const char** endptr, int* result) {
+    const char* ptr = str;
+    int neg = 0;
+    unsigned base = 10;
+    unsigned long val = 0;
+    unsigned long limit;
+    unsigned d;
+    int overflow = 0;
+    const char* digits;
+
+    while (arg_isspace(*ptr))
+        ptr++;
+    if (*ptr == '+' || *ptr == '-')
+        neg = (*ptr++ == '-');
+    limit = neg ? (unsigned long)INT_MAX + 1 : (unsigned long)INT_MAX;
+
+    if (ptr[0] == '0') {
+        switch (ptr[1] | 0x20) {
+            case 'x':
+                base = 16;
+                break;
+            case 'o':
+                base = 8;
+                break;
+            case 'b':
+                base = 2;
+                break;
+        }
+        if (base != 10)
+            ptr += 2;
     }
-    /* printf("'%c' '%c' mismatch\n", *str, *suffix); */
 
-    /* return 0 (fail) if the matching did not consume the entire suffix */
-    if (*suffix != 0)
-        return 0; /* failed to consume entire suffix */
-
-    /* skip any remaining whitespace in str */
-    while (isspace((int)(*str)))
-        str++;
+    digits = ptr;
+    while ((d = arg_digit(*ptr)) < base) {
+        if (val > (limit - d) / base)
+            overflow = 1;
+        else
+            val = val * base + d;
+        ptr++;
+    }
+    *endptr = ptr;
+    if (ptr == digits)
+        return ARG_ERR_BADINT;
+
+    /* KB, MB or GB multiply the value */
+    {
+        unsigned shift = 0;
+        switch (ptr[0] | 0x20) {
+            case 'k':
+                shift = 10;
+                break;
+            case 'm':
+                shift = 20;
+                break;
+            case 'g':
+                shift = 30;
+                break;
+        }
+        if (shift && (ptr[1] | 0x20) == 'b') {
+            if (val > (limit >> shift))
+                overflow = 1;
+            else
+                val <<= shift;
+            ptr += 2;
+        }
+    }
+    while (arg_isspace(*ptr))
+        ptr++;
+    *endptr = ptr;
 
-    /* return 1 (success) if we have reached end of str else return 0 (fail) */
-    return (*str == '\0') ? 1 : 0;
+    if (overflow)
+        return ARG_ERR_OVERFLOW;
+    /* -(INT_MAX + 1) is computed without overflowing int */
+    *result = (neg && val) ? -(int)(val - 1) - 1 : (int)val;
+    return 0;
 }
 
 static int arg_int_scanfn(struct arg_int* parent, const char* argval) {
@@ -153,65 +159,52 @@ static int arg_int_scanfn(struct arg_int* parent, const char* argval) {
         /* leave parent arguiment value unaltered but still count the argument. */
         parent->count++;
     } else {
-        long int val;
+        int val = 0;
         const char* end;
 
-        /* attempt to extract hex integer (eg: +0x123) from argval into val conversion */
-        val = strtol0X(argval, &end, 'X', 16);
-        if (end == argval) {
-            /* hex failed, attempt octal conversion (eg +0o123) */
-            val = strtol0X(argval, &end, 'O', 8);
-            if (end == argval) {
-                /* octal failed, attempt binary conversion (eg +0B101) */
-                val = strtol0X(argval, &end, 'B', 2);
-                if (end == argval) {
-                    /* binary failed, attempt decimal conversion with no prefix (eg 1234) */
-                    val = strtol(argval, (char**)&end, 10);
-                    if (end == argval) {
-                        /* all supported number formats failed */
-                        return ARG_ERR_BADINT;
-                    }
-                }
-            }
-        }
-
-        /* Safety check for integer overflow. WARNING: this check    */
-        /* achieves nothing on machines where size(int)==size(long). */
-        if (val > INT_MAX || val < INT_MIN)
-            errorcode = ARG_ERR_OVERFLOW;
-
-        /* Detect any suffixes (KB,MB,GB) and multiply argument value appropriately. */
-        /* We need to be mindful of integer overflows when using such big numbers.   */
-        if (detectsuffix(end, "KB")) /* kilobytes */
-        {
-            if (val > (INT_MAX / 1024) || val < (INT_MIN / 1024))
-                errorcode = ARG_ERR_OVERFLOW; /* Overflow would occur if we proceed */
-            else
-                val *= 1024;                /* 1KB = 1024 */
-        } else if (detectsuffix(end, "MB")) /* megabytes */
-        {
-            if (val > (INT_MAX / 1048576) || val < (INT_MIN / 1048576))
-                errorcode = ARG_ERR_OVERFLOW; /* Overflow would occur if we proceed */
-            else
-                val *= 1048576;             /* 1MB = 1024*1024 */
-        } else if (detectsuffix(end, "GB")) /* gigabytes */
-        {
-            if (val > (INT_MAX / 1073741824) || val < (INT_MIN / 1073741824))
-                errorcode = ARG_ERR_OVERFLOW; /* Overflow would occur if we proceed */
-            else
-                val *= 1073741824; /* 1GB = 1024*1024*1024 */
-        } else if (!detectsuffix(end, ""))
+        errorcode = arg_int_scan(argval, &end, &val);
+        if (*end != '\0')
             errorcode = ARG_ERR_BADINT; /* invalid suffix detected */
 
         /* if success then store result in parent->ival[] array */
         if (errorcode == 0)
-            parent->ival[parent->count++] = (int)val;
+            parent->ival[parent->count++] = val;
     }
 
     /* printf("%s:scanfn(%p,%p) returns %d\n",__FILE__,parent,argval,errorcode); */
     return errorcode;
 }
 
+/* Same as arg_int_scanfn(), but the value is a comma separated list, */
+/* each of its integers taking one entry of parent->ival[].           */
+static int arg_int_list_scanfn(struct arg_int* parent, const char* argval) {
+    const int count = parent->count;
+    const char* ptr = argval;
+
+    if (!argval)
+        return arg_int_scanfn(parent, argval);
+    for (;;) {
+        int val = 0;
+        int errorcode;
+
+        if (parent->count == parent->hdr.maxcount) {
+            errorcode = ARG_ERR_MAXCOUNT;
+        } else {
+            errorcode = arg_int_scan(ptr, &ptr, &val);
+            if (*ptr != '\0' && *ptr != ',')
+                errorcode = ARG_ERR_BADINT;
+        }
+        if (errorcode) {
+            /* none of the list is kept */
+            parent->count = count;
+            return errorcode;
+        }
+        parent->ival[parent->count++] = val;
+        if (*ptr++ == '\0')
+            return 0;
+    }
+}
+
 static int arg_int_checkfn(struct arg_int* parent) {
     int errorcode = (parent->count < parent->hdr.mincount) ? ARG_ERR_MINCOUNT : 0;
     /*printf("%s:checkfn(%p) returns %d\n",__FILE__,parent,errorcode);*/
@@ -259,15 +252,23 @@ struct arg_int* arg_int1(const char* shortopts, const char* longopts, const char
     return arg_intn(shortopts, longopts, datatype, 1, 1, glossary);
 }
 
-struct arg_int* arg_intn(const char* shortopts, const char* longopts, const char* datatype, int mincount, int maxcount, const char* glossary) {
+static struct arg_int* arg_int_create(const char* shortopts,
+                                      const char* longopts,
+                                      const char* datatype,
+                                      int* ival,
+                                      int mincount,
+                                      int maxcount,
+                                      const char* glossary,
+                                      arg_scanfn* scanfn) {
     size_t nbytes;
     struct arg_int* result;
 
     /* foolproof things by ensuring maxcount is not less than mincount */
     maxcount = (maxcount < mincount) ? mincount : maxcount;
 
-    nbytes = sizeof(struct arg_int)    /* storage for struct arg_int */
-             + (size_t)maxcount * sizeof(int); /* storage for ival[maxcount] array */
+    nbytes = sizeof(struct arg_int); /* storage for struct arg_int */
+    if (ival == NULL)
+        nbytes += (size_t)maxcount * sizeof(int); /* storage for ival[maxcount] array */
 
     result = (struct arg_int*)xmalloc(nbytes);
 
@@ -281,14 +282,30 @@ struct arg_int* arg_intn(const char* shortopts, const char* longopts, const char
     result->hdr.maxcount = maxcount;
     result->hdr.parent = result;
     result->hdr.resetfn = (arg_resetfn*)arg_int_resetfn;
-    result->hdr.scanfn = (arg_scanfn*)arg_int_scanfn;
+    result->hdr.scanfn = scanfn;
     result->hdr.checkfn = (arg_checkfn*)arg_int_checkfn;
     result->hdr.errorfn = (arg_errorfn*)arg_int_errorfn;
 
-    /* store the ival[maxcount] array immediately after the arg_int struct */
-    result->ival = (int*)(result + 1);
+    /* store the ival[maxcount] array immediately after the arg_int struct, */
+    /* unless the caller provided it                                       */
+    result->ival = ival ? ival : (int*)(result + 1);
     result->count = 0;
 
-    ARG_TRACE(("arg_intn() returns %p\n", result));
+    ARG_TRACE(("arg_int_create() returns %p\n", result));
     return result;
 }
+
+struct arg_int* arg_intn(const char* shortopts, const char* longopts, const char* datatype, int mincount, int maxcount, const char* glossary) {
+    return arg_int_create(shortopts, longopts, datatype, NULL, mincount, maxcount, glossary, (arg_scanfn*)arg_int_scanfn);
+}
+
+struct arg_int* arg_int_list(const char* shortopts,
+                             const char* longopts,
+                             const char* datatype,
+                             int* ival,
+                             int mincount,
+                             int maxcount,
+                             const char* glossary) {
+    return arg_int_create(shortopts, longopts, datatype ? datatype : "<int>[,<int>]...", ival, mincount, maxcount, glossary,
+                          (arg_scanfn*)arg_int_list_scanfn);
+}
@@ -109,7 +109,7 @@ TREX_API TRex* trex_compile(const TRexChar* pattern, const TRexChar** error, int
 TREX_API TRex* trex_compile(const TRexChar* pattern, const TRexChar** error, int flags);
 #endif
 TREX_API void trex_free(TRex* exp);
-TREX_API TRexBool trex_match(TRex* exp, const TRexChar* text);
+TREX_API TRexBool trex_match(const TRex* exp, const TRexChar* text);
 TREX_API TRexBool trex_search(TRex* exp, const TRexChar* text, const TRexChar** out_begin, const TRexChar** out_end);
 TREX_API TRexBool
 trex_searchrange(TRex* exp, const TRexChar* text_begin, const TRexChar* text_end, const TRexChar** out_begin, const TRexChar** out_end);
@@ -122,9 +122,13 @@ TREX_API TRexBool trex_getsubexp(TRex* exp, int n, TRexMatch* subexp);
 
 #endif
 
+static size_t trex_size(const TRex* exp);
+static TRex* trex_copy(const TRex* exp, void* mem);
+
 struct privhdr {
     const char* pattern;
     int flags;
+    const TRex* rex; /* pattern compiled by arg_rexn(), NULL if it is invalid */
 };
 
 static void arg_rex_resetfn(struct arg_rex* parent) {
@@ -134,8 +138,6 @@ static void arg_rex_resetfn(struct arg_rex* parent) {
 
 static int arg_rex_scanfn(struct arg_rex* parent, const char* argval) {
     int errorcode = 0;
-    const TRexChar* error = NULL;
-    TRex* rex = NULL;
     TRexBool is_match = TRex_False;
 
     if (parent->count == parent->hdr.maxcount) {
@@ -152,14 +154,12 @@ static int arg_rex_scanfn(struct arg_rex* parent, const char* argval) {
         /* test the current argument value for a match with the regular expression */
         /* if a match is detected, record the argument value in the arg_rex struct */
 
-        rex = trex_compile(priv->pattern, &error, priv->flags);
-        is_match = trex_match(rex, argval);
+        /* the program is only read by trex_match(), so it is compiled once and shared */
+        is_match = priv->rex && trex_match(priv->rex, argval);
         if (!is_match)
             errorcode = ARG_ERR_REGNOMATCH;
         else
             parent->sval[parent->count++] = argval;
-
-        trex_free(rex);
     }
 
     ARG_TRACE(("%s:scanfn(%p) returns %d\n", __FILE__, parent, errorcode));
@@ -246,9 +246,19 @@ struct arg_rex* arg_rexn(const char* shortopts,
     /* foolproof things by ensuring maxcount is not less than mincount */
     maxcount = (maxcount < mincount) ? mincount : maxcount;
 
+    /* compile the regular expression now, both to trap any regex errors
+     * rather than when an argument is actually parsed, and to not compile
+     * it again for every argument. */
+    rex = trex_compile(pattern, &error, flags);
+    if (rex == NULL) {
+        ARG_LOG(("argtable: %s \"%s\"\n", error ? error : _TREXC("undefined"), pattern));
+        ARG_LOG(("argtable: Bad argument table.\n"));
+    }
+
     nbytes = sizeof(struct arg_rex)      /* storage for struct arg_rex */
              + sizeof(struct privhdr)    /* storage for private arg_rex data */
-             + (size_t)maxcount * sizeof(char*); /* storage for sval[maxcount] array */
+             + (size_t)maxcount * sizeof(char*) /* storage for sval[maxcount] array */
+             + (rex ? trex_size(rex) : 0); /* storage for the compiled pattern */
 
     /* init the arg_hdr struct */
     result = (struct arg_rex*)xmalloc(nbytes);
@@ -279,18 +289,9 @@ struct arg_rex* arg_rexn(const char* shortopts,
     for (i = 0; i < maxcount; i++)
         result->sval[i] = "";
 
-    /* here we construct and destroy a regex representation of the regular
-     * expression for no other reason than to force any regex errors to be
-     * trapped now rather than later. If we don't, then errors may go undetected
-     * until an argument is actually parsed.
-     */
-
-    rex = trex_compile(priv->pattern, &error, priv->flags);
-    if (rex == NULL) {
-        ARG_LOG(("argtable: %s \"%s\"\n", error ? error : _TREXC("undefined"), priv->pattern));
-        ARG_LOG(("argtable: Bad argument table.\n"));
-    }
-
+    /* store the compiled pattern immediately after the sval[] array, so that
+     * arg_freetable() frees it along with the arg_rex struct */
+    priv->rex = rex ? trex_copy(rex, result->sval + maxcount) : NULL;
     trex_free(rex);
 
     ARG_TRACE(("arg_rexn() returns %p\n", result));
@@ -355,6 +356,15 @@ typedef struct tagTRexNode {
     int next;
 } TRexNode;
 
+/* State of a match, kept apart from the compiled program so that several
+ * matches may use the same program at the same time. */
+typedef struct {
+    const TRexChar* bol;
+    const TRexChar* eol;
+    int currsubexp;
+    TRexMatch* matches; /* NULL if the subexpressions are not recorded */
+} TRexState;
+
 struct TRex {
     const TRexChar* _eol;
     const TRexChar* _bol;
@@ -722,7 +732,7 @@ static TRexBool trex_matchcclass(int cclass, TRexChar c) {
     return TRex_False; /*cannot happen*/
 }
 
-static TRexBool trex_matchclass(TRex* exp, TRexNode* node, TRexChar c) {
+static TRexBool trex_matchclass(const TRex* exp, const TRexNode* node, TRexChar c) {
     do {
         switch (node->type) {
             case OP_RANGE:
@@ -753,12 +763,12 @@ static TRexBool trex_matchclass(TRex* exp, TRexNode* node, TRexChar c) {
     return TRex_False;
 }
 
-static const TRexChar* trex_matchnode(TRex* exp, TRexNode* node, const TRexChar* str, TRexNode* next) {
+static const TRexChar* trex_matchnode(const TRex* exp, TRexState* st, const TRexNode* node, const TRexChar* str, const TRexNode* next) {
     TRexNodeType type = node->type;
     switch (type) {
         case OP_GREEDY: {
             /* TRexNode *greedystop = (node->next != -1) ? &exp->_nodes[node->next] : NULL; */
-            TRexNode* greedystop = NULL;
+            const TRexNode* greedystop = NULL;
             int p0 = (node->right >> 16) & 0x0000FFFF, p1 = node->right & 0x0000FFFF, nmaches = 0;
             const TRexChar *s = str, *good = str;
 
@@ -770,7 +780,7 @@ static const TRexChar* trex_matchnode(TRex* exp, TRexNode* node, const TRexChar*
 
             while ((nmaches == 0xFFFF || nmaches < p1)) {
                 const TRexChar* stop;
-                if ((s = trex_matchnode(exp, &exp->_nodes[node->left], s, greedystop)) == NULL)
+                if ((s = trex_matchnode(exp, st, &exp->_nodes[node->left], s, greedystop)) == NULL)
                     break;
                 nmaches++;
                 good = s;
@@ -778,13 +788,13 @@ static const TRexChar* trex_matchnode(TRex* exp, TRexNode* node, const TRexChar*
                     /* checks that 0 matches satisfy the expression(if so skips) */
                     /* if not would always stop(for instance if is a '?') */
                     if (greedystop->type != OP_GREEDY || (greedystop->type == OP_GREEDY && ((greedystop->right >> 16) & 0x0000FFFF) != 0)) {
-                        TRexNode* gnext = NULL;
+                        const TRexNode* gnext = NULL;
                         if (greedystop->next != -1) {
                             gnext = &exp->_nodes[greedystop->next];
                         } else if (next && next->next != -1) {
                             gnext = &exp->_nodes[next->next];
                         }
-                        stop = trex_matchnode(exp, greedystop, s, gnext);
+                        stop = trex_matchnode(exp, st, greedystop, s, gnext);
                         if (stop) {
                             /* if satisfied stop it */
                             if (p0 == p1 && p0 == nmaches)
@@ -797,7 +807,7 @@ static const TRexChar* trex_matchnode(TRex* exp, TRexNode* node, const TRexChar*
                     }
                 }
 
-                if (s >= exp->_eol)
+                if (s >= st->eol)
                     break;
             }
             if (p0 == p1 && p0 == nmaches)
@@ -810,8 +820,8 @@ static const TRexChar* trex_matchnode(TRex* exp, TRexNode* node, const TRexChar*
         }
         case OP_OR: {
             const TRexChar* asd = str;
-            TRexNode* temp = &exp->_nodes[node->left];
-            while ((asd = trex_matchnode(exp, temp, asd, NULL)) != NULL) {
+            const TRexNode* temp = &exp->_nodes[node->left];
+            while ((asd = trex_matchnode(exp, st, temp, asd, NULL)) != NULL) {
                 if (temp->next != -1)
                     temp = &exp->_nodes[temp->next];
                 else
@@ -819,7 +829,7 @@ static const TRexChar* trex_matchnode(TRex* exp, TRexNode* node, const TRexChar*
             }
             asd = str;
             temp = &exp->_nodes[node->right];
-            while ((asd = trex_matchnode(exp, temp, asd, NULL)) != NULL) {
+            while ((asd = trex_matchnode(exp, st, temp, asd, NULL)) != NULL) {
                 if (temp->next != -1)
                     temp = &exp->_nodes[temp->next];
                 else
@@ -830,47 +840,48 @@ static const TRexChar* trex_matchnode(TRex* exp, TRexNode* node, const TRexChar*
         }
         case OP_EXPR:
         case OP_NOCAPEXPR: {
-            TRexNode* n = &exp->_nodes[node->left];
+            const TRexNode* n = &exp->_nodes[node->left];
             const TRexChar* cur = str;
             int capture = -1;
-            if (node->type != OP_NOCAPEXPR && node->right == exp->_currsubexp) {
-                capture = exp->_currsubexp;
-                exp->_matches[capture].begin = cur;
-                exp->_currsubexp++;
+            if (node->type != OP_NOCAPEXPR && node->right == st->currsubexp) {
+                capture = st->matches ? st->currsubexp : -1;
+                if (capture != -1)
+                    st->matches[capture].begin = cur;
+                st->currsubexp++;
             }
 
             do {
-                TRexNode* subnext = NULL;
+                const TRexNode* subnext = NULL;
                 if (n->next != -1) {
                     subnext = &exp->_nodes[n->next];
                 } else {
                     subnext = next;
                 }
-                if ((cur = trex_matchnode(exp, n, cur, subnext)) == NULL) {
+                if ((cur = trex_matchnode(exp, st, n, cur, subnext)) == NULL) {
                     if (capture != -1) {
-                        exp->_matches[capture].begin = 0;
-                        exp->_matches[capture].len = 0;
+                        st->matches[capture].begin = 0;
+                        st->matches[capture].len = 0;
                     }
                     return NULL;
                 }
             } while ((n->next != -1) && ((n = &exp->_nodes[n->next]) != NULL));
 
             if (capture != -1)
-                exp->_matches[capture].len = (int)(cur - exp->_matches[capture].begin);
+                st->matches[capture].len = (int)(cur - st->matches[capture].begin);
             return cur;
         }
         case OP_WB:
-            if ((str == exp->_bol && !isspace((int)(*str))) || (str == exp->_eol && !isspace((int)(*(str - 1)))) || (!isspace((int)(*str)) && isspace((int)(*(str + 1)))) ||
+            if ((str == st->bol && !isspace((int)(*str))) || (str == st->eol && !isspace((int)(*(str - 1)))) || (!isspace((int)(*str)) && isspace((int)(*(str + 1)))) ||
                 (isspace((int)(*str)) && !isspace((int)(*(str + 1))))) {
                 return (node->left == 'b') ? str : NULL;
             }
             return (node->left == 'b') ? NULL : str;
         case OP_BOL:
-            if (str == exp->_bol)
+            if (str == st->bol)
                 return str;
             return NULL;
         case OP_EOL:
-            if (str == exp->_eol)
+            if (str == st->eol)
                 return str;
             return NULL;
         case OP_DOT: {
@@ -947,6 +958,26 @@ TRex* trex_compile(const TRexChar* pattern, const TRexChar** error, int flags) {
     return exp;
 }
 
+/* Return the size of the copy of the program made by trex_copy() */
+static size_t trex_size(const TRex* exp) {
+    return sizeof(TRex) + (size_t)exp->_nsize * sizeof(TRexNode);
+}
+
+/* Copy the program at 'mem', to be used only by trex_match(): the copy has no
+ * storage for the subexpressions. Returns the copy. */
+static TRex* trex_copy(const TRex* exp, void* mem) {
+    TRex* copy = (TRex*)mem;
+    *copy = *exp;
+    copy->_nodes = (TRexNode*)(copy + 1);
+    memcpy(copy->_nodes, exp->_nodes, (size_t)exp->_nsize * sizeof(TRexNode));
+    copy->_nallocated = exp->_nsize;
+    copy->_matches = NULL;
+    copy->_jmpbuf = NULL;
+    copy->_error = NULL;
+    copy->_p = NULL;
+    return copy;
+}
+
 void trex_free(TRex* exp) {
     if (exp) {
         xfree(exp->_nodes);
@@ -956,13 +987,17 @@ void trex_free(TRex* exp) {
     }
 }
 
-TRexBool trex_match(TRex* exp, const TRexChar* text) {
+/* Unlike trex_search(), this doesn't record the subexpressions, and doesn't
+ * modify the program: it may be called by several tasks at the same time. */
+TRexBool trex_match(const TRex* exp, const TRexChar* text) {
     const TRexChar* res = NULL;
-    exp->_bol = text;
-    exp->_eol = text + scstrlen(text);
-    exp->_currsubexp = 0;
-    res = trex_matchnode(exp, exp->_nodes, text, NULL);
-    if (res == NULL || res != exp->_eol)
+    TRexState st;
+    st.bol = text;
+    st.eol = text + scstrlen(text);
+    st.currsubexp = 0;
+    st.matches = NULL;
+    res = trex_matchnode(exp, &st, exp->_nodes, text, NULL);
+    if (res == NULL || res != st.eol)
         return TRex_False;
     return TRex_True;
 }
@@ -970,15 +1005,17 @@ TRexBool trex_match(TRex* exp, const TRexChar* text) {
 TRexBool trex_searchrange(TRex* exp, const TRexChar* text_begin, const TRexChar* text_end, const TRexChar** out_begin, const TRexChar** out_end) {
     const TRexChar* cur = NULL;
     int node = exp->_first;
+    TRexState st;
     if (text_begin >= text_end)
         return TRex_False;
-    exp->_bol = text_begin;
-    exp->_eol = text_end;
+    st.bol = text_begin;
+    st.eol = text_end;
+    st.matches = exp->_matches;
     do {
         cur = text_begin;
         while (node != -1) {
-            exp->_currsubexp = 0;
-            cur = trex_matchnode(exp, &exp->_nodes[node], cur, NULL);
+            st.currsubexp = 0;
+            cur = trex_matchnode(exp, &st, &exp->_nodes[node], cur, NULL);
             if (!cur)
                 break;
             node = exp->_nodes[node].next;
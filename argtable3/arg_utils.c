@@ -48,6 +48,9 @@
 
 static void panic(const char* fmt, ...);
 static arg_panicfn* s_panic = panic;
+static arg_mallocfn* s_malloc = malloc;
+static arg_reallocfn* s_realloc = realloc;
+static arg_freefn* s_free = free;
 
 void dbg_printf(const char* fmt, ...) {
     va_list args;
@@ -84,19 +87,35 @@ void arg_set_panic(arg_panicfn* proc) {
     s_panic = proc;
 }
 
+void arg_set_allocator(arg_mallocfn* malloc_fn, arg_reallocfn* realloc_fn, arg_freefn* free_fn) {
+    s_malloc = malloc_fn ? malloc_fn : malloc;
+    s_realloc = realloc_fn ? realloc_fn : realloc;
+    s_free = free_fn ? free_fn : free;
+}
+
 void* xmalloc(size_t size) {
-    void* ret = malloc(size);
+    void* ret = s_malloc(size);
     if (!ret) {
         s_panic("Out of memory!\n");
     }
     return ret;
 }
 
+/* Like xmalloc(), but returns NULL rather than calling the panic handler */
+void* xtrymalloc(size_t size) {
+    return s_malloc(size);
+}
+
 void* xcalloc(size_t count, size_t size) {
     size_t allocated_count = count && size ? count : 1;
     size_t allocated_size = count && size ? size : 1;
-    void* ret = calloc(allocated_count, allocated_size);
-    if (!ret) {
+    void* ret = NULL;
+    if (allocated_count <= (size_t)-1 / allocated_size) {
+        ret = s_malloc(allocated_count * allocated_size);
+    }
+    if (ret) {
+        memset(ret, 0, allocated_count * allocated_size);
+    } else {
         s_panic("Out of memory!\n");
     }
     return ret;
@@ -104,7 +123,7 @@ void* xcalloc(size_t count, size_t size) {
 
 void* xrealloc(void* ptr, size_t size) {
     size_t allocated_size = size ? size : 1;
-    void* ret = realloc(ptr, allocated_size);
+    void* ret = s_realloc(ptr, allocated_size);
     if (!ret) {
         s_panic("Out of memory!\n");
     }
@@ -112,7 +131,7 @@ void* xrealloc(void* ptr, size_t size) {
 }
 
 void xfree(void* ptr) {
-    free(ptr);
+    s_free(ptr);
 }
 
 static void merge(void* data, int esize, int i, int j, int k, arg_comparefn* comparefn) {
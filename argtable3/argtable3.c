@@ -42,6 +42,9 @@
 #if ARG_REPLACE_GETOPT == 1
 #include "arg_getopt.h"
 #else
+#if defined(__NEWLIB__) && !defined(__PICOLIBC__)
+#define __need_getopt_newlib /* ESP-IDF-specific: declares the reentrant getopt_long_r() */
+#endif
 #include <getopt.h>
 #endif
 #else
@@ -62,6 +65,60 @@
 #include <stdlib.h>
 #include <string.h>
 
+/*
+ * ESP-IDF-specific: the scan state of getopt_long() is global, so commands
+ * parsed by several tasks at once would corrupt each other's scan. newlib's
+ * getopt_long_r() keeps it in a struct getopt_data owned by the caller;
+ * elsewhere the scans are serialized, one arg_parse() at a time.
+ */
+#if !defined(ARG_AMALGAMATION) && ARG_REPLACE_GETOPT == 0 && defined(__NEWLIB__) && !defined(__PICOLIBC__)
+#define ARG_GETOPT_REENTRANT 1
+#else
+#include <pthread.h>
+static pthread_mutex_t s_getopt_lock = PTHREAD_MUTEX_INITIALIZER;
+struct getopt_data {
+    char* optarg;
+    int optind, opterr, optopt;
+};
+#endif
+
+static void arg_getopt_begin(struct getopt_data* data) {
+    memset(data, 0, sizeof(*data)); /* optind 0 restarts the scan, opterr 0 disables error reporting */
+#ifndef ARG_GETOPT_REENTRANT
+    pthread_mutex_lock(&s_getopt_lock);
+#endif
+}
+
+static void arg_getopt_end(struct getopt_data* data) {
+    (void)data;
+#ifndef ARG_GETOPT_REENTRANT
+    pthread_mutex_unlock(&s_getopt_lock);
+#endif
+}
+
+static int arg_getopt(int argc, char** argv, const char* shortopts, const struct option* longopts, int* longindex, struct getopt_data* data) {
+#ifdef ARG_GETOPT_REENTRANT
+#ifdef ARG_LONG_ONLY
+    return __getopt_long_only_r(argc, argv, shortopts, longopts, longindex, data);
+#else
+    return __getopt_long_r(argc, argv, shortopts, longopts, longindex, data);
+#endif
+#else
+    int copt;
+    optind = data->optind;
+    opterr = data->opterr;
+#ifdef ARG_LONG_ONLY
+    copt = getopt_long_only(argc, argv, shortopts, longopts, longindex);
+#else
+    copt = getopt_long(argc, argv, shortopts, longopts, longindex);
+#endif
+    data->optarg = optarg;
+    data->optind = optind;
+    data->optopt = optopt;
+    return copt;
+#endif
+}
+
 static void arg_register_error(struct arg_end* end, void* parent, int error, const char* argval) {
     /* printf("arg_register_error(%p,%p,%d,%s)\n",end,parent,error,argval); */
     if (end->count < end->hdr.maxcount) {
@@ -90,9 +147,9 @@ static int find_shortoption(struct arg_hdr** table, char shortopt) {
 }
 
 struct longoptions {
-    int getoptval;
     int noptions;
     struct option* options;
+    int* tabindex; /* ESP-IDF-specific: table entry of each option, getopt doesn't write to a shared getoptval */
 };
 
 #if 0
@@ -100,7 +157,6 @@ static
 void dump_longoptions(struct longoptions * longoptions)
 {
     int i;
-    printf("getoptval = %d\n", longoptions->getoptval);
     printf("noptions  = %d\n", longoptions->noptions);
     for (i = 0; i < longoptions->noptions; i++)
     {
@@ -114,7 +170,7 @@ void dump_longoptions(struct longoptions * longoptions)
 }
 #endif
 
-static struct longoptions* alloc_longoptions(struct arg_hdr** table) {
+static struct longoptions* alloc_longoptions(struct arg_hdr** table, arg_mallocfn* alloc) {
     struct longoptions* result;
     size_t nbytes;
     int noptions = 1;
@@ -146,13 +202,15 @@ static struct longoptions* alloc_longoptions(struct arg_hdr** table) {
 
     /* allocate storage for return data structure as: */
     /* (struct longoptions) + (struct options)[noptions] + char[longoptlen] */
-    nbytes = sizeof(struct longoptions) + sizeof(struct option) * (size_t)noptions + longoptlen;
-    result = (struct longoptions*)xmalloc(nbytes);
+    nbytes = sizeof(struct longoptions) + (sizeof(struct option) + sizeof(int)) * (size_t)noptions + longoptlen;
+    result = (struct longoptions*)alloc(nbytes);
+    if (!result)
+        return NULL;
 
-    result->getoptval = 0;
     result->noptions = noptions;
     result->options = (struct option*)(result + 1);
-    store = (char*)(result->options + noptions);
+    result->tabindex = (int*)(result->options + noptions);
+    store = (char*)(result->tabindex + noptions);
 
     for (tabindex = 0; !(table[tabindex]->flag & ARG_TERMINATOR); tabindex++) {
         const char* longopts = table[tabindex]->longopts;
@@ -169,8 +227,9 @@ static struct longoptions* alloc_longoptions(struct arg_hdr** table) {
             /*fprintf(stderr,"storestart=\"%s\"\n",storestart);*/
 
             result->options[option_index].name = storestart;
-            result->options[option_index].flag = &(result->getoptval);
-            result->options[option_index].val = tabindex;
+            result->options[option_index].flag = NULL;
+            result->options[option_index].val = 0;
+            result->tabindex[option_index] = tabindex;
             if (table[tabindex]->flag & ARG_HASOPTVALUE)
                 result->options[option_index].has_arg = 2;
             else if (table[tabindex]->flag & ARG_HASVALUE)
@@ -191,7 +250,7 @@ static struct longoptions* alloc_longoptions(struct arg_hdr** table) {
     return result;
 }
 
-static char* alloc_shortoptions(struct arg_hdr** table) {
+static char* alloc_shortoptions(struct arg_hdr** table, arg_mallocfn* alloc) {
     char* result;
     size_t len = 2;
     int tabindex;
@@ -203,7 +262,9 @@ static char* alloc_shortoptions(struct arg_hdr** table) {
         len += 3 * (hdr->shortopts ? strlen(hdr->shortopts) : 0);
     }
 
-    result = xmalloc(len);
+    result = alloc(len);
+    if (!result)
+        return NULL;
 
     res = result;
 
@@ -237,67 +298,151 @@ static int arg_endindex(struct arg_hdr** table) {
     return tabindex;
 }
 
-static void arg_parse_tagged(int argc, char** argv, struct arg_hdr** table, struct arg_end* endtable) {
+/*
+ * Option tables of an argtable, built once by arg_compile() rather than
+ * on every arg_parse() call, and kept in the arg_end entry of the table.
+ * shortindex[] maps each short option char to the index of its table
+ * entry, or ARG_NOSHORTINDEX. refcount counts the arg_compile() calls
+ * not yet balanced by arg_uncompile().
+ */
+#define ARG_NOSHORTINDEX 0xff
+struct arg_compiled {
+    int refcount;
+    struct longoptions* longoptions;
+    char* shortoptions;
+    unsigned char shortindex[128];
+};
+
+static const struct arg_compiled* arg_find_compiled(struct arg_end* endtable) {
+    /* Pairs with the release store in arg_compile() */
+    return __atomic_load_n(&endtable->compiled, __ATOMIC_ACQUIRE);
+}
+
+int arg_compile(void** argtable) {
+    struct arg_hdr** table = (struct arg_hdr**)argtable;
+    const int endindex = arg_endindex(table);
+    struct arg_end* endtable = (struct arg_end*)table[endindex];
+    struct arg_compiled* compiled = endtable->compiled;
+    int tabindex;
+
+    if (compiled) {
+        compiled->refcount++;
+        return 0;
+    }
+
+    /* Out of memory is reported to the caller rather than to the panic handler */
+    compiled = (struct arg_compiled*)xtrymalloc(sizeof(struct arg_compiled));
+    if (!compiled)
+        return -1;
+    compiled->refcount = 1;
+    compiled->longoptions = alloc_longoptions(table, xtrymalloc);
+    compiled->shortoptions = alloc_shortoptions(table, xtrymalloc);
+    if (!compiled->longoptions || !compiled->shortoptions) {
+        xfree(compiled->shortoptions);
+        xfree(compiled->longoptions);
+        xfree(compiled);
+        return -1;
+    }
+    memset(compiled->shortindex, ARG_NOSHORTINDEX, sizeof(compiled->shortindex));
+    /* Walk the table backwards, so that the first entry with a short option wins, as in find_shortoption() */
+    for (tabindex = endindex - 1; tabindex >= 0; tabindex--) {
+        const char* shortopts = table[tabindex]->shortopts;
+        if (tabindex >= ARG_NOSHORTINDEX) {
+            /* Too many entries to be indexed, let arg_parse() build the tables itself */
+            xfree(compiled->shortoptions);
+            xfree(compiled->longoptions);
+            xfree(compiled);
+            return 1;
+        }
+        while (shortopts && *shortopts) {
+            unsigned char c = (unsigned char)*shortopts++;
+            if (c < sizeof(compiled->shortindex))
+                compiled->shortindex[c] = (unsigned char)tabindex;
+        }
+    }
+
+    /* The tables are complete before they become visible to arg_parse() */
+    __atomic_store_n(&endtable->compiled, compiled, __ATOMIC_RELEASE);
+    return 0;
+}
+
+void arg_uncompile(void** argtable) {
+    struct arg_hdr** table = (struct arg_hdr**)argtable;
+    struct arg_end* endtable = (struct arg_end*)table[arg_endindex(table)];
+    struct arg_compiled* compiled = endtable->compiled;
+
+    if (!compiled || --compiled->refcount > 0)
+        return;
+    __atomic_store_n(&endtable->compiled, NULL, __ATOMIC_RELAXED);
+    xfree(compiled->shortoptions);
+    xfree(compiled->longoptions);
+    xfree(compiled);
+}
+
+static void arg_parse_tagged(int argc,
+                             char** argv,
+                             struct arg_hdr** table,
+                             struct arg_end* endtable,
+                             const struct arg_compiled* compiled,
+                             struct getopt_data* state) {
     struct longoptions* longoptions;
     char* shortoptions;
     int copt;
+    int longindex;
 
     /*printf("arg_parse_tagged(%d,%p,%p,%p)\n",argc,argv,table,endtable);*/
 
-    /* allocate short and long option arrays for the given opttable[].   */
-    /* if the allocs fail then put an error msg in the last table entry. */
-    longoptions = alloc_longoptions(table);
-    shortoptions = alloc_shortoptions(table);
+    /* allocate short and long option arrays for the given opttable[],   */
+    /* unless they were built by arg_compile().                          */
+    if (compiled) {
+        longoptions = compiled->longoptions;
+        shortoptions = compiled->shortoptions;
+    } else {
+        longoptions = alloc_longoptions(table, xmalloc);
+        shortoptions = alloc_shortoptions(table, xmalloc);
+    }
 
     /*dump_longoptions(longoptions);*/
 
-    /* reset getopts internal option-index to zero, and disable error reporting */
-    optind = 0;
-    opterr = 0;
-
-    /* fetch and process args using getopt_long */
-#ifdef ARG_LONG_ONLY
-    while ((copt = getopt_long_only(argc, argv, shortoptions, longoptions->options, NULL)) != -1) {
-#else
-    while ((copt = getopt_long(argc, argv, shortoptions, longoptions->options, NULL)) != -1) {
-#endif
+    /* fetch and process args using getopt_long, its scan state was reset by arg_getopt_begin() */
+    while ((copt = arg_getopt(argc, argv, shortoptions, longoptions->options, &longindex, state)) != -1) {
         /*
-           printf("optarg='%s'\n",optarg);
-           printf("optind=%d\n",optind);
+           printf("state->optarg='%s'\n",state->optarg);
+           printf("state->optind=%d\n",state->optind);
            printf("copt=%c\n",(char)copt);
-           printf("optopt=%c (%d)\n",optopt, (int)(optopt));
+           printf("state->optopt=%c (%d)\n",state->optopt, (int)(state->optopt));
          */
         switch (copt) {
             case 0: {
-                int tabindex = longoptions->getoptval;
+                int tabindex = longoptions->tabindex[longindex];
                 void* parent = table[tabindex]->parent;
                 /*printf("long option detected from argtable[%d]\n", tabindex);*/
-                if (optarg && optarg[0] == 0 && (table[tabindex]->flag & ARG_HASVALUE)) {
-                    /* printf(": long option %s requires an argument\n",argv[optind-1]); */
-                    arg_register_error(endtable, endtable, ARG_EMISSARG, argv[optind - 1]);
+                if (state->optarg && state->optarg[0] == 0 && (table[tabindex]->flag & ARG_HASVALUE)) {
+                    /* printf(": long option %s requires an argument\n",argv[state->optind-1]); */
+                    arg_register_error(endtable, endtable, ARG_EMISSARG, argv[state->optind - 1]);
                     /* continue to scan the (empty) argument value to enforce argument count checking */
                 }
                 if (table[tabindex]->scanfn) {
-                    int errorcode = table[tabindex]->scanfn(parent, optarg);
+                    int errorcode = table[tabindex]->scanfn(parent, state->optarg);
                     if (errorcode != 0)
-                        arg_register_error(endtable, parent, errorcode, optarg);
+                        arg_register_error(endtable, parent, errorcode, state->optarg);
                 }
             } break;
 
             case '?':
                 /*
                  * getopt_long() found an unrecognised short option.
-                 * if it was a short option its value is in optopt
-                 * if it was a long option then optopt=0
+                 * if it was a short option its value is in state->optopt
+                 * if it was a long option then state->optopt=0
                  */
-                switch (optopt) {
+                switch (state->optopt) {
                     case 0:
-                        /*printf("?0 unrecognised long option %s\n",argv[optind-1]);*/
-                        arg_register_error(endtable, endtable, ARG_ELONGOPT, argv[optind - 1]);
+                        /*printf("?0 unrecognised long option %s\n",argv[state->optind-1]);*/
+                        arg_register_error(endtable, endtable, ARG_ELONGOPT, argv[state->optind - 1]);
                         break;
                     default:
-                        /*printf("?* unrecognised short option '%c'\n",optopt);*/
-                        arg_register_error(endtable, endtable, optopt, NULL);
+                        /*printf("?* unrecognised short option '%c'\n",state->optopt);*/
+                        arg_register_error(endtable, endtable, state->optopt, NULL);
                         break;
                 }
                 break;
@@ -306,13 +451,20 @@ static void arg_parse_tagged(int argc, char** argv, struct arg_hdr** table, stru
                 /*
                  * getopt_long() found an option with its argument missing.
                  */
-                /*printf(": option %s requires an argument\n",argv[optind-1]); */
-                arg_register_error(endtable, endtable, ARG_EMISSARG, argv[optind - 1]);
+                /*printf(": option %s requires an argument\n",argv[state->optind-1]); */
+                arg_register_error(endtable, endtable, ARG_EMISSARG, argv[state->optind - 1]);
                 break;
 
             default: {
                 /* getopt_long() found a valid short option */
-                int tabindex = find_shortoption(table, (char)copt);
+                int tabindex;
+                if (compiled) {
+                    tabindex = ((unsigned)copt < sizeof(compiled->shortindex)) ? compiled->shortindex[copt] : ARG_NOSHORTINDEX;
+                    if (tabindex == ARG_NOSHORTINDEX)
+                        tabindex = -1;
+                } else {
+                    tabindex = find_shortoption(table, (char)copt);
+                }
                 /*printf("short option detected from argtable[%d]\n", tabindex);*/
                 if (tabindex == -1) {
                     /* should never get here - but handle it just in case */
@@ -321,9 +473,9 @@ static void arg_parse_tagged(int argc, char** argv, struct arg_hdr** table, stru
                 } else {
                     if (table[tabindex]->scanfn) {
                         void* parent = table[tabindex]->parent;
-                        int errorcode = table[tabindex]->scanfn(parent, optarg);
+                        int errorcode = table[tabindex]->scanfn(parent, state->optarg);
                         if (errorcode != 0)
-                            arg_register_error(endtable, parent, errorcode, optarg);
+                            arg_register_error(endtable, parent, errorcode, state->optarg);
                     }
                 }
                 break;
@@ -331,11 +483,13 @@ static void arg_parse_tagged(int argc, char** argv, struct arg_hdr** table, stru
         }
     }
 
-    xfree(shortoptions);
-    xfree(longoptions);
+    if (!compiled) {
+        xfree(shortoptions);
+        xfree(longoptions);
+    }
 }
 
-static void arg_parse_untagged(int argc, char** argv, struct arg_hdr** table, struct arg_end* endtable) {
+static void arg_parse_untagged(int argc, char** argv, struct arg_hdr** table, struct arg_end* endtable, int argindex) {
     int tabindex = 0;
     int errorlast = 0;
     const char* optarglast = NULL;
@@ -346,8 +500,8 @@ static void arg_parse_untagged(int argc, char** argv, struct arg_hdr** table, st
         void* parent;
         int errorcode;
 
-        /* if we have exhausted our argv[optind] entries then we have finished */
-        if (optind >= argc) {
+        /* if we have exhausted our argv[argindex] entries then we have finished */
+        if (argindex >= argc) {
             /*printf("arg_parse_untagged(): argv[] exhausted\n");*/
             return;
         }
@@ -366,26 +520,26 @@ static void arg_parse_untagged(int argc, char** argv, struct arg_hdr** table, st
             continue;
         }
 
-        /* attempt to scan the current argv[optind] with the current     */
+        /* attempt to scan the current argv[argindex] with the current     */
         /* table[tabindex] entry. If it succeeds then keep it, otherwise */
         /* try again with the next table[] entry.                        */
         parent = table[tabindex]->parent;
-        errorcode = table[tabindex]->scanfn(parent, argv[optind]);
+        errorcode = table[tabindex]->scanfn(parent, argv[argindex]);
         if (errorcode == 0) {
-            /* success, move onto next argv[optind] but stay with same table[tabindex] */
+            /* success, move onto next argv[argindex] but stay with same table[tabindex] */
             /*printf("arg_parse_untagged(): argtable[%d] successfully matched\n",tabindex);*/
-            optind++;
+            argindex++;
 
             /* clear the last tentative error */
             errorlast = 0;
         } else {
-            /* failure, try same argv[optind] with next table[tabindex] entry */
+            /* failure, try same argv[argindex] with next table[tabindex] entry */
             /*printf("arg_parse_untagged(): argtable[%d] failed match\n",tabindex);*/
             tabindex++;
 
             /* remember this as a tentative error we may wish to reinstate later */
             errorlast = errorcode;
-            optarglast = argv[optind];
+            optarglast = argv[argindex];
             parentlast = parent;
         }
     }
@@ -393,14 +547,14 @@ static void arg_parse_untagged(int argc, char** argv, struct arg_hdr** table, st
     /* if a tenative error still remains at this point then register it as a proper error */
     if (errorlast) {
         arg_register_error(endtable, parentlast, errorlast, optarglast);
-        optind++;
+        argindex++;
     }
 
     /* only get here when not all argv[] entries were consumed */
     /* register an error for each unused argv[] entry */
-    while (optind < argc) {
-        /*printf("arg_parse_untagged(): argv[%d]=\"%s\" not consumed\n",optind,argv[optind]);*/
-        arg_register_error(endtable, endtable, ARG_ENOMATCH, argv[optind++]);
+    while (argindex < argc) {
+        /*printf("arg_parse_untagged(): argv[%d]=\"%s\" not consumed\n",argindex,argv[argindex]);*/
+        arg_register_error(endtable, endtable, ARG_ENOMATCH, argv[argindex++]);
     }
 
     return;
@@ -429,11 +583,20 @@ static void arg_reset(void** argtable) {
     } while (!(table[tabindex++]->flag & ARG_TERMINATOR));
 }
 
-int arg_parse(int argc, char** argv, void** argtable) {
+static arg_parse_hook_t* s_parse_hook = NULL;
+
+void arg_set_parse_hook(arg_parse_hook_t* hook) {
+    s_parse_hook = hook;
+}
+
+static int arg_parse_table(int argc, char** argv, void** argtable) {
     struct arg_hdr** table = (struct arg_hdr**)argtable;
     struct arg_end* endtable;
     int endindex;
+    const struct arg_compiled* compiled;
+    char* argvstack[ARG_PARSE_STACK_ARGC + 1];
     char** argvcopy = NULL;
+    struct getopt_data state;
     int i;
 
     /*printf("arg_parse(%d,%p,%p)\n",argc,argv,argtable);*/
@@ -441,9 +604,10 @@ int arg_parse(int argc, char** argv, void** argtable) {
     /* reset any argtable data from previous invocations */
     arg_reset(argtable);
 
-    /* locate the first end-of-table marker within the array */
+    /* locate the first end-of-table marker within the array, it holds the compiled option tables */
     endindex = arg_endindex(table);
     endtable = (struct arg_end*)table[endindex];
+    compiled = arg_find_compiled(endtable);
 
     /* Special case of argc==0.  This can occur on Texas Instruments DSP. */
     /* Failure to trap this case results in an unwanted NULL result from  */
@@ -456,7 +620,11 @@ int arg_parse(int argc, char** argv, void** argtable) {
         return endtable->count;
     }
 
-    argvcopy = (char**)xmalloc(sizeof(char*) * (size_t)(argc + 1));
+    /* short command lines are copied on the stack */
+    if (argc <= ARG_PARSE_STACK_ARGC)
+        argvcopy = argvstack;
+    else
+        argvcopy = (char**)xmalloc(sizeof(char*) * (size_t)(argc + 1));
 
     /*
         Fill in the local copy of argv[]. We need a local copy
@@ -469,21 +637,35 @@ int arg_parse(int argc, char** argv, void** argtable) {
     argvcopy[argc] = NULL;
 
     /* parse the command line (local copy) for tagged options */
-    arg_parse_tagged(argc, argvcopy, table, endtable);
+    arg_getopt_begin(&state);
+    arg_parse_tagged(argc, argvcopy, table, endtable, compiled, &state);
+    arg_getopt_end(&state);
 
     /* parse the command line (local copy) for untagged options */
-    arg_parse_untagged(argc, argvcopy, table, endtable);
+    arg_parse_untagged(argc, argvcopy, table, endtable, state.optind);
 
     /* if no errors so far then perform post-parse checks otherwise dont bother */
     if (endtable->count == 0)
         arg_parse_check(table, endtable);
 
     /* release the local copt of argv[] */
-    xfree(argvcopy);
+    if (argvcopy != argvstack)
+        xfree(argvcopy);
 
     return endtable->count;
 }
 
+int arg_parse(int argc, char** argv, void** argtable) {
+    arg_parse_hook_t* hook = s_parse_hook;
+    int nerrors;
+    if (hook == NULL)
+        return arg_parse_table(argc, argv, argtable);
+    hook(argtable, 0);
+    nerrors = arg_parse_table(argc, argv, argtable);
+    hook(argtable, 1);
+    return nerrors;
+}
+
 /*
  * Concatenate contents of src[] string onto *pdest[] string.
  * The *pdest pointer is altered to point to the end of the
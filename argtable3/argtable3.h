@@ -49,6 +49,7 @@ extern "C" {
 #define ARG_DSTR_SIZE 200
 #define ARG_CMD_NAME_LEN 100
 #define ARG_CMD_DESCRIPTION_LEN 256
+#define ARG_PARSE_STACK_ARGC 16 /* ESP-IDF-specific: arg_parse copies argv on the stack up to this many arguments */
 
 #ifndef ARG_REPLACE_GETOPT
 #define ARG_REPLACE_GETOPT 0 /* ESP-IDF-specific: use newlib-provided getopt instead of the embedded one */
@@ -162,12 +163,15 @@ typedef struct arg_date {
 } arg_date_t;
 
 enum { ARG_ELIMIT = 1, ARG_EMALLOC, ARG_ENOMATCH, ARG_ELONGOPT, ARG_EMISSARG };
+struct arg_compiled;
+
 typedef struct arg_end {
     struct arg_hdr hdr;  /* The mandatory argtable header struct */
     int count;           /* Number of errors encountered */
     int* error;          /* Array of error codes */
     void** parent;       /* Array of pointers to offending arg_xxx struct */
     const char** argval; /* Array of pointers to offending argv[] string */
+    struct arg_compiled* compiled; /* ESP-IDF-specific: option tables of the argtable built by arg_compile(), or NULL */
 } arg_end_t;
 
 typedef struct arg_cmd_info {
@@ -187,10 +191,26 @@ ARG_EXTERN struct arg_lit* arg_litn(const char* shortopts, const char* longopts,
 ARG_EXTERN struct arg_int* arg_int0(const char* shortopts, const char* longopts, const char* datatype, const char* glossary);
 ARG_EXTERN struct arg_int* arg_int1(const char* shortopts, const char* longopts, const char* datatype, const char* glossary);
 ARG_EXTERN struct arg_int* arg_intn(const char* shortopts, const char* longopts, const char* datatype, int mincount, int maxcount, const char* glossary);
+/* Each value is a comma separated list of integers, e.g. --reg=0x10,0x20,4KB, stored in ival[maxcount] if not NULL */
+ARG_EXTERN struct arg_int* arg_int_list(const char* shortopts,
+                                        const char* longopts,
+                                        const char* datatype,
+                                        int* ival,
+                                        int mincount,
+                                        int maxcount,
+                                        const char* glossary);
 
 ARG_EXTERN struct arg_dbl* arg_dbl0(const char* shortopts, const char* longopts, const char* datatype, const char* glossary);
 ARG_EXTERN struct arg_dbl* arg_dbl1(const char* shortopts, const char* longopts, const char* datatype, const char* glossary);
 ARG_EXTERN struct arg_dbl* arg_dbln(const char* shortopts, const char* longopts, const char* datatype, int mincount, int maxcount, const char* glossary);
+/* Each value is a comma separated list of doubles, stored in dval[maxcount] if not NULL */
+ARG_EXTERN struct arg_dbl* arg_dbl_list(const char* shortopts,
+                                        const char* longopts,
+                                        const char* datatype,
+                                        double* dval,
+                                        int mincount,
+                                        int maxcount,
+                                        const char* glossary);
 
 ARG_EXTERN struct arg_str* arg_str0(const char* shortopts, const char* longopts, const char* datatype, const char* glossary);
 ARG_EXTERN struct arg_str* arg_str1(const char* shortopts, const char* longopts, const char* datatype, const char* glossary);
@@ -224,6 +244,24 @@ ARG_EXTERN struct arg_end* arg_end(int maxcount);
 /**** other functions *******************************************/
 ARG_EXTERN int arg_nullcheck(void** argtable);
 ARG_EXTERN int arg_parse(int argc, char** argv, void** argtable);
+/* Build the option tables of an argtable once, for all the following arg_parse calls.
+ * Returns 0 on success, 1 if the argtable has too many entries to be compiled (arg_parse then
+ * builds the tables itself), or -1 if out of memory; nothing is to be uncompiled in the last case.
+ * The tables are freed by the arg_uncompile call balancing the first arg_compile.
+ * Calls for one argtable must be serialized, and arg_uncompile must not run during an arg_parse of it. */
+ARG_EXTERN int arg_compile(void** argtable);
+ARG_EXTERN void arg_uncompile(void** argtable);
+
+/* Called before (done == 0) and after (done == 1) each arg_parse, e.g. to time it */
+typedef void(arg_parse_hook_t)(void** argtable, int done);
+ARG_EXTERN void arg_set_parse_hook(arg_parse_hook_t* hook);
+
+/* Allocate all the memory of argtable with these functions. NULL restores malloc, realloc and free.
+ * Set before any argtable is created, memory is freed with the functions it was allocated with. */
+typedef void*(arg_mallocfn)(size_t size);
+typedef void*(arg_reallocfn)(void* ptr, size_t size);
+typedef void(arg_freefn)(void* ptr);
+ARG_EXTERN void arg_set_allocator(arg_mallocfn* malloc_fn, arg_reallocfn* realloc_fn, arg_freefn* free_fn);
 ARG_EXTERN void arg_print_option(FILE* fp, const char* shortopts, const char* longopts, const char* datatype, const char* suffix);
 ARG_EXTERN void arg_print_syntax(FILE* fp, void** argtable, const char* suffix);
 ARG_EXTERN void arg_print_syntaxv(FILE* fp, void** argtable, const char* suffix);
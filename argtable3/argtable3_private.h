@@ -87,6 +87,7 @@ typedef void(arg_panicfn)(const char* fmt, ...);
  * the namespace is flat for everything including apps and libraries.
  */
 #define	xmalloc argtable3_xmalloc
+#define	xtrymalloc argtable3_xtrymalloc
 #define	xcalloc argtable3_xcalloc
 #define	xrealloc argtable3_xrealloc
 #define	xfree argtable3_xfree
@@ -94,22 +95,22 @@ typedef void(arg_panicfn)(const char* fmt, ...);
 extern void dbg_printf(const char* fmt, ...);
 extern void arg_set_panic(arg_panicfn* proc);
 extern void* xmalloc(size_t size);
+extern void* xtrymalloc(size_t size);
 extern void* xcalloc(size_t count, size_t size);
 extern void* xrealloc(void* ptr, size_t size);
 extern void xfree(void* ptr);
 
 struct arg_hashtable_entry {
     void *k, *v;
-    unsigned int h;
-    struct arg_hashtable_entry* next;
+    unsigned int h; /* hash of the key, zero for empty slots */
 };
 
 typedef struct arg_hashtable {
-    unsigned int tablelength;
-    struct arg_hashtable_entry** table;
+    unsigned int tablelength; /* number of slots, a power of two */
+    struct arg_hashtable_entry* table;
     unsigned int entrycount;
     unsigned int loadlimit;
-    unsigned int primeindex;
+    unsigned int hashshift; /* 32 - log2(tablelength) */
     unsigned int (*hashfn)(const void* k);
     int (*eqfn)(const void* k1, const void* k2);
 } arg_hashtable_t;
@@ -200,8 +201,8 @@ void arg_hashtable_destroy(arg_hashtable_t* h, int free_values);
 typedef struct arg_hashtable_itr {
     arg_hashtable_t* h;
     struct arg_hashtable_entry* e;
-    struct arg_hashtable_entry* parent;
     unsigned int index;
+    unsigned int end; /* empty slot where the iteration started */
 } arg_hashtable_itr_t;
 
 arg_hashtable_itr_t* arg_hashtable_itr_create(arg_hashtable_t* h);
@@ -7,16 +7,50 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <stdatomic.h>
 #include <sys/param.h>
 #include "esp_heap_caps.h"
 #include "esp_log.h"
 #include "esp_console.h"
-#include "esp_system.h"
 #include "linenoise/linenoise.h"
 #include "argtable3/argtable3.h"
+#include "console_private.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
 #include "sys/queue.h"
+#if CONFIG_CONSOLE_CMD_STATS
+#include "esp_timer.h"
+#endif
 
 #define ANSI_COLOR_DEFAULT      39      /** Default foreground color */
+#define CMD_INDEX_MIN_SIZE      16      /** Initial number of slots in the command index */
+#define DEFAULT_MAX_CMDLINE_ARGS 32     /** Used when max_cmdline_args is not set in the config */
+#define DEFAULT_PIPE_BUFFER_SIZE 512    /** Used when pipe_buffer_size is not set in the config */
+#define DEFAULT_PIPE_TASK_STACK_SIZE 4096 /** Used when pipe_task_stack_size is not set in the config */
+#define CMD_STATS_BUCKETS       32      /** Buckets of the histogram of execution times, one per power of two */
+
+#if CONFIG_CONSOLE_CMD_STATS
+/**
+ * What calls of a command cost, updated with s_stats_lock taken
+ */
+typedef struct cmd_stats_ {
+    uint32_t calls;
+    uint32_t time_min_us;
+    uint32_t time_max_us;
+    uint64_t time_total_us;
+    uint64_t split_total_us;
+    uint64_t arg_parse_total_us;
+    int64_t heap_total;             //!< sum of the bytes allocated and not freed by each call
+    int32_t heap_max;
+    uint32_t heap_peak_max;
+    uint32_t stack_free_min;
+    uint32_t histogram[CMD_STATS_BUCKETS]; //!< bucket n counts the calls which took less than 2^n us
+} cmd_stats_t;
+#endif
 
 typedef struct cmd_item_ {
     /**
@@ -28,17 +62,113 @@ typedef struct cmd_item_ {
      */
     const char *help;
     /**
-     * Hint text, usually lists possible arguments, dynamically allocated.
-     * May be NULL.
+     * Hint text given at registration (statically allocated by application), may be NULL.
+     */
+    const char *hint_src;
+    /**
+     * Hint text, usually lists possible arguments, generated from hint_src or
+     * argtable on the first lookup. NULL until then, and s_no_hint if the
+     * command has no hint.
      */
-    char *hint;
+    char *_Atomic hint;
+    /**
+     * Help text printed as is (statically allocated by application), may be NULL.
+     */
+    const char *help_formatted;
+    char *help_cache;               //!< formatted help, kept while the cache has room, may be NULL
+    size_t help_cache_len;          //!< length of help_cache
+    TAILQ_ENTRY(cmd_item_) help_lru; //!< next command in s_help_lru, if help_cache is set
     esp_console_cmd_func_t func;    //!< pointer to the command handler
     void *argtable;                 //!< optional pointer to arg table
-    SLIST_ENTRY(cmd_item_) next;    //!< next command in the list
+    uint32_t flags;                 //!< ESP_CONSOLE_CMD_FLAG_xxx flags given at registration
+    uint32_t hash;                  //!< hash of the command name, used by the command index
+    TAILQ_ENTRY(cmd_item_) next;    //!< next command in s_cmd_list, or in s_cmd_retired
+#if CONFIG_CONSOLE_CMD_STATS
+    cmd_stats_t *stats;             //!< moved to the new item when the command is registered again
+#endif
 } cmd_item_t;
 
-/** linked list of command structures */
-static SLIST_HEAD(cmd_list_, cmd_item_) s_cmd_list;
+/** linked list of command structures, in registration order */
+static TAILQ_HEAD(cmd_list_, cmd_item_) s_cmd_list = TAILQ_HEAD_INITIALIZER(s_cmd_list);
+
+/** marks the commands whose hint was generated, and is empty */
+static char s_no_hint[] = "";
+
+/**
+ * Commands whose formatted help is cached, least recently printed first.
+ * Protected by s_cmd_lock, as is the help cache of each command.
+ */
+static TAILQ_HEAD(help_lru_, cmd_item_) s_help_lru = TAILQ_HEAD_INITIALIZER(s_help_lru);
+static size_t s_help_cache_used;
+
+/**
+ * Commands replaced by registering the same name again. A concurrent lookup
+ * may still be using one, so they are freed by cmd_retired_reclaim once no
+ * lookup or command is in progress. Protected by s_cmd_lock.
+ */
+static TAILQ_HEAD(cmd_retired_, cmd_item_) s_cmd_retired = TAILQ_HEAD_INITIALIZER(s_cmd_retired);
+
+/** number of lookups and commands in progress, see cmd_reader_enter */
+static atomic_int s_cmd_readers;
+
+/** s_cmd_retired may have items to free, checked when the last reader exits */
+static atomic_bool s_cmd_retired_pending;
+
+/**
+ * Open addressing index of the commands in s_cmd_list, keyed by command name.
+ * Size is always a power of two, so the slot is found by masking the hash.
+ */
+typedef struct cmd_index_ {
+    size_t size;                     //!< number of slots
+    struct cmd_index_ *retired;      //!< smaller index this one replaced
+    cmd_item_t *_Atomic slots[];     //!< the commands, NULL for empty slots
+} cmd_index_t;
+
+/**
+ * Commands are looked up without taking any lock: the index only ever gets
+ * new entries, and when it has to grow a new one is built and published with
+ * a single atomic store. The replaced index is kept (and freed by
+ * esp_console_deinit) since a concurrent lookup may still be reading it.
+ */
+static cmd_index_t *_Atomic s_cmd_index;
+static size_t s_cmd_count;
+
+/**
+ * Serializes registration, and protects s_cmd_list and s_cmd_sorted, which
+ * are only used by help and completion. Command dispatch doesn't take it.
+ */
+static SemaphoreHandle_t s_cmd_lock;
+
+/**
+ * The same commands sorted by name, so that all commands starting with a
+ * given prefix form a contiguous range that can be found by binary search.
+ */
+static cmd_item_t **s_cmd_sorted;
+static size_t s_cmd_sorted_size;
+
+/**
+ * Commands defined with ESP_CONSOLE_CMD_REGISTER, placed in a section by the
+ * linker. On chips the linker sorts them by name (see linker.lf), otherwise
+ * esp_console_init sorts pointers to them in s_static_sorted.
+ */
+#if CONFIG_IDF_TARGET_LINUX
+extern const esp_console_cmd_t __start_console_cmd_desc[] __attribute__((weak));
+extern const esp_console_cmd_t __stop_console_cmd_desc[] __attribute__((weak));
+#define STATIC_CMDS_START __start_console_cmd_desc
+#define STATIC_CMDS_END __stop_console_cmd_desc
+#else
+extern const esp_console_cmd_t _console_cmd_desc_start[];
+extern const esp_console_cmd_t _console_cmd_desc_end[];
+#define STATIC_CMDS_START _console_cmd_desc_start
+#define STATIC_CMDS_END _console_cmd_desc_end
+#endif
+
+static const esp_console_cmd_t **s_static_sorted;   //!< NULL if the section is sorted
+static size_t s_static_count;
+static uint8_t *s_static_compiled;                  //!< bit set for each static command whose argtable was compiled at init
+#if CONFIG_CONSOLE_CMD_STATS
+static cmd_stats_t *s_static_stats;                 //!< one per static command, in sorted order
+#endif
 
 /** run-time configuration options */
 static esp_console_config_t s_config = {
@@ -48,7 +178,38 @@ static esp_console_config_t s_config = {
 /** temporary buffer used for command line parsing */
 static char *s_tmp_line_buf;
 
+/** argument array used by esp_console_run, allocated once with s_tmp_line_buf */
+static char **s_tmp_argv;
+
+#if CONFIG_CONSOLE_CMD_STATS
+/** protects the statistics of all the commands */
+static SemaphoreHandle_t s_stats_lock;
+
+/** time spent in arg_parse by the command the task is running */
+typedef struct {
+    int64_t arg_parse_start_us;
+    uint32_t arg_parse_us;
+} call_timing_t;
+
+static _Thread_local call_timing_t *s_call_timing;
+
+static void stats_arg_parse_hook(void **argtable, int done);
+#endif
+
 static const cmd_item_t *find_command_by_name(const char *name);
+static esp_err_t static_cmds_init(void);
+static void static_cmds_free(void);
+static esp_err_t cmd_index_insert(cmd_item_t *item);
+static void cmd_index_replace(cmd_item_t *old_item, cmd_item_t *item);
+static void cmd_index_free(void);
+static void cmd_item_free(cmd_item_t *item);
+static void cmd_retired_reclaim(void);
+static void cmd_free_hint(cmd_item_t *item);
+static void help_cache_drop(cmd_item_t *item);
+static void help_args_free(void);
+#if CONFIG_CONSOLE_CMD_STATS
+static void stats_args_free(void);
+#endif
 
 esp_err_t esp_console_init(const esp_console_config_t *config)
 {
@@ -65,10 +226,52 @@ esp_err_t esp_console_init(const esp_console_config_t *config)
     if (s_config.heap_alloc_caps == 0) {
         s_config.heap_alloc_caps = MALLOC_CAP_DEFAULT;
     }
-    s_tmp_line_buf = heap_caps_calloc(1, config->max_cmdline_length, s_config.heap_alloc_caps);
+    if (s_config.max_cmdline_args == 0) {
+        s_config.max_cmdline_args = DEFAULT_MAX_CMDLINE_ARGS;
+    }
+    if (s_config.pipe_buffer_size == 0) {
+        s_config.pipe_buffer_size = DEFAULT_PIPE_BUFFER_SIZE;
+    }
+    if (s_config.pipe_task_stack_size == 0) {
+        s_config.pipe_task_stack_size = DEFAULT_PIPE_TASK_STACK_SIZE;
+    }
+    esp_err_t err = esp_console_alloc_init(&s_config);
+    if (err != ESP_OK) {
+        return err;
+    }
+    s_tmp_line_buf = esp_console_calloc(1, config->max_cmdline_length);
     if (s_tmp_line_buf == NULL) {
+        esp_console_alloc_deinit();
+        return ESP_ERR_NO_MEM;
+    }
+    s_tmp_argv = esp_console_calloc(s_config.max_cmdline_args, sizeof(char *));
+    s_cmd_lock = xSemaphoreCreateMutex();
+    bool failed = (s_tmp_argv == NULL || s_cmd_lock == NULL || static_cmds_init() != ESP_OK);
+#if CONFIG_CONSOLE_CMD_STATS
+    s_stats_lock = xSemaphoreCreateMutex();
+    if (s_stats_lock == NULL) {
+        failed = true;
+    } else if (failed) {
+        vSemaphoreDelete(s_stats_lock);
+        s_stats_lock = NULL;
+    }
+#endif
+    if (failed) {
+        static_cmds_free();
+        if (s_cmd_lock) {
+            vSemaphoreDelete(s_cmd_lock);
+            s_cmd_lock = NULL;
+        }
+        esp_console_free(s_tmp_argv);
+        s_tmp_argv = NULL;
+        esp_console_free(s_tmp_line_buf);
+        s_tmp_line_buf = NULL;
+        esp_console_alloc_deinit();
         return ESP_ERR_NO_MEM;
     }
+#if CONFIG_CONSOLE_CMD_STATS
+    arg_set_parse_hook(stats_arg_parse_hook);
+#endif
     return ESP_OK;
 }
 
@@ -77,115 +280,540 @@ esp_err_t esp_console_deinit(void)
     if (!s_tmp_line_buf) {
         return ESP_ERR_INVALID_STATE;
     }
-    free(s_tmp_line_buf);
+    esp_console_free(s_tmp_line_buf);
     s_tmp_line_buf = NULL;
+    esp_console_free(s_tmp_argv);
+    s_tmp_argv = NULL;
     cmd_item_t *it, *tmp;
-    SLIST_FOREACH_SAFE(it, &s_cmd_list, next, tmp) {
-        SLIST_REMOVE(&s_cmd_list, it, cmd_item_, next);
-        free(it->hint);
-        free(it);
+    TAILQ_FOREACH_SAFE(it, &s_cmd_list, next, tmp) {
+        TAILQ_REMOVE(&s_cmd_list, it, next);
+        if (it->argtable) {
+            arg_uncompile(it->argtable);
+        }
+        cmd_free_hint(it);
+        help_cache_drop(it);
+#if CONFIG_CONSOLE_CMD_STATS
+        esp_console_free(it->stats);
+#endif
+        esp_console_free(it);
+    }
+    TAILQ_FOREACH_SAFE(it, &s_cmd_retired, next, tmp) {
+        TAILQ_REMOVE(&s_cmd_retired, it, next);
+        cmd_item_free(it);
     }
+    atomic_store(&s_cmd_retired_pending, false);
+    cmd_index_free();
+    esp_console_free(s_cmd_sorted);
+    s_cmd_sorted = NULL;
+    s_cmd_sorted_size = 0;
+    s_cmd_count = 0;
+    static_cmds_free();
+    help_args_free();
+    vSemaphoreDelete(s_cmd_lock);
+    s_cmd_lock = NULL;
+#if CONFIG_CONSOLE_CMD_STATS
+    stats_args_free();
+    arg_set_parse_hook(NULL);
+    vSemaphoreDelete(s_stats_lock);
+    s_stats_lock = NULL;
+#endif
+    esp_console_alloc_deinit();
     return ESP_OK;
 }
 
 esp_err_t esp_console_cmd_register(const esp_console_cmd_t *cmd)
 {
-    cmd_item_t *item = NULL;
     if (!cmd || cmd->command == NULL) {
         return ESP_ERR_INVALID_ARG;
     }
     if (strchr(cmd->command, ' ') != NULL) {
         return ESP_ERR_INVALID_ARG;
     }
-    item = (cmd_item_t *)find_command_by_name(cmd->command);
-    if (!item) {
-        // not registered before
-        item = heap_caps_calloc(1, sizeof(*item), s_config.heap_alloc_caps);
-        if (item == NULL) {
-            return ESP_ERR_NO_MEM;
-        }
-    } else {
-        // remove from list and free the old hint, because we will alloc new hint for the command
-        SLIST_REMOVE(&s_cmd_list, item, cmd_item_, next);
-        free(item->hint);
+    if (s_cmd_lock == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    xSemaphoreTake(s_cmd_lock, portMAX_DELAY);
+    cmd_item_t *old_item = (cmd_item_t *)find_command_by_name(cmd->command);
+    cmd_item_t *item = esp_console_calloc(1, sizeof(*item));
+    if (item == NULL) {
+        xSemaphoreGive(s_cmd_lock);
+        return ESP_ERR_NO_MEM;
     }
     item->command = cmd->command;
     item->help = cmd->help;
-    if (cmd->hint) {
-        /* Prepend a space before the hint. It separates command name and
-         * the hint. arg_print_syntax below adds this space as well.
-         */
-        int unused __attribute__((unused));
-        unused = asprintf(&item->hint, " %s", cmd->hint);
-    } else if (cmd->argtable) {
-        /* Generate hint based on cmd->argtable */
-        char *buf = NULL;
-        size_t buf_size = 0;
-        FILE *f = open_memstream(&buf, &buf_size);
-        if (f != NULL) {
-            arg_print_syntax(f, cmd->argtable, NULL);
-            fclose(f);
-        }
-        item->hint = buf;
+    item->help_formatted = cmd->help_formatted;
+    item->hint_src = cmd->hint;
+    item->flags = cmd->flags;
+    /* Build the option tables of the argtable once, rather than on each arg_parse call */
+    if (cmd->argtable && arg_compile(cmd->argtable) < 0) {
+        esp_console_free(item);
+        xSemaphoreGive(s_cmd_lock);
+        return ESP_ERR_NO_MEM;
     }
     item->argtable = cmd->argtable;
     item->func = cmd->func;
-    cmd_item_t *last = SLIST_FIRST(&s_cmd_list);
-    if (last == NULL) {
-        SLIST_INSERT_HEAD(&s_cmd_list, item, next);
+    if (old_item == NULL) {
+        esp_err_t err = ESP_OK;
+#if CONFIG_CONSOLE_CMD_STATS
+        item->stats = esp_console_calloc(1, sizeof(cmd_stats_t));
+        err = item->stats ? ESP_OK : ESP_ERR_NO_MEM;
+#endif
+        /* A new command becomes visible to lookups only once it is complete */
+        if (err != ESP_OK || cmd_index_insert(item) != ESP_OK) {
+            /* arg_uncompile must be serialized with the other calls for the argtable */
+            cmd_item_free(item);
+            xSemaphoreGive(s_cmd_lock);
+            return ESP_ERR_NO_MEM;
+        }
     } else {
-        cmd_item_t *it;
-        while ((it = SLIST_NEXT(last, next)) != NULL) {
-            last = it;
+        /* Commands being run keep updating the same statistics */
+#if CONFIG_CONSOLE_CMD_STATS
+        item->stats = old_item->stats;
+        old_item->stats = NULL;
+#endif
+        /* The same hint would be generated again, and whoever shows the old one may go on */
+        char *hint = atomic_load_explicit(&old_item->hint, memory_order_relaxed);
+        if (hint != NULL && item->hint_src == old_item->hint_src && item->argtable == old_item->argtable) {
+            atomic_store_explicit(&item->hint, hint, memory_order_relaxed);
+            atomic_store_explicit(&old_item->hint, NULL, memory_order_relaxed);
         }
-        SLIST_INSERT_AFTER(last, item, next);
+        /* Lookups find either the old item or the new one, never a mix of both */
+        cmd_index_replace(old_item, item);
+        TAILQ_REMOVE(&s_cmd_list, old_item, next);
+        help_cache_drop(old_item);
+        TAILQ_INSERT_TAIL(&s_cmd_retired, old_item, next);
+        atomic_store(&s_cmd_retired_pending, true);
+        cmd_retired_reclaim();
     }
+    TAILQ_INSERT_TAIL(&s_cmd_list, item, next);
+    xSemaphoreGive(s_cmd_lock);
     return ESP_OK;
 }
 
+/* Free an item which isn't visible to lookups */
+static void cmd_item_free(cmd_item_t *item)
+{
+    if (item->argtable) {
+        arg_uncompile(item->argtable);
+    }
+    cmd_free_hint(item);
+#if CONFIG_CONSOLE_CMD_STATS
+    esp_console_free(item->stats);
+#endif
+    esp_console_free(item);
+}
+
+/*
+ * A lookup takes place between cmd_reader_enter and cmd_reader_exit, and so
+ * do commands, which may parse their argtable with the compiled tables of
+ * the item. The items found are not freed before cmd_reader_exit.
+ */
+static void cmd_reader_enter(void)
+{
+    atomic_fetch_add(&s_cmd_readers, 1);
+    /* Pairs with the fence in cmd_retired_reclaim: either the reclaim sees
+     * this reader, or this reader sees the items which replaced the retired ones */
+    atomic_thread_fence(memory_order_seq_cst);
+}
+
+static void cmd_reader_exit(void)
+{
+    if (atomic_fetch_sub(&s_cmd_readers, 1) == 1 && atomic_load(&s_cmd_retired_pending) && s_cmd_lock != NULL) {
+        xSemaphoreTake(s_cmd_lock, portMAX_DELAY);
+        cmd_retired_reclaim();
+        xSemaphoreGive(s_cmd_lock);
+    }
+}
+
+/*
+ * Free the retired items, unless a reader may still use them. Generated
+ * hints are kept until esp_console_deinit, since callers of
+ * esp_console_get_hint use them after the lookup. Called with s_cmd_lock taken.
+ */
+static void cmd_retired_reclaim(void)
+{
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&s_cmd_readers, memory_order_relaxed) != 0) {
+        return;
+    }
+    atomic_store(&s_cmd_retired_pending, false);
+    cmd_item_t *it, *tmp;
+    TAILQ_FOREACH_SAFE(it, &s_cmd_retired, next, tmp) {
+        char *hint = atomic_load_explicit(&it->hint, memory_order_relaxed);
+        if (hint == NULL || hint == s_no_hint) {
+            TAILQ_REMOVE(&s_cmd_retired, it, next);
+            cmd_item_free(it);
+        }
+    }
+}
+
+static const esp_console_cmd_t *static_cmd_at(size_t pos)
+{
+    return s_static_sorted ? s_static_sorted[pos] : &STATIC_CMDS_START[pos];
+}
+
+static int static_cmd_compare(const void *a, const void *b)
+{
+    return strcmp((*(const esp_console_cmd_t *const *) a)->command, (*(const esp_console_cmd_t *const *) b)->command);
+}
+
+/* Find the commands defined with ESP_CONSOLE_CMD_REGISTER. Nothing is allocated
+ * if the linker sorted them, except their statistics. */
+static esp_err_t static_cmds_init(void)
+{
+    const esp_console_cmd_t *start = STATIC_CMDS_START;
+    s_static_count = (start != NULL) ? STATIC_CMDS_END - start : 0;
+    bool sorted = true;
+    for (size_t i = 1; i < s_static_count && sorted; i++) {
+        sorted = (strcmp(start[i - 1].command, start[i].command) < 0);
+    }
+    if (!sorted) {
+        s_static_sorted = esp_console_calloc(s_static_count, sizeof(esp_console_cmd_t *));
+        if (s_static_sorted == NULL) {
+            return ESP_ERR_NO_MEM;
+        }
+        for (size_t i = 0; i < s_static_count; i++) {
+            s_static_sorted[i] = &start[i];
+        }
+        qsort(s_static_sorted, s_static_count, sizeof(esp_console_cmd_t *), static_cmd_compare);
+    }
+    /* Build the option tables of the argtables which are already created, like
+     * esp_console_cmd_register does. The others are built on each arg_parse call. */
+    if (s_static_count > 0) {
+        s_static_compiled = esp_console_calloc((s_static_count + 7) / 8, 1);
+        if (s_static_compiled == NULL) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    for (size_t i = 0; i < s_static_count; i++) {
+        if (start[i].argtable == NULL || arg_nullcheck(start[i].argtable) != 0) {
+            continue;
+        }
+        const int res = arg_compile(start[i].argtable);
+        if (res < 0) {
+            return ESP_ERR_NO_MEM;
+        }
+        if (res == 0) {
+            s_static_compiled[i / 8] |= 1 << (i % 8);
+        }
+    }
+#if CONFIG_CONSOLE_CMD_STATS
+    if (s_static_count > 0) {
+        s_static_stats = esp_console_calloc(s_static_count, sizeof(cmd_stats_t));
+        if (s_static_stats == NULL) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+#endif
+    return ESP_OK;
+}
+
+static void static_cmds_free(void)
+{
+    if (s_static_compiled) {
+        const esp_console_cmd_t *start = STATIC_CMDS_START;
+        for (size_t i = 0; i < s_static_count; i++) {
+            if (s_static_compiled[i / 8] & (1 << (i % 8))) {
+                arg_uncompile(start[i].argtable);
+            }
+        }
+        esp_console_free(s_static_compiled);
+        s_static_compiled = NULL;
+    }
+    esp_console_free(s_static_sorted);
+    s_static_sorted = NULL;
+    s_static_count = 0;
+#if CONFIG_CONSOLE_CMD_STATS
+    esp_console_free(s_static_stats);
+    s_static_stats = NULL;
+#endif
+}
+
+/* Return the position of the first static command which is not less than
+ * the first 'len' characters of 'name'.
+ */
+static size_t static_cmd_lower_bound(const char *name, size_t len)
+{
+    size_t lo = 0;
+    size_t hi = s_static_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (strncmp(static_cmd_at(mid)->command, name, len) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/* Return the position of the static command, or SIZE_MAX if there is none.
+ * Static commands replaced by a registered command are still found. */
+static size_t find_static_command(const char *name)
+{
+    const size_t pos = static_cmd_lower_bound(name, SIZE_MAX);
+    if (pos < s_static_count && strcmp(static_cmd_at(pos)->command, name) == 0) {
+        return pos;
+    }
+    return SIZE_MAX;
+}
+
+/* Static commands whose name was registered at run time are hidden */
+static bool static_cmd_hidden(const esp_console_cmd_t *cmd)
+{
+    return find_command_by_name(cmd->command) != NULL;
+}
+
+/* Hint of a static command, which has the leading space already, see ESP_CONSOLE_CMD_REGISTER */
+static const char *static_cmd_hint(const esp_console_cmd_t *cmd)
+{
+    return (cmd->hint != NULL && cmd->hint[0] != '\0' && cmd->hint[1] != '\0') ? cmd->hint : NULL;
+}
+
+/* Return the position of the first command in s_cmd_sorted which is not
+ * less than the first 'len' characters of 'name'.
+ */
+static size_t cmd_sorted_lower_bound(const char *name, size_t len)
+{
+    size_t lo = 0;
+    size_t hi = s_cmd_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (strncmp(s_cmd_sorted[mid]->command, name, len) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
 void esp_console_get_completion(const char *buf, linenoiseCompletions *lc)
 {
     size_t len = strlen(buf);
     if (len == 0) {
         return;
     }
-    cmd_item_t *it;
-    SLIST_FOREACH(it, &s_cmd_list, next) {
-        /* Check if command starts with buf */
-        if (strncmp(buf, it->command, len) == 0) {
-            linenoiseAddCompletion(lc, it->command);
+    if (s_cmd_lock == NULL) {
+        return;
+    }
+    xSemaphoreTake(s_cmd_lock, portMAX_DELAY);
+    /* Commands starting with buf are contiguous in both sorted arrays, which
+     * are merged so that the completions stay sorted */
+    size_t i = cmd_sorted_lower_bound(buf, len);
+    size_t j = static_cmd_lower_bound(buf, len);
+    while (true) {
+        const char *command = (i < s_cmd_count) ? s_cmd_sorted[i]->command : NULL;
+        const char *static_command = (j < s_static_count) ? static_cmd_at(j)->command : NULL;
+        if (command != NULL && strncmp(buf, command, len) != 0) {
+            command = NULL;
+        }
+        if (static_command != NULL && strncmp(buf, static_command, len) != 0) {
+            static_command = NULL;
+        }
+        if (command == NULL && static_command == NULL) {
+            break;
+        }
+        int cmp = (command == NULL) ? 1 : (static_command == NULL) ? -1 : strcmp(command, static_command);
+        if (cmp <= 0) {
+            i++;
+        }
+        if (cmp >= 0) {
+            /* Skipped as well if a registered command has the same name */
+            j++;
+        }
+        /* Command names stay valid until esp_console_deinit, no need to copy them */
+        linenoiseAddCompletionRef(lc, (cmp <= 0) ? command : static_command);
+    }
+    xSemaphoreGive(s_cmd_lock);
+}
+
+/* Generate the hint of the command, from the hint given at registration or from its argtable */
+static char *cmd_make_hint(const cmd_item_t *item)
+{
+    char *buf = NULL;
+    if (item->hint_src) {
+        /* Prepend a space before the hint. It separates command name and
+         * the hint. arg_print_syntax below adds this space as well.
+         */
+        const size_t len = strlen(item->hint_src);
+        buf = esp_console_malloc(len + 2);
+        if (buf != NULL) {
+            buf[0] = ' ';
+            memcpy(buf + 1, item->hint_src, len + 1);
+        }
+    } else if (item->argtable) {
+        /* Generate hint based on item->argtable */
+        size_t buf_size = 0;
+        FILE *f = esp_console_open_memstream(&buf, &buf_size);
+        if (f != NULL) {
+            arg_print_syntax(f, item->argtable, NULL);
+            fclose(f);
+        }
+    }
+    return buf;
+}
+
+/* Return the hint of the command, generating it on the first call. Called with s_cmd_lock taken. */
+static const char *cmd_load_hint(cmd_item_t *item)
+{
+    char *hint = atomic_load_explicit(&item->hint, memory_order_relaxed);
+    if (hint == NULL) {
+        hint = cmd_make_hint(item);
+        if (hint == NULL) {
+            hint = s_no_hint;
         }
+        /* Pairs with the acquire load in cmd_get_hint */
+        atomic_store_explicit(&item->hint, hint, memory_order_release);
+    }
+    return (hint == s_no_hint) ? NULL : hint;
+}
+
+/* Return the hint of the command, taking s_cmd_lock only if it must be generated */
+static const char *cmd_get_hint(cmd_item_t *item)
+{
+    char *hint = atomic_load_explicit(&item->hint, memory_order_acquire);
+    if (hint != NULL) {
+        return (hint == s_no_hint) ? NULL : hint;
+    }
+    xSemaphoreTake(s_cmd_lock, portMAX_DELAY);
+    const char *ret = cmd_load_hint(item);
+    xSemaphoreGive(s_cmd_lock);
+    return ret;
+}
+
+/* Called with s_cmd_lock taken, or when the command isn't visible to lookups */
+static void cmd_free_hint(cmd_item_t *item)
+{
+    char *hint = atomic_exchange(&item->hint, NULL);
+    if (hint != s_no_hint) {
+        esp_console_free(hint);
     }
 }
 
 const char *esp_console_get_hint(const char *buf, int *color, int *bold)
 {
-    size_t len = strlen(buf);
-    cmd_item_t *it;
-    SLIST_FOREACH(it, &s_cmd_list, next) {
-        if (strlen(it->command) == len &&
-                strncmp(buf, it->command, len) == 0) {
-            *color = s_config.hint_color;
-            *bold = s_config.hint_bold;
-            return it->hint;
+    cmd_reader_enter();
+    cmd_item_t *it = (cmd_item_t *)find_command_by_name(buf);
+    const size_t pos = (it == NULL) ? find_static_command(buf) : SIZE_MAX;
+    const char *hint = NULL;
+    if (it != NULL || pos != SIZE_MAX) {
+        *color = s_config.hint_color;
+        *bold = s_config.hint_bold;
+        hint = it ? cmd_get_hint(it) : static_cmd_hint(static_cmd_at(pos));
+    }
+    cmd_reader_exit();
+    return hint;
+}
+
+/* FNV-1a, cheap enough to run on every dispatch and good enough for short names.
+ * Zero is reserved to mark items which are not in the index yet.
+ */
+static uint32_t cmd_name_hash(const char *name)
+{
+    uint32_t hash = 2166136261u;
+    while (*name) {
+        hash ^= (unsigned char) *name++;
+        hash *= 16777619u;
+    }
+    return hash ? hash : 1;
+}
+
+static void cmd_index_place(cmd_index_t *index, cmd_item_t *item)
+{
+    const size_t mask = index->size - 1;
+    size_t slot = item->hash & mask;
+    while (atomic_load_explicit(&index->slots[slot], memory_order_relaxed) != NULL) {
+        slot = (slot + 1) & mask;
+    }
+    /* Pairs with the acquire load in find_command_by_name */
+    atomic_store_explicit(&index->slots[slot], item, memory_order_release);
+}
+
+/* Called with s_cmd_lock taken */
+static esp_err_t cmd_index_insert(cmd_item_t *item)
+{
+    cmd_index_t *index = atomic_load_explicit(&s_cmd_index, memory_order_relaxed);
+    const size_t index_size = index ? index->size : 0;
+    /* Make room in both structures first, so that a failed allocation leaves them consistent */
+    if (s_cmd_count == s_cmd_sorted_size) {
+        size_t new_size = s_cmd_sorted_size ? s_cmd_sorted_size * 2 : CMD_INDEX_MIN_SIZE;
+        cmd_item_t **new_sorted = esp_console_realloc(s_cmd_sorted, new_size * sizeof(cmd_item_t *));
+        if (new_sorted == NULL) {
+            return ESP_ERR_NO_MEM;
         }
+        s_cmd_sorted = new_sorted;
+        s_cmd_sorted_size = new_size;
+    }
+    /* Keep the load factor at or below 3/4, so that probe sequences stay short */
+    if ((s_cmd_count + 1) * 4 > index_size * 3) {
+        size_t new_size = index_size ? index_size * 2 : CMD_INDEX_MIN_SIZE;
+        cmd_index_t *new_index = esp_console_calloc(1, sizeof(cmd_index_t) + new_size * sizeof(cmd_item_t *));
+        if (new_index == NULL) {
+            return ESP_ERR_NO_MEM;
+        }
+        new_index->size = new_size;
+        new_index->retired = index;
+        for (size_t i = 0; i < index_size; i++) {
+            cmd_item_t *it = atomic_load_explicit(&index->slots[i], memory_order_relaxed);
+            if (it != NULL) {
+                cmd_index_place(new_index, it);
+            }
+        }
+        atomic_store_explicit(&s_cmd_index, new_index, memory_order_release);
+        index = new_index;
+    }
+    item->hash = cmd_name_hash(item->command);
+    cmd_index_place(index, item);
+    size_t pos = cmd_sorted_lower_bound(item->command, SIZE_MAX);
+    memmove(&s_cmd_sorted[pos + 1], &s_cmd_sorted[pos], (s_cmd_count - pos) * sizeof(cmd_item_t *));
+    s_cmd_sorted[pos] = item;
+    s_cmd_count++;
+    return ESP_OK;
+}
+
+/* Put item in the place of old_item, which has the same name. Called with s_cmd_lock taken */
+static void cmd_index_replace(cmd_item_t *old_item, cmd_item_t *item)
+{
+    cmd_index_t *index = atomic_load_explicit(&s_cmd_index, memory_order_relaxed);
+    const size_t mask = index->size - 1;
+    size_t slot = old_item->hash & mask;
+    while (atomic_load_explicit(&index->slots[slot], memory_order_relaxed) != old_item) {
+        slot = (slot + 1) & mask;
+    }
+    item->hash = old_item->hash;
+    /* Pairs with the acquire load in find_command_by_name */
+    atomic_store_explicit(&index->slots[slot], item, memory_order_release);
+    s_cmd_sorted[cmd_sorted_lower_bound(item->command, SIZE_MAX)] = item;
+}
+
+static void cmd_index_free(void)
+{
+    cmd_index_t *index = atomic_exchange(&s_cmd_index, NULL);
+    while (index != NULL) {
+        cmd_index_t *retired = index->retired;
+        esp_console_free(index);
+        index = retired;
     }
-    return NULL;
 }
 
 static const cmd_item_t *find_command_by_name(const char *name)
 {
-    const cmd_item_t *cmd = NULL;
-    cmd_item_t *it;
-    size_t len = strlen(name);
-    SLIST_FOREACH(it, &s_cmd_list, next) {
-        if (strlen(it->command) == len &&
-                strcmp(name, it->command) == 0) {
-            cmd = it;
-            break;
+    const cmd_index_t *index = atomic_load_explicit(&s_cmd_index, memory_order_acquire);
+    if (index == NULL) {
+        return NULL;
+    }
+    const uint32_t hash = cmd_name_hash(name);
+    const size_t mask = index->size - 1;
+    size_t slot = hash & mask;
+    const cmd_item_t *it;
+    while ((it = atomic_load_explicit(&index->slots[slot], memory_order_acquire)) != NULL) {
+        if (it->hash == hash && strcmp(name, it->command) == 0) {
+            return it;
         }
+        slot = (slot + 1) & mask;
     }
-    return cmd;
+    return NULL;
 }
 
 esp_err_t esp_console_run(const char *cmdline, int *cmd_ret)
@@ -193,51 +821,503 @@ esp_err_t esp_console_run(const char *cmdline, int *cmd_ret)
     if (s_tmp_line_buf == NULL) {
         return ESP_ERR_INVALID_STATE;
     }
-    char **argv = (char **) heap_caps_calloc(s_config.max_cmdline_args, sizeof(char *), s_config.heap_alloc_caps);
-    if (argv == NULL) {
-        return ESP_ERR_NO_MEM;
+    return esp_console_run_ex(cmdline, s_tmp_line_buf, s_config.max_cmdline_length,
+                              s_tmp_argv, s_config.max_cmdline_args, cmd_ret);
+}
+
+esp_err_t esp_console_find_command(const char *name, esp_console_parsed_cmd_t *parsed)
+{
+    cmd_reader_enter();
+    const cmd_item_t *cmd = find_command_by_name(name);
+    if (cmd != NULL) {
+        parsed->command = cmd->command;
+        parsed->func = cmd->func;
+        parsed->flags = cmd->flags;
+#if CONFIG_CONSOLE_CMD_STATS
+        parsed->stats = cmd->stats;
+#endif
+    }
+    /* The fields copied stay valid once the item is replaced */
+    cmd_reader_exit();
+    if (cmd == NULL) {
+        const size_t pos = find_static_command(name);
+        if (pos == SIZE_MAX) {
+            return ESP_ERR_NOT_FOUND;
+        }
+        const esp_console_cmd_t *static_cmd = static_cmd_at(pos);
+        parsed->command = static_cmd->command;
+        parsed->func = static_cmd->func;
+        parsed->flags = static_cmd->flags;
+#if CONFIG_CONSOLE_CMD_STATS
+        parsed->stats = &s_static_stats[pos];
+#endif
+    }
+#if CONFIG_CONSOLE_CMD_STATS
+    parsed->split_us = 0;
+#endif
+    return ESP_OK;
+}
+
+static esp_err_t esp_console_parse(const char *cmdline, char *buf, size_t buf_size,
+                                   char **argv, size_t argv_size, esp_console_parsed_cmd_t *parsed)
+{
+    if (cmdline == NULL || buf == NULL || buf_size == 0 || argv == NULL || argv_size < 2) {
+        return ESP_ERR_INVALID_ARG;
+    }
+#if CONFIG_CONSOLE_CMD_STATS
+    const int64_t start_us = esp_timer_get_time();
+#endif
+    /* Don't run what is left of a line, or of its arguments, which doesn't fit */
+    if (cmdline != buf && strlcpy(buf, cmdline, buf_size) >= buf_size) {
+        return ESP_ERR_INVALID_SIZE;
     }
-    strlcpy(s_tmp_line_buf, cmdline, s_config.max_cmdline_length);
 
-    size_t argc = esp_console_split_argv(s_tmp_line_buf, argv,
-                                         s_config.max_cmdline_args);
+    size_t argc = 0;
+    esp_err_t err = esp_console_split_command(buf, argv, argv_size, &argc);
+    if (err != ESP_OK) {
+        return err;
+    }
     if (argc == 0) {
-        free(argv);
         return ESP_ERR_INVALID_ARG;
     }
-    const cmd_item_t *cmd = find_command_by_name(argv[0]);
-    if (cmd == NULL) {
-        free(argv);
+    parsed->argc = argc;
+    parsed->argv = argv;
+    for (size_t i = 0; i < argc; i++) {
+        if (esp_console_is_operator(argv[i])) {
+            return ESP_ERR_NOT_SUPPORTED;
+        }
+    }
+    err = esp_console_find_command(argv[0], parsed);
+#if CONFIG_CONSOLE_CMD_STATS
+    parsed->split_us = esp_timer_get_time() - start_us;
+#endif
+    return err;
+}
+
+esp_err_t esp_console_run_ex(const char *cmdline, char *buf, size_t buf_size,
+                             char **argv, size_t argv_size, int *cmd_ret)
+{
+    esp_console_parsed_cmd_t parsed;
+    esp_err_t err = esp_console_parse(cmdline, buf, buf_size, argv, argv_size, &parsed);
+    if (err == ESP_ERR_NOT_SUPPORTED) {
+        /* The only path which allocates, see esp_console_run_ex */
+        return esp_console_run_redirected(&s_config, parsed.argv, parsed.argc, cmd_ret);
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+    *cmd_ret = esp_console_call(&parsed);
+    return ESP_OK;
+}
+
+esp_err_t esp_console_context_create(const esp_console_context_config_t *config, esp_console_context_t **ret_ctx)
+{
+    if (config == NULL || ret_ctx == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    *ret_ctx = NULL;
+    if (s_tmp_line_buf == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    size_t max_cmdline_length = config->max_cmdline_length ? config->max_cmdline_length : s_config.max_cmdline_length;
+    size_t max_cmdline_args = config->max_cmdline_args ? config->max_cmdline_args : s_config.max_cmdline_args;
+    if (max_cmdline_length == 0 || max_cmdline_args < 2) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    esp_console_context_t *ctx = esp_console_calloc(1, sizeof(*ctx) + max_cmdline_args * sizeof(char *) +
+                                                    max_cmdline_length);
+    if (ctx == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    ctx->max_cmdline_length = max_cmdline_length;
+    ctx->max_cmdline_args = max_cmdline_args;
+    ctx->argv = (char **)(ctx + 1);
+    ctx->line_buf = (char *)(ctx->argv + max_cmdline_args);
+    *ret_ctx = ctx;
+    return ESP_OK;
+}
+
+esp_err_t esp_console_context_delete(esp_console_context_t *ctx)
+{
+    if (ctx == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    esp_console_free(ctx);
+    return ESP_OK;
+}
+
+esp_err_t esp_console_context_parse(esp_console_context_t *ctx, const char *cmdline, esp_console_parsed_cmd_t *parsed)
+{
+    if (ctx == NULL || parsed == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (s_tmp_line_buf == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    return esp_console_parse(cmdline, ctx->line_buf, ctx->max_cmdline_length,
+                             ctx->argv, ctx->max_cmdline_args, parsed);
+}
+
+esp_err_t esp_console_run_ctx(esp_console_context_t *ctx, const char *cmdline, int *cmd_ret)
+{
+    esp_console_parsed_cmd_t parsed;
+    esp_err_t err = esp_console_context_parse(ctx, cmdline, &parsed);
+    if (err == ESP_ERR_NOT_SUPPORTED) {
+        /* The only path which allocates, see esp_console_run_ex */
+        return esp_console_run_redirected(&s_config, parsed.argv, parsed.argc, cmd_ret);
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+    *cmd_ret = esp_console_call(&parsed);
+    return ESP_OK;
+}
+
+#if CONFIG_CONSOLE_CMD_STATS
+static void stats_arg_parse_hook(void **argtable, int done)
+{
+    call_timing_t *timing = s_call_timing;
+    if (timing == NULL) {
+        return;
+    }
+    const int64_t now_us = esp_timer_get_time();
+    if (!done) {
+        timing->arg_parse_start_us = now_us;
+    } else {
+        timing->arg_parse_us += now_us - timing->arg_parse_start_us;
+    }
+}
+
+static size_t stats_bucket(uint32_t time_us)
+{
+    return time_us ? MIN(32 - __builtin_clz(time_us), CMD_STATS_BUCKETS - 1) : 0;
+}
+
+int esp_console_call(const esp_console_parsed_cmd_t *parsed)
+{
+    /* Commands may run other commands, which are timed on their own */
+    call_timing_t timing = { 0 };
+    call_timing_t *outer = s_call_timing;
+    s_call_timing = &timing;
+    const size_t heap_before = heap_caps_get_free_size(MALLOC_CAP_DEFAULT);
+    const size_t heap_min_before = heap_caps_get_minimum_free_size(MALLOC_CAP_DEFAULT);
+    const int64_t start_us = esp_timer_get_time();
+
+    cmd_reader_enter();
+    const int ret = (*parsed->func)(parsed->argc, parsed->argv);
+    cmd_reader_exit();
+
+    const uint32_t time_us = esp_timer_get_time() - start_us;
+    const int32_t heap_used = heap_before - heap_caps_get_free_size(MALLOC_CAP_DEFAULT);
+    /* The peak is only known if the command made the free heap reach a new low */
+    const size_t heap_min_after = heap_caps_get_minimum_free_size(MALLOC_CAP_DEFAULT);
+    const uint32_t heap_peak = (heap_min_after < heap_min_before) ? heap_before - heap_min_after : 0;
+    const uint32_t stack_free = uxTaskGetStackHighWaterMark(NULL);
+    s_call_timing = outer;
+
+    cmd_stats_t *stats = parsed->stats;
+    xSemaphoreTake(s_stats_lock, portMAX_DELAY);
+    if (stats->calls == 0 || time_us < stats->time_min_us) {
+        stats->time_min_us = time_us;
+    }
+    if (stats->calls == 0 || stack_free < stats->stack_free_min) {
+        stats->stack_free_min = stack_free;
+    }
+    stats->calls++;
+    stats->time_max_us = MAX(stats->time_max_us, time_us);
+    stats->time_total_us += time_us;
+    stats->split_total_us += parsed->split_us;
+    stats->arg_parse_total_us += timing.arg_parse_us;
+    stats->heap_total += heap_used;
+    stats->heap_max = MAX(stats->heap_max, heap_used);
+    stats->heap_peak_max = MAX(stats->heap_peak_max, heap_peak);
+    stats->histogram[stats_bucket(time_us)]++;
+    xSemaphoreGive(s_stats_lock);
+    return ret;
+}
+
+/* Upper bound of the time under which 99% of the calls ran */
+static uint32_t stats_p99(const cmd_stats_t *stats)
+{
+    uint64_t slower = 0;
+    size_t bucket = CMD_STATS_BUCKETS;
+    while (bucket > 0 && (slower + stats->histogram[bucket - 1]) * 100 <= stats->calls) {
+        slower += stats->histogram[--bucket];
+    }
+    if (bucket == 0) {
+        return 0;
+    }
+    /* The calls in bucket n took less than 2^n us */
+    const uint32_t bucket_max = (1ULL << (bucket - 1)) - 1;
+    return MIN(bucket_max, stats->time_max_us);
+}
+
+static void stats_summarize(const cmd_stats_t *stats, esp_console_cmd_stats_t *ret_stats)
+{
+    const uint32_t calls = MAX(stats->calls, 1);
+    *ret_stats = (esp_console_cmd_stats_t) {
+        .calls = stats->calls,
+        .time_min_us = stats->time_min_us,
+        .time_avg_us = stats->time_total_us / calls,
+        .time_max_us = stats->time_max_us,
+        .time_p99_us = stats_p99(stats),
+        .split_avg_us = stats->split_total_us / calls,
+        .arg_parse_avg_us = stats->arg_parse_total_us / calls,
+        .heap_avg = stats->heap_total / calls,
+        .heap_max = stats->heap_max,
+        .heap_peak_max = stats->heap_peak_max,
+        .stack_free_min = stats->stack_free_min,
+    };
+}
+
+esp_err_t esp_console_get_cmd_stats(const char *command, esp_console_cmd_stats_t *ret_stats)
+{
+    if (command == NULL || ret_stats == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (s_stats_lock == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    cmd_reader_enter();
+    const cmd_item_t *it = find_command_by_name(command);
+    const size_t pos = (it == NULL) ? find_static_command(command) : SIZE_MAX;
+    if (it == NULL && pos == SIZE_MAX) {
+        cmd_reader_exit();
         return ESP_ERR_NOT_FOUND;
     }
-    *cmd_ret = (*cmd->func)(argc, argv);
-    free(argv);
+    xSemaphoreTake(s_stats_lock, portMAX_DELAY);
+    cmd_stats_t stats = it ? *it->stats : s_static_stats[pos];
+    xSemaphoreGive(s_stats_lock);
+    cmd_reader_exit();
+    stats_summarize(&stats, ret_stats);
+    return ESP_OK;
+}
+
+esp_err_t esp_console_reset_cmd_stats(void)
+{
+    if (s_stats_lock == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    cmd_item_t *it;
+    xSemaphoreTake(s_cmd_lock, portMAX_DELAY);
+    xSemaphoreTake(s_stats_lock, portMAX_DELAY);
+    TAILQ_FOREACH(it, &s_cmd_list, next) {
+        memset(it->stats, 0, sizeof(*it->stats));
+    }
+    if (s_static_stats) {
+        memset(s_static_stats, 0, s_static_count * sizeof(cmd_stats_t));
+    }
+    xSemaphoreGive(s_stats_lock);
+    xSemaphoreGive(s_cmd_lock);
     return ESP_OK;
 }
 
+static struct {
+    struct arg_lit *reset;
+    struct arg_str *command;
+    struct arg_end *end;
+} stats_args;
+
+static void print_cmd_stats(const char *command, const esp_console_cmd_stats_t *stats)
+{
+    printf("%-16s %8"PRIu32" %8"PRIu32" %8"PRIu32" %8"PRIu32" %8"PRIu32" %8"PRIu32" %8"PRIi32" %8"PRIu32" %8u\n",
+           command, stats->calls, stats->time_avg_us, stats->time_p99_us, stats->time_max_us,
+           stats->split_avg_us, stats->arg_parse_avg_us, stats->heap_avg, stats->heap_peak_max,
+           (unsigned) stats->stack_free_min);
+}
+
+static int stats_command(int argc, char **argv)
+{
+    int nerrors = arg_parse(argc, argv, (void **) &stats_args);
+    if (nerrors != 0) {
+        arg_print_errors(stderr, stats_args.end, argv[0]);
+        return 1;
+    }
+    esp_console_cmd_stats_t stats;
+    if (stats_args.command->count > 0) {
+        const char *command = stats_args.command->sval[0];
+        if (esp_console_get_cmd_stats(command, &stats) != ESP_OK) {
+            printf("%s: Unrecognized command '%s'\n", argv[0], command);
+            return 1;
+        }
+    }
+    printf("%-16s %8s %8s %8s %8s %8s %8s %8s %8s %8s\n", "command", "calls", "avg us", "p99 us", "max us",
+           "split us", "parse us", "heap B", "peak B", "stack B");
+    if (stats_args.command->count > 0) {
+        print_cmd_stats(stats_args.command->sval[0], &stats);
+    } else {
+        /* Only the commands which were run */
+        cmd_item_t *it;
+        xSemaphoreTake(s_cmd_lock, portMAX_DELAY);
+        TAILQ_FOREACH(it, &s_cmd_list, next) {
+            xSemaphoreTake(s_stats_lock, portMAX_DELAY);
+            cmd_stats_t cmd_stats = *it->stats;
+            xSemaphoreGive(s_stats_lock);
+            if (cmd_stats.calls > 0) {
+                stats_summarize(&cmd_stats, &stats);
+                print_cmd_stats(it->command, &stats);
+            }
+        }
+        for (size_t i = 0; i < s_static_count; i++) {
+            const esp_console_cmd_t *static_cmd = static_cmd_at(i);
+            xSemaphoreTake(s_stats_lock, portMAX_DELAY);
+            cmd_stats_t cmd_stats = s_static_stats[i];
+            xSemaphoreGive(s_stats_lock);
+            if (cmd_stats.calls > 0 && !static_cmd_hidden(static_cmd)) {
+                stats_summarize(&cmd_stats, &stats);
+                print_cmd_stats(static_cmd->command, &stats);
+            }
+        }
+        xSemaphoreGive(s_cmd_lock);
+    }
+    if (stats_args.reset->count > 0) {
+        esp_console_reset_cmd_stats();
+    }
+    return 0;
+}
+
+/* Free the argtable of the stats command, allocated like the rest of the console memory */
+static void stats_args_free(void)
+{
+    if (stats_args.end) {
+        arg_freetable((void **) &stats_args, sizeof(stats_args) / sizeof(stats_args.end));
+        memset(&stats_args, 0, sizeof(stats_args));
+    }
+}
+
+esp_err_t esp_console_register_stats_command(void)
+{
+    /* Registering the stats command again keeps its argtable */
+    if (stats_args.end == NULL) {
+        stats_args.reset = arg_lit0("r", "reset", "Reset the statistics once printed");
+        stats_args.command = arg_str0(NULL, NULL, "<command>", "Name of command");
+        stats_args.end = arg_end(2);
+    }
+
+    esp_console_cmd_t command = {
+        .command = "console_stats",
+        .help = "Print how many times each command was run, how long it took, and the heap "
+                "and stack it used. Times are averages, except p99 and max. Split is the time "
+                "spent splitting the command line, parse the time spent in arg_parse.",
+        .func = &stats_command,
+        .argtable = &stats_args
+    };
+    return esp_console_cmd_register(&command);
+}
+#else
+int esp_console_call(const esp_console_parsed_cmd_t *parsed)
+{
+    cmd_reader_enter();
+    const int ret = (*parsed->func)(parsed->argc, parsed->argv);
+    cmd_reader_exit();
+    return ret;
+}
+
+esp_err_t esp_console_get_cmd_stats(const char *command, esp_console_cmd_stats_t *ret_stats)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+esp_err_t esp_console_reset_cmd_stats(void)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+esp_err_t esp_console_register_stats_command(void)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+#endif // CONFIG_CONSOLE_CMD_STATS
+
 static struct {
     struct arg_str *help_cmd;
     struct arg_end *end;
 } help_args;
 
-static void print_arg_help(cmd_item_t *it)
+static void format_arg_help(FILE *f, const char *command, const char *hint, const char *help, void *argtable)
 {
      /* First line: command name and hint
       * Pad all the hints to the same column
       */
-     const char *hint = (it->hint) ? it->hint : "";
-     printf("%-s %s\n", it->command, hint);
+     fprintf(f, "%-s %s\n", command, hint ? hint : "");
      /* Second line: print help.
       * Argtable has a nice helper function for this which does line
       * wrapping.
       */
-     printf("  "); // arg_print_formatted does not indent the first line
-     arg_print_formatted(stdout, 2, 78, it->help);
+     fprintf(f, "  "); // arg_print_formatted does not indent the first line
+     arg_print_formatted(f, 2, 78, help);
      /* Finally, print the list of arguments */
-     if (it->argtable) {
-         arg_print_glossary(stdout, (void **) it->argtable, "  %12s  %s\n");
+     if (argtable) {
+         arg_print_glossary(f, (void **) argtable, "  %12s  %s\n");
      }
-     printf("\n");
+     fprintf(f, "\n");
+}
+
+/* Forget the formatted help of the command. Called with s_cmd_lock taken. */
+static void help_cache_drop(cmd_item_t *item)
+{
+    if (item->help_cache == NULL) {
+        return;
+    }
+    TAILQ_REMOVE(&s_help_lru, item, help_lru);
+    s_help_cache_used -= item->help_cache_len;
+    esp_console_free(item->help_cache);
+    item->help_cache = NULL;
+    item->help_cache_len = 0;
+}
+
+/* Print the help of the command, formatting it only if it isn't cached.
+ * Called with s_cmd_lock taken. */
+static void print_arg_help(cmd_item_t *it)
+{
+    if (it->help_formatted) {
+        fputs(it->help_formatted, stdout);
+        return;
+    }
+    if (it->help_cache) {
+        /* Most recently printed last, it is evicted last */
+        TAILQ_REMOVE(&s_help_lru, it, help_lru);
+        TAILQ_INSERT_TAIL(&s_help_lru, it, help_lru);
+        fwrite(it->help_cache, 1, it->help_cache_len, stdout);
+        return;
+    }
+    char *buf = NULL;
+    size_t len = 0;
+    FILE *f = esp_console_open_memstream(&buf, &len);
+    const char *hint = cmd_load_hint(it);
+    if (f == NULL) {
+        format_arg_help(stdout, it->command, hint, it->help, it->argtable);
+        return;
+    }
+    format_arg_help(f, it->command, hint, it->help, it->argtable);
+    fclose(f);
+    fwrite(buf, 1, len, stdout);
+    if (buf == NULL || len > s_config.help_cache_size) {
+        esp_console_free(buf);
+        return;
+    }
+    while (s_help_cache_used + len > s_config.help_cache_size) {
+        help_cache_drop(TAILQ_FIRST(&s_help_lru));
+    }
+    it->help_cache = buf;
+    it->help_cache_len = len;
+    s_help_cache_used += len;
+    TAILQ_INSERT_TAIL(&s_help_lru, it, help_lru);
+}
+
+/* Print the help of a static command, which is never cached */
+static void print_static_help(const esp_console_cmd_t *cmd)
+{
+    if (cmd->help_formatted) {
+        fputs(cmd->help_formatted, stdout);
+        return;
+    }
+    format_arg_help(stdout, cmd->command, static_cmd_hint(cmd), cmd->help, cmd->argtable);
+}
+
+static bool has_help(const char *help, const char *help_formatted)
+{
+    return help != NULL || help_formatted != NULL;
 }
 
 static int help_command(int argc, char **argv)
@@ -254,26 +1334,39 @@ static int help_command(int argc, char **argv)
 
     if (help_args.help_cmd->count == 0) {
         /* Print summary of each command */
-        SLIST_FOREACH(it, &s_cmd_list, next) {
-            if (it->help == NULL) {
+        xSemaphoreTake(s_cmd_lock, portMAX_DELAY);
+        TAILQ_FOREACH(it, &s_cmd_list, next) {
+            if (!has_help(it->help, it->help_formatted)) {
                 continue;
             }
             print_arg_help(it);
         }
+        /* Then the static commands, by name */
+        for (size_t i = 0; i < s_static_count; i++) {
+            const esp_console_cmd_t *cmd = static_cmd_at(i);
+            if (has_help(cmd->help, cmd->help_formatted) && !static_cmd_hidden(cmd)) {
+                print_static_help(cmd);
+            }
+        }
+        xSemaphoreGive(s_cmd_lock);
         ret_value = 0;
     } else {
         /* Print summary of given command */
         bool found_command = false;
-        SLIST_FOREACH(it, &s_cmd_list, next) {
-            if (it->help == NULL) {
-                continue;
-            }
-            if (strcmp(help_args.help_cmd->sval[0], it->command) == 0) {
-                print_arg_help(it);
-                found_command = true;
-                ret_value = 0;
-                break;
-            }
+        xSemaphoreTake(s_cmd_lock, portMAX_DELAY);
+        const char *name = help_args.help_cmd->sval[0];
+        it = (cmd_item_t *)find_command_by_name(name);
+        const size_t pos = (it == NULL) ? find_static_command(name) : SIZE_MAX;
+        if (it != NULL && has_help(it->help, it->help_formatted)) {
+            print_arg_help(it);
+            found_command = true;
+        } else if (pos != SIZE_MAX && has_help(static_cmd_at(pos)->help, static_cmd_at(pos)->help_formatted)) {
+            print_static_help(static_cmd_at(pos));
+            found_command = true;
+        }
+        xSemaphoreGive(s_cmd_lock);
+        if (found_command) {
+            ret_value = 0;
         }
 
         /* If given command has not been found, print error message*/
@@ -286,10 +1379,22 @@ static int help_command(int argc, char **argv)
     return ret_value;
 }
 
+/* Free the argtable of the help command, allocated like the rest of the console memory */
+static void help_args_free(void)
+{
+    if (help_args.end) {
+        arg_freetable((void **) &help_args, sizeof(help_args) / sizeof(help_args.end));
+        memset(&help_args, 0, sizeof(help_args));
+    }
+}
+
 esp_err_t esp_console_register_help_command(void)
 {
-    help_args.help_cmd = arg_str0(NULL, NULL, "<string>", "Name of command");
-    help_args.end = arg_end(1);
+    /* Registering the help command again keeps its argtable */
+    if (help_args.end == NULL) {
+        help_args.help_cmd = arg_str0(NULL, NULL, "<string>", "Name of command");
+        help_args.end = arg_end(1);
+    }
 
     esp_console_cmd_t command = {
         .command = "help",
@@ -0,0 +1,232 @@
+/*
+ * SPDX-FileCopyrightText: 2016-2021 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "sdkconfig.h"
+#include "esp_err.h"
+#include "esp_console.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Buffers of one caller of esp_console_run_ctx, allocated in one chunk
+ */
+struct esp_console_context_s {
+    size_t max_cmdline_length;
+    size_t max_cmdline_args;
+    char **argv;
+    char *line_buf;
+};
+
+/**
+ * @brief Command line split into arguments, with the command it selects
+ */
+typedef struct {
+    const char *command;            //!< registered command name, valid until esp_console_deinit
+    esp_console_cmd_func_t func;    //!< command handler
+    uint32_t flags;                 //!< ESP_CONSOLE_CMD_FLAG_xxx flags of the command
+    size_t argc;                    //!< number of arguments
+    char **argv;                    //!< arguments, pointing into the buffers of the context
+#if CONFIG_CONSOLE_CMD_STATS
+    struct cmd_stats_ *stats;       //!< statistics of the command
+    uint32_t split_us;              //!< time spent splitting the command line and looking up the command
+#endif
+} esp_console_parsed_cmd_t;
+
+/**
+ * @brief Split command line in the buffers of the context and look up the command
+ *
+ * The arguments stay valid until the context is used again.
+ *
+ * @param ctx context returned by esp_console_context_create
+ * @param cmdline command line (command name followed by a number of arguments)
+ * @param[out] parsed the parsed command
+ * @return
+ *      - ESP_OK, if the command was found
+ *      - ESP_ERR_INVALID_ARG, if the command line is empty, or only contained whitespace
+ *      - ESP_ERR_NOT_FOUND, if command with given name wasn't registered
+ *      - ESP_ERR_NOT_SUPPORTED, if the line has redirections, which only
+ *        esp_console_run_redirected runs. The argc and argv fields are set.
+ *      - ESP_ERR_INVALID_STATE, if esp_console_init wasn't called
+ */
+esp_err_t esp_console_context_parse(esp_console_context_t *ctx, const char *cmdline, esp_console_parsed_cmd_t *parsed);
+
+/**
+ * @brief Redirection operators, see esp_console_split_command
+ */
+extern const char esp_console_op_pipe[];
+extern const char esp_console_op_in[];
+extern const char esp_console_op_out[];
+extern const char esp_console_op_append[];
+
+static inline bool esp_console_is_operator(const char *arg)
+{
+    return arg == esp_console_op_pipe || arg == esp_console_op_in ||
+           arg == esp_console_op_out || arg == esp_console_op_append;
+}
+
+/**
+ * @brief Split command line into arguments in place, like esp_console_split_argv, but
+ *        keeping redirection operators apart
+ *
+ * Arguments which are a redirection operator, and are neither quoted nor
+ * escaped, are returned as a pointer to the esp_console_op_xxx constant, so
+ * they are told apart from arguments with the same text by comparing pointers.
+ *
+ * @param line pointer to buffer to parse; it is modified in place
+ * @param argv array where the pointers to arguments are written
+ * @param argv_size number of elements in argv_array (max. number of arguments)
+ * @param[out] ret_argc number of arguments written to argv
+ * @return
+ *      - ESP_OK, if all the arguments were written to argv
+ *      - ESP_ERR_INVALID_SIZE, if the line has more than argv_size - 1 arguments;
+ *        only the first ones are written to argv
+ */
+esp_err_t esp_console_split_command(char *line, char **argv, size_t argv_size, size_t *ret_argc);
+
+/**
+ * @brief Look up the command with the given name
+ *
+ * @param name command name
+ * @param[out] parsed command, func, flags (and stats) fields are set
+ * @return
+ *      - ESP_OK, if the command was found
+ *      - ESP_ERR_NOT_FOUND, if command with given name wasn't registered
+ */
+esp_err_t esp_console_find_command(const char *name, esp_console_parsed_cmd_t *parsed);
+
+/**
+ * @brief Run the commands of a line which has redirections
+ *
+ * @param config configuration of the console, for the pipe buffer and task sizes
+ * @param argv arguments returned by esp_console_split_command, which are modified
+ * @param argc number of arguments
+ * @param[out] cmd_ret return code of the last command (set if it was run)
+ * @return see esp_console_run
+ */
+esp_err_t esp_console_run_redirected(const esp_console_config_t *config, char **argv, size_t argc, int *cmd_ret);
+
+/**
+ * @brief Select where the memory of the console comes from, see esp_console_config_t
+ *
+ * Also makes linenoise and argtable allocate their memory with esp_console_malloc.
+ *
+ * @param config configuration given to esp_console_init, heap_alloc_caps is set
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if both pool_size and allocator are set, or the allocator lacks a function
+ *      - ESP_ERR_NO_MEM if the pool couldn't be allocated
+ *      - ESP_ERR_NOT_SUPPORTED if pool_size is set on the Linux target
+ */
+esp_err_t esp_console_alloc_init(const esp_console_config_t *config);
+
+/**
+ * @brief Stop allocating from the pool, which is freed once its last block is
+ */
+void esp_console_alloc_deinit(void);
+
+/**
+ * @brief Allocate memory of the console, from the pool, the allocator or heap_alloc_caps
+ */
+void *esp_console_malloc(size_t size);
+
+/**
+ * @brief Same as esp_console_malloc, and zero the memory
+ */
+void *esp_console_calloc(size_t count, size_t size);
+
+/**
+ * @brief Resize memory of the console, the block stays where it was allocated
+ */
+void *esp_console_realloc(void *ptr, size_t size);
+
+/**
+ * @brief Free memory of the console, wherever it was allocated
+ */
+void esp_console_free(void *ptr);
+
+/**
+ * @brief Same as open_memstream, with the buffer allocated by esp_console_malloc
+ *
+ * The stream is unbuffered, each write is appended to the buffer. The buffer
+ * is NULL if nothing was written, and it is freed with esp_console_free.
+ */
+FILE *esp_console_open_memstream(char **buf, size_t *len);
+
+/**
+ * @brief Write the lines added to the history since it was saved to its file
+ *
+ * The lines are appended to the file while it has less than twice max_len
+ * lines, then the file is compacted: it is rewritten with the lines of the
+ * history, so that it doesn't grow forever and stays quick to load.
+ *
+ * @param path file the history is saved to
+ * @param max_len number of entries kept in the history
+ * @param append append the lines instead of rewriting the file each time
+ * @param unsaved number of lines added to the history since it was saved
+ * @param[inout] file_lines upper bound of the number of lines in the file, updated
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_FAIL if the file couldn't be written
+ */
+esp_err_t esp_console_history_write(const char *path, uint32_t max_len, bool append,
+                                    uint32_t unsaved, uint32_t *file_lines);
+
+/**
+ * @brief Telnet commands being received from the client of a network session, zero initialized
+ */
+typedef struct {
+    uint8_t state;                  //!< where the input is in a telnet command
+    uint8_t cmd;                    //!< command whose option is expected
+    uint8_t sub[5];                 //!< subnegotiation being received: the option, then its data
+    size_t sub_len;                 //!< bytes of the subnegotiation, including the ones not kept
+    size_t cols;                    //!< width of the terminal last sent by the client, 0 if none
+    void (*reply)(void *arg, const uint8_t *data, size_t len); //!< sends the answers to the requests of the client, may be NULL
+    void *reply_arg;                //!< argument of reply
+} esp_console_telnet_t;
+
+/**
+ * @brief Options the REPL requests from a telnet client: it echoes and edits the line,
+ *        the client sends each key and its window size
+ */
+#define ESP_CONSOLE_TELNET_NEGOTIATION_LEN (9)
+extern const uint8_t esp_console_telnet_negotiation[ESP_CONSOLE_TELNET_NEGOTIATION_LEN];
+
+/**
+ * @brief Remove the telnet commands from the input of a network session
+ *
+ * Commands may be split across calls, the state is kept in telnet. Options
+ * requested by the client are answered with telnet->reply, and the width of
+ * the terminal it sends is stored in telnet->cols. Unless binary is set, the
+ * CR LF and CR NUL sequences which end lines become LF.
+ *
+ * @param telnet state of the session
+ * @param buf data received from the client, filtered in place
+ * @param len number of bytes in buf
+ * @param binary don't translate the line endings, e.g. in framed mode
+ * @return number of bytes of data left at the start of buf
+ */
+size_t esp_console_telnet_filter(esp_console_telnet_t *telnet, char *buf, size_t len, bool binary);
+
+/**
+ * @brief Run the parsed command, and record its statistics if CONFIG_CONSOLE_CMD_STATS is set
+ *
+ * Commands replaced by registering them again are not freed while one runs.
+ *
+ * @param parsed command returned by esp_console_context_parse
+ * @return return code of the command
+ */
+int esp_console_call(const esp_console_parsed_cmd_t *parsed);
+
+#ifdef __cplusplus
+}
+#endif
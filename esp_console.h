@@ -9,7 +9,10 @@
 extern "C" {
 #endif
 
+#include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
 #include "sdkconfig.h"
 #include "esp_heap_caps.h"
 #include "esp_err.h"
@@ -17,15 +20,51 @@ extern "C" {
 // Forward declaration. Definition in linenoise/linenoise.h.
 typedef struct linenoiseCompletions linenoiseCompletions;
 
+// Forward declaration. Definition below, with esp_console_executor_create.
+typedef struct esp_console_executor_s esp_console_executor_t;
+
+// Forward declaration. Definition below, with esp_console_output_create.
+typedef struct esp_console_output_s esp_console_output_t;
+
+// Forward declaration. Definition in linenoise/linenoise.h.
+struct linenoiseState;
+
+/**
+ * @brief What writing to a console output does when its buffer is full
+ */
+typedef enum {
+    ESP_CONSOLE_OUTPUT_BLOCK,       //!< wait for the writer task to make room, up to block_timeout_ms
+    ESP_CONSOLE_OUTPUT_DROP_OLDEST, //!< drop the oldest output not sent yet
+    ESP_CONSOLE_OUTPUT_DROP_NEWEST, //!< drop what doesn't fit
+} esp_console_output_policy_t;
+
+/**
+ * @brief Functions allocating the memory of the console
+ *
+ * Used for the commands, hints, help, contexts and pipelines of the console,
+ * the completions, line buffers and history of linenoise, and the argtables.
+ */
+typedef struct {
+    void *(*malloc)(size_t size, void *arg);                //!< allocate size bytes, NULL if out of memory
+    void *(*realloc)(void *ptr, size_t size, void *arg);    //!< resize a block, allocate one if ptr is NULL
+    void (*free)(void *ptr, void *arg);                     //!< free a block, ptr may be NULL
+    void *arg;                                              //!< passed to each function
+} esp_console_allocator_t;
+
 /**
  * @brief Parameters for console initialization
  */
 typedef struct {
     size_t max_cmdline_length;  //!< length of command line buffer, in bytes
-    size_t max_cmdline_args;    //!< maximum number of command line arguments to parse
+    size_t max_cmdline_args;    //!< maximum number of command line arguments to parse (0 means default, 32)
     uint32_t heap_alloc_caps;   //!< where to (e.g. MALLOC_CAP_SPIRAM) allocate heap objects such as cmds used by esp_console
     int hint_color;             //!< ASCII color code of hint text
     int hint_bold;              //!< Set to 1 to print hint text in bold
+    size_t help_cache_size;     //!< bytes of formatted help kept for the next help commands, least recently printed dropped first. If 0, help is formatted each time
+    size_t pipe_buffer_size;    //!< bytes buffered between two commands of a pipeline, see esp_console_run (0 means default, 512)
+    uint32_t pipe_task_stack_size; //!< stack size of the tasks running the commands of a pipeline but the last one (0 means default, 4096)
+    size_t pool_size;           //!< if not 0, all the memory of the console comes from one region of this size, allocated at init with heap_alloc_caps
+    const esp_console_allocator_t *allocator; //!< if set, the memory of the console is allocated with these functions instead of heap_alloc_caps. Copied at init
 } esp_console_config_t;
 
 /**
@@ -38,7 +77,12 @@ typedef struct {
         .max_cmdline_args = 32,                \
         .heap_alloc_caps = MALLOC_CAP_DEFAULT, \
         .hint_color = 39,                      \
-        .hint_bold = 0                         \
+        .hint_bold = 0,                        \
+        .help_cache_size = 2048,               \
+        .pipe_buffer_size = 512,               \
+        .pipe_task_stack_size = 4096,          \
+        .pool_size = 0,                        \
+        .allocator = NULL,                     \
     }
 
 /**
@@ -52,6 +96,19 @@ typedef struct {
     uint32_t task_priority;        //!< repl task priority
     const char *prompt;            //!< prompt (NULL represents default: "esp> ")
     size_t max_cmdline_length;     //!< maximum length of a command line. If 0, default value will be used
+    esp_console_executor_t *executor; //!< if set, commands are run by the workers of this executor instead of the REPL task, with the streams of the session they were typed in. Deleting the REPL waits for them
+    size_t history_arena_size;     //!< bytes allocated once for the lines of the history. If 0, 64 bytes per entry
+    uint32_t history_heap_caps;    //!< capabilities of the memory the history is allocated from, e.g. MALLOC_CAP_SPIRAM. If 0, the history is allocated like the rest of the console
+    bool history_append;           //!< append new commands to history_save_path, and rewrite it only once it may hold twice max_history_len lines
+    uint32_t history_flush_count;  //!< save the history once this many new commands were run. If 0, after each command
+    uint32_t history_flush_ms;     //!< if not 0, also save the new commands once they are this many milliseconds old
+    size_t tx_buffer_size;         //!< if not 0, the output of the REPL task is buffered in a console output of this size, see esp_console_output_create
+    esp_console_output_policy_t tx_policy; //!< what writing does when the buffer of the output is full
+    uint32_t heap_alloc_caps;      //!< capabilities of the memory the console allocates, see esp_console_config_t. If 0, MALLOC_CAP_DEFAULT
+    size_t pool_size;              //!< if not 0, the console allocates from one region of this size, see esp_console_config_t
+    size_t log_buffer_size;        //!< if not 0, the logs printed while a line is edited are kept in a buffer of this size, see esp_console_log_batch_start
+    uint32_t log_coalesce_ms;      //!< logs kept while a line is edited are printed at most once per this many milliseconds. If 0, 100 ms
+    esp_console_output_policy_t log_policy; //!< what logging does when the buffer of the logs is full
 } esp_console_repl_config_t;
 
 /**
@@ -66,6 +123,19 @@ typedef struct {
         .task_priority = 2,               \
         .prompt = NULL,                   \
         .max_cmdline_length = 0,          \
+        .executor = NULL,                 \
+        .history_arena_size = 0,          \
+        .history_heap_caps = 0,           \
+        .history_append = false,          \
+        .history_flush_count = 0,         \
+        .history_flush_ms = 0,            \
+        .tx_buffer_size = 0,              \
+        .tx_policy = ESP_CONSOLE_OUTPUT_BLOCK, \
+        .heap_alloc_caps = 0,             \
+        .pool_size = 0,                   \
+        .log_buffer_size = 0,             \
+        .log_coalesce_ms = 0,             \
+        .log_policy = ESP_CONSOLE_OUTPUT_DROP_OLDEST, \
 }
 
 #if CONFIG_ESP_CONSOLE_UART_DEFAULT || CONFIG_ESP_CONSOLE_UART_CUSTOM
@@ -127,21 +197,61 @@ typedef struct {
 #define ESP_CONSOLE_DEV_USB_SERIAL_JTAG_CONFIG_DEFAULT() {}
 #endif // CONFIG_ESP_CONSOLE_USB_SERIAL_JTAG || (defined __DOXYGEN__ && SOC_USB_SERIAL_JTAG_SUPPORTED)
 
+/**
+ * @brief Parameters for console device: TCP (telnet)
+ *
+ */
+typedef struct {
+    uint16_t port;          //!< TCP port the REPL listens on
+    size_t max_sessions;    //!< Connections served at the same time, more are refused
+    size_t tx_buffer_size;  //!< Output of each session waiting for the client to receive it. If 0, 4096 bytes
+    bool close_on_overflow; //!< Close the session whose output doesn't fit in tx_buffer_size, instead of dropping what doesn't fit
+} esp_console_dev_tcp_config_t;
+
+#define ESP_CONSOLE_DEV_TCP_CONFIG_DEFAULT() \
+{                                            \
+    .port = 23,                              \
+    .max_sessions = 4,                       \
+    .tx_buffer_size = 4096,                  \
+    .close_on_overflow = false,              \
+}
+
 /**
  * @brief initialize console module
  * @param config console configuration
  * @note  Call this once before using other console module features
+ * @note  From then on linenoise and argtable allocate their memory like the
+ *        console does, so create the argtables of the commands after this call
+ *        when config->allocator is set. Blocks of the pool freed after
+ *        esp_console_deinit are still returned to it, the region itself is
+ *        freed once it is empty.
  * @return
  *      - ESP_OK on success
  *      - ESP_ERR_NO_MEM if out of memory
  *      - ESP_ERR_INVALID_STATE if already initialized
- *      - ESP_ERR_INVALID_ARG if the configuration is invalid
+ *      - ESP_ERR_INVALID_ARG if the configuration is invalid, e.g. both pool_size and allocator are set
+ *      - ESP_ERR_NOT_SUPPORTED if pool_size is set on the Linux target
  */
 esp_err_t esp_console_init(const esp_console_config_t *config);
 
+/**
+ * @brief Get the usage of the memory pool of the console
+ * @param[out] free_bytes bytes currently free in the pool
+ * @param[out] min_free_bytes lowest number of free bytes since esp_console_init, may be NULL
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if free_bytes is NULL
+ *      - ESP_ERR_INVALID_STATE if the console wasn't initialized with a pool_size
+ */
+esp_err_t esp_console_get_pool_info(size_t *free_bytes, size_t *min_free_bytes);
+
 /**
  * @brief de-initialize console module
  * @note  Call this once when done using console module functions
+ * @note  linenoise and argtable allocate with malloc and free again from then
+ *        on, except that the blocks of the pool are still freed into it. Blocks
+ *        of config->allocator which are freed later, e.g. the argtables of the
+ *        commands, are freed with free.
  * @return
  *      - ESP_OK on success
  *      - ESP_ERR_INVALID_STATE if not initialized yet
@@ -174,7 +284,8 @@ typedef struct {
     /**
      * Hint text, usually lists possible arguments.
      * If set to NULL, and 'argtable' field is non-NULL, hint will be generated
-     * automatically
+     * automatically, when it is first needed.
+     * If set, the pointer must be valid until the call to esp_console_deinit.
      */
     const char *hint;
     /**
@@ -185,34 +296,755 @@ typedef struct {
      * Array or structure of pointers to arg_xxx structures, may be NULL.
      * Used to generate hint text if 'hint' is set to NULL.
      * Array/structure which this field points to must end with an arg_end.
-     * Only used for the duration of esp_console_cmd_register call.
+     * Must be valid until the call to esp_console_deinit, hint and help are generated from it when needed.
      */
     void *argtable;
+    /**
+     * Combination of ESP_CONSOLE_CMD_FLAG_xxx flags, 0 by default.
+     */
+    uint32_t flags;
+    /**
+     * Complete help of the command, printed by help command as is instead of
+     * the one formatted from the name, hint, help and argtable, e.g. the
+     * output of 'help <command>' saved as a string constant, which stays in
+     * flash. If set, the pointer must be valid until the call to
+     * esp_console_deinit, and the command is listed by help even if 'help'
+     * is NULL.
+     */
+    const char *help_formatted;
 } esp_console_cmd_t;
 
+/**
+ * @brief Command must be run by the task which read the command line
+ *
+ * Commands with this flag are never submitted to an executor, e.g. because
+ * they change the state of the REPL, or are not safe to run concurrently.
+ */
+#define ESP_CONSOLE_CMD_FLAG_SYNC_ONLY  (1 << 0)
+
 /**
  * @brief Register console command
  * @param cmd pointer to the command description; can point to a temporary value
+ * @note New commands may be registered while other tasks are running commands.
+ *       Registering a command again with the same name replaces it: tasks
+ *       which already looked up the command may still run the old handler.
+ *       The replaced description is freed once no command is running and no
+ *       lookup is in progress. Only its hint, if it was generated (e.g. shown
+ *       by the REPL) and differs from the new one, is kept until
+ *       esp_console_deinit, since callers of esp_console_get_hint may still
+ *       be using it.
  * @return
  *      - ESP_OK on success
  *      - ESP_ERR_NO_MEM if out of memory
  *      - ESP_ERR_INVALID_ARG if command description includes invalid arguments
+ *      - ESP_ERR_INVALID_STATE, if esp_console_init wasn't called
  */
 esp_err_t esp_console_cmd_register(const esp_console_cmd_t *cmd);
 
+/** @cond */
+#if CONFIG_IDF_TARGET_LINUX
+/* A single section whose name is a C identifier, so that the linker defines
+ * __start_ and __stop_ symbols for it. Commands are sorted at esp_console_init. */
+#define ESP_CONSOLE_CMD_SECTION(name)   "console_cmd_desc"
+#else
+/* One section per command, sorted by name when placed in flash, see linker.lf */
+#define ESP_CONSOLE_CMD_SECTION(name)   ".console_cmd_desc." #name
+#endif
+/** @endcond */
+
+/**
+ * @brief Define a console command at compile time
+ *
+ * The description is a constant placed in flash, in a table of commands built
+ * by the linker and sorted by name. These commands are available as soon as
+ * esp_console_init is called, without calling esp_console_cmd_register, and
+ * cost no heap: no hint is generated and help isn't cached for them.
+ * A command registered at run time with the same name replaces it.
+ *
+ * Example:
+ * @code{c}
+ * ESP_CONSOLE_CMD_REGISTER(free, "Get the size of the free heap", "", &free_cmd, NULL);
+ * ESP_CONSOLE_CMD_REGISTER(led, "Set the LED", "<on|off>", &led_cmd, &led_args,
+ *                          .flags = ESP_CONSOLE_CMD_FLAG_SYNC_ONLY);
+ * @endcode
+ *
+ * @note The object file must be linked for its commands to exist, while
+ *       nothing references them: register the component with WHOLE_ARCHIVE,
+ *       or define the commands in a file which has other functions the
+ *       application calls.
+ * @note Each command may only be defined once in the application.
+ *
+ * @param name_ command name, as an identifier (not a string)
+ * @param help_ help text, may be NULL to hide the command from 'help'
+ * @param hint_ hint text, must be a string literal, "" if the command has no hint.
+ *              It isn't generated from the argtable.
+ * @param func_ function which implements the command
+ * @param argtable_ argtable of the command, may be NULL. Its arg_xxx entries are
+ *                  created at run time, they must be before the command is run
+ *                  or its help printed. If they are created before esp_console_init,
+ *                  the option tables are built once there, otherwise arg_parse
+ *                  builds them each time the command is run.
+ * @param ... other fields of esp_console_cmd_t, as designated initializers
+ */
+#define ESP_CONSOLE_CMD_REGISTER(name_, help_, hint_, func_, argtable_, ...) \
+    __attribute__((used, section(ESP_CONSOLE_CMD_SECTION(name_)), aligned(__alignof__(esp_console_cmd_t)))) \
+    const esp_console_cmd_t esp_console_cmd_desc_##name_ = { \
+        .command = #name_, \
+        .help = help_, \
+        .hint = " " hint_, \
+        .func = func_, \
+        .argtable = argtable_, \
+        __VA_ARGS__ \
+    }
+
 /**
  * @brief Run command line
+ *
+ * The command line is parsed in a buffer shared by all callers, so this
+ * function must not be called from several tasks at the same time. Tasks
+ * which run commands concurrently should use esp_console_run_ctx instead.
+ *
+ * The standard streams of the command may be redirected, with operators
+ * separated from the other arguments by spaces:
+ * @verbatim
+ * - 'cmd > path' writes the standard output of the command to the file,
+ *   'cmd >> path' appends to it, and 'cmd < path' reads its standard input
+ *   from the file.
+ *
+ * - 'cmd1 | cmd2' connects the standard output of cmd1 to the standard
+ *   input of cmd2, through a buffer of pipe_buffer_size bytes: cmd1 waits
+ *   while the buffer is full, and its writes fail once cmd2 has returned.
+ *   All commands of the pipeline but the last are run by tasks of their own,
+ *   with the priority of the caller, and the return code of the pipeline
+ *   is the one of the last command.
+ * @endverbatim
+ * Operators which are quoted or escaped are plain arguments. The streams are
+ * those of the task running the command, so pipes are not supported on the
+ * linux target, where tasks share them.
+ *
  * @param cmdline command line (command name followed by a number of arguments)
  * @param[out] cmd_ret return code from the command (set if command was run)
  * @return
  *      - ESP_OK, if command was run
  *      - ESP_ERR_INVALID_ARG, if the command line is empty, or only contained
- *        whitespace
+ *        whitespace, or if a redirection has no path or conflicts with a pipe
  *      - ESP_ERR_NOT_FOUND, if command with given name wasn't registered
+ *      - ESP_ERR_INVALID_SIZE, if the line is longer than max_cmdline_length, or
+ *        has more than max_cmdline_args - 1 arguments; nothing is run
+ *      - ESP_ERR_NOT_SUPPORTED, if the line has a pipe which isn't supported, or
+ *        a command of a pipeline other than the last has ESP_CONSOLE_CMD_FLAG_SYNC_ONLY
+ *      - ESP_FAIL, if a file of a redirection can't be opened
+ *      - ESP_ERR_NO_MEM, if the pipes or their tasks couldn't be created
  *      - ESP_ERR_INVALID_STATE, if esp_console_init wasn't called
  */
 esp_err_t esp_console_run(const char *cmdline, int *cmd_ret);
 
+/**
+ * @brief Run command line, using buffers provided by the caller
+ *
+ * Same as esp_console_run, but the command line is parsed in 'buf' and
+ * the arguments are stored in 'argv', and the line buffer shared by
+ * esp_console_run is not touched. No memory is allocated, unless the line
+ * has redirections: running them allocates the state of the redirections,
+ * and the pipes and tasks of a pipeline, which are freed before returning.
+ *
+ * @param cmdline command line (command name followed by a number of arguments).
+ *                May point to 'buf', in which case the line is parsed in place
+ *                and its contents are modified.
+ * @param buf buffer where command line is copied and split into arguments
+ * @param buf_size size of 'buf', in bytes
+ * @param argv array where the pointers to arguments are written
+ * @param argv_size number of elements in 'argv', at most argv_size - 1
+ *                  arguments are passed to the command
+ * @param[out] cmd_ret return code from the command (set if command was run)
+ * @return
+ *      - ESP_OK, if command was run
+ *      - ESP_ERR_INVALID_ARG, if the command line is empty, or only contained
+ *        whitespace, or if the buffers are invalid
+ *      - ESP_ERR_NOT_FOUND, if command with given name wasn't registered
+ *      - ESP_ERR_INVALID_SIZE, if the command line doesn't fit in 'buf', or has
+ *        more than argv_size - 1 arguments; nothing is run
+ *      - other errors of esp_console_run, if the line has redirections
+ */
+esp_err_t esp_console_run_ex(const char *cmdline, char *buf, size_t buf_size,
+                             char **argv, size_t argv_size, int *cmd_ret);
+
+/**
+ * @brief Type defined for console execution context
+ *
+ * A context owns the buffers needed to parse and run a command line, so that
+ * several tasks, each with its own context, can run commands at the same time.
+ * Looking up a command in the registry doesn't take any lock. Handlers of
+ * different commands may run in parallel, and may call arg_parse at the same
+ * time: each call keeps its own getopt scan state (with newlib's
+ * getopt_long_r; on other C libraries, e.g. on the Linux target, the calls
+ * are serialized). An argtable holds the result of its last parse, so a
+ * handler which uses a static argtable must not be run by two tasks at once.
+ */
+typedef struct esp_console_context_s esp_console_context_t;
+
+/**
+ * @brief Parameters for console execution context
+ */
+typedef struct {
+    size_t max_cmdline_length;  //!< length of command line buffer, in bytes. If 0, the value given to esp_console_init is used
+    size_t max_cmdline_args;    //!< maximum number of command line arguments to parse. If 0, the value given to esp_console_init is used
+} esp_console_context_config_t;
+
+/**
+ * @brief Default console execution context configuration value
+ *
+ */
+#define ESP_CONSOLE_CONTEXT_CONFIG_DEFAULT() \
+    {                                        \
+        .max_cmdline_length = 0,             \
+        .max_cmdline_args = 0,               \
+    }
+
+/**
+ * @brief Create console execution context
+ * @param config context configuration
+ * @param[out] ret_ctx created context, NULL on failure
+ * @note The buffers of the context are allocated once, like the rest of
+ *       the memory of the console, see esp_console_init
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if the configuration is invalid
+ *      - ESP_ERR_INVALID_STATE, if esp_console_init wasn't called
+ *      - ESP_ERR_NO_MEM if out of memory
+ */
+esp_err_t esp_console_context_create(const esp_console_context_config_t *config, esp_console_context_t **ret_ctx);
+
+/**
+ * @brief Delete console execution context
+ * @param ctx context returned by esp_console_context_create
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if ctx is NULL
+ */
+esp_err_t esp_console_context_delete(esp_console_context_t *ctx);
+
+/**
+ * @brief Run command line using the buffers of the given context
+ *
+ * Same as esp_console_run, but safe to call from several tasks at the same
+ * time, as long as each of them uses a different context. Like
+ * esp_console_run_ex, this doesn't allocate memory unless the line has
+ * redirections.
+ *
+ * @param ctx context returned by esp_console_context_create
+ * @param cmdline command line (command name followed by a number of arguments)
+ * @param[out] cmd_ret return code from the command (set if command was run)
+ * @return
+ *      - ESP_OK, if command was run
+ *      - ESP_ERR_INVALID_ARG, if ctx is NULL, or the command line is empty,
+ *        or only contained whitespace
+ *      - ESP_ERR_NOT_FOUND, if command with given name wasn't registered
+ *      - ESP_ERR_INVALID_SIZE, if the line doesn't fit in the buffers of the context
+ *      - ESP_ERR_INVALID_STATE, if esp_console_init wasn't called
+ *      - other errors of esp_console_run, if the line has redirections
+ */
+esp_err_t esp_console_run_ctx(esp_console_context_t *ctx, const char *cmdline, int *cmd_ret);
+
+/**
+ * @brief Callback receiving the output of a command, see esp_console_capture_t
+ *
+ * @param data output, not terminated
+ * @param len length of data
+ * @param arg argument given in esp_console_capture_t
+ * @return ESP_OK to keep receiving the output, any other value drops the rest of it
+ */
+typedef esp_err_t (*esp_console_capture_cb_t)(const char *data, size_t len, void *arg);
+
+/**
+ * @brief Where the output of a command run with esp_console_run_capture goes
+ *
+ * With only buf, the output is written to it, and what doesn't fit is dropped.
+ * With cb, the output is passed to it as it is written: line by line through
+ * buf if given, which is then only used as the buffer of the stream, or else
+ * as the command writes it.
+ */
+typedef struct {
+    char *buf;                      //!< buffer for the output, may be NULL if cb is set
+    size_t buf_size;                //!< size of buf
+    esp_console_capture_cb_t cb;    //!< callback receiving the output, or NULL
+    void *arg;                      //!< argument of cb
+    size_t len;                     //!< [out] length of the output written to buf, if cb is NULL
+    bool truncated;                 //!< [out] some of the output was dropped
+} esp_console_capture_t;
+
+/**
+ * @brief Run command line with the output of the command captured
+ *
+ * Same as esp_console_run_ctx, with stdout and stderr of the calling task
+ * sent where capture says while the command runs (on the linux target, the
+ * standard streams are shared by all threads). The output isn't terminated.
+ *
+ * @param ctx context returned by esp_console_context_create
+ * @param cmdline command line (command name followed by a number of arguments)
+ * @param capture where the output goes; len and truncated are set
+ * @param[out] cmd_ret return code from the command (set if command was run)
+ * @return
+ *      - ESP_OK, if command was run
+ *      - ESP_ERR_INVALID_ARG, if capture has neither buf nor cb
+ *      - ESP_ERR_NO_MEM, if the stream of the output can't be opened
+ *      - other errors of esp_console_run_ctx
+ */
+esp_err_t esp_console_run_capture(esp_console_context_t *ctx, const char *cmdline,
+                                  esp_console_capture_t *capture, int *cmd_ret);
+
+/**
+ * @brief Parameters for running a script
+ */
+typedef struct {
+    bool stop_on_error;     //!< stop at the first command which can't be run or returns non-zero
+} esp_console_script_config_t;
+
+/**
+ * @brief Default script configuration value
+ *
+ */
+#define ESP_CONSOLE_SCRIPT_CONFIG_DEFAULT() \
+    {                                       \
+        .stop_on_error = true,              \
+    }
+
+/**
+ * @brief Outcome of a script
+ */
+typedef struct {
+    size_t commands_run;    //!< number of commands which were run
+    size_t errors;          //!< number of commands which couldn't be run or returned non-zero
+    size_t error_line;      //!< line of the first error, counting from 1, or 0 if there was none
+    int cmd_ret;            //!< return code of the last command which was run
+} esp_console_script_result_t;
+
+/**
+ * @brief Run the commands of a script, read from a stream
+ *
+ * The script holds one command line per line. A line may hold several commands
+ * separated by ';' (see esp_console_command_len). Empty lines and lines starting
+ * with '#' are skipped. Each line is read into the buffer of the context, and
+ * its commands are parsed there, so running a script doesn't allocate anything,
+ * unless its commands have redirections (see esp_console_run_ex).
+ *
+ * @param ctx context returned by esp_console_context_create; lines must fit in its buffer
+ * @param script stream the script is read from, e.g. a file opened with fopen
+ * @param config how to handle errors
+ * @param[out] ret_result outcome of the script, may be NULL
+ * @return
+ *      - ESP_OK, if all the commands were run and returned 0
+ *      - ESP_FAIL, if a command returned non-zero
+ *      - ESP_ERR_NOT_FOUND, if a command wasn't registered
+ *      - ESP_ERR_INVALID_SIZE, if a line didn't fit in the buffer of the context
+ *      - ESP_ERR_INVALID_ARG, if ctx, script or config is NULL, or if a command
+ *        is invalid, e.g. a redirection has no path (see esp_console_run)
+ *      If several commands failed, the error of the first one is returned.
+ */
+esp_err_t esp_console_run_script(esp_console_context_t *ctx, FILE *script,
+                                 const esp_console_script_config_t *config, esp_console_script_result_t *ret_result);
+
+/**
+ * @brief Run the commands of a script held in memory
+ *
+ * Same as esp_console_run_script, reading the script from a buffer.
+ *
+ * @param ctx context returned by esp_console_context_create; lines must fit in its buffer
+ * @param script the script, doesn't need to be zero-terminated
+ * @param script_len length of the script
+ * @param config how to handle errors
+ * @param[out] ret_result outcome of the script, may be NULL
+ * @return see esp_console_run_script
+ */
+esp_err_t esp_console_run_script_buf(esp_console_context_t *ctx, const char *script, size_t script_len,
+                                     const esp_console_script_config_t *config, esp_console_script_result_t *ret_result);
+
+/**
+ * @brief Identifier of a job submitted to an executor, never 0
+ */
+typedef uint32_t esp_console_job_id_t;
+
+/**
+ * @brief State of a job in flight
+ */
+typedef enum {
+    ESP_CONSOLE_JOB_QUEUED,     //!< waiting for a free worker
+    ESP_CONSOLE_JOB_RUNNING,    //!< command handler is running on a worker
+} esp_console_job_state_t;
+
+/**
+ * @brief Description of a job in flight, returned by esp_console_executor_list_jobs
+ */
+typedef struct {
+    esp_console_job_id_t id;        //!< job identifier
+    esp_console_job_state_t state;  //!< job state
+    const char *command;            //!< command name, valid until esp_console_deinit
+    bool cancel_requested;          //!< esp_console_executor_cancel was called for this job
+} esp_console_job_info_t;
+
+/**
+ * @brief Callback called on the worker task when a job is finished
+ *
+ * It is called with the standard streams of the worker, not those of the
+ * task which submitted the job.
+ *
+ * @param id job identifier
+ * @param err ESP_OK if the command was run, ESP_ERR_INVALID_STATE if the job
+ *            was cancelled before it started
+ * @param cmd_ret return code from the command, 0 if it wasn't run
+ * @param arg argument given to esp_console_executor_submit
+ */
+typedef void (*esp_console_job_done_cb_t)(esp_console_job_id_t id, esp_err_t err, int cmd_ret, void *arg);
+
+/**
+ * @brief Parameters for console executor
+ */
+typedef struct {
+    size_t num_workers;         //!< number of worker tasks
+    size_t queue_len;           //!< maximum number of jobs in flight, queued or running
+    uint32_t task_stack_size;   //!< worker task stack size
+    uint32_t task_priority;     //!< worker task priority
+    int task_core_id;           //!< core the workers are pinned to, -1 not to pin them
+    size_t max_cmdline_length;  //!< length of the command line buffer of each job. If 0, the value given to esp_console_init is used
+    size_t max_cmdline_args;    //!< maximum number of arguments of each job. If 0, the value given to esp_console_init is used
+} esp_console_executor_config_t;
+
+/**
+ * @brief Default console executor configuration value
+ *
+ */
+#define ESP_CONSOLE_EXECUTOR_CONFIG_DEFAULT() \
+    {                                         \
+        .num_workers = 1,                     \
+        .queue_len = 4,                       \
+        .task_stack_size = 4096,              \
+        .task_priority = 2,                   \
+        .task_core_id = -1,                   \
+        .max_cmdline_length = 0,              \
+        .max_cmdline_args = 0,                \
+    }
+
+/**
+ * @brief Create console executor
+ *
+ * An executor runs commands on a pool of worker tasks, in the order they were
+ * submitted. All the memory it needs, including one execution context per
+ * job, is allocated here.
+ *
+ * @param config executor configuration
+ * @param[out] ret_executor created executor, NULL on failure
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if the configuration is invalid
+ *      - ESP_ERR_INVALID_STATE, if esp_console_init wasn't called
+ *      - ESP_ERR_NO_MEM if out of memory
+ *      - ESP_FAIL if a worker task could not be created
+ */
+esp_err_t esp_console_executor_create(const esp_console_executor_config_t *config, esp_console_executor_t **ret_executor);
+
+/**
+ * @brief Delete console executor
+ *
+ * Jobs still queued are cancelled, and their callbacks are called. Waits for
+ * the running jobs to finish.
+ *
+ * @note Must not be called from a command run by the executor itself
+ *
+ * @param executor executor returned by esp_console_executor_create
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if executor is NULL
+ */
+esp_err_t esp_console_executor_delete(esp_console_executor_t *executor);
+
+/**
+ * @brief Parse command line and queue it to be run by a worker
+ *
+ * The command line is copied, so the caller may reuse it as soon as this
+ * function returns. The command is run with the stdin, stdout and stderr of
+ * the calling task, which must stay open until the job is finished.
+ *
+ * @param executor executor returned by esp_console_executor_create
+ * @param cmdline command line (command name followed by a number of arguments)
+ * @param done_cb function called on the worker task when the job is finished, may be NULL
+ * @param arg argument passed to done_cb
+ * @param[out] ret_id identifier of the queued job, may be NULL
+ * @return
+ *      - ESP_OK, if the job was queued
+ *      - ESP_ERR_INVALID_ARG, if executor is NULL, or the command line is
+ *        empty, or only contained whitespace
+ *      - ESP_ERR_NOT_FOUND, if command with given name wasn't registered
+ *      - ESP_ERR_NOT_SUPPORTED, if the command has ESP_CONSOLE_CMD_FLAG_SYNC_ONLY
+ *        flag, or the line has redirections (see esp_console_run), and has to be
+ *        run by the caller
+ *      - ESP_ERR_INVALID_SIZE, if the line is longer than max_cmdline_length, or
+ *        has more than max_cmdline_args - 1 arguments
+ *      - ESP_ERR_NO_MEM, if queue_len jobs are already in flight
+ */
+esp_err_t esp_console_executor_submit(esp_console_executor_t *executor, const char *cmdline,
+                                      esp_console_job_done_cb_t done_cb, void *arg,
+                                      esp_console_job_id_t *ret_id);
+
+/**
+ * @brief Cancel a job
+ *
+ * A queued job is not run; its callback is called with ESP_ERR_INVALID_STATE.
+ * A running job can't be stopped, but its handler may poll
+ * esp_console_executor_is_cancelled and return early.
+ *
+ * @param executor executor returned by esp_console_executor_create
+ * @param id job identifier returned by esp_console_executor_submit
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if executor is NULL
+ *      - ESP_ERR_NOT_FOUND, if the job is already finished
+ */
+esp_err_t esp_console_executor_cancel(esp_console_executor_t *executor, esp_console_job_id_t id);
+
+/**
+ * @brief Check if the job run by the calling task was cancelled
+ *
+ * @param executor executor running the command which calls this function
+ * @return true if esp_console_executor_cancel was called for the job run by
+ *         the calling task, false otherwise, or if the calling task is not a
+ *         worker of the executor
+ */
+bool esp_console_executor_is_cancelled(esp_console_executor_t *executor);
+
+/**
+ * @brief List jobs in flight
+ *
+ * @param executor executor returned by esp_console_executor_create
+ * @param[out] jobs array where the jobs are described, may be NULL if max_jobs is 0
+ * @param max_jobs number of elements in 'jobs'
+ * @param[out] num_jobs number of jobs in flight, may be larger than max_jobs
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if executor or num_jobs is NULL
+ */
+esp_err_t esp_console_executor_list_jobs(esp_console_executor_t *executor, esp_console_job_info_t *jobs,
+                                         size_t max_jobs, size_t *num_jobs);
+
+/**
+ * @brief Parameters for console output
+ */
+typedef struct {
+    int fd;                     //!< file descriptor the output is sent to, e.g. fileno(stdout)
+    size_t buffer_size;         //!< size of the TX ring buffer
+    size_t chunk_size;          //!< maximum number of bytes sent by each write to fd, at most half of buffer_size
+    esp_console_output_policy_t policy; //!< what writing does when the buffer is full
+    uint32_t block_timeout_ms;  //!< with ESP_CONSOLE_OUTPUT_BLOCK, drop what doesn't fit after waiting this long. If 0, wait forever
+    uint32_t task_stack_size;   //!< writer task stack size
+    uint32_t task_priority;     //!< writer task priority
+    int task_core_id;           //!< core the writer task is pinned to, -1 not to pin it
+} esp_console_output_config_t;
+
+/**
+ * @brief Default console output configuration value
+ *
+ * @param output_fd file descriptor the output is sent to
+ */
+#define ESP_CONSOLE_OUTPUT_CONFIG_DEFAULT(output_fd) \
+    {                                         \
+        .fd = (output_fd),                    \
+        .buffer_size = 4096,                  \
+        .chunk_size = 256,                    \
+        .policy = ESP_CONSOLE_OUTPUT_BLOCK,   \
+        .block_timeout_ms = 0,                \
+        .task_stack_size = 2048,              \
+        .task_priority = 1,                   \
+        .task_core_id = -1,                   \
+    }
+
+/**
+ * @brief Statistics of a console output
+ */
+typedef struct {
+    size_t bytes_sent;          //!< bytes written to the file descriptor
+    size_t bytes_dropped;       //!< bytes dropped because the buffer was full, or because writing to the file descriptor failed
+    size_t max_used;            //!< highest number of bytes waiting in the buffer
+} esp_console_output_stats_t;
+
+/**
+ * @brief Create console output
+ *
+ * A console output buffers what is written to it in a ring buffer, which a
+ * writer task sends to the file descriptor in chunks. Writers return as soon
+ * as the data is in the buffer, instead of waiting for the device to send it.
+ * All the memory it needs is allocated here.
+ *
+ * @param config output configuration
+ * @param[out] ret_output created output, NULL on failure
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if the configuration is invalid
+ *      - ESP_ERR_NO_MEM if out of memory
+ *      - ESP_FAIL if the writer task could not be created
+ */
+esp_err_t esp_console_output_create(const esp_console_output_config_t *config, esp_console_output_t **ret_output);
+
+/**
+ * @brief Delete console output
+ *
+ * Waits for the writer task to send what is in the buffer. The file
+ * descriptor is left open.
+ *
+ * @note The stream returned by esp_console_output_get_stream must not be used
+ *       anymore, and must not be the stdout of any task.
+ *
+ * @param output output returned by esp_console_output_create
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if output is NULL
+ */
+esp_err_t esp_console_output_delete(esp_console_output_t *output);
+
+/**
+ * @brief Write to console output
+ *
+ * The data is copied to the buffer. When it doesn't fit, the policy of the
+ * output applies; the bytes dropped are counted in the statistics. May be
+ * called from several tasks at the same time.
+ *
+ * @param output output returned by esp_console_output_create
+ * @param data data to write
+ * @param len length of the data
+ * @return number of bytes added to the buffer
+ */
+size_t esp_console_output_write(esp_console_output_t *output, const void *data, size_t len);
+
+/**
+ * @brief Get a stream writing to console output
+ *
+ * The stream is not buffered: each write goes to the buffer of the output.
+ * It may be used as stdout of a task, so that printf is buffered.
+ *
+ * @param output output returned by esp_console_output_create
+ * @return the stream, closed by esp_console_output_delete
+ */
+FILE *esp_console_output_get_stream(esp_console_output_t *output);
+
+/**
+ * @brief Wait for the writer task to send what is in the buffer of console output
+ *
+ * @param output output returned by esp_console_output_create
+ * @param timeout_ms maximum time to wait, in milliseconds
+ * @return
+ *      - ESP_OK once the buffer is empty
+ *      - ESP_ERR_INVALID_ARG if output is NULL
+ *      - ESP_ERR_TIMEOUT if data was still waiting after timeout_ms
+ */
+esp_err_t esp_console_output_flush(esp_console_output_t *output, uint32_t timeout_ms);
+
+/**
+ * @brief Get statistics of console output
+ *
+ * @param output output returned by esp_console_output_create
+ * @param[out] ret_stats statistics since the output was created
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if output or ret_stats is NULL
+ */
+esp_err_t esp_console_output_get_stats(esp_console_output_t *output, esp_console_output_stats_t *ret_stats);
+
+/**
+ * @brief Parameters for the batching of logs, see esp_console_log_batch_start
+ */
+typedef struct {
+    size_t buffer_size;         //!< bytes of logs kept while a line is edited
+    uint32_t coalesce_ms;       //!< logs kept are printed at most once per this many milliseconds, all at once
+    esp_console_output_policy_t policy; //!< what logging does when the buffer is full
+    uint32_t block_timeout_ms;  //!< with ESP_CONSOLE_OUTPUT_BLOCK, how long logging waits for the line to be hidden, if the buffer is full
+} esp_console_log_batch_config_t;
+
+/**
+ * @brief Default log batching configuration value
+ */
+#define ESP_CONSOLE_LOG_BATCH_CONFIG_DEFAULT()       \
+    {                                                \
+        .buffer_size = 2048,                         \
+        .coalesce_ms = 100,                          \
+        .policy = ESP_CONSOLE_OUTPUT_DROP_OLDEST,    \
+        .block_timeout_ms = 100,                     \
+    }
+
+/**
+ * @brief Start batching the logs printed while a line is edited
+ *
+ * Installs a vprintf function for esp_log (see esp_log_set_vprintf). While a
+ * line is edited, i.e. between esp_console_log_batch_begin and
+ * esp_console_log_batch_end, the logs are kept in a buffer instead of being
+ * printed over the line. They are printed by esp_console_log_batch_flush, or
+ * by logging once the oldest one waited coalesce_ms: the line is hidden once,
+ * all the logs kept are written, and the line is shown again. When the buffer
+ * is full, the policy applies to whole log lines:
+ *   - ESP_CONSOLE_OUTPUT_DROP_OLDEST drops the oldest lines kept
+ *   - ESP_CONSOLE_OUTPUT_DROP_NEWEST drops the new line
+ *   - ESP_CONSOLE_OUTPUT_BLOCK prints the lines kept right away, waiting up to
+ *     block_timeout_ms for the line editor, and drops the new line if it couldn't
+ * The number of lines dropped is printed with the next logs. Log lines longer
+ * than 256 bytes are truncated. Outside of line editing, logs are printed by
+ * the previous vprintf function, as if batching wasn't started.
+ *
+ * @note The console REPL does this when log_buffer_size is set in its configuration.
+ *
+ * @param config batching configuration
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if the configuration is invalid
+ *      - ESP_ERR_INVALID_STATE if batching was already started
+ *      - ESP_ERR_NO_MEM if out of memory
+ */
+esp_err_t esp_console_log_batch_start(const esp_console_log_batch_config_t *config);
+
+/**
+ * @brief Stop batching logs
+ *
+ * The logs still kept are printed, and the previous vprintf function of
+ * esp_log is restored.
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_STATE if batching wasn't started
+ */
+esp_err_t esp_console_log_batch_stop(void);
+
+/**
+ * @brief Keep the logs while a line is edited
+ *
+ * To be called once linenoiseEditStart has shown the prompt. The logs are
+ * printed on the output of the line editor. Nothing is kept if the terminal
+ * is in dumb mode, since the line couldn't be hidden.
+ *
+ * @param ls state of the line being edited, kept until esp_console_log_batch_end
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if ls is NULL
+ *      - ESP_ERR_INVALID_STATE if batching wasn't started, or a line is already edited
+ *      - ESP_ERR_NOT_SUPPORTED in dumb mode
+ */
+esp_err_t esp_console_log_batch_begin(struct linenoiseState *ls);
+
+/**
+ * @brief Print the logs kept, and stop keeping them
+ *
+ * To be called once linenoiseEditStop ended the line, before the command is
+ * run. Does nothing if no line is edited.
+ */
+void esp_console_log_batch_end(void);
+
+/**
+ * @brief Print the logs kept once they waited long enough
+ *
+ * Logs are only printed by logging, so the last ones of a burst wait for this
+ * function, which the task editing the line calls between reads.
+ *
+ * @param force print the logs kept even if they didn't wait coalesce_ms
+ * @param[out] ret_wait_ms if not NULL, milliseconds until the logs still kept
+ *             are due, UINT32_MAX if there are none
+ */
+void esp_console_log_batch_flush(bool force, uint32_t *ret_wait_ms);
+
 /**
  * @brief Split command line into arguments in place
  * @verbatim
@@ -225,7 +1057,9 @@ esp_err_t esp_console_run(const char *cmdline, int *cmd_ret);
  *
  *     'abc "123 456" def' -> [ 'abc', '123 456', 'def' ]
  *
- * - Escape sequences may be used to produce backslash, double quote, and space:
+ * - Escape sequences may be used to produce backslash, double quote, space,
+ *   semicolon, which otherwise separates commands (see esp_console_command_len),
+ *   and the '|', '<' and '>' of redirections (see esp_console_run):
  *
  *     'a\ b\\c\"' -> [ 'a b\c"' ]
  * @endverbatim
@@ -239,6 +1073,188 @@ esp_err_t esp_console_run(const char *cmdline, int *cmd_ret);
  */
 size_t esp_console_split_argv(char *line, char **argv, size_t argv_size);
 
+/**
+ * @brief Position of an argument in a command line
+ */
+typedef struct {
+    size_t offset;      //!< offset of the argument in the line, after the opening quote if it is quoted
+    size_t length;      //!< length of the argument in the line, without the quotes
+    bool escaped;       //!< the argument contains escape sequences, see esp_console_unescape_arg
+    bool quoted;        //!< the argument is surrounded with quotes
+} esp_console_arg_span_t;
+
+/**
+ * @brief Find the arguments of a command line, without copying or modifying it
+ *
+ * Arguments are delimited as described for esp_console_split_argv. Each argument is
+ * returned as a span of the line. Unless the span is marked as escaped, it is the
+ * argument itself; otherwise esp_console_unescape_arg gives the argument.
+ *
+ * @param line command line to parse, doesn't need to be zero-terminated
+ * @param line_len length of the line
+ * @param[out] spans array where the spans of the arguments are written
+ * @param max_spans number of elements in the spans array
+ * @param[out] ret_count number of arguments in the line, even if they don't all fit in spans
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_SIZE if the line has more than max_spans arguments;
+ *        the first max_spans are returned
+ *      - ESP_ERR_INVALID_ARG if line or ret_count is NULL
+ */
+esp_err_t esp_console_split_argv_spans(const char *line, size_t line_len,
+                                       esp_console_arg_span_t *spans, size_t max_spans, size_t *ret_count);
+
+/**
+ * @brief Copy an argument found by esp_console_split_argv_spans, removing its escape sequences
+ *
+ * @param line the command line given to esp_console_split_argv_spans
+ * @param span span of the argument
+ * @param[out] out buffer for the zero-terminated argument, may be the line itself at or
+ *             before span->offset
+ * @param out_size size of the out buffer; the argument is truncated if it doesn't fit
+ * @return length of the argument, which may be larger than out_size - 1 if it was truncated
+ */
+size_t esp_console_unescape_arg(const char *line, const esp_console_arg_span_t *span, char *out, size_t out_size);
+
+/**
+ * @brief Find the end of the first command of a line holding several commands separated by ';'
+ *
+ * A semicolon doesn't separate commands if it is escaped with a backslash, or
+ * in a quoted argument, as described for esp_console_split_argv.
+ *
+ * @param line command line, doesn't need to be zero-terminated
+ * @param line_len length of the line
+ * @return length of the first command; unless it is line_len, line[ret] is the separator
+ */
+size_t esp_console_command_len(const char *line, size_t line_len);
+
+/******************************************************************************
+ *              Framed protocol
+ ******************************************************************************/
+
+/*
+ * Scripts and test hosts may exchange binary frames with the console instead of
+ * typing lines, which skips line editing, echo and prompts. A frame is
+ *
+ *     COBS(type, seq, data..., crc16_lo, crc16_hi) 0x00
+ *
+ * i.e. the payload is COBS encoded so that it contains no zero byte, and a zero
+ * byte ends the frame. crc16 is the CRC-16/CCITT-FALSE of type, seq and data.
+ * A request of type ESP_CONSOLE_FRAME_TYPE_RUN carries a command line as data,
+ * without terminating zero. Each request gets a response whose type is the type
+ * of the request ORed with ESP_CONSOLE_FRAME_RESPONSE, with the same seq, and
+ * whose data is
+ *
+ *     err (int32, little endian)     ESP_OK if the command was run, or why not
+ *     cmd_ret (int32, little endian) return code of the command
+ *     flags (uint8)                  ESP_CONSOLE_FRAME_FLAG_xxx
+ *     output...                      what the command printed to stdout and stderr
+ *
+ * A frame which can't be decoded is answered as a request of type
+ * ESP_CONSOLE_FRAME_TYPE_ERROR with seq 0, with err set to ESP_ERR_INVALID_CRC or
+ * ESP_ERR_INVALID_SIZE.
+ *
+ * A REPL session switches to framed mode when it receives ESP_CONSOLE_FRAME_SEQ
+ * while editing a line, and answers with a single zero byte: the host discards
+ * what it received before. An ESP_CONSOLE_FRAME_TYPE_EXIT request switches the
+ * session back to line editing. Empty frames are ignored, so the host may send
+ * a zero byte to resynchronize. The REPL runs the requests one at a time on its
+ * own task, even if it has an executor, and returns up to 1024 bytes of output.
+ */
+
+#define ESP_CONSOLE_FRAME_SEQ               "\x1b[=F"   //!< switches a REPL session to framed mode
+#define ESP_CONSOLE_FRAME_TYPE_RUN          0x01        //!< run the command line carried by the request
+#define ESP_CONSOLE_FRAME_TYPE_EXIT         0x02        //!< switch the REPL session back to line editing
+#define ESP_CONSOLE_FRAME_TYPE_ERROR        0x7f        //!< stands for the type of an invalid frame
+#define ESP_CONSOLE_FRAME_RESPONSE          0x80        //!< set in the type of responses
+#define ESP_CONSOLE_FRAME_FLAG_TRUNCATED    (1 << 0)    //!< the output didn't fit in the response
+
+#define ESP_CONSOLE_FRAME_HEADER_LEN        2   //!< type and seq
+#define ESP_CONSOLE_FRAME_CRC_LEN           2   //!< crc16 ending the payload
+#define ESP_CONSOLE_FRAME_RESULT_LEN        9   //!< err, cmd_ret and flags, starting the data of a response
+
+/**
+ * @brief Size of the buffer holding a frame with a payload of n bytes, including the ending zero
+ */
+#define ESP_CONSOLE_FRAME_ENCODED_LEN(n)    ((n) + (n) / 254 + 2)
+
+/**
+ * @brief Size of the buffer holding a request carrying a command line of n bytes
+ */
+#define ESP_CONSOLE_FRAME_REQUEST_LEN(n) \
+    ESP_CONSOLE_FRAME_ENCODED_LEN(ESP_CONSOLE_FRAME_HEADER_LEN + (n) + ESP_CONSOLE_FRAME_CRC_LEN)
+
+/**
+ * @brief Size of the buffer holding a response carrying up to n bytes of output
+ */
+#define ESP_CONSOLE_FRAME_RESPONSE_LEN(n) \
+    ESP_CONSOLE_FRAME_REQUEST_LEN(ESP_CONSOLE_FRAME_RESULT_LEN + (n))
+
+/**
+ * @brief Build a frame
+ *
+ * @param type type of the frame, e.g. ESP_CONSOLE_FRAME_TYPE_RUN
+ * @param seq sequence number, echoed in the response
+ * @param data data of the frame, e.g. the command line to run
+ * @param data_len length of the data
+ * @param[out] frame buffer for the frame, including the ending zero
+ * @param frame_size size of the frame buffer, at least ESP_CONSOLE_FRAME_REQUEST_LEN(data_len)
+ * @param[out] ret_len length of the frame, including the ending zero
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_SIZE if the frame doesn't fit in the buffer
+ *      - ESP_ERR_INVALID_ARG if a pointer argument is NULL
+ */
+esp_err_t esp_console_frame_encode(uint8_t type, uint8_t seq, const void *data, size_t data_len,
+                                   uint8_t *frame, size_t frame_size, size_t *ret_len);
+
+/**
+ * @brief Decode a frame in place, and check its CRC
+ *
+ * @param frame the frame, without the ending zero; it is overwritten by its payload
+ * @param frame_len length of the frame
+ * @param[out] ret_type type of the frame
+ * @param[out] ret_seq sequence number of the frame
+ * @param[out] ret_data data of the frame, pointing into the frame buffer and
+ *             followed by a zero byte, which replaces the CRC
+ * @param[out] ret_data_len length of the data
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_SIZE if the frame is not valid COBS, or too short
+ *      - ESP_ERR_INVALID_CRC if the CRC doesn't match
+ *      - ESP_ERR_INVALID_ARG if a pointer argument is NULL
+ */
+esp_err_t esp_console_frame_decode(uint8_t *frame, size_t frame_len, uint8_t *ret_type, uint8_t *ret_seq,
+                                   uint8_t **ret_data, size_t *ret_data_len);
+
+/**
+ * @brief Handle a request frame, running its command line with the given context
+ *
+ * The command runs on the calling task, with stdout and stderr pointing to the
+ * response, so the output of the command is returned in the response.
+ * Requests of other types than ESP_CONSOLE_FRAME_TYPE_RUN get a response with
+ * err set to ESP_ERR_NOT_SUPPORTED, except ESP_CONSOLE_FRAME_TYPE_EXIT, which
+ * gets an empty response with err set to ESP_OK. If the output can't be
+ * captured, the command isn't run and err is set to ESP_ERR_NO_MEM.
+ *
+ * @param ctx context returned by esp_console_context_create
+ * @param frame the request, without the ending zero; it is overwritten
+ * @param frame_len length of the request
+ * @param[out] resp buffer for the response, including the ending zero
+ * @param resp_size size of the response buffer, ESP_CONSOLE_FRAME_RESPONSE_LEN of the
+ *             maximum length of the output; longer output is truncated
+ * @param[out] ret_resp_len length of the response, including the ending zero
+ * @param[out] ret_type type of the request, or ESP_CONSOLE_FRAME_TYPE_ERROR if it
+ *             couldn't be decoded; may be NULL
+ * @return
+ *      - ESP_OK if a response was built, even if the request was invalid or
+ *        the command failed
+ *      - ESP_ERR_INVALID_SIZE if resp_size is smaller than ESP_CONSOLE_FRAME_RESPONSE_LEN(0)
+ *      - ESP_ERR_INVALID_ARG if a pointer argument is NULL
+ */
+esp_err_t esp_console_frame_run(esp_console_context_t *ctx, uint8_t *frame, size_t frame_len,
+                                uint8_t *resp, size_t resp_size, size_t *ret_resp_len, uint8_t *ret_type);
+
 /**
  * @brief Callback which provides command completion for linenoise library
  *
@@ -247,6 +1263,9 @@ size_t esp_console_split_argv(char *line, char **argv, size_t argv_size);
  *
  *   linenoiseSetCompletionCallback(&esp_console_get_completion);
  *
+ * Command names are added with linenoiseAddCompletionRef, i.e. without
+ * copying them; they stay valid until esp_console_deinit is called.
+ *
  * @param buf the string typed by the user
  * @param lc linenoiseCompletions to be filled in
  */
@@ -285,6 +1304,64 @@ const char *esp_console_get_hint(const char *buf, int *color, int *bold);
  */
 esp_err_t esp_console_register_help_command(void);
 
+/**
+ * @brief Statistics of the calls of a command
+ *
+ * Recorded only if CONFIG_CONSOLE_CMD_STATS is enabled. The heap is the one
+ * of MALLOC_CAP_DEFAULT capabilities, and the stack the one of the task which
+ * ran the command.
+ */
+typedef struct {
+    uint32_t calls;             //!< number of times the command was run
+    uint32_t time_min_us;       //!< shortest execution time of the command
+    uint32_t time_avg_us;       //!< average execution time of the command
+    uint32_t time_max_us;       //!< longest execution time of the command
+    uint32_t time_p99_us;       //!< time under which 99% of the calls ran, rounded up to the next power of two minus 1
+    uint32_t split_avg_us;      //!< average time spent splitting the command line and looking up the command, before running it
+    uint32_t arg_parse_avg_us;  //!< average time spent in arg_parse by the command, included in its execution time
+    int32_t heap_avg;           //!< average number of bytes allocated and not freed by a call
+    int32_t heap_max;           //!< largest number of bytes allocated and not freed by a call
+    uint32_t heap_peak_max;     //!< largest number of bytes allocated at once during a call, known only for the calls which made the free heap reach a new low
+    size_t stack_free_min;      //!< smallest stack high water mark of the tasks the command ran in, in bytes
+} esp_console_cmd_stats_t;
+
+/**
+ * @brief Get the statistics of a command
+ *
+ * @param command name of the command
+ * @param[out] ret_stats statistics since the command was first registered, or since esp_console_reset_cmd_stats
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if command or ret_stats is NULL
+ *      - ESP_ERR_NOT_FOUND if the command isn't registered
+ *      - ESP_ERR_INVALID_STATE, if esp_console_init wasn't called
+ *      - ESP_ERR_NOT_SUPPORTED if CONFIG_CONSOLE_CMD_STATS is disabled
+ */
+esp_err_t esp_console_get_cmd_stats(const char *command, esp_console_cmd_stats_t *ret_stats);
+
+/**
+ * @brief Reset the statistics of all the commands
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_STATE, if esp_console_init wasn't called
+ *      - ESP_ERR_NOT_SUPPORTED if CONFIG_CONSOLE_CMD_STATS is disabled
+ */
+esp_err_t esp_console_reset_cmd_stats(void);
+
+/**
+ * @brief Register a 'console_stats' command
+ *
+ * The command prints the statistics of the commands which were run, or of the
+ * command given as argument. With -r, it resets them once printed.
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_STATE, if esp_console_init wasn't called
+ *      - ESP_ERR_NOT_SUPPORTED if CONFIG_CONSOLE_CMD_STATS is disabled
+ */
+esp_err_t esp_console_register_stats_command(void);
+
 /******************************************************************************
  *              Console REPL
  ******************************************************************************/
@@ -302,9 +1379,16 @@ typedef struct esp_console_repl_s esp_console_repl_t;
 struct esp_console_repl_s {
     /**
      * @brief Delete console REPL environment
+     *
+     * Waits until the REPL task has exited, and the commands submitted to the
+     * executor from its sessions are done.
+     *
+     * @note Must not be called from a command run by the REPL task.
+     *
      * @param[in] repl REPL handle returned from esp_console_new_repl_xxx
      * @return
      *      - ESP_OK on success
+     *      - ESP_ERR_INVALID_STATE if already deleted, or called from the REPL task
      *      - ESP_FAIL on errors
      */
     esp_err_t (*del)(esp_console_repl_t *repl);
@@ -381,6 +1465,37 @@ esp_err_t esp_console_new_repl_usb_cdc(const esp_console_dev_usb_cdc_config_t *d
 esp_err_t esp_console_new_repl_usb_serial_jtag(const esp_console_dev_usb_serial_jtag_config_t *dev_config, const esp_console_repl_config_t *repl_config, esp_console_repl_t **ret_repl);
 #endif // CONFIG_ESP_CONSOLE_USB_SERIAL_JTAG || (defined __DOXYGEN__ && SOC_USB_SERIAL_JTAG_SUPPORTED)
 
+/**
+ * @brief Establish a console REPL environment over TCP, for telnet clients
+ *
+ * @param[in] dev_config TCP configuration
+ * @param[in] repl_config REPL configuration
+ * @param[out] ret_repl return REPL handle after initialization succeed, return NULL otherwise
+ *
+ * @note This is an all-in-one function to establish the environment needed for REPL, includes:
+ *       - Listens on the given port, on all interfaces
+ *       - Initializes linenoise
+ *       - Spawn new thread to run REPL in the background
+ *
+ *       The REPL task accepts the connections, and serves each of them as a
+ *       session of its own, see esp_console_repl_add_session. The width of each
+ *       terminal is negotiated with telnet (NAWS), instead of being probed.
+ *       Each session has a history of its own, which starts with the commands
+ *       of the sessions before it; the commands of all the sessions are saved
+ *       to history_save_path. The network must be up before
+ *       the REPL is started; the stdin/stdout of the application are not used.
+ *       Sending never blocks the REPL task: the output a client doesn't
+ *       receive fast enough waits in a buffer of tx_buffer_size bytes, and
+ *       what doesn't fit is dropped, or closes the session.
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if an argument is NULL, or max_sessions is 0
+ *      - ESP_ERR_NO_MEM if out of memory
+ *      - ESP_FAIL if the port can't be listened on
+ */
+esp_err_t esp_console_new_repl_tcp(const esp_console_dev_tcp_config_t *dev_config, const esp_console_repl_config_t *repl_config, esp_console_repl_t **ret_repl);
+
 /**
  * @brief Start REPL environment
  * @param[in] repl REPL handle returned from esp_console_new_repl_xxx
@@ -391,6 +1506,34 @@ esp_err_t esp_console_new_repl_usb_serial_jtag(const esp_console_dev_usb_serial_
  */
 esp_err_t esp_console_start_repl(esp_console_repl_t *repl);
 
+/**
+ * @brief Serve another console session from the task of the REPL
+ *
+ * The REPL task waits with select() for input on all its sessions, and edits
+ * one line per session, so several consoles (e.g. a second UART, or a network
+ * socket opened with fdopen) are served by a single task and stack. Commands
+ * entered in a session print to the streams of that session.
+ *
+ * @param[in] repl REPL handle returned from esp_console_new_repl_xxx
+ * @param[in] in input stream of the session, in blocking mode; its driver must support select()
+ * @param[in] out output stream of the session, may be the same as 'in'
+ *
+ * @note The REPL takes ownership of the streams, and closes them when the
+ *       session ends, i.e. when the end of the input stream is reached, or
+ *       when the REPL is deleted. A session added before the REPL is started
+ *       shows its prompt once the REPL is started.
+ * @note Each session has a history of its own, which starts as a copy of the
+ *       history of the REPL. Only the commands of the main session of the REPL
+ *       are added to the history of the REPL, and saved to history_save_path.
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if an argument is NULL
+ *      - ESP_ERR_INVALID_STATE, if the REPL was deleted
+ *      - ESP_ERR_NO_MEM if out of memory
+ */
+esp_err_t esp_console_repl_add_session(esp_console_repl_t *repl, FILE *in, FILE *out);
+
 #ifdef __cplusplus
 }
 #endif
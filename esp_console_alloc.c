@@ -0,0 +1,340 @@
+/*
+ * SPDX-FileCopyrightText: 2016-2021 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE     // for fopencookie
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/param.h>
+#include "sdkconfig.h"
+#include "esp_err.h"
+#include "esp_heap_caps.h"
+#include "esp_console.h"
+#include "console_private.h"
+#include "linenoise/linenoise.h"
+#include "argtable3/argtable3.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#if !CONFIG_IDF_TARGET_LINUX
+#include "multi_heap.h"
+#endif
+
+#define MEMSTREAM_MIN_SIZE      64      // first allocation of a memory stream
+
+/** capabilities of the memory allocated when there is no pool nor allocator */
+static uint32_t s_caps = MALLOC_CAP_DEFAULT;
+
+/** allocator given to esp_console_init, used if malloc is set */
+static esp_console_allocator_t s_allocator;
+
+/** protects s_allocator and the pools, created by the first esp_console_init */
+static SemaphoreHandle_t s_alloc_lock;
+static StaticSemaphore_t s_alloc_lock_buf;
+
+static void alloc_lock(void)
+{
+    if (s_alloc_lock) {
+        xSemaphoreTake(s_alloc_lock, portMAX_DELAY);
+    }
+}
+
+static void alloc_unlock(void)
+{
+    if (s_alloc_lock) {
+        xSemaphoreGive(s_alloc_lock);
+    }
+}
+
+#if !CONFIG_IDF_TARGET_LINUX
+/* Region given to the console, the header is at its start and the heap follows it.
+ * Blocks are freed into the pool they come from, even once the console stopped
+ * using it, and a pool which isn't used anymore is freed with its last block. */
+typedef struct console_pool_s {
+    struct console_pool_s *next;
+    multi_heap_handle_t heap;
+    const char *end;                // end of the region
+    bool retired;                   // esp_console_deinit was called, nothing is allocated from it anymore
+} console_pool_t;
+
+/** pool the console allocates from, NULL if there is none */
+static console_pool_t *s_pool;
+
+/** all the pools still holding blocks, s_pool first */
+static console_pool_t *s_pools;
+
+/* Return the pool holding ptr, or NULL. Called with s_alloc_lock taken. */
+static console_pool_t *pool_find(const void *ptr)
+{
+    for (console_pool_t *pool = s_pools; pool != NULL; pool = pool->next) {
+        if ((const char *) ptr > (const char *) pool && (const char *) ptr < pool->end) {
+            return pool;
+        }
+    }
+    return NULL;
+}
+
+/* Free the pool if it was retired and holds no block anymore. Called with s_alloc_lock taken. */
+static void pool_release_if_unused(console_pool_t *pool)
+{
+    if (!pool->retired) {
+        return;
+    }
+    multi_heap_info_t info;
+    multi_heap_get_info(pool->heap, &info);
+    if (info.allocated_blocks > 0) {
+        return;
+    }
+    console_pool_t **it = &s_pools;
+    while (*it != pool) {
+        it = &(*it)->next;
+    }
+    *it = pool->next;
+    heap_caps_free(pool);
+}
+
+/* Create the pool the console allocates from. Called with s_alloc_lock taken. */
+static esp_err_t pool_create(size_t size, uint32_t caps)
+{
+    if (size <= sizeof(console_pool_t)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    console_pool_t *pool = heap_caps_malloc(size, caps);
+    if (pool == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    pool->heap = multi_heap_register(pool + 1, size - sizeof(console_pool_t));
+    if (pool->heap == NULL) {
+        heap_caps_free(pool);
+        return ESP_ERR_INVALID_ARG;
+    }
+    pool->end = (const char *) pool + size;
+    pool->retired = false;
+    pool->next = s_pools;
+    s_pools = pool;
+    s_pool = pool;
+    return ESP_OK;
+}
+#endif // !CONFIG_IDF_TARGET_LINUX
+
+esp_err_t esp_console_alloc_init(const esp_console_config_t *config)
+{
+    const esp_console_allocator_t *allocator = config->allocator;
+    if (allocator && (config->pool_size > 0 || !allocator->malloc || !allocator->realloc || !allocator->free)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+#if CONFIG_IDF_TARGET_LINUX
+    if (config->pool_size > 0) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+#endif
+    if (s_alloc_lock == NULL) {
+        s_alloc_lock = xSemaphoreCreateMutexStatic(&s_alloc_lock_buf);
+    }
+    alloc_lock();
+#if !CONFIG_IDF_TARGET_LINUX
+    if (config->pool_size > 0) {
+        esp_err_t err = pool_create(config->pool_size, config->heap_alloc_caps);
+        if (err != ESP_OK) {
+            alloc_unlock();
+            return err;
+        }
+    }
+#endif
+    s_caps = config->heap_alloc_caps;
+    if (allocator) {
+        s_allocator = *allocator;
+    } else {
+        memset(&s_allocator, 0, sizeof(s_allocator));
+    }
+    linenoiseSetAllocator(esp_console_malloc, esp_console_realloc, esp_console_free);
+    arg_set_allocator(esp_console_malloc, esp_console_realloc, esp_console_free);
+    alloc_unlock();
+    return ESP_OK;
+}
+
+void esp_console_alloc_deinit(void)
+{
+    alloc_lock();
+    /* Allocate like before esp_console_init from now on */
+    s_caps = MALLOC_CAP_DEFAULT;
+    memset(&s_allocator, 0, sizeof(s_allocator));
+    bool pool_blocks = false;
+#if !CONFIG_IDF_TARGET_LINUX
+    if (s_pool) {
+        s_pool->retired = true;
+        pool_release_if_unused(s_pool);
+        s_pool = NULL;
+    }
+    pool_blocks = (s_pools != NULL);
+#endif
+    /* The blocks still held in retired pools must be freed into them: the console
+     * functions are kept then, they allocate like the defaults do otherwise */
+    if (!pool_blocks) {
+        linenoiseSetAllocator(NULL, NULL, NULL);
+        arg_set_allocator(NULL, NULL, NULL);
+    }
+    alloc_unlock();
+}
+
+esp_err_t esp_console_get_pool_info(size_t *free_bytes, size_t *min_free_bytes)
+{
+    if (free_bytes == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+#if CONFIG_IDF_TARGET_LINUX
+    return ESP_ERR_INVALID_STATE;
+#else
+    alloc_lock();
+    if (s_pool == NULL) {
+        alloc_unlock();
+        return ESP_ERR_INVALID_STATE;
+    }
+    *free_bytes = multi_heap_free_size(s_pool->heap);
+    if (min_free_bytes) {
+        *min_free_bytes = multi_heap_minimum_free_size(s_pool->heap);
+    }
+    alloc_unlock();
+    return ESP_OK;
+#endif
+}
+
+void *esp_console_malloc(size_t size)
+{
+    void *ptr;
+    alloc_lock();
+#if !CONFIG_IDF_TARGET_LINUX
+    if (s_pool) {
+        ptr = multi_heap_malloc(s_pool->heap, size);
+    } else
+#endif
+    if (s_allocator.malloc) {
+        ptr = s_allocator.malloc(size, s_allocator.arg);
+    } else {
+        ptr = heap_caps_malloc(size, s_caps);
+    }
+    alloc_unlock();
+    return ptr;
+}
+
+void *esp_console_calloc(size_t count, size_t size)
+{
+    if (size > 0 && count > SIZE_MAX / size) {
+        return NULL;
+    }
+    void *ptr = esp_console_malloc(count * size);
+    if (ptr) {
+        memset(ptr, 0, count * size);
+    }
+    return ptr;
+}
+
+void *esp_console_realloc(void *ptr, size_t size)
+{
+    if (ptr == NULL) {
+        return esp_console_malloc(size);
+    }
+    void *new_ptr;
+    alloc_lock();
+#if !CONFIG_IDF_TARGET_LINUX
+    console_pool_t *pool = pool_find(ptr);
+    if (pool) {
+        new_ptr = multi_heap_realloc(pool->heap, ptr, size);
+        if (size == 0) {
+            pool_release_if_unused(pool);
+        }
+    } else
+#endif
+    if (s_allocator.realloc) {
+        new_ptr = s_allocator.realloc(ptr, size, s_allocator.arg);
+    } else {
+        new_ptr = heap_caps_realloc(ptr, size, s_caps);
+    }
+    alloc_unlock();
+    return new_ptr;
+}
+
+void esp_console_free(void *ptr)
+{
+    if (ptr == NULL) {
+        return;
+    }
+    alloc_lock();
+#if !CONFIG_IDF_TARGET_LINUX
+    console_pool_t *pool = pool_find(ptr);
+    if (pool) {
+        multi_heap_free(pool->heap, ptr);
+        pool_release_if_unused(pool);
+    } else
+#endif
+    if (s_allocator.free) {
+        s_allocator.free(ptr, s_allocator.arg);
+    } else {
+        heap_caps_free(ptr);
+    }
+    alloc_unlock();
+}
+
+/* Buffer of a stream opened by esp_console_open_memstream */
+typedef struct {
+    char **buf;
+    size_t *len;
+    size_t size;                    // bytes allocated for *buf
+} memstream_t;
+
+static ssize_t memstream_write(void *cookie, const char *data, size_t size)
+{
+    memstream_t *ms = (memstream_t *) cookie;
+    const size_t needed = *ms->len + size + 1;
+    if (needed > ms->size) {
+        const size_t new_size = MAX(MAX(ms->size * 2, needed), MEMSTREAM_MIN_SIZE);
+        char *new_buf = esp_console_realloc(*ms->buf, new_size);
+        if (new_buf == NULL) {
+            errno = ENOMEM;
+            return -1;
+        }
+        *ms->buf = new_buf;
+        ms->size = new_size;
+    }
+    memcpy(*ms->buf + *ms->len, data, size);
+    *ms->len += size;
+    (*ms->buf)[*ms->len] = '\0';
+    return size;
+}
+
+static int memstream_close(void *cookie)
+{
+    esp_console_free(cookie);
+    return 0;
+}
+
+FILE *esp_console_open_memstream(char **buf, size_t *len)
+{
+    memstream_t *ms = esp_console_malloc(sizeof(*ms));
+    if (ms == NULL) {
+        return NULL;
+    }
+    *buf = NULL;
+    *len = 0;
+    ms->buf = buf;
+    ms->len = len;
+    ms->size = 0;
+    const cookie_io_functions_t memstream_funcs = {
+        .write = memstream_write,
+        .close = memstream_close,
+    };
+    FILE *f = fopencookie(ms, "w", memstream_funcs);
+    if (f == NULL) {
+        esp_console_free(ms);
+        return NULL;
+    }
+    /* No stdio buffer, it would come from the system heap */
+    setvbuf(f, NULL, _IONBF, 0);
+    return f;
+}
@@ -0,0 +1,66 @@
+/*
+ * SPDX-FileCopyrightText: 2016-2021 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE     // for fopencookie
+#endif
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/param.h>
+#include "esp_err.h"
+#include "esp_console.h"
+
+static ssize_t capture_write(void *cookie, const char *data, size_t size)
+{
+    esp_console_capture_t *capture = (esp_console_capture_t *) cookie;
+    if (capture->cb) {
+        if (!capture->truncated && capture->cb(data, size, capture->arg) != ESP_OK) {
+            capture->truncated = true;
+        }
+    } else {
+        const size_t len = MIN(size, capture->buf_size - capture->len);
+        memcpy(capture->buf + capture->len, data, len);
+        capture->len += len;
+        capture->truncated |= (len < size);
+    }
+    /* Pretend the rest was written, so that the command doesn't see an error */
+    return size;
+}
+
+esp_err_t esp_console_run_capture(esp_console_context_t *ctx, const char *cmdline,
+                                  esp_console_capture_t *capture, int *cmd_ret)
+{
+    if (ctx == NULL || capture == NULL || (capture->buf == NULL && capture->cb == NULL)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    capture->len = 0;
+    capture->truncated = false;
+    const cookie_io_functions_t capture_funcs = {
+        .write = capture_write,
+    };
+    FILE *capture_file = fopencookie(capture, "w", capture_funcs);
+    if (capture_file == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    /* Output for a callback goes through the buffer a line at a time, output for
+     * the buffer is written right into it */
+    if (capture->cb && capture->buf && capture->buf_size > 0) {
+        setvbuf(capture_file, capture->buf, _IOLBF, capture->buf_size);
+    } else {
+        setvbuf(capture_file, NULL, _IONBF, 0);
+    }
+    /* Commands print to the standard streams of the calling task, point them to the capture */
+    FILE *task_out = stdout;
+    FILE *task_err = stderr;
+    stdout = capture_file;
+    stderr = capture_file;
+    esp_err_t err = esp_console_run_ctx(ctx, cmdline, cmd_ret);
+    stdout = task_out;
+    stderr = task_err;
+    fclose(capture_file);
+    return err;
+}
@@ -0,0 +1,327 @@
+/*
+ * SPDX-FileCopyrightText: 2016-2021 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_console.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "console_private.h"
+
+static const char *TAG = "console.executor";
+
+typedef enum {
+    JOB_STATE_FREE,
+    JOB_STATE_QUEUED,
+    JOB_STATE_RUNNING,
+    JOB_STATE_CANCELLED,    // cancelled while queued, the worker only calls the callback
+} job_state_t;
+
+typedef struct {
+    esp_console_job_id_t id;
+    job_state_t state;              // protected by the executor lock
+    bool cancel_requested;          // protected by the executor lock
+    TaskHandle_t worker;            // task running the job, protected by the executor lock
+    esp_console_parsed_cmd_t cmd;   // arguments point into the buffers of ctx
+    esp_console_job_done_cb_t done_cb;
+    void *done_arg;
+    esp_console_context_t *ctx;     // buffers the command line is parsed in
+    FILE *in;                       // standard streams of the task which submitted the job
+    FILE *out;
+    FILE *err;
+} console_job_t;
+
+struct esp_console_executor_s {
+    SemaphoreHandle_t lock;         // protects the state of the jobs and next_id
+    QueueHandle_t free_jobs;        // jobs in JOB_STATE_FREE state
+    QueueHandle_t pending_jobs;     // jobs to be run, NULL tells a worker to exit
+    SemaphoreHandle_t exit_sem;     // given by each worker when it exits
+    esp_console_job_id_t next_id;
+    size_t num_workers;             // number of workers created
+    TaskHandle_t *workers;
+    size_t num_jobs;
+    console_job_t jobs[];
+};
+
+static void esp_console_executor_free(esp_console_executor_t *executor);
+
+static void esp_console_worker_task(void *args)
+{
+    esp_console_executor_t *executor = (esp_console_executor_t *) args;
+    console_job_t *job;
+
+    while (xQueueReceive(executor->pending_jobs, &job, portMAX_DELAY) == pdTRUE && job != NULL) {
+        xSemaphoreTake(executor->lock, portMAX_DELAY);
+        bool cancelled = (job->state == JOB_STATE_CANCELLED);
+        if (!cancelled) {
+            job->state = JOB_STATE_RUNNING;
+            job->worker = xTaskGetCurrentTaskHandle();
+        }
+        xSemaphoreGive(executor->lock);
+
+        esp_err_t err = ESP_ERR_INVALID_STATE;
+        int cmd_ret = 0;
+        if (!cancelled) {
+            /* The command reads and prints like it would on the task which submitted it */
+            FILE *task_in = stdin;
+            FILE *task_out = stdout;
+            FILE *task_err = stderr;
+            stdin = job->in;
+            stdout = job->out;
+            stderr = job->err;
+            cmd_ret = esp_console_call(&job->cmd);
+            fflush(stdout);
+            stdin = task_in;
+            stdout = task_out;
+            stderr = task_err;
+            err = ESP_OK;
+        }
+        /* Release the job before calling back, so that the callback may submit another one */
+        esp_console_job_id_t id = job->id;
+        esp_console_job_done_cb_t done_cb = job->done_cb;
+        void *done_arg = job->done_arg;
+        xSemaphoreTake(executor->lock, portMAX_DELAY);
+        job->state = JOB_STATE_FREE;
+        job->worker = NULL;
+        job->cancel_requested = false;
+        xSemaphoreGive(executor->lock);
+        xQueueSend(executor->free_jobs, &job, 0);
+
+        if (done_cb) {
+            done_cb(id, err, cmd_ret, done_arg);
+        }
+    }
+    xSemaphoreGive(executor->exit_sem);
+    vTaskDelete(NULL);
+}
+
+esp_err_t esp_console_executor_create(const esp_console_executor_config_t *config, esp_console_executor_t **ret_executor)
+{
+    esp_err_t ret = ESP_OK;
+    esp_console_executor_t *executor = NULL;
+    if (config == NULL || ret_executor == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    *ret_executor = NULL;
+    if (config->num_workers == 0 || config->queue_len == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    executor = esp_console_calloc(1, sizeof(*executor) + config->queue_len * sizeof(console_job_t));
+    if (executor == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    executor->next_id = 1;
+    executor->lock = xSemaphoreCreateMutex();
+    executor->free_jobs = xQueueCreate(config->queue_len, sizeof(console_job_t *));
+    /* Room for every job, and for the exit requests of all the workers */
+    executor->pending_jobs = xQueueCreate(config->queue_len + config->num_workers, sizeof(console_job_t *));
+    executor->exit_sem = xSemaphoreCreateCounting(config->num_workers, 0);
+    executor->workers = esp_console_calloc(config->num_workers, sizeof(TaskHandle_t));
+    if (executor->lock == NULL || executor->free_jobs == NULL || executor->pending_jobs == NULL ||
+            executor->exit_sem == NULL || executor->workers == NULL) {
+        ret = ESP_ERR_NO_MEM;
+        goto _exit;
+    }
+
+    esp_console_context_config_t ctx_config = {
+        .max_cmdline_length = config->max_cmdline_length,
+        .max_cmdline_args = config->max_cmdline_args,
+    };
+    for (size_t i = 0; i < config->queue_len; i++) {
+        console_job_t *job = &executor->jobs[i];
+        ret = esp_console_context_create(&ctx_config, &job->ctx);
+        if (ret != ESP_OK) {
+            goto _exit;
+        }
+        executor->num_jobs++;
+        xQueueSend(executor->free_jobs, &job, 0);
+    }
+
+    BaseType_t core_id = (config->task_core_id < 0) ? tskNO_AFFINITY : config->task_core_id;
+    for (size_t i = 0; i < config->num_workers; i++) {
+        if (xTaskCreatePinnedToCore(esp_console_worker_task, "console_worker", config->task_stack_size,
+                                    executor, config->task_priority, &executor->workers[i], core_id) != pdTRUE) {
+            ESP_LOGE(TAG, "failed to create worker %d", (int) i);
+            ret = ESP_FAIL;
+            goto _exit;
+        }
+        executor->num_workers++;
+    }
+
+    *ret_executor = executor;
+    return ESP_OK;
+_exit:
+    esp_console_executor_free(executor);
+    return ret;
+}
+
+/* Stop the workers, then free everything. Queued jobs must be cancelled beforehand. */
+static void esp_console_executor_free(esp_console_executor_t *executor)
+{
+    const console_job_t *exit_request = NULL;
+    for (size_t i = 0; i < executor->num_workers; i++) {
+        xQueueSend(executor->pending_jobs, &exit_request, portMAX_DELAY);
+    }
+    for (size_t i = 0; i < executor->num_workers; i++) {
+        xSemaphoreTake(executor->exit_sem, portMAX_DELAY);
+    }
+    for (size_t i = 0; i < executor->num_jobs; i++) {
+        esp_console_context_delete(executor->jobs[i].ctx);
+    }
+    if (executor->exit_sem) {
+        vSemaphoreDelete(executor->exit_sem);
+    }
+    if (executor->pending_jobs) {
+        vQueueDelete(executor->pending_jobs);
+    }
+    if (executor->free_jobs) {
+        vQueueDelete(executor->free_jobs);
+    }
+    if (executor->lock) {
+        vSemaphoreDelete(executor->lock);
+    }
+    esp_console_free(executor->workers);
+    esp_console_free(executor);
+}
+
+esp_err_t esp_console_executor_delete(esp_console_executor_t *executor)
+{
+    if (executor == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    xSemaphoreTake(executor->lock, portMAX_DELAY);
+    for (size_t i = 0; i < executor->num_jobs; i++) {
+        if (executor->jobs[i].state == JOB_STATE_QUEUED) {
+            executor->jobs[i].state = JOB_STATE_CANCELLED;
+        }
+    }
+    xSemaphoreGive(executor->lock);
+    /* Exit requests are queued after the cancelled jobs, so the callbacks of
+     * those jobs are called before the workers exit. */
+    esp_console_executor_free(executor);
+    return ESP_OK;
+}
+
+esp_err_t esp_console_executor_submit(esp_console_executor_t *executor, const char *cmdline,
+                                      esp_console_job_done_cb_t done_cb, void *arg,
+                                      esp_console_job_id_t *ret_id)
+{
+    console_job_t *job = NULL;
+    if (executor == NULL || cmdline == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (xQueueReceive(executor->free_jobs, &job, 0) != pdTRUE) {
+        return ESP_ERR_NO_MEM;
+    }
+    /* Parsing here, in the buffers of the job, lets the caller reuse cmdline
+     * and tells it right away if the command doesn't exist. */
+    esp_err_t err = esp_console_context_parse(job->ctx, cmdline, &job->cmd);
+    if (err == ESP_OK && (job->cmd.flags & ESP_CONSOLE_CMD_FLAG_SYNC_ONLY)) {
+        err = ESP_ERR_NOT_SUPPORTED;
+    }
+    if (err != ESP_OK) {
+        xQueueSend(executor->free_jobs, &job, 0);
+        return err;
+    }
+    job->done_cb = done_cb;
+    job->done_arg = arg;
+    job->in = stdin;
+    job->out = stdout;
+    job->err = stderr;
+
+    xSemaphoreTake(executor->lock, portMAX_DELAY);
+    job->id = executor->next_id++;
+    if (executor->next_id == 0) {
+        executor->next_id = 1;
+    }
+    job->state = JOB_STATE_QUEUED;
+    esp_console_job_id_t id = job->id;
+    xSemaphoreGive(executor->lock);
+
+    /* Never blocks, the queue has room for all the jobs */
+    xQueueSend(executor->pending_jobs, &job, portMAX_DELAY);
+    if (ret_id) {
+        *ret_id = id;
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_console_executor_cancel(esp_console_executor_t *executor, esp_console_job_id_t id)
+{
+    if (executor == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    esp_err_t ret = ESP_ERR_NOT_FOUND;
+    xSemaphoreTake(executor->lock, portMAX_DELAY);
+    for (size_t i = 0; i < executor->num_jobs; i++) {
+        console_job_t *job = &executor->jobs[i];
+        if (job->id != id) {
+            continue;
+        }
+        if (job->state == JOB_STATE_QUEUED) {
+            job->state = JOB_STATE_CANCELLED;
+            job->cancel_requested = true;
+            ret = ESP_OK;
+        } else if (job->state == JOB_STATE_RUNNING || job->state == JOB_STATE_CANCELLED) {
+            job->cancel_requested = true;
+            ret = ESP_OK;
+        }
+        break;
+    }
+    xSemaphoreGive(executor->lock);
+    return ret;
+}
+
+bool esp_console_executor_is_cancelled(esp_console_executor_t *executor)
+{
+    if (executor == NULL) {
+        return false;
+    }
+    bool cancelled = false;
+    TaskHandle_t task = xTaskGetCurrentTaskHandle();
+    xSemaphoreTake(executor->lock, portMAX_DELAY);
+    for (size_t i = 0; i < executor->num_jobs; i++) {
+        const console_job_t *job = &executor->jobs[i];
+        if (job->state == JOB_STATE_RUNNING && job->worker == task) {
+            cancelled = job->cancel_requested;
+            break;
+        }
+    }
+    xSemaphoreGive(executor->lock);
+    return cancelled;
+}
+
+esp_err_t esp_console_executor_list_jobs(esp_console_executor_t *executor, esp_console_job_info_t *jobs,
+                                         size_t max_jobs, size_t *num_jobs)
+{
+    if (executor == NULL || num_jobs == NULL || (jobs == NULL && max_jobs != 0)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    size_t count = 0;
+    xSemaphoreTake(executor->lock, portMAX_DELAY);
+    for (size_t i = 0; i < executor->num_jobs; i++) {
+        const console_job_t *job = &executor->jobs[i];
+        if (job->state == JOB_STATE_FREE) {
+            continue;
+        }
+        if (count < max_jobs) {
+            jobs[count].id = job->id;
+            jobs[count].state = (job->state == JOB_STATE_RUNNING) ? ESP_CONSOLE_JOB_RUNNING : ESP_CONSOLE_JOB_QUEUED;
+            jobs[count].command = job->cmd.command;
+            jobs[count].cancel_requested = job->cancel_requested;
+        }
+        count++;
+    }
+    xSemaphoreGive(executor->lock);
+    *num_jobs = count;
+    return ESP_OK;
+}
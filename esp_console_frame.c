@@ -0,0 +1,204 @@
+/*
+ * SPDX-FileCopyrightText: 2016-2021 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "esp_err.h"
+#include "esp_console.h"
+
+/* CRC-16/CCITT-FALSE (polynomial 0x1021, initial value 0xffff), a nibble at a time */
+static const uint16_t s_crc16_table[16] = {
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50a5, 0x60c6, 0x70e7,
+    0x8108, 0x9129, 0xa14a, 0xb16b, 0xc18c, 0xd1ad, 0xe1ce, 0xf1ef,
+};
+
+static uint16_t frame_crc16(const uint8_t *data, size_t len)
+{
+    uint16_t crc = 0xffff;
+    for (size_t i = 0; i < len; i++) {
+        crc = (crc << 4) ^ s_crc16_table[(crc >> 12) ^ (data[i] >> 4)];
+        crc = (crc << 4) ^ s_crc16_table[(crc >> 12) ^ (data[i] & 0xf)];
+    }
+    return crc;
+}
+
+/* COBS encoder fed one byte at a time. A block is a code byte followed by
+ * code - 1 non-zero bytes, and stands for these bytes followed by a zero,
+ * except for blocks of 254 bytes and for the last block. */
+typedef struct {
+    uint8_t *buf;
+    size_t code_pos;    // where the code of the current block goes
+    size_t len;
+} cobs_encoder_t;
+
+static void cobs_start(cobs_encoder_t *enc, uint8_t *buf)
+{
+    enc->buf = buf;
+    enc->code_pos = 0;
+    enc->len = 1;
+}
+
+/* The encoder writes at most 1 + n / 254 bytes ahead of the n bytes it was fed,
+ * so the input may be in the same buffer, that far after the output. */
+static void cobs_put(cobs_encoder_t *enc, uint8_t byte)
+{
+    if (byte != 0) {
+        enc->buf[enc->len++] = byte;
+    }
+    if (byte == 0 || enc->len - enc->code_pos == 0xff) {
+        enc->buf[enc->code_pos] = enc->len - enc->code_pos;
+        enc->code_pos = enc->len++;
+    }
+}
+
+static size_t cobs_finish(cobs_encoder_t *enc)
+{
+    enc->buf[enc->code_pos] = enc->len - enc->code_pos;
+    enc->buf[enc->len++] = 0;
+    return enc->len;
+}
+
+static esp_err_t cobs_decode(uint8_t *buf, size_t len, size_t *ret_len)
+{
+    size_t in = 0;
+    size_t out = 0;
+    while (in < len) {
+        const uint8_t code = buf[in++];
+        if (code == 0 || code - 1 > len - in) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        memmove(buf + out, buf + in, code - 1);
+        in += code - 1;
+        out += code - 1;
+        if (code != 0xff && in < len) {
+            buf[out++] = 0;
+        }
+    }
+    *ret_len = out;
+    return ESP_OK;
+}
+
+static void put_le32(uint8_t *buf, uint32_t value)
+{
+    buf[0] = value;
+    buf[1] = value >> 8;
+    buf[2] = value >> 16;
+    buf[3] = value >> 24;
+}
+
+esp_err_t esp_console_frame_encode(uint8_t type, uint8_t seq, const void *data, size_t data_len,
+                                   uint8_t *frame, size_t frame_size, size_t *ret_len)
+{
+    if (frame == NULL || ret_len == NULL || (data == NULL && data_len != 0)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (frame_size < ESP_CONSOLE_FRAME_REQUEST_LEN(data_len)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    const uint8_t header[ESP_CONSOLE_FRAME_HEADER_LEN] = { type, seq };
+    uint16_t crc = 0xffff;
+    cobs_encoder_t enc;
+    cobs_start(&enc, frame);
+    for (size_t i = 0; i < sizeof(header) + data_len; i++) {
+        const uint8_t byte = (i < sizeof(header)) ? header[i] : ((const uint8_t *) data)[i - sizeof(header)];
+        crc = (crc << 4) ^ s_crc16_table[(crc >> 12) ^ (byte >> 4)];
+        crc = (crc << 4) ^ s_crc16_table[(crc >> 12) ^ (byte & 0xf)];
+        cobs_put(&enc, byte);
+    }
+    cobs_put(&enc, crc & 0xff);
+    cobs_put(&enc, crc >> 8);
+    *ret_len = cobs_finish(&enc);
+    return ESP_OK;
+}
+
+esp_err_t esp_console_frame_decode(uint8_t *frame, size_t frame_len, uint8_t *ret_type, uint8_t *ret_seq,
+                                   uint8_t **ret_data, size_t *ret_data_len)
+{
+    if (frame == NULL || ret_type == NULL || ret_seq == NULL || ret_data == NULL || ret_data_len == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    size_t len;
+    esp_err_t err = cobs_decode(frame, frame_len, &len);
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (len < ESP_CONSOLE_FRAME_HEADER_LEN + ESP_CONSOLE_FRAME_CRC_LEN) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    len -= ESP_CONSOLE_FRAME_CRC_LEN;
+    if (frame_crc16(frame, len) != (frame[len] | (frame[len + 1] << 8))) {
+        return ESP_ERR_INVALID_CRC;
+    }
+    /* The CRC isn't needed anymore, terminate the data in its place */
+    frame[len] = 0;
+    *ret_type = frame[0];
+    *ret_seq = frame[1];
+    *ret_data = frame + ESP_CONSOLE_FRAME_HEADER_LEN;
+    *ret_data_len = len - ESP_CONSOLE_FRAME_HEADER_LEN;
+    return ESP_OK;
+}
+
+esp_err_t esp_console_frame_run(esp_console_context_t *ctx, uint8_t *frame, size_t frame_len,
+                                uint8_t *resp, size_t resp_size, size_t *ret_resp_len, uint8_t *ret_type)
+{
+    if (ctx == NULL || frame == NULL || resp == NULL || ret_resp_len == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (resp_size < ESP_CONSOLE_FRAME_RESPONSE_LEN(0)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    /* The payload is built at the end of the response buffer and encoded in
+     * place, far enough after the start for the encoder not to catch up */
+    size_t payload_max = resp_size - 2 - (resp_size - 2) / 255;
+    while (ESP_CONSOLE_FRAME_ENCODED_LEN(payload_max) > resp_size) {
+        payload_max--;
+    }
+    uint8_t *payload = resp + resp_size - 1 - payload_max;
+    const size_t result_pos = ESP_CONSOLE_FRAME_HEADER_LEN;
+    const size_t output_pos = result_pos + ESP_CONSOLE_FRAME_RESULT_LEN;
+    /* The output of the command is written in place in the response */
+    esp_console_capture_t capture = {
+        .buf = (char *) payload + output_pos,
+        .buf_size = payload_max - output_pos - ESP_CONSOLE_FRAME_CRC_LEN,
+    };
+
+    uint8_t type;
+    uint8_t seq;
+    uint8_t *data;
+    size_t data_len;
+    int cmd_ret = 0;
+    esp_err_t err = esp_console_frame_decode(frame, frame_len, &type, &seq, &data, &data_len);
+    if (err != ESP_OK) {
+        type = ESP_CONSOLE_FRAME_TYPE_ERROR;
+        seq = 0;
+    } else if (type == ESP_CONSOLE_FRAME_TYPE_RUN) {
+        err = esp_console_run_capture(ctx, (const char *) data, &capture, &cmd_ret);
+    } else if (type != ESP_CONSOLE_FRAME_TYPE_EXIT) {
+        err = ESP_ERR_NOT_SUPPORTED;
+    }
+    if (ret_type) {
+        *ret_type = type;
+    }
+
+    payload[0] = type | ESP_CONSOLE_FRAME_RESPONSE;
+    payload[1] = seq;
+    put_le32(payload + result_pos, err);
+    put_le32(payload + result_pos + 4, cmd_ret);
+    payload[result_pos + 8] = capture.truncated ? ESP_CONSOLE_FRAME_FLAG_TRUNCATED : 0;
+    size_t payload_len = output_pos + capture.len;
+    const uint16_t crc = frame_crc16(payload, payload_len);
+    payload[payload_len++] = crc & 0xff;
+    payload[payload_len++] = crc >> 8;
+
+    cobs_encoder_t enc;
+    cobs_start(&enc, resp);
+    for (size_t i = 0; i < payload_len; i++) {
+        cobs_put(&enc, payload[i]);
+    }
+    *ret_resp_len = cobs_finish(&enc);
+    return ESP_OK;
+}
@@ -0,0 +1,26 @@
+/*
+ * SPDX-FileCopyrightText: 2016-2021 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "console_private.h"
+#include "linenoise/linenoise.h"
+
+esp_err_t esp_console_history_write(const char *path, uint32_t max_len, bool append,
+                                    uint32_t unsaved, uint32_t *file_lines)
+{
+    int res;
+    if (append && *file_lines + unsaved < 2 * max_len) {
+        res = linenoiseHistoryAppend(path, unsaved);
+        *file_lines += unsaved;
+    } else {
+        /* Rewrite the file, dropping the lines evicted from the history */
+        res = linenoiseHistorySave(path);
+        *file_lines = max_len;
+    }
+    return res == 0 ? ESP_OK : ESP_FAIL;
+}
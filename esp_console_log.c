@@ -0,0 +1,300 @@
+/*
+ * SPDX-FileCopyrightText: 2016-2021 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <string.h>
+#include <inttypes.h>
+#include <sys/param.h>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_console.h"
+#include "console_private.h"
+#include "linenoise/linenoise.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+#define LOG_BATCH_LINE_LEN              (256)   // longest log line kept, longer ones are truncated
+#define LOG_BATCH_DEFAULT_COALESCE_MS   (100)   // used if coalesce_ms is 0
+
+typedef uint16_t log_record_len_t;              // each log line kept is preceded by its length
+
+/* Log lines kept while a line is edited. Lock order: s_batch.lock, then stdout_taken_sem. */
+typedef struct {
+    SemaphoreHandle_t lock;         // protects the fields below
+    StaticSemaphore_t lock_buf;
+    vprintf_like_t prev_vprintf;    // prints the logs when no line is edited
+    uint8_t *ring;                  // NULL if batching isn't started
+    size_t size;                    // size of ring
+    size_t tail;                    // start of the oldest log line kept
+    size_t used;                    // bytes kept, lengths included
+    uint32_t dropped;               // log lines dropped since the last flush
+    TickType_t pending_since;       // when the oldest log line kept (or dropped) was logged
+    TickType_t coalesce_ticks;
+    TickType_t block_ticks;
+    esp_console_output_policy_t policy;
+    struct linenoiseState *ls;      // line being edited, NULL if none
+    char line[LOG_BATCH_LINE_LEN];  // log line being added
+} log_batch_t;
+
+static log_batch_t s_batch;
+
+static bool log_batch_pending(void)
+{
+    return s_batch.used > 0 || s_batch.dropped > 0;
+}
+
+static void ring_put(const void *data, size_t len)
+{
+    const size_t head = (s_batch.tail + s_batch.used) % s_batch.size;
+    const size_t first = MIN(len, s_batch.size - head);
+    memcpy(s_batch.ring + head, data, first);
+    memcpy(s_batch.ring, (const uint8_t *) data + first, len - first);
+    s_batch.used += len;
+}
+
+static void ring_get(void *data, size_t len)
+{
+    const size_t first = MIN(len, s_batch.size - s_batch.tail);
+    memcpy(data, s_batch.ring + s_batch.tail, first);
+    memcpy((uint8_t *) data + first, s_batch.ring, len - first);
+    s_batch.tail = (s_batch.tail + len) % s_batch.size;
+    s_batch.used -= len;
+}
+
+/* Write the oldest log line kept to out (or nowhere if NULL) and remove it. Returns its last character. */
+static char ring_take_record(FILE *out)
+{
+    log_record_len_t len;
+    ring_get(&len, sizeof(len));
+    const size_t first = MIN(len, s_batch.size - s_batch.tail);
+    const char last = (char) s_batch.ring[(s_batch.tail + len - 1) % s_batch.size];
+    if (out) {
+        fwrite(s_batch.ring + s_batch.tail, 1, first, out);
+        fwrite(s_batch.ring, 1, len - first, out);
+    }
+    s_batch.tail = (s_batch.tail + len) % s_batch.size;
+    s_batch.used -= len;
+    return last;
+}
+
+/* Keep the log line formatted in s_batch.line, applying the drop policies.
+ * Returns false if there is no room for it. Called with the lock taken. */
+static bool log_batch_put(size_t len)
+{
+    len = MIN(len, s_batch.size - sizeof(log_record_len_t));
+    const size_t needed = len + sizeof(log_record_len_t);
+    if (s_batch.policy == ESP_CONSOLE_OUTPUT_DROP_OLDEST) {
+        while (s_batch.size - s_batch.used < needed) {
+            ring_take_record(NULL);
+            s_batch.dropped++;
+        }
+    }
+    if (s_batch.size - s_batch.used < needed) {
+        return false;
+    }
+    if (!log_batch_pending()) {
+        s_batch.pending_since = xTaskGetTickCount();
+    }
+    const log_record_len_t record_len = (log_record_len_t) len;
+    ring_put(&record_len, sizeof(record_len));
+    ring_put(s_batch.line, len);
+    return true;
+}
+
+static void log_batch_drop(void)
+{
+    if (!log_batch_pending()) {
+        s_batch.pending_since = xTaskGetTickCount();
+    }
+    s_batch.dropped++;
+}
+
+/* Write all the logs kept to the output of the line, hiding the line if redraw is set.
+ * Called with the lock and stdout_taken_sem taken. */
+static void log_batch_print(bool redraw)
+{
+    struct linenoiseState *ls = s_batch.ls;
+    if (redraw) {
+        linenoiseHide(ls);
+    }
+    char last = '\n';
+    while (s_batch.used > 0) {
+        last = ring_take_record(ls->out);
+    }
+    if (last != '\n') {
+        fputc('\n', ls->out);
+    }
+    if (s_batch.dropped > 0) {
+        fprintf(ls->out, "(%" PRIu32 " log lines dropped)\n", s_batch.dropped);
+        s_batch.dropped = 0;
+    }
+    if (redraw) {
+        linenoiseShow(ls);
+    } else {
+        fflush(ls->out);
+    }
+}
+
+/* Print the logs kept if the line editor is free within wait. Called with the lock taken. */
+static bool log_batch_try_print(TickType_t wait)
+{
+    if (xSemaphoreTake(stdout_taken_sem, wait) != pdTRUE) {
+        return false;
+    }
+    log_batch_print(true);
+    xSemaphoreGive(stdout_taken_sem);
+    return true;
+}
+
+static int log_batch_vprintf(const char *fmt, va_list args)
+{
+    xSemaphoreTake(s_batch.lock, portMAX_DELAY);
+    if (s_batch.ls == NULL) {
+        vprintf_like_t prev_vprintf = s_batch.prev_vprintf;
+        xSemaphoreGive(s_batch.lock);
+        return prev_vprintf(fmt, args);
+    }
+    const int ret = vsnprintf(s_batch.line, sizeof(s_batch.line), fmt, args);
+    if (ret < 0) {
+        xSemaphoreGive(s_batch.lock);
+        return ret;
+    }
+    size_t len = MIN((size_t) ret, sizeof(s_batch.line) - 1);
+    if (len == 0) {
+        xSemaphoreGive(s_batch.lock);
+        return ret;
+    }
+    if (len < (size_t) ret) {
+        s_batch.line[len - 1] = '\n';
+    }
+    if (!log_batch_put(len)) {
+        if (s_batch.policy == ESP_CONSOLE_OUTPUT_BLOCK && log_batch_try_print(s_batch.block_ticks)) {
+            log_batch_put(len);
+        } else {
+            log_batch_drop();
+        }
+    }
+    if (xTaskGetTickCount() - s_batch.pending_since >= s_batch.coalesce_ticks) {
+        /* Don't wait for the line editor, the task editing the line prints the logs once it's done */
+        log_batch_try_print(0);
+    }
+    xSemaphoreGive(s_batch.lock);
+    return ret;
+}
+
+esp_err_t esp_console_log_batch_start(const esp_console_log_batch_config_t *config)
+{
+    if (config == NULL || config->buffer_size <= sizeof(log_record_len_t) ||
+            config->policy > ESP_CONSOLE_OUTPUT_DROP_NEWEST) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (s_batch.lock == NULL) {
+        s_batch.lock = xSemaphoreCreateMutexStatic(&s_batch.lock_buf);
+    }
+    uint8_t *ring = esp_console_malloc(config->buffer_size);
+    if (ring == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    xSemaphoreTake(s_batch.lock, portMAX_DELAY);
+    if (s_batch.ring != NULL) {
+        xSemaphoreGive(s_batch.lock);
+        esp_console_free(ring);
+        return ESP_ERR_INVALID_STATE;
+    }
+    s_batch.ring = ring;
+    s_batch.size = config->buffer_size;
+    s_batch.tail = 0;
+    s_batch.used = 0;
+    s_batch.dropped = 0;
+    s_batch.coalesce_ticks = pdMS_TO_TICKS(config->coalesce_ms ? config->coalesce_ms : LOG_BATCH_DEFAULT_COALESCE_MS);
+    s_batch.block_ticks = pdMS_TO_TICKS(config->block_timeout_ms);
+    s_batch.policy = config->policy;
+    s_batch.ls = NULL;
+    /* Logging waits for the lock, so prev_vprintf is set before it is used */
+    s_batch.prev_vprintf = esp_log_set_vprintf(log_batch_vprintf);
+    xSemaphoreGive(s_batch.lock);
+    return ESP_OK;
+}
+
+esp_err_t esp_console_log_batch_stop(void)
+{
+    if (s_batch.lock == NULL || s_batch.ring == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    esp_console_log_batch_end();
+    /* A task may still be in log_batch_vprintf, which passes the logs to prev_vprintf from now on */
+    esp_log_set_vprintf(s_batch.prev_vprintf);
+    xSemaphoreTake(s_batch.lock, portMAX_DELAY);
+    uint8_t *ring = s_batch.ring;
+    s_batch.ring = NULL;
+    xSemaphoreGive(s_batch.lock);
+    esp_console_free(ring);
+    return ESP_OK;
+}
+
+esp_err_t esp_console_log_batch_begin(struct linenoiseState *ls)
+{
+    if (ls == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (linenoiseIsDumbMode()) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    if (s_batch.lock == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    esp_err_t ret = ESP_OK;
+    xSemaphoreTake(s_batch.lock, portMAX_DELAY);
+    if (s_batch.ring == NULL || s_batch.ls != NULL) {
+        ret = ESP_ERR_INVALID_STATE;
+    } else {
+        s_batch.ls = ls;
+    }
+    xSemaphoreGive(s_batch.lock);
+    return ret;
+}
+
+void esp_console_log_batch_end(void)
+{
+    if (s_batch.lock == NULL) {
+        return;
+    }
+    xSemaphoreTake(s_batch.lock, portMAX_DELAY);
+    if (s_batch.ls != NULL) {
+        if (log_batch_pending()) {
+            xSemaphoreTake(stdout_taken_sem, portMAX_DELAY);
+            log_batch_print(false);
+            xSemaphoreGive(stdout_taken_sem);
+        }
+        s_batch.ls = NULL;
+    }
+    xSemaphoreGive(s_batch.lock);
+}
+
+void esp_console_log_batch_flush(bool force, uint32_t *ret_wait_ms)
+{
+    uint32_t wait_ms = UINT32_MAX;
+    if (s_batch.lock == NULL) {
+        goto _exit;
+    }
+    xSemaphoreTake(s_batch.lock, portMAX_DELAY);
+    if (s_batch.ls != NULL && log_batch_pending()) {
+        const TickType_t waited = xTaskGetTickCount() - s_batch.pending_since;
+        if (force || waited >= s_batch.coalesce_ticks) {
+            log_batch_try_print(portMAX_DELAY);
+        } else {
+            wait_ms = (s_batch.coalesce_ticks - waited) * portTICK_PERIOD_MS;
+        }
+    }
+    xSemaphoreGive(s_batch.lock);
+_exit:
+    if (ret_wait_ms) {
+        *ret_wait_ms = wait_ms;
+    }
+}
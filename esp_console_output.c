@@ -0,0 +1,330 @@
+/*
+ * SPDX-FileCopyrightText: 2016-2021 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE     // for fopencookie
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/param.h>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_console.h"
+#include "console_private.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+static const char *TAG = "console.output";
+
+/* The buffer is a ring: the bytes waiting to be sent start at tail, and the
+ * chunk being sent by the writer task, if any, is right before it. Writers only
+ * copy to the free part, so the writer task sends from the buffer directly. */
+struct esp_console_output_s {
+    SemaphoreHandle_t lock;         // protects the ring and the statistics
+    SemaphoreHandle_t data_sem;     // given when there is data to send or the task must exit
+    SemaphoreHandle_t room_sem;     // given once to each waiter when a chunk has been sent
+    SemaphoreHandle_t exit_sem;     // given by the writer task when it exits
+    TaskHandle_t task;
+    FILE *stream;
+    int fd;
+    size_t chunk_size;
+    esp_console_output_policy_t policy;
+    uint32_t block_timeout_ms;
+    bool exit;                      // protected by lock
+    size_t waiters;                 // tasks waiting on room_sem, protected by lock
+    size_t signalled;               // times room_sem was given and not taken yet, protected by lock
+    size_t tail;                    // protected by lock
+    size_t len;                     // bytes waiting to be sent, protected by lock
+    size_t sending;                 // bytes of the chunk being sent, protected by lock
+    esp_console_output_stats_t stats;   // protected by lock
+    size_t size;
+    uint8_t buf[];
+};
+
+static void esp_console_output_free(esp_console_output_t *output);
+
+static size_t output_room(const esp_console_output_t *output)
+{
+    return output->size - output->len - output->sending;
+}
+
+/* Wake up the tasks waiting for room in the buffer. Waiters which were given
+ * room_sem since they started waiting are not given it again, so that no
+ * token is left for the next waits. Called with the lock taken. */
+static void output_wake_waiters(esp_console_output_t *output)
+{
+    for (; output->signalled < output->waiters; output->signalled++) {
+        xSemaphoreGive(output->room_sem);
+    }
+}
+
+/* Wait until the writer task has sent a chunk, or until deadline. Called with
+ * the lock taken, which is released while waiting. Returns false on timeout. */
+static bool output_wait_room(esp_console_output_t *output, bool forever, TickType_t deadline)
+{
+    TickType_t wait = portMAX_DELAY;
+    if (!forever) {
+        const TickType_t now = xTaskGetTickCount();
+        if ((int32_t)(deadline - now) <= 0) {
+            return false;
+        }
+        wait = deadline - now;
+    }
+    output->waiters++;
+    xSemaphoreGive(output->lock);
+    bool woken = (xSemaphoreTake(output->room_sem, wait) == pdTRUE);
+    xSemaphoreTake(output->lock, portMAX_DELAY);
+    output->waiters--;
+    if (woken) {
+        output->signalled--;
+    } else if (output->signalled > output->waiters) {
+        /* room_sem was given for this task after it timed out, each other
+         * waiter takes one at most, so it is still there */
+        xSemaphoreTake(output->room_sem, 0);
+        output->signalled--;
+        woken = true;
+    }
+    return woken || forever;
+}
+
+/* Copy data after the bytes waiting in the ring, which must have room for it.
+ * Called with the lock taken. */
+static void output_copy_in(esp_console_output_t *output, const uint8_t *data, size_t len)
+{
+    const size_t head = (output->tail + output->len) % output->size;
+    const size_t first = MIN(len, output->size - head);
+    memcpy(output->buf + head, data, first);
+    memcpy(output->buf, data + first, len - first);
+    output->len += len;
+    output->stats.max_used = MAX(output->stats.max_used, output->len + output->sending);
+}
+
+static void esp_console_output_task(void *args)
+{
+    esp_console_output_t *output = (esp_console_output_t *) args;
+
+    xSemaphoreTake(output->lock, portMAX_DELAY);
+    while (true) {
+        if (output->len == 0) {
+            if (output->exit) {
+                break;
+            }
+            xSemaphoreGive(output->lock);
+            xSemaphoreTake(output->data_sem, portMAX_DELAY);
+            xSemaphoreTake(output->lock, portMAX_DELAY);
+            continue;
+        }
+        /* Send at most a chunk, and only up to the end of the buffer, so that
+         * it is a single write from the buffer itself */
+        const size_t start = output->tail;
+        const size_t chunk = MIN(MIN(output->len, output->size - start), output->chunk_size);
+        output->tail = (start + chunk) % output->size;
+        output->len -= chunk;
+        output->sending = chunk;
+        xSemaphoreGive(output->lock);
+
+        size_t sent = 0;
+        while (sent < chunk) {
+            const ssize_t written = write(output->fd, output->buf + start + sent, chunk - sent);
+            if (written <= 0) {
+                break;
+            }
+            sent += written;
+        }
+
+        xSemaphoreTake(output->lock, portMAX_DELAY);
+        output->sending = 0;
+        output->stats.bytes_sent += sent;
+        /* Don't retry on errors, the writers would wait for the device forever */
+        output->stats.bytes_dropped += chunk - sent;
+        output_wake_waiters(output);
+    }
+    xSemaphoreGive(output->lock);
+    xSemaphoreGive(output->exit_sem);
+    vTaskDelete(NULL);
+}
+
+size_t esp_console_output_write(esp_console_output_t *output, const void *data, size_t len)
+{
+    if (output == NULL || (data == NULL && len != 0)) {
+        return 0;
+    }
+    const uint8_t *bytes = (const uint8_t *) data;
+    const bool forever = (output->block_timeout_ms == 0);
+    const TickType_t deadline = xTaskGetTickCount() + pdMS_TO_TICKS(output->block_timeout_ms);
+    size_t added = 0;
+
+    xSemaphoreTake(output->lock, portMAX_DELAY);
+    if (output->policy == ESP_CONSOLE_OUTPUT_DROP_OLDEST && len > output_room(output)) {
+        /* Make room by dropping the oldest bytes not sent yet. If that's not
+         * enough, only the end of the data is kept. */
+        const size_t drop = MIN(len - output_room(output), output->len);
+        output->tail = (output->tail + drop) % output->size;
+        output->len -= drop;
+        output->stats.bytes_dropped += drop;
+        if (len > output_room(output)) {
+            const size_t skip = len - output_room(output);
+            output->stats.bytes_dropped += skip;
+            bytes += skip;
+            len -= skip;
+        }
+    }
+    while (len > 0) {
+        const size_t part = MIN(len, output_room(output));
+        if (part > 0) {
+            output_copy_in(output, bytes, part);
+            xSemaphoreGive(output->data_sem);
+            bytes += part;
+            len -= part;
+            added += part;
+        }
+        if (len == 0) {
+            break;
+        }
+        if (output->policy != ESP_CONSOLE_OUTPUT_BLOCK || !output_wait_room(output, forever, deadline)) {
+            output->stats.bytes_dropped += len;
+            break;
+        }
+    }
+    xSemaphoreGive(output->lock);
+    return added;
+}
+
+esp_err_t esp_console_output_flush(esp_console_output_t *output, uint32_t timeout_ms)
+{
+    if (output == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    const TickType_t deadline = xTaskGetTickCount() + pdMS_TO_TICKS(timeout_ms);
+    esp_err_t ret = ESP_OK;
+    xSemaphoreTake(output->lock, portMAX_DELAY);
+    while (output->len > 0 || output->sending > 0) {
+        if (!output_wait_room(output, false, deadline)) {
+            ret = ESP_ERR_TIMEOUT;
+            break;
+        }
+    }
+    xSemaphoreGive(output->lock);
+    return ret;
+}
+
+esp_err_t esp_console_output_get_stats(esp_console_output_t *output, esp_console_output_stats_t *ret_stats)
+{
+    if (output == NULL || ret_stats == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    xSemaphoreTake(output->lock, portMAX_DELAY);
+    *ret_stats = output->stats;
+    xSemaphoreGive(output->lock);
+    return ESP_OK;
+}
+
+static ssize_t output_stream_write(void *cookie, const char *data, size_t size)
+{
+    esp_console_output_write((esp_console_output_t *) cookie, data, size);
+    /* Dropped bytes are counted in the statistics, don't make the caller see an error */
+    return size;
+}
+
+FILE *esp_console_output_get_stream(esp_console_output_t *output)
+{
+    return output ? output->stream : NULL;
+}
+
+esp_err_t esp_console_output_create(const esp_console_output_config_t *config, esp_console_output_t **ret_output)
+{
+    esp_err_t ret = ESP_OK;
+    esp_console_output_t *output = NULL;
+    if (config == NULL || ret_output == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    *ret_output = NULL;
+    /* A chunk being sent must leave room for the writers */
+    if (config->fd < 0 || config->chunk_size == 0 || config->chunk_size > config->buffer_size / 2) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    output = esp_console_calloc(1, sizeof(*output) + config->buffer_size);
+    if (output == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    output->fd = config->fd;
+    output->size = config->buffer_size;
+    output->chunk_size = config->chunk_size;
+    output->policy = config->policy;
+    output->block_timeout_ms = config->block_timeout_ms;
+    output->lock = xSemaphoreCreateMutex();
+    output->data_sem = xSemaphoreCreateBinary();
+    output->room_sem = xSemaphoreCreateCounting(UINT16_MAX, 0);
+    output->exit_sem = xSemaphoreCreateBinary();
+    const cookie_io_functions_t stream_funcs = {
+        .write = output_stream_write,
+    };
+    output->stream = fopencookie(output, "w", stream_funcs);
+    if (output->lock == NULL || output->data_sem == NULL || output->room_sem == NULL ||
+            output->exit_sem == NULL || output->stream == NULL) {
+        ret = ESP_ERR_NO_MEM;
+        goto _exit;
+    }
+    /* The ring is the buffer, each write to the stream goes there */
+    setvbuf(output->stream, NULL, _IONBF, 0);
+
+    BaseType_t core_id = (config->task_core_id < 0) ? tskNO_AFFINITY : config->task_core_id;
+    if (xTaskCreatePinnedToCore(esp_console_output_task, "console_output", config->task_stack_size,
+                                output, config->task_priority, &output->task, core_id) != pdTRUE) {
+        ESP_LOGE(TAG, "failed to create writer task");
+        ret = ESP_FAIL;
+        goto _exit;
+    }
+
+    *ret_output = output;
+    return ESP_OK;
+_exit:
+    esp_console_output_free(output);
+    return ret;
+}
+
+/* Stop the writer task once it has sent everything, then free everything */
+static void esp_console_output_free(esp_console_output_t *output)
+{
+    if (output->stream) {
+        fclose(output->stream);
+    }
+    if (output->task) {
+        xSemaphoreTake(output->lock, portMAX_DELAY);
+        output->exit = true;
+        xSemaphoreGive(output->lock);
+        xSemaphoreGive(output->data_sem);
+        xSemaphoreTake(output->exit_sem, portMAX_DELAY);
+    }
+    if (output->exit_sem) {
+        vSemaphoreDelete(output->exit_sem);
+    }
+    if (output->room_sem) {
+        vSemaphoreDelete(output->room_sem);
+    }
+    if (output->data_sem) {
+        vSemaphoreDelete(output->data_sem);
+    }
+    if (output->lock) {
+        vSemaphoreDelete(output->lock);
+    }
+    esp_console_free(output);
+}
+
+esp_err_t esp_console_output_delete(esp_console_output_t *output)
+{
+    if (output == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    /* The writer task sends what is left in the buffer before exiting */
+    esp_console_output_free(output);
+    return ESP_OK;
+}
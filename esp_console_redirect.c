@@ -0,0 +1,381 @@
+/*
+ * SPDX-FileCopyrightText: 2016-2021 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE     // for fopencookie
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/param.h>
+#include "esp_err.h"
+#include "esp_console.h"
+#include "console_private.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+#define PIPE_READ_BUFFER_SIZE   64      // stdio buffer of the read end, so that reading a line doesn't go to the pipe for each byte
+
+/* Buffer between two commands of a pipeline, a ring. Each end is a stream,
+ * and the pipe is freed once both are closed. */
+typedef struct {
+    SemaphoreHandle_t lock;         // protects the ring and the flags
+    SemaphoreHandle_t readable;     // given when data was added, or the write end closed
+    SemaphoreHandle_t writable;     // given when data was removed, or the read end closed
+    size_t ends;                    // streams not closed yet, protected by lock
+    bool reader_closed;             // protected by lock
+    bool writer_closed;             // protected by lock
+    size_t tail;                    // protected by lock
+    size_t len;                     // protected by lock
+    size_t size;
+    char read_buf[PIPE_READ_BUFFER_SIZE]; // stdio buffer of the read end, allocated with the pipe
+    uint8_t buf[];
+} console_pipe_t;
+
+/* One command of a pipeline, and the streams it is run with */
+typedef struct {
+    esp_console_parsed_cmd_t cmd;
+    const char *in_path;            // file given with '<', or NULL
+    const char *out_path;           // file given with '>' or '>>', or NULL
+    bool append;                    // out_path was given with '>>'
+    FILE *in;
+    FILE *out;
+    FILE *err;
+    bool close_in;                  // in is a file or a pipe, closed once the command returned
+    bool close_out;                 // same for out
+    int ret;
+    SemaphoreHandle_t done;         // given by the task of the command, once it returned
+} pipeline_stage_t;
+
+static void pipe_free(console_pipe_t *pipe)
+{
+    if (pipe->writable) {
+        vSemaphoreDelete(pipe->writable);
+    }
+    if (pipe->readable) {
+        vSemaphoreDelete(pipe->readable);
+    }
+    if (pipe->lock) {
+        vSemaphoreDelete(pipe->lock);
+    }
+    esp_console_free(pipe);
+}
+
+/* Wait on sem, with the lock of the pipe released meanwhile */
+static void pipe_wait(console_pipe_t *pipe, SemaphoreHandle_t sem)
+{
+    xSemaphoreGive(pipe->lock);
+    xSemaphoreTake(sem, portMAX_DELAY);
+    xSemaphoreTake(pipe->lock, portMAX_DELAY);
+}
+
+/* Block until everything was written, as not all stdio implementations write
+ * the rest of a partial write */
+static ssize_t pipe_write(void *cookie, const char *data, size_t size)
+{
+    console_pipe_t *pipe = (console_pipe_t *) cookie;
+    size_t written = 0;
+    xSemaphoreTake(pipe->lock, portMAX_DELAY);
+    while (written < size) {
+        while (pipe->len == pipe->size && !pipe->reader_closed) {
+            pipe_wait(pipe, pipe->writable);
+        }
+        if (pipe->reader_closed) {
+            xSemaphoreGive(pipe->lock);
+            errno = EPIPE;
+            return -1;
+        }
+        const size_t head = (pipe->tail + pipe->len) % pipe->size;
+        const size_t n = MIN(size - written, MIN(pipe->size - pipe->len, pipe->size - head));
+        memcpy(pipe->buf + head, data + written, n);
+        pipe->len += n;
+        written += n;
+        xSemaphoreGive(pipe->readable);
+    }
+    xSemaphoreGive(pipe->lock);
+    return written;
+}
+
+static ssize_t pipe_read(void *cookie, char *data, size_t size)
+{
+    console_pipe_t *pipe = (console_pipe_t *) cookie;
+    xSemaphoreTake(pipe->lock, portMAX_DELAY);
+    while (pipe->len == 0 && !pipe->writer_closed) {
+        pipe_wait(pipe, pipe->readable);
+    }
+    const size_t n = MIN(size, MIN(pipe->len, pipe->size - pipe->tail));
+    memcpy(data, pipe->buf + pipe->tail, n);
+    pipe->tail = (pipe->tail + n) % pipe->size;
+    pipe->len -= n;
+    xSemaphoreGive(pipe->writable);
+    xSemaphoreGive(pipe->lock);
+    /* Zero once the write end is closed and everything was read */
+    return n;
+}
+
+/* Close one end, and wake up the other so that it sees it. The semaphores are
+ * given with the lock held, as the other end may free the pipe once it is released. */
+static int pipe_close(console_pipe_t *pipe, bool *closed, SemaphoreHandle_t other_side)
+{
+    xSemaphoreTake(pipe->lock, portMAX_DELAY);
+    *closed = true;
+    const bool last = (--pipe->ends == 0);
+    if (last) {
+        xSemaphoreGive(pipe->lock);
+        pipe_free(pipe);
+        return 0;
+    }
+    xSemaphoreGive(other_side);
+    xSemaphoreGive(pipe->lock);
+    return 0;
+}
+
+static int pipe_close_read(void *cookie)
+{
+    console_pipe_t *pipe = (console_pipe_t *) cookie;
+    return pipe_close(pipe, &pipe->reader_closed, pipe->writable);
+}
+
+static int pipe_close_write(void *cookie)
+{
+    console_pipe_t *pipe = (console_pipe_t *) cookie;
+    return pipe_close(pipe, &pipe->writer_closed, pipe->readable);
+}
+
+static esp_err_t pipe_create(size_t size, FILE **ret_read, FILE **ret_write)
+{
+    console_pipe_t *pipe = esp_console_calloc(1, sizeof(*pipe) + size);
+    if (pipe == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    pipe->size = size;
+    pipe->lock = xSemaphoreCreateMutex();
+    pipe->readable = xSemaphoreCreateBinary();
+    pipe->writable = xSemaphoreCreateBinary();
+    if (pipe->lock == NULL || pipe->readable == NULL || pipe->writable == NULL) {
+        pipe_free(pipe);
+        return ESP_ERR_NO_MEM;
+    }
+    const cookie_io_functions_t read_funcs = {
+        .read = pipe_read,
+        .close = pipe_close_read,
+    };
+    const cookie_io_functions_t write_funcs = {
+        .write = pipe_write,
+        .close = pipe_close_write,
+    };
+    FILE *read_end = fopencookie(pipe, "r", read_funcs);
+    FILE *write_end = read_end ? fopencookie(pipe, "w", write_funcs) : NULL;
+    pipe->ends = (read_end != NULL) + (write_end != NULL);
+    if (write_end == NULL) {
+        if (read_end) {
+            /* Frees the pipe, the only end */
+            fclose(read_end);
+        } else {
+            pipe_free(pipe);
+        }
+        return ESP_ERR_NO_MEM;
+    }
+    /* The ring is the buffer of the write end, each write goes there */
+    setvbuf(write_end, NULL, _IONBF, 0);
+    setvbuf(read_end, pipe->read_buf, _IOFBF, sizeof(pipe->read_buf));
+    *ret_read = read_end;
+    *ret_write = write_end;
+    return ESP_OK;
+}
+
+/* Close the files and pipes of the stage */
+static void stage_close(pipeline_stage_t *stage)
+{
+    if (stage->close_in) {
+        fclose(stage->in);
+        stage->close_in = false;
+    }
+    if (stage->close_out) {
+        fclose(stage->out);
+        stage->close_out = false;
+    }
+}
+
+/* Run the command of the stage with its streams, then close them so that the
+ * commands before and after it in the pipeline see it finished */
+static void stage_run(pipeline_stage_t *stage)
+{
+    FILE *task_in = stdin;
+    FILE *task_out = stdout;
+    FILE *task_err = stderr;
+    stdin = stage->in;
+    stdout = stage->out;
+    stderr = stage->err;
+    stage->ret = esp_console_call(&stage->cmd);
+    fflush(stdout);
+    stdin = task_in;
+    stdout = task_out;
+    stderr = task_err;
+    stage_close(stage);
+}
+
+static void stage_task(void *arg)
+{
+    pipeline_stage_t *stage = (pipeline_stage_t *) arg;
+    SemaphoreHandle_t done = stage->done;
+    stage_run(stage);
+    xSemaphoreGive(done);
+    vTaskDelete(NULL);
+}
+
+/* Set the path of a redirection, which may only be given once */
+static bool stage_set_path(const char **path, char **argv, size_t argc, size_t *pos)
+{
+    if (*path != NULL || *pos + 1 >= argc || esp_console_is_operator(argv[*pos + 1])) {
+        return false;
+    }
+    *path = argv[++*pos];
+    return true;
+}
+
+/* Split the arguments into the commands of the pipeline, taking the redirections
+ * out. The arguments of each command are packed in argv, followed by a NULL. */
+static esp_err_t pipeline_split(char **argv, size_t argc, pipeline_stage_t *stages, size_t count)
+{
+    size_t stage = 0;
+    size_t out = 0;
+    stages[0].cmd.argv = argv;
+    for (size_t pos = 0; pos <= argc; pos++) {
+        pipeline_stage_t *s = &stages[stage];
+        if (pos == argc || argv[pos] == esp_console_op_pipe) {
+            argv[out] = NULL;
+            s->cmd.argc = &argv[out] - s->cmd.argv;
+            if (s->cmd.argc == 0) {
+                return ESP_ERR_INVALID_ARG;
+            }
+            if (pos < argc) {
+                stages[++stage].cmd.argv = &argv[++out];
+            }
+        } else if (argv[pos] == esp_console_op_in) {
+            /* Only the first command may read a file, the others read the pipe */
+            if (stage != 0 || !stage_set_path(&s->in_path, argv, argc, &pos)) {
+                return ESP_ERR_INVALID_ARG;
+            }
+        } else if (argv[pos] == esp_console_op_out || argv[pos] == esp_console_op_append) {
+            s->append = (argv[pos] == esp_console_op_append);
+            if (stage != count - 1 || !stage_set_path(&s->out_path, argv, argc, &pos)) {
+                return ESP_ERR_INVALID_ARG;
+            }
+        } else {
+            argv[out++] = argv[pos];
+        }
+    }
+    return ESP_OK;
+}
+
+/* Find the commands, and open the streams they are run with */
+static esp_err_t pipeline_open(const esp_console_config_t *config, pipeline_stage_t *stages, size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        pipeline_stage_t *s = &stages[i];
+        char **argv = s->cmd.argv;
+        const size_t argc = s->cmd.argc;
+        esp_err_t err = esp_console_find_command(argv[0], &s->cmd);
+        if (err != ESP_OK) {
+            return err;
+        }
+        s->cmd.argv = argv;
+        s->cmd.argc = argc;
+        if (i < count - 1 && (s->cmd.flags & ESP_CONSOLE_CMD_FLAG_SYNC_ONLY)) {
+            return ESP_ERR_NOT_SUPPORTED;
+        }
+        /* By default, the streams of the caller */
+        s->in = stdin;
+        s->out = stdout;
+        s->err = stderr;
+    }
+    pipeline_stage_t *first = &stages[0];
+    pipeline_stage_t *last = &stages[count - 1];
+    if (first->in_path) {
+        first->in = fopen(first->in_path, "r");
+        if (first->in == NULL) {
+            return ESP_FAIL;
+        }
+        first->close_in = true;
+    }
+    if (last->out_path) {
+        last->out = fopen(last->out_path, last->append ? "a" : "w");
+        if (last->out == NULL) {
+            return ESP_FAIL;
+        }
+        last->close_out = true;
+    }
+    for (size_t i = 0; i + 1 < count; i++) {
+        esp_err_t err = pipe_create(config->pipe_buffer_size, &stages[i + 1].in, &stages[i].out);
+        if (err != ESP_OK) {
+            return err;
+        }
+        stages[i + 1].close_in = true;
+        stages[i].close_out = true;
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_console_run_redirected(const esp_console_config_t *config, char **argv, size_t argc, int *cmd_ret)
+{
+    size_t count = 1;
+    for (size_t i = 0; i < argc; i++) {
+        count += (argv[i] == esp_console_op_pipe);
+    }
+#if CONFIG_IDF_TARGET_LINUX
+    /* The commands would share the standard streams, which are global */
+    if (count > 1) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+#endif
+    pipeline_stage_t *stages = esp_console_calloc(count, sizeof(pipeline_stage_t));
+    if (stages == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    SemaphoreHandle_t done = NULL;
+    esp_err_t err = pipeline_split(argv, argc, stages, count);
+    if (err == ESP_OK) {
+        err = pipeline_open(config, stages, count);
+    }
+    if (err == ESP_OK && count > 1) {
+        done = xSemaphoreCreateCounting(count - 1, 0);
+        err = done ? ESP_OK : ESP_ERR_NO_MEM;
+    }
+
+    /* All commands but the last run in tasks of their own */
+    size_t started = 0;
+    while (err == ESP_OK && started < count - 1) {
+        pipeline_stage_t *s = &stages[started];
+        s->done = done;
+        if (xTaskCreate(stage_task, "console_pipe", config->pipe_task_stack_size, s,
+                        uxTaskPriorityGet(NULL), NULL) != pdPASS) {
+            err = ESP_ERR_NO_MEM;
+            break;
+        }
+        started++;
+    }
+    if (err == ESP_OK) {
+        stage_run(&stages[count - 1]);
+        *cmd_ret = stages[count - 1].ret;
+    }
+    /* The commands which weren't run get end of file or fail to write, so the
+     * ones which were started finish */
+    for (size_t i = started; i < count; i++) {
+        stage_close(&stages[i]);
+    }
+    for (size_t i = 0; i < started; i++) {
+        xSemaphoreTake(done, portMAX_DELAY);
+    }
+    if (done) {
+        vSemaphoreDelete(done);
+    }
+    esp_console_free(stages);
+    return err;
+}
@@ -4,20 +4,33 @@
  * SPDX-License-Identifier: Apache-2.0
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE     // for fopencookie
+#endif
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <sys/cdefs.h>
+#include <sys/param.h>
+#include <sys/select.h>
+#include <unistd.h>
+#include "sys/queue.h"
 #include "sdkconfig.h"
 #include "esp_err.h"
 #include "esp_log.h"
 #include "esp_console.h"
+#include "console_private.h"
 #include "esp_vfs_dev.h"
+#include "esp_vfs_eventfd.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/semphr.h"
 #include "driver/uart.h"
 #include "driver/usb_serial_jtag.h"
 #include "linenoise/linenoise.h"
+#include "lwip/sockets.h"
 
 #include <driver/uart_vfs.h>
 #include <driver/usb_serial_jtag_vfs.h>
@@ -25,7 +38,20 @@
 static const char *TAG = "console.repl";
 
 #define CONSOLE_PROMPT_MAX_LEN (32)
+/* Line buffers of a session: the line, the saved line and the render buffer */
+#define CONSOLE_SESSION_BUF_LEN(max_cmdline_length) \
+    (2 * (max_cmdline_length) + LINENOISE_RENDER_LEN(max_cmdline_length, CONSOLE_PROMPT_MAX_LEN))
 #define CONSOLE_PATH_MAX_LEN   (ESP_VFS_PATH_MAX)
+#define CONSOLE_MAX_CMDLINE_ARGS (32) // same as in ESP_CONSOLE_CONFIG_DEFAULT
+#define CONSOLE_REPL_POLL_MS   (100) // how long select() waits before checking for new sessions, or for the deletion of the REPL
+#define CONSOLE_FRAME_OUTPUT_LEN (1024) // bytes of command output returned in a framed response
+#define CONSOLE_OUTPUT_FLUSH_MS (1000) // how long switching to framed mode waits for the buffered output to be sent
+#define CONSOLE_TCP_TX_BUF_LEN (1024)   // output of a network session buffered before it is sent
+#define CONSOLE_TCP_CHUNK_LEN  (256)    // bytes of a network session output escaped at a time, on the stack
+#define CONSOLE_TCP_PENDING_LEN (4096)  // output of a network session waiting to be sent, if not configured
+#define CONSOLE_TCP_DEFAULT_COLS (80)   // width of a network session terminal, until the client tells it
+
+#define TELNET_IAC  (255)       // telnet "interpret as command" byte, doubled in the output of a network session
 
 typedef enum {
     CONSOLE_REPL_STATE_DEINIT,
@@ -33,33 +59,108 @@ typedef enum {
     CONSOLE_REPL_STATE_START,
 } repl_state_t;
 
-typedef struct {
+typedef struct console_session_ {
+    struct linenoiseState ls;           // State of the line being edited
+    FILE *in;                           // Input stream of the session
+    FILE *out;                          // Output stream of the session
+    bool owned;                         // Streams are closed when the session ends
+    char *line_buf;                     // Line edited by linenoise, then parsed in place by esp_console_run_ex
+    char *saved_line_buf;               // Line being edited, saved by linenoise while browsing the history
+    char *render_buf;                   // Buffer linenoise builds each redraw of the line in
+    struct linenoiseHistory history;    // History of the session, the main session browses the global one instead
+    bool framed;                        // Exchanging frames instead of editing lines
+    uint8_t *frame_buf;                 // Request being received, followed by the response; allocated when framed mode is first entered
+    size_t frame_len;                   // Bytes of the request received so far
+    bool frame_overflow;                // The request doesn't fit in frame_buf, it is dropped up to its end
+    bool telnet;                        // Network session, its input is a socket speaking telnet
+    esp_console_telnet_t telnet_rx;     // Telnet commands being received
+    uint8_t *tx_buf;                    // Output of a network session the socket didn't take yet, protected by the lock of out
+    size_t tx_len;                      // Bytes waiting in tx_buf
+    bool tx_failed;                     // The output of the network session can't be sent, the session is closed
+    struct esp_console_repl_com_ *repl_com; // REPL serving the session
+    size_t jobs;                        // Jobs submitted from the session and not done, protected by sessions_lock
+    bool ended;                         // Not served anymore, freed once its last job is done
+    SLIST_ENTRY(console_session_) next;
+} console_session_t;
+
+typedef SLIST_HEAD(console_session_list_, console_session_) console_session_list_t;
+
+typedef struct esp_console_repl_com_ {
     esp_console_repl_t repl_core;        // base class
     char prompt[CONSOLE_PROMPT_MAX_LEN]; // Prompt to be printed before each line
     repl_state_t state;
     const char *history_save_path;
+    uint32_t history_max_len;           // Number of entries kept in the history
+    size_t history_arena_size;          // Arena of each history, see linenoiseHistoryInit
+    uint32_t history_heap_caps;
+    bool history_shared;                // No session browses the global history, the commands of all the sessions are added to it
+    bool history_append;                // Append new lines to the history file instead of rewriting it
+    uint32_t history_flush_count;       // Save the history once this many lines are unsaved
+    TickType_t history_flush_ticks;     // Save the history once lines are unsaved for this long, if not 0
+    uint32_t history_unsaved;           // Lines added to the history since it was saved
+    TickType_t history_unsaved_since;   // When the oldest unsaved line was added
+    uint32_t history_file_lines;        // Upper bound of the number of lines in the history file
     TaskHandle_t task_hdl;              // REPL task handle
+    SemaphoreHandle_t exit_sem;         // Given by the REPL task once it doesn't use the REPL anymore
+    int wake_fd;                        // Event written to wake the REPL task up from select() when the REPL is deleted, -1 if none
     size_t max_cmdline_length;          // Maximum length of a command line. If 0, default value will be used.
+    char *line_buf;                     // Line buffers of the main session
+    char *argv[CONSOLE_MAX_CMDLINE_ARGS]; // Arguments of the command being run
+    esp_console_executor_t *executor;   // Runs the commands if not NULL, owned by the application
+    console_session_t main_session;     // Session on the standard streams of the REPL task, uses line_buf
+    console_session_list_t sessions;    // Sessions served by the REPL task
+    console_session_list_t new_sessions; // Sessions added by esp_console_repl_add_session, not served yet
+    SemaphoreHandle_t sessions_lock;    // Protects new_sessions and the job counts
+    size_t jobs;                        // Jobs submitted from all the sessions and not done
+    SemaphoreHandle_t jobs_done_sem;    // Given when the last job submitted from the sessions is done
+    esp_console_context_t *frame_ctx;   // Runs the commands of the sessions in framed mode, created when first needed
+    size_t tx_buffer_size;              // Size of the buffer of output, 0 if the output isn't buffered
+    esp_console_output_policy_t tx_policy;
+    esp_console_output_t *output;       // Buffers the standard output of the REPL task, NULL if not buffered
+    esp_console_log_batch_config_t log_batch; // Batching of the logs printed over the main session, if buffer_size is not 0
+    int listen_fd;                      // Accepts the sessions of a network REPL, -1 if none
+    size_t max_tcp_sessions;            // Network sessions served at the same time
+    size_t tcp_tx_buffer_size;          // Size of tx_buf of each network session
+    bool tcp_close_on_overflow;         // Close the network session whose output doesn't fit in tx_buf, instead of dropping it
 } esp_console_repl_com_t;
 
 typedef struct {
     esp_console_repl_com_t repl_com; // base class
     int uart_channel;                // uart channel number
+    void (*set_raw_mode)(int uart_channel, bool raw); // line endings of the console device are translated unless raw
 } esp_console_repl_universal_t;
 
 static void esp_console_repl_task(void *args);
+static void esp_console_repl_tcp_task(void *args);
+static esp_err_t esp_console_repl_tcp_delete(esp_console_repl_t *repl);
 #if CONFIG_ESP_CONSOLE_UART_DEFAULT || CONFIG_ESP_CONSOLE_UART_CUSTOM
 static esp_err_t esp_console_repl_uart_delete(esp_console_repl_t *repl);
+static void esp_console_repl_uart_set_raw_mode(int uart_channel, bool raw);
 #endif // CONFIG_ESP_CONSOLE_UART_DEFAULT || CONFIG_ESP_CONSOLE_UART_CUSTOM
 #if CONFIG_ESP_CONSOLE_USB_CDC
 static esp_err_t esp_console_repl_usb_cdc_delete(esp_console_repl_t *repl);
+static void esp_console_repl_usb_cdc_set_raw_mode(int uart_channel, bool raw);
 #endif // CONFIG_ESP_CONSOLE_USB_CDC
 #if CONFIG_ESP_CONSOLE_USB_SERIAL_JTAG
 static esp_err_t esp_console_repl_usb_serial_jtag_delete(esp_console_repl_t *repl);
+static void esp_console_repl_usb_serial_jtag_set_raw_mode(int uart_channel, bool raw);
 #endif //CONFIG_ESP_CONSOLE_USB_SERIAL_JTAG
-static esp_err_t esp_console_common_init(size_t max_cmdline_length, esp_console_repl_com_t *repl_com);
-static esp_err_t esp_console_setup_prompt(const char *prompt, esp_console_repl_com_t *repl_com);
-static esp_err_t esp_console_setup_history(const char *history_path, uint32_t max_history_len, esp_console_repl_com_t *repl_com);
+static void esp_console_repl_log_batch_config(const esp_console_repl_config_t *repl_config, esp_console_repl_com_t *repl_com)
+{
+    esp_console_log_batch_config_t log_batch = ESP_CONSOLE_LOG_BATCH_CONFIG_DEFAULT();
+    log_batch.buffer_size = repl_config->log_buffer_size;
+    log_batch.coalesce_ms = repl_config->log_coalesce_ms;
+    log_batch.policy = repl_config->log_policy;
+    repl_com->log_batch = log_batch;
+}
+
+static esp_err_t esp_console_repl_init_console(const esp_console_repl_config_t *repl_config);
+static esp_err_t esp_console_common_init(const esp_console_repl_config_t *repl_config, esp_console_repl_com_t *repl_com);
+static void esp_console_common_deinit(esp_console_repl_com_t *repl_com);
+static void esp_console_history_flush(esp_console_repl_com_t *repl_com);
+static esp_err_t esp_console_setup_prompt(const char *prompt, bool probe, esp_console_repl_com_t *repl_com);
+static esp_err_t esp_console_setup_history(const esp_console_repl_config_t *repl_config, esp_console_repl_com_t *repl_com);
+static void esp_console_repl_log_batch_config(const esp_console_repl_config_t *repl_config, esp_console_repl_com_t *repl_com);
 
 #if CONFIG_ESP_CONSOLE_USB_CDC
 esp_err_t esp_console_new_repl_usb_cdc(const esp_console_dev_usb_cdc_config_t *dev_config, const esp_console_repl_config_t *repl_config, esp_console_repl_t **ret_repl)
@@ -70,12 +171,21 @@ esp_err_t esp_console_new_repl_usb_cdc(const esp_console_dev_usb_cdc_config_t *d
         ret = ESP_ERR_INVALID_ARG;
         goto _exit;
     }
+    // initialize console, the REPL context is allocated like the rest of its memory
+    ret = esp_console_repl_init_console(repl_config);
+    if (ret != ESP_OK) {
+        goto _exit;
+    }
     // allocate memory for console REPL context
-    cdc_repl = calloc(1, sizeof(esp_console_repl_universal_t));
+    cdc_repl = esp_console_calloc(1, sizeof(esp_console_repl_universal_t));
     if (!cdc_repl) {
+        esp_console_deinit();
         ret = ESP_ERR_NO_MEM;
         goto _exit;
     }
+    /* The error path closes the descriptors which are set */
+    cdc_repl->repl_com.listen_fd = -1;
+    cdc_repl->repl_com.wake_fd = -1;
 
     /* Minicom, screen, idf_monitor send CR when ENTER key is pressed */
     esp_vfs_dev_cdcacm_set_rx_line_endings(ESP_LINE_ENDINGS_CR);
@@ -87,24 +197,29 @@ esp_err_t esp_console_new_repl_usb_cdc(const esp_console_dev_usb_cdc_config_t *d
     fcntl(fileno(stdin), F_SETFL, 0);
 
     // initialize console, common part
-    ret = esp_console_common_init(repl_config->max_cmdline_length, &cdc_repl->repl_com);
+    ret = esp_console_common_init(repl_config, &cdc_repl->repl_com);
     if (ret != ESP_OK) {
         goto _exit;
     }
 
     // setup history
-    ret = esp_console_setup_history(repl_config->history_save_path, repl_config->max_history_len, &cdc_repl->repl_com);
+    ret = esp_console_setup_history(repl_config, &cdc_repl->repl_com);
     if (ret != ESP_OK) {
         goto _exit;
     }
 
     // setup prompt
-    esp_console_setup_prompt(repl_config->prompt, &cdc_repl->repl_com);
+    esp_console_setup_prompt(repl_config->prompt, true, &cdc_repl->repl_com);
+    cdc_repl->repl_com.executor = repl_config->executor;
+    cdc_repl->repl_com.tx_buffer_size = repl_config->tx_buffer_size;
+    cdc_repl->repl_com.tx_policy = repl_config->tx_policy;
+    esp_console_repl_log_batch_config(repl_config, &cdc_repl->repl_com);
 
     /* Fill the structure here as it will be used directly by the created task. */
     cdc_repl->uart_channel = CONFIG_ESP_CONSOLE_UART_NUM;
     cdc_repl->repl_com.state = CONSOLE_REPL_STATE_INIT;
     cdc_repl->repl_com.repl_core.del = esp_console_repl_usb_cdc_delete;
+    cdc_repl->set_raw_mode = esp_console_repl_usb_cdc_set_raw_mode;
 
     /* spawn a single thread to run REPL */
     if (xTaskCreate(esp_console_repl_task, "console_repl", repl_config->task_stack_size,
@@ -118,7 +233,8 @@ esp_err_t esp_console_new_repl_usb_cdc(const esp_console_dev_usb_cdc_config_t *d
 _exit:
     if (cdc_repl) {
         esp_console_deinit();
-        free(cdc_repl);
+        esp_console_common_deinit(&cdc_repl->repl_com);
+        esp_console_free(cdc_repl);
     }
     if (ret_repl) {
         *ret_repl = NULL;
@@ -136,12 +252,21 @@ esp_err_t esp_console_new_repl_usb_serial_jtag(const esp_console_dev_usb_serial_
     }
 
     esp_err_t ret = ESP_OK;
+    // initialize console, the REPL context is allocated like the rest of its memory
+    ret = esp_console_repl_init_console(repl_config);
+    if (ret != ESP_OK) {
+        goto _exit;
+    }
     // allocate memory for console REPL context
-    usb_serial_jtag_repl = calloc(1, sizeof(esp_console_repl_universal_t));
+    usb_serial_jtag_repl = esp_console_calloc(1, sizeof(esp_console_repl_universal_t));
     if (!usb_serial_jtag_repl) {
+        esp_console_deinit();
         ret = ESP_ERR_NO_MEM;
         goto _exit;
     }
+    /* The error path closes the descriptors which are set */
+    usb_serial_jtag_repl->repl_com.listen_fd = -1;
+    usb_serial_jtag_repl->repl_com.wake_fd = -1;
 
     /* Minicom, screen, idf_monitor send CR when ENTER key is pressed */
     usb_serial_jtag_vfs_set_rx_line_endings(ESP_LINE_ENDINGS_CR);
@@ -161,7 +286,7 @@ esp_err_t esp_console_new_repl_usb_serial_jtag(const esp_console_dev_usb_serial_
     }
 
     // initialize console, common part
-    ret = esp_console_common_init(repl_config->max_cmdline_length, &usb_serial_jtag_repl->repl_com);
+    ret = esp_console_common_init(repl_config, &usb_serial_jtag_repl->repl_com);
     if (ret != ESP_OK) {
         goto _exit;
     }
@@ -170,18 +295,23 @@ esp_err_t esp_console_new_repl_usb_serial_jtag(const esp_console_dev_usb_serial_
     usb_serial_jtag_vfs_use_driver();
 
     // setup history
-    ret = esp_console_setup_history(repl_config->history_save_path, repl_config->max_history_len, &usb_serial_jtag_repl->repl_com);
+    ret = esp_console_setup_history(repl_config, &usb_serial_jtag_repl->repl_com);
     if (ret != ESP_OK) {
         goto _exit;
     }
 
     // setup prompt
-    esp_console_setup_prompt(repl_config->prompt, &usb_serial_jtag_repl->repl_com);
+    esp_console_setup_prompt(repl_config->prompt, true, &usb_serial_jtag_repl->repl_com);
+    usb_serial_jtag_repl->repl_com.executor = repl_config->executor;
+    usb_serial_jtag_repl->repl_com.tx_buffer_size = repl_config->tx_buffer_size;
+    usb_serial_jtag_repl->repl_com.tx_policy = repl_config->tx_policy;
+    esp_console_repl_log_batch_config(repl_config, &usb_serial_jtag_repl->repl_com);
 
     /* Fill the structure here as it will be used directly by the created task. */
     usb_serial_jtag_repl->uart_channel = CONFIG_ESP_CONSOLE_UART_NUM;
     usb_serial_jtag_repl->repl_com.state = CONSOLE_REPL_STATE_INIT;
     usb_serial_jtag_repl->repl_com.repl_core.del = esp_console_repl_usb_serial_jtag_delete;
+    usb_serial_jtag_repl->set_raw_mode = esp_console_repl_usb_serial_jtag_set_raw_mode;
 
     /* spawn a single thread to run REPL */
     if (xTaskCreate(esp_console_repl_task, "console_repl", repl_config->task_stack_size,
@@ -195,7 +325,8 @@ esp_err_t esp_console_new_repl_usb_serial_jtag(const esp_console_dev_usb_serial_
 _exit:
     if (usb_serial_jtag_repl) {
         esp_console_deinit();
-        free(usb_serial_jtag_repl);
+        esp_console_common_deinit(&usb_serial_jtag_repl->repl_com);
+        esp_console_free(usb_serial_jtag_repl);
     }
     if (ret_repl) {
         *ret_repl = NULL;
@@ -213,12 +344,21 @@ esp_err_t esp_console_new_repl_uart(const esp_console_dev_uart_config_t *dev_con
         ret = ESP_ERR_INVALID_ARG;
         goto _exit;
     }
+    // initialize console, the REPL context is allocated like the rest of its memory
+    ret = esp_console_repl_init_console(repl_config);
+    if (ret != ESP_OK) {
+        goto _exit;
+    }
     // allocate memory for console REPL context
-    uart_repl = calloc(1, sizeof(esp_console_repl_universal_t));
+    uart_repl = esp_console_calloc(1, sizeof(esp_console_repl_universal_t));
     if (!uart_repl) {
+        esp_console_deinit();
         ret = ESP_ERR_NO_MEM;
         goto _exit;
     }
+    /* The error path closes the descriptors which are set */
+    uart_repl->repl_com.listen_fd = -1;
+    uart_repl->repl_com.wake_fd = -1;
 
     /* Drain stdout before reconfiguring it */
     fflush(stdout);
@@ -265,24 +405,29 @@ esp_err_t esp_console_new_repl_uart(const esp_console_dev_uart_config_t *dev_con
     uart_vfs_dev_use_driver(dev_config->channel);
 
     // initialize console, common part
-    ret = esp_console_common_init(repl_config->max_cmdline_length, &uart_repl->repl_com);
+    ret = esp_console_common_init(repl_config, &uart_repl->repl_com);
     if (ret != ESP_OK) {
         goto _exit;
     }
 
     // setup history
-    ret = esp_console_setup_history(repl_config->history_save_path, repl_config->max_history_len, &uart_repl->repl_com);
+    ret = esp_console_setup_history(repl_config, &uart_repl->repl_com);
     if (ret != ESP_OK) {
         goto _exit;
     }
 
     // setup prompt
-    esp_console_setup_prompt(repl_config->prompt, &uart_repl->repl_com);
+    esp_console_setup_prompt(repl_config->prompt, true, &uart_repl->repl_com);
+    uart_repl->repl_com.executor = repl_config->executor;
+    uart_repl->repl_com.tx_buffer_size = repl_config->tx_buffer_size;
+    uart_repl->repl_com.tx_policy = repl_config->tx_policy;
+    esp_console_repl_log_batch_config(repl_config, &uart_repl->repl_com);
 
     /* Fill the structure here as it will be used directly by the created task. */
     uart_repl->uart_channel = dev_config->channel;
     uart_repl->repl_com.state = CONSOLE_REPL_STATE_INIT;
     uart_repl->repl_com.repl_core.del = esp_console_repl_uart_delete;
+    uart_repl->set_raw_mode = esp_console_repl_uart_set_raw_mode;
 
     /* Spawn a single thread to run REPL, we need to pass `uart_repl` to it as
      * it also requires the uart channel. */
@@ -297,8 +442,9 @@ esp_err_t esp_console_new_repl_uart(const esp_console_dev_uart_config_t *dev_con
 _exit:
     if (uart_repl) {
         esp_console_deinit();
+        esp_console_common_deinit(&uart_repl->repl_com);
         uart_driver_delete(dev_config->channel);
-        free(uart_repl);
+        esp_console_free(uart_repl);
     }
     if (ret_repl) {
         *ret_repl = NULL;
@@ -307,6 +453,99 @@ _exit:
 }
 #endif // CONFIG_ESP_CONSOLE_UART_DEFAULT || CONFIG_ESP_CONSOLE_UART_CUSTOM
 
+esp_err_t esp_console_new_repl_tcp(const esp_console_dev_tcp_config_t *dev_config, const esp_console_repl_config_t *repl_config, esp_console_repl_t **ret_repl)
+{
+    esp_err_t ret = ESP_OK;
+    esp_console_repl_com_t *tcp_repl = NULL;
+    if (!repl_config || !dev_config || !ret_repl || dev_config->max_sessions == 0) {
+        ret = ESP_ERR_INVALID_ARG;
+        goto _exit;
+    }
+    // initialize console, the REPL context is allocated like the rest of its memory
+    ret = esp_console_repl_init_console(repl_config);
+    if (ret != ESP_OK) {
+        goto _exit;
+    }
+    // allocate memory for console REPL context
+    tcp_repl = esp_console_calloc(1, sizeof(esp_console_repl_com_t));
+    if (!tcp_repl) {
+        esp_console_deinit();
+        ret = ESP_ERR_NO_MEM;
+        goto _exit;
+    }
+    /* The error path closes the descriptors which are set */
+    tcp_repl->listen_fd = -1;
+    tcp_repl->wake_fd = -1;
+
+    // initialize console, common part
+    ret = esp_console_common_init(repl_config, tcp_repl);
+    if (ret != ESP_OK) {
+        goto _exit;
+    }
+
+    // setup history
+    ret = esp_console_setup_history(repl_config, tcp_repl);
+    if (ret != ESP_OK) {
+        goto _exit;
+    }
+
+    // setup prompt
+    esp_console_setup_prompt(repl_config->prompt, false, tcp_repl);
+    tcp_repl->executor = repl_config->executor;
+    tcp_repl->max_tcp_sessions = dev_config->max_sessions;
+    tcp_repl->history_shared = true;
+    tcp_repl->tcp_tx_buffer_size = dev_config->tx_buffer_size ? dev_config->tx_buffer_size : CONSOLE_TCP_PENDING_LEN;
+    tcp_repl->tcp_close_on_overflow = dev_config->close_on_overflow;
+
+    /* Connections are accepted by the REPL task, along with the input of the sessions */
+    tcp_repl->listen_fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (tcp_repl->listen_fd < 0) {
+        ESP_LOGE(TAG, "socket() failed (errno %d)", errno);
+        ret = ESP_FAIL;
+        goto _exit;
+    }
+    const int reuse = 1;
+    setsockopt(tcp_repl->listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    const struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(dev_config->port),
+        .sin_addr.s_addr = htonl(INADDR_ANY),
+    };
+    if (bind(tcp_repl->listen_fd, (const struct sockaddr *) &addr, sizeof(addr)) != 0 ||
+            listen(tcp_repl->listen_fd, dev_config->max_sessions) != 0) {
+        ESP_LOGE(TAG, "listening on port %u failed (errno %d)", dev_config->port, errno);
+        ret = ESP_FAIL;
+        goto _exit;
+    }
+
+    /* Fill the structure here as it will be used directly by the created task. */
+    tcp_repl->state = CONSOLE_REPL_STATE_INIT;
+    tcp_repl->repl_core.del = esp_console_repl_tcp_delete;
+
+    /* spawn a single thread to run REPL */
+    if (xTaskCreate(esp_console_repl_tcp_task, "console_repl", repl_config->task_stack_size,
+                    tcp_repl, repl_config->task_priority, &tcp_repl->task_hdl) != pdTRUE) {
+        ret = ESP_FAIL;
+        goto _exit;
+    }
+
+    *ret_repl = &tcp_repl->repl_core;
+    return ESP_OK;
+_exit:
+    if (tcp_repl) {
+        if (tcp_repl->listen_fd >= 0) {
+            close(tcp_repl->listen_fd);
+        }
+        esp_console_deinit();
+        esp_console_common_deinit(tcp_repl);
+        esp_console_free(tcp_repl);
+    }
+    if (ret_repl) {
+        *ret_repl = NULL;
+    }
+    return ret;
+}
+
 esp_err_t esp_console_start_repl(esp_console_repl_t *repl)
 {
     esp_err_t ret = ESP_OK;
@@ -324,7 +563,8 @@ _exit:
     return ret;
 }
 
-static esp_err_t esp_console_setup_prompt(const char *prompt, esp_console_repl_com_t *repl_com)
+/* Network terminals aren't probed, they are expected to support escape sequences */
+static esp_err_t esp_console_setup_prompt(const char *prompt, bool probe, esp_console_repl_com_t *repl_com)
 {
     /* set command line prompt */
     const char *prompt_temp = "esp>";
@@ -334,7 +574,7 @@ static esp_err_t esp_console_setup_prompt(const char *prompt, esp_console_repl_c
     snprintf(repl_com->prompt, CONSOLE_PROMPT_MAX_LEN - 1, LOG_COLOR_I "%s " LOG_RESET_COLOR, prompt_temp);
 
     /* Figure out if the terminal supports escape sequences */
-    int probe_status = linenoiseProbe();
+    int probe_status = probe ? linenoiseProbe() : 0;
     if (probe_status) {
         /* zero indicates success */
         linenoiseSetDumbMode(1);
@@ -349,49 +589,108 @@ static esp_err_t esp_console_setup_prompt(const char *prompt, esp_console_repl_c
     return ESP_OK;
 }
 
-static esp_err_t esp_console_setup_history(const char *history_path, uint32_t max_history_len, esp_console_repl_com_t *repl_com)
+static esp_err_t esp_console_setup_history(const esp_console_repl_config_t *repl_config, esp_console_repl_com_t *repl_com)
 {
     esp_err_t ret = ESP_OK;
 
-    repl_com->history_save_path = history_path;
-    if (history_path) {
-        /* Load command history from filesystem */
-        linenoiseHistoryLoad(history_path);
+    /* Set where and how much history is kept, before loading it */
+    if (linenoiseHistorySetArena(repl_config->history_arena_size, repl_config->history_heap_caps) != 1) {
+        ESP_LOGE(TAG, "set history arena to %u bytes failed", (unsigned) repl_config->history_arena_size);
+        ret = ESP_ERR_NO_MEM;
+        goto _exit;
     }
 
     /* Set command history size */
-    if (linenoiseHistorySetMaxLen(max_history_len) != 1) {
-        ESP_LOGE(TAG, "set max history length to %"PRIu32" failed", max_history_len);
+    if (linenoiseHistorySetMaxLen(repl_config->max_history_len) != 1) {
+        ESP_LOGE(TAG, "set max history length to %"PRIu32" failed", repl_config->max_history_len);
         ret = ESP_FAIL;
         goto _exit;
     }
+
+    repl_com->history_save_path = repl_config->history_save_path;
+    repl_com->history_max_len = repl_config->max_history_len;
+    repl_com->history_arena_size = repl_config->history_arena_size;
+    repl_com->history_heap_caps = repl_config->history_heap_caps;
+    repl_com->history_append = repl_config->history_append;
+    repl_com->history_flush_count = MAX(repl_config->history_flush_count, 1);
+    repl_com->history_flush_ticks = pdMS_TO_TICKS(repl_config->history_flush_ms);
+    if (repl_com->history_save_path) {
+        /* Load command history from filesystem */
+        linenoiseHistoryLoad(repl_com->history_save_path);
+        /* The file was compacted when it got too long, assume it is full */
+        repl_com->history_file_lines = repl_com->history_max_len;
+    }
     return ESP_OK;
 _exit:
     return ret;
 }
 
-static esp_err_t esp_console_common_init(size_t max_cmdline_length, esp_console_repl_com_t *repl_com)
+/* Initialize the console, before the REPL allocates anything with esp_console_malloc */
+static esp_err_t esp_console_repl_init_console(const esp_console_repl_config_t *repl_config)
 {
-    esp_err_t ret = ESP_OK;
-    /* Initialize the console */
     esp_console_config_t console_config = ESP_CONSOLE_CONFIG_DEFAULT();
-    repl_com->max_cmdline_length = console_config.max_cmdline_length;
     /* Replace the default command line length if passed as a parameter */
-    if (max_cmdline_length != 0) {
-        console_config.max_cmdline_length = max_cmdline_length;
-        repl_com->max_cmdline_length = max_cmdline_length;
+    if (repl_config->max_cmdline_length != 0) {
+        console_config.max_cmdline_length = repl_config->max_cmdline_length;
+    }
+    if (repl_config->heap_alloc_caps != 0) {
+        console_config.heap_alloc_caps = repl_config->heap_alloc_caps;
     }
+    console_config.pool_size = repl_config->pool_size;
 
 #if CONFIG_LOG_COLORS
     console_config.hint_color = atoi(LOG_COLOR_CYAN);
 #else
     console_config.hint_color = -1;
 #endif
-    ret = esp_console_init(&console_config);
-    if (ret != ESP_OK) {
+    return esp_console_init(&console_config);
+}
+
+static esp_err_t esp_console_common_init(const esp_console_repl_config_t *repl_config, esp_console_repl_com_t *repl_com)
+{
+    esp_err_t ret = ESP_OK;
+    const esp_console_config_t console_config = ESP_CONSOLE_CONFIG_DEFAULT();
+    repl_com->max_cmdline_length = console_config.max_cmdline_length;
+    if (repl_config->max_cmdline_length != 0) {
+        repl_com->max_cmdline_length = repl_config->max_cmdline_length;
+    }
+
+    /* Allocate the line buffers once, so that reading and running a command
+     * doesn't allocate anything on the heap. The second one keeps the line
+     * being edited while browsing the history, the third one holds redraws. */
+    repl_com->line_buf = esp_console_calloc(1, CONSOLE_SESSION_BUF_LEN(repl_com->max_cmdline_length));
+    if (repl_com->line_buf == NULL) {
+        ret = ESP_ERR_NO_MEM;
         goto _exit;
     }
 
+    repl_com->sessions_lock = xSemaphoreCreateMutex();
+    repl_com->jobs_done_sem = xSemaphoreCreateBinary();
+    repl_com->exit_sem = xSemaphoreCreateBinary();
+    if (repl_com->sessions_lock == NULL || repl_com->jobs_done_sem == NULL || repl_com->exit_sem == NULL) {
+        ret = ESP_ERR_NO_MEM;
+        goto _exit;
+    }
+
+    /* Without the event, the REPL task notices that it is deleted within CONSOLE_REPL_POLL_MS */
+    const esp_vfs_eventfd_config_t eventfd_config = ESP_VFS_EVENTD_CONFIG_DEFAULT();
+    esp_err_t err = esp_vfs_eventfd_register(&eventfd_config);
+    if (err == ESP_OK || err == ESP_ERR_INVALID_STATE) {
+        repl_com->wake_fd = eventfd(0, 0);
+    }
+    if (repl_com->wake_fd < 0) {
+        ESP_LOGD(TAG, "no eventfd to wake the REPL task up, it polls");
+    }
+
+    /* linenoise serializes its output using this semaphore */
+    if (stdout_taken_sem == NULL) {
+        stdout_taken_sem = xSemaphoreCreateMutex();
+        if (stdout_taken_sem == NULL) {
+            ret = ESP_ERR_NO_MEM;
+            goto _exit;
+        }
+    }
+
     ret = esp_console_register_help_command();
     if (ret != ESP_OK) {
         goto _exit;
@@ -410,6 +709,186 @@ _exit:
     return ret;
 }
 
+static void esp_console_session_free(console_session_t *session)
+{
+    if (session->out != session->in) {
+        fclose(session->out);
+    }
+    fclose(session->in);
+    linenoiseHistoryRelease(&session->history);
+    esp_console_free(session->frame_buf);
+    esp_console_free(session->tx_buf);
+    esp_console_free(session);
+}
+
+/* Stop serving the session, it is freed once the jobs submitted from it are done */
+static void esp_console_session_end(esp_console_repl_com_t *repl_com, console_session_t *session)
+{
+    xSemaphoreTake(repl_com->sessions_lock, portMAX_DELAY);
+    session->ended = true;
+    const bool idle = (session->jobs == 0);
+    xSemaphoreGive(repl_com->sessions_lock);
+    if (idle) {
+        esp_console_session_free(session);
+    }
+}
+
+/* Count a job submitted from the session as done, and free the session if it ended meanwhile */
+static void esp_console_session_job_done(console_session_t *session)
+{
+    esp_console_repl_com_t *repl_com = session->repl_com;
+    xSemaphoreTake(repl_com->sessions_lock, portMAX_DELAY);
+    const bool release = (--session->jobs == 0 && session->ended);
+    if (--repl_com->jobs == 0) {
+        /* Given with the lock held, so that esp_console_repl_wait_jobs can drop the stale ones */
+        xSemaphoreGive(repl_com->jobs_done_sem);
+    }
+    xSemaphoreGive(repl_com->sessions_lock);
+    if (release) {
+        esp_console_session_free(session);
+    }
+}
+
+/* Wait until the jobs submitted from the sessions are done, and their results printed */
+static void esp_console_repl_wait_jobs(esp_console_repl_com_t *repl_com)
+{
+    xSemaphoreTake(repl_com->sessions_lock, portMAX_DELAY);
+    const bool busy = (repl_com->jobs > 0);
+    if (busy) {
+        /* Given when the count last dropped to 0 */
+        xSemaphoreTake(repl_com->jobs_done_sem, 0);
+    }
+    xSemaphoreGive(repl_com->sessions_lock);
+    if (busy) {
+        xSemaphoreTake(repl_com->jobs_done_sem, portMAX_DELAY);
+    }
+}
+
+/* Wake the REPL task up from select() */
+static void esp_console_repl_wake(esp_console_repl_com_t *repl_com)
+{
+    if (repl_com->wake_fd >= 0) {
+        const uint64_t event = 1;
+        write(repl_com->wake_fd, &event, sizeof(event));
+    }
+}
+
+/* Tell the REPL task to exit and wait until it did, then wait for the jobs
+ * submitted from the sessions. Nothing uses the REPL once this returns. */
+static esp_err_t esp_console_repl_stop(esp_console_repl_com_t *repl_com)
+{
+    if (xTaskGetCurrentTaskHandle() == repl_com->task_hdl) {
+        ESP_LOGE(TAG, "can't be deleted by a command it runs");
+        return ESP_ERR_INVALID_STATE;
+    }
+    const repl_state_t state = repl_com->state;
+    repl_com->state = CONSOLE_REPL_STATE_DEINIT;
+    if (state == CONSOLE_REPL_STATE_INIT) {
+        /* The task still waits for esp_console_start_repl */
+        xTaskNotifyGive(repl_com->task_hdl);
+    } else {
+        esp_console_repl_wake(repl_com);
+    }
+    xSemaphoreTake(repl_com->exit_sem, portMAX_DELAY);
+    /* Print what is left of the logs, and unhook log_batch_vprintf before the line it refers to is freed */
+    if (state == CONSOLE_REPL_STATE_START && repl_com->log_batch.buffer_size > 0) {
+        esp_console_log_batch_end();
+        esp_console_log_batch_stop();
+    }
+    esp_console_repl_wait_jobs(repl_com);
+    return ESP_OK;
+}
+
+/* Free what esp_console_common_init allocated, and the sessions added to the REPL */
+static void esp_console_common_deinit(esp_console_repl_com_t *repl_com)
+{
+    /* Don't lose the commands whose saving was deferred */
+    esp_console_history_flush(repl_com);
+    console_session_t *session;
+    while ((session = SLIST_FIRST(&repl_com->sessions)) != NULL) {
+        SLIST_REMOVE_HEAD(&repl_com->sessions, next);
+        if (session->owned) {
+            esp_console_session_free(session);
+        }
+    }
+    while ((session = SLIST_FIRST(&repl_com->new_sessions)) != NULL) {
+        SLIST_REMOVE_HEAD(&repl_com->new_sessions, next);
+        esp_console_session_free(session);
+    }
+    if (repl_com->sessions_lock) {
+        vSemaphoreDelete(repl_com->sessions_lock);
+        repl_com->sessions_lock = NULL;
+    }
+    if (repl_com->jobs_done_sem) {
+        vSemaphoreDelete(repl_com->jobs_done_sem);
+        repl_com->jobs_done_sem = NULL;
+    }
+    if (repl_com->exit_sem) {
+        vSemaphoreDelete(repl_com->exit_sem);
+        repl_com->exit_sem = NULL;
+    }
+    if (repl_com->wake_fd >= 0) {
+        close(repl_com->wake_fd);
+        repl_com->wake_fd = -1;
+    }
+    if (repl_com->frame_ctx) {
+        esp_console_context_delete(repl_com->frame_ctx);
+        repl_com->frame_ctx = NULL;
+    }
+    if (repl_com->output) {
+        esp_console_output_delete(repl_com->output);
+        repl_com->output = NULL;
+    }
+    esp_console_free(repl_com->main_session.frame_buf);
+    repl_com->main_session.frame_buf = NULL;
+    esp_console_free(repl_com->line_buf);
+    repl_com->line_buf = NULL;
+}
+
+/* Allocate a session on the given streams, with its line buffers */
+static console_session_t *esp_console_session_new(esp_console_repl_com_t *repl_com, FILE *in, FILE *out)
+{
+    console_session_t *session = esp_console_calloc(1, sizeof(*session) +
+                                                    CONSOLE_SESSION_BUF_LEN(repl_com->max_cmdline_length));
+    if (!session) {
+        return NULL;
+    }
+    session->in = in;
+    session->out = out;
+    session->owned = true;
+    session->repl_com = repl_com;
+    session->line_buf = (char *)(session + 1);
+    session->saved_line_buf = session->line_buf + repl_com->max_cmdline_length;
+    session->render_buf = session->saved_line_buf + repl_com->max_cmdline_length;
+    /* The arena is allocated when the REPL task fills the history, see esp_console_session_serve */
+    linenoiseHistoryInit(&session->history, repl_com->history_max_len,
+                         repl_com->history_arena_size, repl_com->history_heap_caps);
+    session->ls.history = &session->history;
+    /* Data must not wait in the stream buffer, where select() doesn't see it */
+    setvbuf(in, NULL, _IONBF, 0);
+    return session;
+}
+
+esp_err_t esp_console_repl_add_session(esp_console_repl_t *repl, FILE *in, FILE *out)
+{
+    if (!repl || !in || !out) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    esp_console_repl_com_t *repl_com = __containerof(repl, esp_console_repl_com_t, repl_core);
+    if (repl_com->state == CONSOLE_REPL_STATE_DEINIT) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    console_session_t *session = esp_console_session_new(repl_com, in, out);
+    if (!session) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    xSemaphoreTake(repl_com->sessions_lock, portMAX_DELAY);
+    SLIST_INSERT_HEAD(&repl_com->new_sessions, session, next);
+    xSemaphoreGive(repl_com->sessions_lock);
+    return ESP_OK;
+}
+
 #if CONFIG_ESP_CONSOLE_UART_DEFAULT || CONFIG_ESP_CONSOLE_UART_CUSTOM
 static esp_err_t esp_console_repl_uart_delete(esp_console_repl_t *repl)
 {
@@ -422,14 +901,25 @@ static esp_err_t esp_console_repl_uart_delete(esp_console_repl_t *repl)
         ret = ESP_ERR_INVALID_STATE;
         goto _exit;
     }
-    repl_com->state = CONSOLE_REPL_STATE_DEINIT;
+    ret = esp_console_repl_stop(repl_com);
+    if (ret != ESP_OK) {
+        goto _exit;
+    }
     esp_console_deinit();
+    esp_console_common_deinit(repl_com);
     uart_vfs_dev_use_nonblocking(uart_repl->uart_channel);
     uart_driver_delete(uart_repl->uart_channel);
-    free(uart_repl);
+    esp_console_free(uart_repl);
 _exit:
     return ret;
 }
+
+static void esp_console_repl_uart_set_raw_mode(int uart_channel, bool raw)
+{
+    /* LF means that the line endings are left as they are */
+    uart_vfs_dev_port_set_rx_line_endings(uart_channel, raw ? ESP_LINE_ENDINGS_LF : ESP_LINE_ENDINGS_CR);
+    uart_vfs_dev_port_set_tx_line_endings(uart_channel, raw ? ESP_LINE_ENDINGS_LF : ESP_LINE_ENDINGS_CRLF);
+}
 #endif // CONFIG_ESP_CONSOLE_UART_DEFAULT || CONFIG_ESP_CONSOLE_UART_CUSTOM
 
 #if CONFIG_ESP_CONSOLE_USB_CDC
@@ -444,12 +934,22 @@ static esp_err_t esp_console_repl_usb_cdc_delete(esp_console_repl_t *repl)
         ret = ESP_ERR_INVALID_STATE;
         goto _exit;
     }
-    repl_com->state = CONSOLE_REPL_STATE_DEINIT;
+    ret = esp_console_repl_stop(repl_com);
+    if (ret != ESP_OK) {
+        goto _exit;
+    }
     esp_console_deinit();
-    free(cdc_repl);
+    esp_console_common_deinit(repl_com);
+    esp_console_free(cdc_repl);
 _exit:
     return ret;
 }
+
+static void esp_console_repl_usb_cdc_set_raw_mode(int uart_channel, bool raw)
+{
+    esp_vfs_dev_cdcacm_set_rx_line_endings(raw ? ESP_LINE_ENDINGS_LF : ESP_LINE_ENDINGS_CR);
+    esp_vfs_dev_cdcacm_set_tx_line_endings(raw ? ESP_LINE_ENDINGS_LF : ESP_LINE_ENDINGS_CRLF);
+}
 #endif // CONFIG_ESP_CONSOLE_USB_CDC
 
 #if CONFIG_ESP_CONSOLE_USB_SERIAL_JTAG
@@ -464,16 +964,691 @@ static esp_err_t esp_console_repl_usb_serial_jtag_delete(esp_console_repl_t *rep
         ret = ESP_ERR_INVALID_STATE;
         goto _exit;
     }
-    repl_com->state = CONSOLE_REPL_STATE_DEINIT;
+    ret = esp_console_repl_stop(repl_com);
+    if (ret != ESP_OK) {
+        goto _exit;
+    }
     esp_console_deinit();
+    esp_console_common_deinit(repl_com);
     usb_serial_jtag_vfs_use_nonblocking();
     usb_serial_jtag_driver_uninstall();
-    free(usb_serial_jtag_repl);
+    esp_console_free(usb_serial_jtag_repl);
 _exit:
     return ret;
 }
+
+static void esp_console_repl_usb_serial_jtag_set_raw_mode(int uart_channel, bool raw)
+{
+    usb_serial_jtag_vfs_set_rx_line_endings(raw ? ESP_LINE_ENDINGS_LF : ESP_LINE_ENDINGS_CR);
+    usb_serial_jtag_vfs_set_tx_line_endings(raw ? ESP_LINE_ENDINGS_LF : ESP_LINE_ENDINGS_CRLF);
+}
 #endif // CONFIG_ESP_CONSOLE_USB_SERIAL_JTAG
 
+static esp_err_t esp_console_repl_tcp_delete(esp_console_repl_t *repl)
+{
+    esp_err_t ret = ESP_OK;
+    esp_console_repl_com_t *repl_com = __containerof(repl, esp_console_repl_com_t, repl_core);
+    // check if already de-initialized
+    if (repl_com->state == CONSOLE_REPL_STATE_DEINIT) {
+        ESP_LOGE(TAG, "already de-initialized");
+        ret = ESP_ERR_INVALID_STATE;
+        goto _exit;
+    }
+    ret = esp_console_repl_stop(repl_com);
+    if (ret != ESP_OK) {
+        goto _exit;
+    }
+    esp_console_deinit();
+    esp_console_common_deinit(repl_com);
+    close(repl_com->listen_fd);
+    esp_console_free(repl_com);
+_exit:
+    return ret;
+}
+
+/* Number of characters the prompt takes on the terminal, not counting the
+ * escape sequences used to color it. */
+static size_t esp_console_prompt_len(const char *prompt)
+{
+    size_t len = 0;
+    while (*prompt) {
+        if (*prompt == '\x1b') {
+            /* Skip CSI sequence up to and including its final byte */
+            prompt++;
+            if (*prompt == '[') {
+                prompt++;
+                while (*prompt && (*prompt < 0x40 || *prompt > 0x7e)) {
+                    prompt++;
+                }
+            }
+            if (*prompt) {
+                prompt++;
+            }
+            continue;
+        }
+        len++;
+        prompt++;
+    }
+    return len;
+}
+
+static void esp_console_repl_print_result(FILE *out, esp_err_t err, int ret)
+{
+    if (err == ESP_ERR_NOT_FOUND) {
+        fprintf(out, "Unrecognized command\n");
+    } else if (err == ESP_ERR_INVALID_ARG) {
+        // command was empty
+    } else if (err == ESP_ERR_INVALID_SIZE) {
+        fprintf(out, "Too many arguments\n");
+    } else if (err == ESP_OK && ret != ESP_OK) {
+        fprintf(out, "Command returned non-zero error code: 0x%x (%s)\n", ret, esp_err_to_name(ret));
+    } else if (err != ESP_OK) {
+        fprintf(out, "Internal error: %s\n", esp_err_to_name(err));
+    }
+}
+
+/* Called on the worker task which ran a command submitted from a session, given as arg */
+static void esp_console_repl_job_done(esp_console_job_id_t id, esp_err_t err, int cmd_ret, void *arg)
+{
+    console_session_t *session = (console_session_t *) arg;
+    if (err == ESP_ERR_INVALID_STATE) {
+        fprintf(session->out, "Job %"PRIu32" cancelled\n", id);
+    } else {
+        esp_console_repl_print_result(session->out, err, cmd_ret);
+    }
+    fflush(session->out);
+    esp_console_session_job_done(session);
+}
+
+/* Write the lines added to the history since it was last saved */
+static void esp_console_history_flush(esp_console_repl_com_t *repl_com)
+{
+    if (repl_com->history_unsaved == 0) {
+        return;
+    }
+    if (esp_console_history_write(repl_com->history_save_path, repl_com->history_max_len, repl_com->history_append,
+                                  repl_com->history_unsaved, &repl_com->history_file_lines) != ESP_OK) {
+        ESP_LOGW(TAG, "failed to save history to %s", repl_com->history_save_path);
+    }
+    repl_com->history_unsaved = 0;
+}
+
+/* Save the history if its unsaved lines waited long enough */
+static void esp_console_history_flush_expired(esp_console_repl_com_t *repl_com)
+{
+    if (repl_com->history_unsaved != 0 && repl_com->history_flush_ticks != 0 &&
+            xTaskGetTickCount() - repl_com->history_unsaved_since >= repl_com->history_flush_ticks) {
+        esp_console_history_flush(repl_com);
+    }
+}
+
+/* Show the prompt of the session and start editing a new line */
+static void esp_console_session_start(esp_console_repl_com_t *repl_com, console_session_t *session)
+{
+    struct linenoiseState *ls = &session->ls;
+    ls->prompt = repl_com->prompt;
+    ls->plen = esp_console_prompt_len(repl_com->prompt);
+    ls->buf = session->line_buf;
+    ls->buflen = repl_com->max_cmdline_length;
+    ls->saved_line = session->saved_line_buf;
+    ls->render_buf = session->render_buf;
+    ls->render_buflen = LINENOISE_RENDER_LEN(repl_com->max_cmdline_length, CONSOLE_PROMPT_MAX_LEN);
+    ls->in = session->in;
+    ls->out = session->out;
+    linenoiseEditStart(ls);
+    if (session == &repl_com->main_session && repl_com->log_batch.buffer_size > 0) {
+        esp_console_log_batch_begin(ls);
+    }
+}
+
+/* Run the command line edited in the session */
+static void esp_console_session_run(esp_console_repl_com_t *repl_com, console_session_t *session)
+{
+    char *line = session->line_buf;
+    /* The commands of the sessions which have a history of their own only go to the
+     * global history if no session browses it. The global history is the one saved. */
+    bool add_global = true;
+    if (session->ls.history != NULL) {
+        linenoiseHistoryAddTo(session->ls.history, line);
+        add_global = repl_com->history_shared;
+    }
+    /* Add the command to the history, and save it to filesystem once enough commands were added */
+    if (add_global && linenoiseHistoryAdd(line) && repl_com->history_save_path) {
+        if (repl_com->history_unsaved++ == 0) {
+            repl_com->history_unsaved_since = xTaskGetTickCount();
+        }
+        if (repl_com->history_unsaved >= repl_com->history_flush_count) {
+            esp_console_history_flush(repl_com);
+        }
+    }
+
+    /* Commands print to the standard streams of the REPL task, point them to the session */
+    FILE *task_in = stdin;
+    FILE *task_out = stdout;
+    FILE *task_err = stderr;
+    stdin = session->in;
+    stdout = session->out;
+    stderr = session->out;
+
+    int ret = 0;
+    esp_err_t err = ESP_ERR_NOT_SUPPORTED;
+    const size_t len = strlen(line);
+    /* Commands separated by ';' are run one after the other, so they aren't given to the executor */
+    const bool batch = (esp_console_command_len(line, len) < len);
+    if (repl_com->executor && !batch) {
+        /* The job has its own copy of the line, and runs with the streams of the session.
+         * The session is kept until the result is printed to it, when the job finishes. */
+        xSemaphoreTake(repl_com->sessions_lock, portMAX_DELAY);
+        session->jobs++;
+        repl_com->jobs++;
+        xSemaphoreGive(repl_com->sessions_lock);
+        err = esp_console_executor_submit(repl_com->executor, line, esp_console_repl_job_done, session, NULL);
+        if (err != ESP_OK) {
+            esp_console_session_job_done(session);
+        }
+    }
+    if (err == ESP_ERR_NOT_SUPPORTED) {
+        /* Try to run the commands. The line is not needed anymore, so parse each of them in place. */
+        for (size_t pos = 0; pos <= len; ) {
+            char *cmd = line + pos;
+            const size_t cmd_len = esp_console_command_len(cmd, len - pos);
+            cmd[cmd_len] = '\0';
+            err = esp_console_run_ex(cmd, cmd, cmd_len + 1, repl_com->argv, CONSOLE_MAX_CMDLINE_ARGS, &ret);
+            esp_console_repl_print_result(stdout, err, ret);
+            pos += cmd_len + 1;
+        }
+    } else if (err != ESP_OK) {
+        esp_console_repl_print_result(stdout, err, ret);
+    }
+
+    fflush(stdout);
+    stdin = task_in;
+    stdout = task_out;
+    stderr = task_err;
+}
+
+/* Size of the request buffer of a session in framed mode, followed by the response buffer */
+static size_t esp_console_frame_request_size(const esp_console_repl_com_t *repl_com)
+{
+    return ESP_CONSOLE_FRAME_REQUEST_LEN(repl_com->max_cmdline_length);
+}
+
+/* Switch the session between line editing and framed mode */
+static esp_err_t esp_console_session_set_framed(esp_console_repl_com_t *repl_com, console_session_t *session, bool framed)
+{
+    if (framed && repl_com->frame_ctx == NULL) {
+        const esp_console_context_config_t ctx_config = {
+            .max_cmdline_length = repl_com->max_cmdline_length,
+            .max_cmdline_args = CONSOLE_MAX_CMDLINE_ARGS,
+        };
+        esp_err_t err = esp_console_context_create(&ctx_config, &repl_com->frame_ctx);
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+    if (framed && session->frame_buf == NULL) {
+        session->frame_buf = esp_console_malloc(esp_console_frame_request_size(repl_com) +
+                                                ESP_CONSOLE_FRAME_RESPONSE_LEN(CONSOLE_FRAME_OUTPUT_LEN));
+        if (session->frame_buf == NULL) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    /* Frames must go through the console device untouched */
+    fflush(session->out);
+    if (session == &repl_com->main_session) {
+        /* What is buffered was written with the line endings of the current mode */
+        if (repl_com->output) {
+            esp_console_output_flush(repl_com->output, CONSOLE_OUTPUT_FLUSH_MS);
+        }
+        esp_console_repl_universal_t *repl = __containerof(repl_com, esp_console_repl_universal_t, repl_com);
+        repl->set_raw_mode(repl->uart_channel, framed);
+    }
+    session->framed = framed;
+    session->frame_len = 0;
+    session->frame_overflow = false;
+    if (framed) {
+        /* The host drops what it received before this, e.g. the end of the prompt */
+        fputc(0, session->out);
+        fflush(session->out);
+    }
+    return ESP_OK;
+}
+
+/* Run the request received in the session, and send the response */
+static void esp_console_session_run_frame(esp_console_repl_com_t *repl_com, console_session_t *session)
+{
+    uint8_t *resp = session->frame_buf + esp_console_frame_request_size(repl_com);
+    size_t resp_len;
+    uint8_t type;
+    /* An empty frame stands for the request which was too long, and gets an error */
+    esp_console_frame_run(repl_com->frame_ctx, session->frame_buf, session->frame_overflow ? 0 : session->frame_len,
+                          resp, ESP_CONSOLE_FRAME_RESPONSE_LEN(CONSOLE_FRAME_OUTPUT_LEN), &resp_len, &type);
+    xSemaphoreTake(stdout_taken_sem, portMAX_DELAY);
+    fwrite(resp, 1, resp_len, session->out);
+    fflush(session->out);
+    xSemaphoreGive(stdout_taken_sem);
+    if (type == ESP_CONSOLE_FRAME_TYPE_EXIT) {
+        esp_console_session_set_framed(repl_com, session, false);
+        esp_console_session_start(repl_com, session);
+    }
+}
+
+/* Collect the frames received in the session, and handle each of them once it is complete */
+static bool esp_console_session_feed_frames(esp_console_repl_com_t *repl_com, console_session_t *session)
+{
+    struct linenoiseState *ls = &session->ls;
+    const size_t request_size = esp_console_frame_request_size(repl_com);
+    if (linenoiseFillInput(ls) <= 0) {
+        if (ls->eof) {
+            if (session->owned) {
+                return false;
+            }
+            ls->eof = 0;
+            clearerr(session->in);
+        }
+        return true;
+    }
+    while (ls->inbuf_len > 0 && session->framed) {
+        const uint8_t byte = ls->inbuf[ls->inbuf_head++];
+        ls->inbuf_len--;
+        if (byte != 0) {
+            if (session->frame_len < request_size) {
+                session->frame_buf[session->frame_len++] = byte;
+            } else {
+                session->frame_overflow = true;
+            }
+            continue;
+        }
+        /* Empty frames only resynchronize */
+        if (session->frame_len > 0 || session->frame_overflow) {
+            esp_console_session_run_frame(repl_com, session);
+        }
+        session->frame_len = 0;
+        session->frame_overflow = false;
+    }
+    return true;
+}
+
+/* Feed the input available on the session to linenoise, and run the command
+ * once the line is complete. Returns false if the session has ended. */
+static bool esp_console_session_feed(esp_console_repl_com_t *repl_com, console_session_t *session)
+{
+    if (session->framed) {
+        return esp_console_session_feed_frames(repl_com, session);
+    }
+    const int res = linenoiseEditFeedLine(&session->ls);
+    if (res == LINENOISE_EDIT_MORE) {
+        if (session->ls.eof) {
+            if (session->owned) {
+                return false;
+            }
+            session->ls.eof = 0;
+            clearerr(session->in);
+        }
+        return true;
+    }
+    linenoiseEditStop(&session->ls);
+    if (session == &repl_com->main_session && repl_com->log_batch.buffer_size > 0) {
+        esp_console_log_batch_end();
+    }
+    if (res == LINENOISE_EDIT_SWITCH) {
+        esp_err_t err = esp_console_session_set_framed(repl_com, session, true);
+        if (err == ESP_OK) {
+            return true;
+        }
+        ESP_LOGE(TAG, "framed mode not available: %s", esp_err_to_name(err));
+    } else if (res == LINENOISE_EDIT_DONE && session->ls.len > 0) {
+        esp_console_session_run(repl_com, session);
+    } else {
+        ESP_LOGD(TAG, "empty line");
+    }
+    if (repl_com->state == CONSOLE_REPL_STATE_START) {
+        esp_console_session_start(repl_com, session);
+    }
+    return true;
+}
+
+/* Without select(), read the input of the session only if some is available, so that
+ * the REPL task doesn't block in read() and notices when the REPL is deleted.
+ * Returns true if input is available, false otherwise or on errors. */
+static bool esp_console_session_poll(console_session_t *session)
+{
+    struct linenoiseState *ls = &session->ls;
+    if (ls->inbuf_len > 0) {
+        return true;
+    }
+    /* Only the first read is non-blocking: the rest of an escape sequence is read as usual */
+    const int fd = fileno(session->in);
+    const int flags = fcntl(fd, F_GETFL);
+    if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) != 0) {
+        return false;
+    }
+    linenoiseFillInput(ls);
+    fcntl(fd, F_SETFL, flags);
+    return ls->inbuf_len > 0 || ls->eof;
+}
+
+/* Check that esp_console_session_poll works on the input of the session */
+static bool esp_console_session_can_poll(console_session_t *session)
+{
+    const int fd = fileno(session->in);
+    const int flags = fcntl(fd, F_GETFL);
+    if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) != 0) {
+        return false;
+    }
+    fcntl(fd, F_SETFL, flags);
+    return true;
+}
+
+/* Start serving a session from the REPL task. Its history starts as a copy of the global one. */
+static void esp_console_session_serve(esp_console_repl_com_t *repl_com, console_session_t *session)
+{
+    linenoiseHistoryCopy(&session->history, NULL);
+    SLIST_INSERT_HEAD(&repl_com->sessions, session, next);
+    esp_console_session_start(repl_com, session);
+}
+
+/* Start serving the sessions added by other tasks */
+static void esp_console_repl_accept_sessions(esp_console_repl_com_t *repl_com)
+{
+    console_session_t *session;
+    xSemaphoreTake(repl_com->sessions_lock, portMAX_DELAY);
+    while ((session = SLIST_FIRST(&repl_com->new_sessions)) != NULL) {
+        SLIST_REMOVE_HEAD(&repl_com->new_sessions, next);
+        esp_console_session_serve(repl_com, session);
+    }
+    xSemaphoreGive(repl_com->sessions_lock);
+}
+
+/* Send data to the socket of a network session, without blocking. What the socket
+ * doesn't take waits in tx_buf, after the data which already waits there, and is sent
+ * by the REPL task once the socket is writable. What doesn't fit is dropped, or fails
+ * the session if tcp_close_on_overflow is set. MSG_MORE tells the stack that more
+ * follows, so that it is sent in as few segments as possible. Returns false once the
+ * session failed. */
+static bool esp_console_telnet_send(console_session_t *session, const void *data, size_t len, int flags)
+{
+    esp_console_repl_com_t *repl_com = session->repl_com;
+    const uint8_t *pos = data;
+    bool wake = false;
+    /* The lock of the stream is recursive, it is already held when called by esp_console_telnet_write */
+    flockfile(session->out);
+    while (len > 0 && session->tx_len == 0 && !session->tx_failed) {
+        const ssize_t sent = send(fileno(session->in), pos, len, flags);
+        if (sent < 0) {
+            if (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK) {
+                session->tx_failed = true;
+            } else if (errno != EINTR) {
+                break;
+            }
+            continue;
+        }
+        pos += sent;
+        len -= sent;
+    }
+    if (len > 0 && !session->tx_failed) {
+        size_t room = repl_com->tcp_tx_buffer_size - session->tx_len;
+        if (len > room && repl_com->tcp_close_on_overflow) {
+            ESP_LOGW(TAG, "session output overflow, closing it");
+            session->tx_failed = true;
+            room = 0;
+        }
+        len = MIN(len, room);
+        memcpy(session->tx_buf + session->tx_len, pos, len);
+        /* The REPL task waits for the socket to be writable only once it knows there is something to send */
+        wake = (session->tx_len == 0 && len > 0) || session->tx_failed;
+        session->tx_len += len;
+    }
+    const bool failed = session->tx_failed;
+    funlockfile(session->out);
+    if (wake && xTaskGetCurrentTaskHandle() != repl_com->task_hdl) {
+        esp_console_repl_wake(repl_com);
+    }
+    return !failed;
+}
+
+/* Send as much of the output waiting in tx_buf as the socket takes, called once it is writable */
+static void esp_console_telnet_flush(console_session_t *session)
+{
+    flockfile(session->out);
+    size_t pos = 0;
+    while (pos < session->tx_len) {
+        const ssize_t sent = send(fileno(session->in), session->tx_buf + pos, session->tx_len - pos, 0);
+        if (sent < 0) {
+            if (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK) {
+                session->tx_failed = true;
+            } else if (errno != EINTR) {
+                break;
+            }
+            continue;
+        }
+        pos += sent;
+    }
+    if (session->tx_failed) {
+        session->tx_len = 0;
+    } else {
+        memmove(session->tx_buf, session->tx_buf + pos, session->tx_len - pos);
+        session->tx_len -= pos;
+    }
+    funlockfile(session->out);
+}
+
+/* Answer a telnet option request of the client */
+static void esp_console_telnet_reply(void *arg, const uint8_t *data, size_t len)
+{
+    esp_console_telnet_send((console_session_t *) arg, data, len, 0);
+}
+
+/* Read the input of a network session for linenoise, without the telnet commands */
+static ssize_t esp_console_telnet_read(void *arg, char *buf, size_t len)
+{
+    console_session_t *session = (console_session_t *) arg;
+    const ssize_t nread = recv(fileno(session->in), buf, len, MSG_DONTWAIT);
+    if (nread <= 0) {
+        return nread;
+    }
+    const size_t out = esp_console_telnet_filter(&session->telnet_rx, buf, nread, session->framed);
+    if (session->telnet_rx.cols > 0) {
+        linenoiseSetColumns(&session->ls, session->telnet_rx.cols);
+        session->telnet_rx.cols = 0;
+    }
+    if (out == 0) {
+        /* Only telnet commands were received */
+        errno = EAGAIN;
+        return -1;
+    }
+    return out;
+}
+
+/* Write the output of a network session, the stream buffer is flushed here.
+ * Line endings become CR LF and IAC bytes are doubled, except in framed mode
+ * where only the latter is done. */
+static ssize_t esp_console_telnet_write(void *cookie, const char *data, size_t size)
+{
+    console_session_t *session = (console_session_t *) cookie;
+    char chunk[CONSOLE_TCP_CHUNK_LEN];
+    size_t len = 0;
+    for (size_t i = 0; i < size; i++) {
+        /* A byte takes two at most */
+        if (len + 2 > sizeof(chunk)) {
+            if (!esp_console_telnet_send(session, chunk, len, MSG_MORE)) {
+                return -1;
+            }
+            len = 0;
+        }
+        if (data[i] == '\n' && !session->framed) {
+            chunk[len++] = '\r';
+        } else if ((uint8_t) data[i] == TELNET_IAC) {
+            chunk[len++] = (char) TELNET_IAC;
+        }
+        chunk[len++] = data[i];
+    }
+    if (!esp_console_telnet_send(session, chunk, len, 0)) {
+        return -1;
+    }
+    return size;
+}
+
+/* Start serving the connection waiting on the socket of a network REPL */
+static void esp_console_repl_tcp_accept(esp_console_repl_com_t *repl_com)
+{
+    const int sock = accept(repl_com->listen_fd, NULL, NULL);
+    if (sock < 0) {
+        return;
+    }
+    size_t count = 0;
+    console_session_t *session;
+    SLIST_FOREACH(session, &repl_com->sessions, next) {
+        count += session->telnet;
+    }
+    if (count >= repl_com->max_tcp_sessions) {
+        ESP_LOGW(TAG, "too many sessions, connection refused");
+        close(sock);
+        return;
+    }
+    /* Output is coalesced in the stream buffer and flushed once per refresh
+     * or command, so there is no need to wait for acknowledgements to send it */
+    const int nodelay = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+    /* A slow client must not stall the other sessions, what it doesn't receive waits in tx_buf */
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+
+    const cookie_io_functions_t out_funcs = {
+        .write = esp_console_telnet_write,
+    };
+    FILE *in = fdopen(sock, "r");
+    session = in ? esp_console_session_new(repl_com, in, NULL) : NULL;
+    uint8_t *tx_buf = session ? esp_console_malloc(repl_com->tcp_tx_buffer_size) : NULL;
+    FILE *out = tx_buf ? fopencookie(session, "w", out_funcs) : NULL;
+    if (out == NULL) {
+        ESP_LOGW(TAG, "out of memory, connection refused");
+        esp_console_free(tx_buf);
+        esp_console_free(session);
+        if (in) {
+            fclose(in);
+        } else {
+            close(sock);
+        }
+        return;
+    }
+    setvbuf(out, NULL, _IOFBF, CONSOLE_TCP_TX_BUF_LEN);
+    session->out = out;
+    session->tx_buf = tx_buf;
+    session->telnet = true;
+    session->ls.read = esp_console_telnet_read;
+    session->ls.read_arg = session;
+    session->telnet_rx.reply = esp_console_telnet_reply;
+    session->telnet_rx.reply_arg = session;
+    linenoiseSetColumns(&session->ls, CONSOLE_TCP_DEFAULT_COLS);
+
+    esp_console_telnet_send(session, esp_console_telnet_negotiation, ESP_CONSOLE_TELNET_NEGOTIATION_LEN, MSG_MORE);
+    fprintf(out, "\n"
+            "Type 'help' to get the list of commands.\n"
+            "Use UP/DOWN arrows to navigate through command history.\n"
+            "Press Ctrl+R to search the command history.\n"
+            "Press TAB when typing command name to auto-complete.\n");
+    esp_console_session_serve(repl_com, session);
+}
+
+/* Serve the sessions of the REPL until it is deleted */
+static void esp_console_repl_serve(esp_console_repl_com_t *repl_com)
+{
+    bool use_select = true;
+    while (repl_com->state == CONSOLE_REPL_STATE_START) {
+        esp_console_repl_accept_sessions(repl_com);
+        esp_console_history_flush_expired(repl_com);
+        uint32_t log_wait_ms = UINT32_MAX;
+        if (repl_com->log_batch.buffer_size > 0) {
+            esp_console_log_batch_flush(false, &log_wait_ms);
+        }
+        if (!use_select) {
+            if (esp_console_session_poll(&repl_com->main_session)) {
+                esp_console_session_feed(repl_com, &repl_com->main_session);
+            } else {
+                vTaskDelay(pdMS_TO_TICKS(MIN(CONSOLE_REPL_POLL_MS, log_wait_ms)));
+            }
+            continue;
+        }
+
+        /* Wait for input on any session, feeding linenoise only the sessions which have some.
+         * Input already read by linenoise, e.g. the lines which follow in a paste, doesn't
+         * make the file descriptor readable, so don't wait if a session has some. */
+        fd_set read_fds;
+        fd_set write_fds;
+        FD_ZERO(&read_fds);
+        FD_ZERO(&write_fds);
+        int max_fd = -1;
+        bool pending = false;
+        console_session_t *session, *tmp;
+        if (repl_com->listen_fd >= 0) {
+            FD_SET(repl_com->listen_fd, &read_fds);
+            max_fd = repl_com->listen_fd;
+        }
+        if (repl_com->wake_fd >= 0) {
+            FD_SET(repl_com->wake_fd, &read_fds);
+            max_fd = MAX(max_fd, repl_com->wake_fd);
+        }
+        SLIST_FOREACH(session, &repl_com->sessions, next) {
+            const int fd = fileno(session->in);
+            FD_SET(fd, &read_fds);
+            if (session->tx_len > 0) {
+                FD_SET(fd, &write_fds);
+            }
+            max_fd = MAX(max_fd, fd);
+            pending |= (session->ls.inbuf_len > 0 || session->tx_failed);
+        }
+        struct timeval timeout = {
+            .tv_sec = 0,
+            .tv_usec = pending ? 0 : MIN(CONSOLE_REPL_POLL_MS, log_wait_ms) * 1000,
+        };
+        const int ready = select(max_fd + 1, &read_fds, &write_fds, NULL, &timeout);
+        if (ready < 0) {
+            if (errno != EINTR && repl_com->listen_fd < 0) {
+                /* The console driver doesn't support select(), poll it instead */
+                ESP_LOGW(TAG, "select() failed (errno %d), only the main session is served", errno);
+                if (!esp_console_session_can_poll(&repl_com->main_session)) {
+                    /* Blocking in read() would keep the REPL from being deleted */
+                    ESP_LOGE(TAG, "the console driver supports neither select() nor non-blocking reads");
+                    break;
+                }
+                use_select = false;
+            } else if (errno != EINTR) {
+                ESP_LOGW(TAG, "select() failed (errno %d)", errno);
+                vTaskDelay(pdMS_TO_TICKS(CONSOLE_REPL_POLL_MS));
+            }
+            continue;
+        }
+        if (repl_com->state != CONSOLE_REPL_STATE_START) {
+            break;
+        }
+        if (repl_com->wake_fd >= 0 && FD_ISSET(repl_com->wake_fd, &read_fds)) {
+            uint64_t events;
+            read(repl_com->wake_fd, &events, sizeof(events));
+        }
+        if (repl_com->listen_fd >= 0 && FD_ISSET(repl_com->listen_fd, &read_fds)) {
+            esp_console_repl_tcp_accept(repl_com);
+        }
+        SLIST_FOREACH_SAFE(session, &repl_com->sessions, next, tmp) {
+            const int fd = fileno(session->in);
+            if (FD_ISSET(fd, &write_fds)) {
+                esp_console_telnet_flush(session);
+            }
+            bool alive = !session->tx_failed;
+            if (alive && (session->ls.inbuf_len > 0 || FD_ISSET(fd, &read_fds))) {
+                alive = esp_console_session_feed(repl_com, session);
+            }
+            if (!alive) {
+                ESP_LOGD(TAG, "session ended");
+                SLIST_REMOVE(&repl_com->sessions, session, console_session_, next);
+                esp_console_session_end(repl_com, session);
+            }
+            if (repl_com->state != CONSOLE_REPL_STATE_START) {
+                break;
+            }
+        }
+    }
+}
+
 static void esp_console_repl_task(void *args)
 {
     esp_console_repl_universal_t *repl_conf = (esp_console_repl_universal_t *) args;
@@ -481,8 +1656,12 @@ static void esp_console_repl_task(void *args)
     const int uart_channel = repl_conf->uart_channel;
 
     /* Waiting for task notify. This happens when `esp_console_start_repl()`
-     * function is called. */
+     * function is called, or when the REPL is deleted before it was started. */
     ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    if (repl_com->state != CONSOLE_REPL_STATE_START) {
+        xSemaphoreGive(repl_com->exit_sem);
+        vTaskDelete(NULL);
+    }
 
     /* Change standard input and output of the task if the requested UART is
      * NOT the default one. This block will replace stdin, stdout and stderr.
@@ -501,11 +1680,30 @@ static void esp_console_repl_task(void *args)
      * buffering shall only be disabled for the current one. */
     setvbuf(stdin, NULL, _IONBF, 0);
 
+    /* Send the output of the task, and of the commands it runs, from a buffer */
+    FILE *device_out = stdout;
+    FILE *device_err = stderr;
+    if (repl_com->tx_buffer_size > 0) {
+        esp_console_output_config_t output_config = ESP_CONSOLE_OUTPUT_CONFIG_DEFAULT(fileno(stdout));
+        output_config.buffer_size = repl_com->tx_buffer_size;
+        output_config.chunk_size = MIN(output_config.chunk_size, repl_com->tx_buffer_size / 2);
+        output_config.policy = repl_com->tx_policy;
+        esp_err_t err = esp_console_output_create(&output_config, &repl_com->output);
+        if (err == ESP_OK) {
+            fflush(stdout);
+            stdout = esp_console_output_get_stream(repl_com->output);
+            stderr = stdout;
+        } else {
+            ESP_LOGW(TAG, "failed to create output buffer (%s), output is not buffered", esp_err_to_name(err));
+        }
+    }
+
     /* This message shall be printed here and not earlier as the stdout
      * has just been set above. */
     printf("\r\n"
            "Type 'help' to get the list of commands.\r\n"
            "Use UP/DOWN arrows to navigate through command history.\r\n"
+           "Press Ctrl+R to search the command history.\r\n"
            "Press TAB when typing command name to auto-complete.\r\n");
 
     if (linenoiseIsDumbMode()) {
@@ -516,35 +1714,53 @@ static void esp_console_repl_task(void *args)
     }
 
     linenoiseSetMaxLineLen(repl_com->max_cmdline_length);
-    while (repl_com->state == CONSOLE_REPL_STATE_START) {
-        char *line = linenoise(repl_com->prompt, NULL);
-        if (line == NULL) {
-            ESP_LOGD(TAG, "empty line");
-            /* Ignore empty lines */
-            continue;
-        }
-        /* Add the command to the history */
-        linenoiseHistoryAdd(line);
-        /* Save command history to filesystem */
-        if (repl_com->history_save_path) {
-            linenoiseHistorySave(repl_com->history_save_path);
+    console_session_t *main_session = &repl_com->main_session;
+    main_session->in = stdin;
+    main_session->out = stdout;
+    main_session->repl_com = repl_com;
+    main_session->line_buf = repl_com->line_buf;
+    main_session->saved_line_buf = repl_com->line_buf + repl_com->max_cmdline_length;
+    main_session->render_buf = main_session->saved_line_buf + repl_com->max_cmdline_length;
+    SLIST_INSERT_HEAD(&repl_com->sessions, main_session, next);
+
+    /* The logs are only printed over the line when the REPL runs on the console they go to */
+    if (repl_com->log_batch.buffer_size > 0 && uart_channel != CONFIG_ESP_CONSOLE_UART_NUM) {
+        repl_com->log_batch.buffer_size = 0;
+    }
+    if (repl_com->log_batch.buffer_size > 0) {
+        esp_err_t err = esp_console_log_batch_start(&repl_com->log_batch);
+        if (err != ESP_OK) {
+            ESP_LOGW(TAG, "failed to start log batching (%s), logs are printed over the line", esp_err_to_name(err));
+            repl_com->log_batch.buffer_size = 0;
         }
+    }
+    esp_console_session_start(repl_com, main_session);
 
-        /* Try to run the command */
-        int ret;
-        esp_err_t err = esp_console_run(line, &ret);
-        if (err == ESP_ERR_NOT_FOUND) {
-            printf("Unrecognized command\n");
-        } else if (err == ESP_ERR_INVALID_ARG) {
-            // command was empty
-        } else if (err == ESP_OK && ret != ESP_OK) {
-            printf("Command returned non-zero error code: 0x%x (%s)\n", ret, esp_err_to_name(ret));
-        } else if (err != ESP_OK) {
-            printf("Internal error: %s\n", esp_err_to_name(err));
-        }
-        /* linenoise allocates line buffer on the heap, so need to free it */
-        linenoiseFree(line);
+    esp_console_repl_serve(repl_com);
+
+    /* The logs are batched until the REPL is deleted, the output is deleted with it */
+    stdout = device_out;
+    stderr = device_err;
+    ESP_LOGD(TAG, "The End");
+    /* The REPL may be freed as soon as this is given */
+    xSemaphoreGive(repl_com->exit_sem);
+    vTaskDelete(NULL);
+}
+
+static void esp_console_repl_tcp_task(void *args)
+{
+    esp_console_repl_com_t *repl_com = (esp_console_repl_com_t *) args;
+
+    /* Waiting for task notify. This happens when `esp_console_start_repl()`
+     * function is called, or when the REPL is deleted before it was started. */
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+    if (repl_com->state == CONSOLE_REPL_STATE_START) {
+        linenoiseSetMaxLineLen(repl_com->max_cmdline_length);
+        esp_console_repl_serve(repl_com);
     }
     ESP_LOGD(TAG, "The End");
+    /* The REPL may be freed as soon as this is given */
+    xSemaphoreGive(repl_com->exit_sem);
     vTaskDelete(NULL);
 }
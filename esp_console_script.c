@@ -0,0 +1,149 @@
+/*
+ * SPDX-FileCopyrightText: 2016-2021 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include "esp_err.h"
+#include "esp_console.h"
+#include "console_private.h"
+
+#define COMMENT '#'
+
+typedef struct {
+    esp_console_context_t *ctx;
+    const esp_console_script_config_t *config;
+    esp_console_script_result_t result;
+    esp_err_t err;      // error of the first command which failed
+    size_t line;        // number of the line being run
+} script_state_t;
+
+/* Account for the outcome of a command. Returns false if the script must stop. */
+static bool script_check(script_state_t *state, esp_err_t err)
+{
+    if (err == ESP_OK) {
+        return true;
+    }
+    state->result.errors++;
+    if (state->err == ESP_OK) {
+        state->err = err;
+        state->result.error_line = state->line;
+    }
+    return !state->config->stop_on_error;
+}
+
+/* Run the commands of the line of len bytes held in the buffer of the context.
+ * Each command is parsed in place, after the ones before it. */
+static bool script_run_line(script_state_t *state, size_t len)
+{
+    char *line = state->ctx->line_buf;
+    size_t pos = strspn(line, " ");
+    if (pos == len || line[pos] == COMMENT) {
+        return true;
+    }
+    while (pos <= len) {
+        char *cmd = line + pos;
+        const size_t cmd_len = esp_console_command_len(cmd, len - pos);
+        cmd[cmd_len] = '\0';
+        pos += cmd_len + 1;
+        /* Empty command, e.g. after the last separator */
+        if (strspn(cmd, " ") == cmd_len) {
+            continue;
+        }
+        int cmd_ret = 0;
+        esp_err_t err = esp_console_run_ex(cmd, cmd, cmd_len + 1, state->ctx->argv,
+                                           state->ctx->max_cmdline_args, &cmd_ret);
+        if (err == ESP_OK) {
+            state->result.commands_run++;
+            state->result.cmd_ret = cmd_ret;
+            err = (cmd_ret == 0) ? ESP_OK : ESP_FAIL;
+        }
+        if (!script_check(state, err)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Drop the line ending, which may be CRLF */
+static size_t script_trim_line(char *line, size_t len)
+{
+    while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+        line[--len] = '\0';
+    }
+    return len;
+}
+
+static esp_err_t script_finish(script_state_t *state, esp_console_script_result_t *ret_result)
+{
+    if (ret_result) {
+        *ret_result = state->result;
+    }
+    return state->err;
+}
+
+esp_err_t esp_console_run_script(esp_console_context_t *ctx, FILE *script,
+                                 const esp_console_script_config_t *config, esp_console_script_result_t *ret_result)
+{
+    if (ctx == NULL || script == NULL || config == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    script_state_t state = {
+        .ctx = ctx,
+        .config = config,
+    };
+    char *buf = ctx->line_buf;
+    bool run = true;
+    while (run && fgets(buf, ctx->max_cmdline_length, script) != NULL) {
+        state.line++;
+        size_t len = strlen(buf);
+        if (len > 0 && buf[len - 1] != '\n') {
+            /* The buffer is full, unless the line ends right after it */
+            int c = fgetc(script);
+            if (c != '\n' && c != EOF) {
+                while (c != '\n' && c != EOF) {
+                    c = fgetc(script);
+                }
+                run = script_check(&state, ESP_ERR_INVALID_SIZE);
+                continue;
+            }
+        }
+        len = script_trim_line(buf, len);
+        run = script_run_line(&state, len);
+    }
+    return script_finish(&state, ret_result);
+}
+
+esp_err_t esp_console_run_script_buf(esp_console_context_t *ctx, const char *script, size_t script_len,
+                                     const esp_console_script_config_t *config, esp_console_script_result_t *ret_result)
+{
+    if (ctx == NULL || (script == NULL && script_len != 0) || config == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    script_state_t state = {
+        .ctx = ctx,
+        .config = config,
+    };
+    char *buf = ctx->line_buf;
+    size_t pos = 0;
+    bool run = true;
+    while (run && pos < script_len) {
+        const char *start = script + pos;
+        const char *end = memchr(start, '\n', script_len - pos);
+        size_t len = end ? (size_t)(end - start) : script_len - pos;
+        pos += len + 1;
+        state.line++;
+        if (len >= ctx->max_cmdline_length) {
+            run = script_check(&state, ESP_ERR_INVALID_SIZE);
+            continue;
+        }
+        memcpy(buf, start, len);
+        buf[len] = '\0';
+        len = script_trim_line(buf, len);
+        run = script_run_line(&state, len);
+    }
+    return script_finish(&state, ret_result);
+}
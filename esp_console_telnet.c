@@ -0,0 +1,142 @@
+/*
+ * SPDX-FileCopyrightText: 2016-2021 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "console_private.h"
+
+/* Telnet commands and options (RFC 854, 857, 858, 1073) */
+#define TELNET_SE   (240)
+#define TELNET_SB   (250)
+#define TELNET_WILL (251)
+#define TELNET_WONT (252)
+#define TELNET_DO   (253)
+#define TELNET_DONT (254)
+#define TELNET_IAC  (255)
+#define TELNET_OPT_ECHO (1)
+#define TELNET_OPT_SGA  (3)
+#define TELNET_OPT_NAWS (31)
+
+typedef enum {
+    TELNET_STATE_DATA,
+    TELNET_STATE_CR,            // CR received, a following LF or NUL is dropped
+    TELNET_STATE_CMD,           // IAC received
+    TELNET_STATE_OPTION,        // WILL, WONT, DO or DONT received
+    TELNET_STATE_SUB,           // in a subnegotiation
+    TELNET_STATE_SUB_IAC,       // IAC received in a subnegotiation
+} telnet_state_t;
+
+const uint8_t esp_console_telnet_negotiation[ESP_CONSOLE_TELNET_NEGOTIATION_LEN] = {
+    TELNET_IAC, TELNET_WILL, TELNET_OPT_ECHO,
+    TELNET_IAC, TELNET_WILL, TELNET_OPT_SGA,
+    TELNET_IAC, TELNET_DO, TELNET_OPT_NAWS,
+};
+
+/* Answer a request of the client: only echo and suppress go ahead are done by
+ * the REPL, and only the window size is wanted from the client. Replies to the
+ * requests the REPL sent need no answer. */
+static void telnet_option(esp_console_telnet_t *telnet, uint8_t cmd, uint8_t opt)
+{
+    uint8_t reply[3] = { TELNET_IAC, 0, opt };
+    if (cmd == TELNET_DO && opt != TELNET_OPT_ECHO && opt != TELNET_OPT_SGA) {
+        reply[1] = TELNET_WONT;
+    } else if (cmd == TELNET_WILL && opt != TELNET_OPT_NAWS) {
+        reply[1] = TELNET_DONT;
+    } else {
+        return;
+    }
+    if (telnet->reply) {
+        telnet->reply(telnet->reply_arg, reply, sizeof(reply));
+    }
+}
+
+/* Subnegotiations longer than the buffer are counted, but not kept */
+static void telnet_sub_put(esp_console_telnet_t *telnet, uint8_t c)
+{
+    if (telnet->sub_len < sizeof(telnet->sub)) {
+        telnet->sub[telnet->sub_len] = c;
+    }
+    telnet->sub_len++;
+}
+
+/* Window size sent by the client, there is no need to probe the terminal */
+static void telnet_sub_end(esp_console_telnet_t *telnet)
+{
+    const uint8_t *sub = telnet->sub;
+    if (telnet->sub_len == 5 && sub[0] == TELNET_OPT_NAWS) {
+        const size_t cols = (sub[1] << 8) | sub[2];
+        if (cols > 0) {
+            telnet->cols = cols;
+        }
+    }
+}
+
+size_t esp_console_telnet_filter(esp_console_telnet_t *telnet, char *buf, size_t len, bool binary)
+{
+    /* The data is filtered in place, it only gets shorter */
+    size_t out = 0;
+    for (size_t i = 0; i < len; i++) {
+        const uint8_t c = buf[i];
+        switch (telnet->state) {
+        case TELNET_STATE_CR:
+            telnet->state = TELNET_STATE_DATA;
+            if (c == '\n' || c == 0) {
+                break;
+            }
+        /* fall through */
+        case TELNET_STATE_DATA:
+            if (c == TELNET_IAC) {
+                telnet->state = TELNET_STATE_CMD;
+                break;
+            }
+            /* Enter is sent as CR LF or CR NUL, linenoise wants LF like the console drivers give it */
+            if (c == '\r' && !binary) {
+                telnet->state = TELNET_STATE_CR;
+                buf[out++] = '\n';
+                break;
+            }
+            buf[out++] = c;
+            break;
+        case TELNET_STATE_CMD:
+            telnet->state = TELNET_STATE_DATA;
+            if (c == TELNET_IAC) {
+                buf[out++] = c;
+            } else if (c >= TELNET_WILL) {
+                telnet->cmd = c;
+                telnet->state = TELNET_STATE_OPTION;
+            } else if (c == TELNET_SB) {
+                telnet->sub_len = 0;
+                telnet->state = TELNET_STATE_SUB;
+            }
+            /* Other commands, e.g. NOP, are ignored */
+            break;
+        case TELNET_STATE_OPTION:
+            telnet_option(telnet, telnet->cmd, c);
+            telnet->state = TELNET_STATE_DATA;
+            break;
+        case TELNET_STATE_SUB:
+            if (c == TELNET_IAC) {
+                telnet->state = TELNET_STATE_SUB_IAC;
+            } else {
+                telnet_sub_put(telnet, c);
+            }
+            break;
+        case TELNET_STATE_SUB_IAC:
+            if (c == TELNET_SE) {
+                telnet_sub_end(telnet);
+                telnet->state = TELNET_STATE_DATA;
+            } else if (c == TELNET_IAC) {
+                telnet_sub_put(telnet, c);
+                telnet->state = TELNET_STATE_SUB;
+            } else {
+                telnet->state = TELNET_STATE_DATA;
+            }
+            break;
+        }
+    }
+    return out;
+}
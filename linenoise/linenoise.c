@@ -50,7 +50,7 @@
  * - Win32 support
  *
  * Bloat:
- * - History search like Ctrl+r in readline?
+ * - Forward history search like Ctrl+s in readline?
  *
  * List of escape sequences used by this program, we do everything just
  * with three sequences. In order to be so cheap we may have some
@@ -113,6 +113,8 @@
 #include <string.h>
 #include <sys/fcntl.h>
 #include <sys/types.h>
+#include <sys/select.h>
+#include "esp_heap_caps.h"
 #include "linenoise.h"
 
 #define LINENOISE_DEFAULT_HISTORY_MAX_LEN 100
@@ -120,20 +122,34 @@
 #define LINENOISE_MINIMAL_MAX_LINE 64
 #define LINENOISE_COMMAND_MAX_LEN 32
 #define LINENOISE_PASTE_KEY_DELAY 30 /* Delay, in milliseconds, between two characters being pasted from clipboard */
+#define LINENOISE_HISTORY_AVG_LINE_LEN 64 /* Bytes of the history arena per entry, unless set by linenoiseHistorySetArena() */
+#define LINENOISE_COLUMNS_TIMEOUT_MS 100 /* Time given to the terminal to answer each query of the columns probe */
+#define LINENOISE_COMPLETIONS_MIN_CAP 4 /* Entries of the first completion table allocation */
 
 static linenoiseCompletionCallback *completionCallback = NULL;
 static linenoiseHintsCallback *hintsCallback = NULL;
 static linenoiseFreeHintsCallback *freeHintsCallback = NULL;
+static linenoiseMallocFn *lnMalloc = malloc;
+static linenoiseReallocFn *lnRealloc = realloc;
+static linenoiseFreeFn *lnFree = free;
 static void refreshLineWithCompletion(struct linenoiseState *ls, const linenoiseCompletions *lc, int flags);
 static void refreshLineWithFlags(struct linenoiseState *l, int flags);
+uint32_t getMillis(void);
 
 static int maskmode = 0; /* Show "***" instead of input. For passwords. */
 static size_t max_cmdline_length = LINENOISE_DEFAULT_MAX_LINE;
 static int mlmode = 0;  /* Multi line mode. Default is single line. */
 static int dumbmode = 0; /* Dumb mode where line editing is disabled. Off by default */
-static int history_max_len = LINENOISE_DEFAULT_HISTORY_MAX_LEN;
-static int history_len = 0;
-static char **history = NULL;
+static int diffmode = 1; /* Refresh only what changed in the line. On by default */
+static uint32_t columns_refresh_ms = 0; /* Probe the columns again after that long, never if 0 */
+/* History used by the lines whose state has none of its own, and by the
+ * History API functions which don't take one. */
+static struct linenoiseHistory global_history = {
+    .max_len = LINENOISE_DEFAULT_HISTORY_MAX_LEN,
+};
+static struct linenoiseHistory *historyOf(struct linenoiseHistory *h);
+static char *historyAt(const struct linenoiseHistory *h, int index);
+static int historySearch(const struct linenoiseHistory *h, const char *query, size_t len, int index);
 
 SemaphoreHandle_t stdout_taken_sem;
 
@@ -146,6 +162,7 @@ enum KEY_ACTION{
 	CTRL_D = 4,         /* Ctrl-d */
 	CTRL_E = 5,         /* Ctrl-e */
 	CTRL_F = 6,         /* Ctrl-f */
+	CTRL_G = 7,         /* Ctrl-g */
 	CTRL_H = 8,         /* Ctrl-h */
 	TAB = 9,            /* Tab */
 	CTRL_K = 11,        /* Ctrl+k */
@@ -153,6 +170,7 @@ enum KEY_ACTION{
 	ENTER = 10,         /* Enter */
 	CTRL_N = 14,        /* Ctrl-n */
 	CTRL_P = 16,        /* Ctrl-p */
+	CTRL_R = 18,        /* Ctrl-r */
 	CTRL_T = 20,        /* Ctrl-t */
 	CTRL_U = 21,        /* Ctrl+u */
 	CTRL_W = 23,        /* Ctrl+w */
@@ -186,6 +204,12 @@ void linenoiseSetMultiLine(int ml) {
     mlmode = ml;
 }
 
+/* Set if to refresh only the part of the line which changed, which may insert
+ * or delete characters on the terminal, or the whole line after each change. */
+void linenoiseSetDiffRefresh(int set) {
+    diffmode = set;
+}
+
 /* Set if terminal does not recognize escape sequences */
 void linenoiseSetDumbMode(int set) {
     dumbmode = set;
@@ -196,23 +220,58 @@ bool linenoiseIsDumbMode(void) {
     return dumbmode;
 }
 
-void flushWrite(void) {
-    if (__fbufsize(stdout) > 0) {
-        fflush(stdout);
+static void flushOutput(FILE *out) {
+    if (__fbufsize(out) > 0) {
+        fflush(out);
+    }
+    const int fd = fileno(out);
+    if (fd >= 0) {
+        fsync(fd);
     }
-    fsync(fileno(stdout));
+}
+
+/* Write raw bytes to the output of the state, bypassing the buffer of the
+ * stream. Streams without a file descriptor, such as the one of a buffered
+ * console output, get them through the stream. Returns what write() does. */
+static ssize_t writeRaw(struct linenoiseState *l, const void *data, size_t len) {
+    const int fd = fileno(l->out);
+    if (fd >= 0) {
+        return write(fd, data, len);
+    }
+    if (fwrite(data, 1, len, l->out) != len) {
+        return -1;
+    }
+    fflush(l->out);
+    return len;
+}
+
+void flushWrite(void) {
+    flushOutput(stdout);
+}
+
+/* Read a byte of the answer of the terminal, waiting until 'deadline' at most.
+ * Returns 1 if a byte was read. */
+static int readAnswer(int fd, char *c, uint32_t deadline) {
+    const int32_t left_ms = (int32_t)(deadline - getMillis());
+    if (fd < 0 || left_ms <= 0) return 0;
+    fd_set fds;
+    FD_ZERO(&fds);
+    FD_SET(fd, &fds);
+    struct timeval tv = { left_ms / 1000, (left_ms % 1000) * 1000 };
+    if (select(fd + 1, &fds, NULL, NULL, &tv) != 1) return 0;
+    return read(fd, c, 1) == 1;
 }
 
 /* Use the ESC [6n escape sequence to query the horizontal cursor position
- * and return it. On error -1 is returned, on success the position of the
- * cursor. */
-static int getCursorPosition(void) {
+ * and return it. The terminal must answer before 'deadline', in milliseconds
+ * as returned by getMillis(). On error or timeout -1 is returned, on success
+ * the position of the cursor. */
+static int getCursorPosition(struct linenoiseState *l, uint32_t deadline) {
     char buf[LINENOISE_COMMAND_MAX_LEN] = { 0 };
     int cols = 0;
     int rows = 0;
     int i = 0;
-    const int out_fd = fileno(stdout);
-    const int in_fd = fileno(stdin);
+    const int in_fd = fileno(l->in);
     /* The following ANSI escape sequence is used to get from the TTY the
      * cursor position. */
     const char get_cursor_cmd[] = "\x1b[6n";
@@ -220,10 +279,10 @@ static int getCursorPosition(void) {
     /* Send the command to the TTY on the other end of the UART.
      * Let's use unistd's write function. Thus, data sent through it are raw
      * reducing the overhead compared to using fputs, fprintf, etc... */
-    write(out_fd, get_cursor_cmd, sizeof(get_cursor_cmd));
+    writeRaw(l, get_cursor_cmd, sizeof(get_cursor_cmd));
 
     /* For USB CDC, it is required to flush the output. */
-    flushWrite();
+    flushOutput(l->out);
 
     /* The other end will send its response which format is ESC [ rows ; cols R
      * We don't know exactly how many bytes we have to read, thus, perform a
@@ -233,8 +292,9 @@ static int getCursorPosition(void) {
     while (i < sizeof(buf)-1) {
         /* Keep using unistd's functions. Here, using `read` instead of `fgets`
          * or `fgets` guarantees us that we we can read a byte regardless on
-         * whether the sender sent end of line character(s) (CR, CRLF, LF). */
-        if (read(in_fd, buf + i, 1) != 1 || buf[i] == 'R') {
+         * whether the sender sent end of line character(s) (CR, CRLF, LF).
+         * Don't wait forever for a terminal which doesn't answer. */
+        if (!readAnswer(in_fd, buf + i, deadline) || buf[i] == 'R') {
             /* If we couldn't read a byte from STDIN or if 'R' was received,
              * the transmission is finished. */
             break;
@@ -258,11 +318,10 @@ static int getCursorPosition(void) {
     return cols;
 }
 
-/* Try to get the number of columns in the current terminal, or assume 80
- * if it fails. */
-static int getColumns(void) {
+/* Try to get the number of columns in the current terminal, giving it
+ * 'timeout_ms' to answer each query. Returns -1 if it fails. */
+static int probeColumns(struct linenoiseState *l, int timeout_ms) {
     char seq[LINENOISE_COMMAND_MAX_LEN] = { 0 };
-    const int fd = fileno(stdout);
 
     /* The following ANSI escape sequence is used to tell the TTY to move
      * the cursor to the most-right position. */
@@ -273,21 +332,21 @@ static int getColumns(void) {
     const char set_cursor_pos[] = "\x1b[%dD";
 
     /* Get the initial position so we can restore it later. */
-    const int start = getCursorPosition();
+    const int start = getCursorPosition(l, getMillis() + timeout_ms);
     if (start == -1) {
         goto failed;
     }
 
     /* Send the command to go to right margin. Use `write` function instead of
      * `fwrite` for the same reasons explained in `getCursorPosition()` */
-    if (write(fd, move_cursor_right, cmd_len) != cmd_len) {
+    if (writeRaw(l, move_cursor_right, cmd_len) != cmd_len) {
         goto failed;
     }
-    flushWrite();
+    flushOutput(l->out);
 
     /* After sending this command, we can get the new position of the cursor,
      * we'd get the size, in columns, of the opened TTY. */
-    const int cols = getCursorPosition();
+    const int cols = getCursorPosition(l, getMillis() + timeout_ms);
     if (cols == -1) {
         goto failed;
     }
@@ -303,37 +362,90 @@ static int getColumns(void) {
         assert (written < LINENOISE_COMMAND_MAX_LEN);
 
         /* Send the command with `write`, which is not buffered. */
-        if (write(fd, seq, written) == -1) {
+        if (writeRaw(l, seq, written) == -1) {
             /* Can't recover... */
         }
-        flushWrite();
+        flushOutput(l->out);
     }
     return cols;
 
 failed:
-    return 80;
+    return -1;
+}
+
+/* Get the number of columns of the terminal of the state, or assume 80 if
+ * probing it fails. The result is kept for the next lines, see
+ * linenoiseSetColumnsRefresh(). */
+static size_t getColumns(struct linenoiseState *l) {
+    const int cols = probeColumns(l, LINENOISE_COLUMNS_TIMEOUT_MS);
+    l->cols_known = 1;
+    l->cols_probed_ms = getMillis();
+    return cols > 0 ? cols : 80;
+}
+
+/* Probe the columns of the terminal again when a line starts at least
+ * 'interval_ms' after they were last probed. With 0, the default, they are
+ * only probed for the first line edited with a state, then when
+ * linenoiseInvalidateColumns() is called or Ctrl-L is pressed. */
+void linenoiseSetColumnsRefresh(uint32_t interval_ms) {
+    columns_refresh_ms = interval_ms;
+}
+
+/* Probe the columns of the terminal when the next line starts, e.g. because
+ * the terminal was resized. */
+void linenoiseInvalidateColumns(struct linenoiseState *l) {
+    l->cols_known = 0;
+}
+
+/* Set the columns of the terminal, when they are known without probing it,
+ * e.g. from a telnet client. They are used from the next refresh of the line. */
+void linenoiseSetColumns(struct linenoiseState *l, size_t cols) {
+    l->cols = cols;
+    l->cols_known = 1;
+    l->cols_probed_ms = getMillis();
+}
+
+/* Probe the columns of the terminal, giving it 'timeout_ms' to answer each
+ * query, and use them for the state. This must not be called while another
+ * task reads the input of the state. Returns the columns, or -1 if the
+ * terminal didn't answer, in which case the state is left as it was. */
+int linenoiseProbeColumns(struct linenoiseState *l, int timeout_ms) {
+    if (l->in == NULL) l->in = stdin;
+    if (l->out == NULL) l->out = stdout;
+    xSemaphoreTake(stdout_taken_sem, portMAX_DELAY);
+    const int cols = probeColumns(l, timeout_ms);
+    xSemaphoreGive(stdout_taken_sem);
+    if (cols > 0) linenoiseSetColumns(l, cols);
+    return cols;
 }
 
 /* Clear the screen. Used to handle ctrl+l */
+static void clearScreen(FILE *out) {
+    fprintf(out,"\x1b[H\x1b[2J");
+    flushOutput(out);
+}
+
 void linenoiseClearScreen(void) {
-    fprintf(stdout,"\x1b[H\x1b[2J");
-    flushWrite();
+    clearScreen(stdout);
 }
 
 /* Beep, used for completion when there is nothing to complete or when all
  * the choices were already shown. */
-static void linenoiseBeep(void) {
-    fprintf(stdout, "\x7");
-    flushWrite();
+static void linenoiseBeep(struct linenoiseState *l) {
+    fprintf(l->out, "\x7");
+    flushOutput(l->out);
 }
 
 /* ============================== Completion ================================ */
 
 /* Free a list of completion option populated by linenoiseAddCompletion(). */
 static void freeCompletions(const linenoiseCompletions *lc) {
-    for (size_t i = 0; i < lc->len; i++)
-        // ReSharper disable once CppDFANullDereference
-        free(lc->cvec[i]);
+    if (!lc->borrowed) {
+        for (size_t i = 0; i < lc->len; i++)
+            // ReSharper disable once CppDFANullDereference
+            lnFree(lc->cvec[i]);
+    }
+    lnFree(lc->cvec);
 }
 
 /* Called by completeLine() and linenoiseShow() to render the current
@@ -344,7 +456,7 @@ static void freeCompletions(const linenoiseCompletions *lc) {
  * Flags are the same as refreshLine*(), that is REFRESH_* macros. */
 static void refreshLineWithCompletion(struct linenoiseState *ls, const linenoiseCompletions *lc, int flags) {
     /* Obtain the table of completions if the caller didn't provide one. */
-    linenoiseCompletions ctable = { 0, NULL };
+    linenoiseCompletions ctable = { 0, NULL, 0 };
     if (lc == NULL) {
         completionCallback(ls->buf,&ctable);
         lc = &ctable;
@@ -359,12 +471,14 @@ static void refreshLineWithCompletion(struct linenoiseState *ls, const linenoise
         ls->len = saved.len;
         ls->pos = saved.pos;
         ls->buf = saved.buf;
+        /* The screen doesn't show the line */
+        ls->shown_valid = 0;
     } else {
         refreshLineWithFlags(ls,flags);
     }
 
     /* Free the completions table if needed. */
-    if (lc != &ctable) freeCompletions(&ctable);
+    if (lc == &ctable) freeCompletions(&ctable);
 }
 
 /* This is an helper function for linenoiseEdit*() and is called when the
@@ -382,12 +496,12 @@ static void refreshLineWithCompletion(struct linenoiseState *ls, const linenoise
  * possible completions, and the caller should read for the next characters
  * from stdin. */
 static int completeLine(struct linenoiseState *ls, int keypressed) {
-    linenoiseCompletions lc = { 0, NULL };
+    linenoiseCompletions lc = { 0, NULL, 0 };
     char c = keypressed;
 
     completionCallback(ls->buf,&lc);
     if (lc.len == 0) {
-        linenoiseBeep();
+        linenoiseBeep(ls);
         ls->in_completion = 0;
     } else {
    
@@ -398,7 +512,7 @@ static int completeLine(struct linenoiseState *ls, int keypressed) {
                     ls->completion_idx = 0;
                 } else {
                     ls->completion_idx = (ls->completion_idx+1) % (lc.len+1);
-                    if (ls->completion_idx == lc.len) linenoiseBeep();
+                    if (ls->completion_idx == lc.len) linenoiseBeep(ls);
                 }
                 c = 0;
                 break;
@@ -447,78 +561,196 @@ void linenoiseSetFreeHintsCallback(linenoiseFreeHintsCallback *fn) {
     freeHintsCallback = fn;
 }
 
+/* Allocate the memory of linenoise with these functions: completions, line
+ * buffers, returned lines and the history, unless it has its own
+ * capabilities. NULL restores malloc, realloc and free. Memory allocated
+ * before the call must be possible to free with the new functions. */
+void linenoiseSetAllocator(linenoiseMallocFn *malloc_fn, linenoiseReallocFn *realloc_fn, linenoiseFreeFn *free_fn) {
+    lnMalloc = malloc_fn ? malloc_fn : malloc;
+    lnRealloc = realloc_fn ? realloc_fn : realloc;
+    lnFree = free_fn ? free_fn : free;
+}
+
+/* Append a pointer to the completion table. The cvec array grows
+ * geometrically: its capacity is LINENOISE_COMPLETIONS_MIN_CAP, or the
+ * smallest larger power of two holding all the entries, so it is only
+ * reallocated, always to a larger size, when it is full.
+ * Returns 0 on success, -1 if out of memory. */
+static int completionsAppend(linenoiseCompletions *lc, char *str) {
+    const int full = lc->len == 0 ||
+                     (lc->len >= LINENOISE_COMPLETIONS_MIN_CAP && (lc->len & (lc->len - 1)) == 0);
+    if (full) {
+        const size_t cap = lc->len ? lc->len * 2 : LINENOISE_COMPLETIONS_MIN_CAP;
+        char** cvec = lnRealloc(lc->cvec, sizeof(char*) * cap);
+        if (cvec == NULL) return -1;
+        lc->cvec = cvec;
+    }
+    lc->cvec[lc->len++] = str;
+    return 0;
+}
+
 /* This function is used by the callback function registered by the user
  * in order to add completion options given the input string when the
  * user typed <tab>. See the example.c source code for a very easy to
  * understand example. */
 void linenoiseAddCompletion(linenoiseCompletions *lc, const char *str) {
+    /* A table which holds borrowed pointers can't own strings as well,
+     * so turn the entries added so far into private copies first. */
+    if (lc->borrowed) {
+        for (size_t i = 0; i < lc->len; i++) {
+            const size_t len = strlen(lc->cvec[i]);
+            char *copy = lnMalloc(len + 1);
+            if (copy == NULL) {
+                lc->len = i;
+                break;
+            }
+            memcpy(copy, lc->cvec[i], len + 1);
+            lc->cvec[i] = copy;
+        }
+        lc->borrowed = 0;
+    }
+
     const size_t len = strlen(str);
 
-    char* copy = malloc(len + 1);
+    char* copy = lnMalloc(len + 1);
     if (copy == NULL) return;
     memcpy(copy,str,len+1);
-    char** cvec = realloc(lc->cvec, sizeof(char*) * (lc->len + 1));
-    if (cvec == NULL) {
-        free(copy);
+    if (completionsAppend(lc, copy) != 0) {
+        lnFree(copy);
+    }
+}
+
+/* Same as linenoiseAddCompletion(), but the string is not copied: the caller
+ * guarantees that it stays valid while the completion table is in use, for
+ * example because it is a statically allocated command name. If the table
+ * already owns some strings, a copy is made to keep the ownership uniform. */
+void linenoiseAddCompletionRef(linenoiseCompletions *lc, const char *str) {
+    if (lc->len > 0 && !lc->borrowed) {
+        linenoiseAddCompletion(lc, str);
         return;
     }
-    lc->cvec = cvec;
-    lc->cvec[lc->len++] = copy;
+    lc->borrowed = 1;
+    completionsAppend(lc, (char *) str);
 }
 
 /* =========================== Line editing ================================= */
 
-/* We define a very simple "append buffer" structure, that is an heap
- * allocated string where we can append to. This is useful in order to
- * write all the escape sequences in a buffer and flush them to the standard
- * output in a single call, to avoid flickering effects. */
+/* We define a very simple "append buffer" structure, that is a string
+ * where we can append to. This is useful in order to write all the escape
+ * sequences in a buffer and flush them to the standard output in a single
+ * call, to avoid flickering effects. The string is built in the render
+ * buffer of the state, which is kept between refreshes, so that refreshing
+ * doesn't allocate once the buffer is large enough. */
 struct abuf {
-    char *b;
-    int len;
+    struct linenoiseState *l;
+    size_t len;
 };
 
-static void abInit(struct abuf *ab) {
-    ab->b = NULL;
+static void abInit(struct abuf *ab, struct linenoiseState *l) {
+    ab->l = l;
     ab->len = 0;
 }
 
-static void abAppend(struct abuf *ab, const char *s, int len) {
-    char *new = realloc(ab->b,ab->len+len);
+/* Make the render buffer hold at least 'size' bytes, doubling its size. */
+static int abGrow(struct abuf *ab, size_t size) {
+    struct linenoiseState *l = ab->l;
+    size_t new_size = l->render_buflen ? l->render_buflen * 2 : LINENOISE_RENDER_EXTRA;
+    if (new_size < size) new_size = size;
+    char *new = l->render_owned ? lnRealloc(l->render_buf,new_size) : lnMalloc(new_size);
+    if (new == NULL) return -1;
+    /* A buffer provided by the caller is left as it is */
+    if (!l->render_owned && ab->len) memcpy(new,l->render_buf,ab->len);
+    l->render_buf = new;
+    l->render_buflen = new_size;
+    l->render_owned = 1;
+    return 0;
+}
 
-    if (new == NULL) return;
-    memcpy(new+ab->len,s,len);
-    ab->b = new;
+static void abAppend(struct abuf *ab, const char *s, int len) {
+    struct linenoiseState *l = ab->l;
+    if (ab->len+len > l->render_buflen && abGrow(ab,ab->len+len) != 0) return;
+    memcpy(l->render_buf+ab->len,s,len);
     ab->len += len;
 }
 
-static void abFree(const struct abuf *ab) {
-    free(ab->b);
+/* Append 'n' characters of the edited line, starting at 'start'. */
+static void abAppendLine(struct abuf *ab, size_t start, size_t n) {
+    if (maskmode == 1) {
+        while (n--) abAppend(ab,"*",1);
+    } else {
+        abAppend(ab,ab->l->buf+start,n);
+    }
+}
+
+/* Write the content of the buffer to the output of the state. */
+static void abWrite(const struct abuf *ab) {
+    struct linenoiseState *l = ab->l;
+    if (fwrite(l->render_buf, ab->len, 1, l->out) == -1) {} /* Can't recover from write error. */
+    flushOutput(l->out);
+    l->refresh_bytes = ab->len;
+    l->refresh_total += ab->len;
+}
+
+/* Hint shown to the right of the line. */
+struct hint {
+    char *str;          /* As returned by the hints callback. */
+    int len;            /* Characters shown, at most the columns left. */
+    int color;
+    int bold;
+    uint32_t hash;      /* Hash of what is shown, 0 if nothing is. */
+};
+
+/* Get the hint of the line. It must be released with freeHint(). */
+static void getHint(const struct linenoiseState *l, int plen, struct hint *h) {
+    h->str = NULL;
+    h->len = 0;
+    h->color = -1;
+    h->bold = 0;
+    h->hash = 0;
+    if (!hintsCallback || plen+l->len >= l->cols) return;
+    h->str = hintsCallback(l->buf,&h->color,&h->bold);
+    if (h->str == NULL) return;
+    h->len = strlen(h->str);
+    const int hintmaxlen = l->cols-(plen+l->len);
+    if (h->len > hintmaxlen) h->len = hintmaxlen;
+    if (h->bold == 1 && h->color == -1) h->color = 37;
+    if (h->len <= 0) return;
+    /* FNV-1a, to tell if the hint on the screen changed */
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < h->len; i++) hash = (hash ^ (unsigned char)h->str[i]) * 16777619u;
+    hash = (hash ^ (uint32_t)h->color) * 16777619u;
+    h->hash = ((hash ^ (uint32_t)h->bold) * 16777619u) | 1;
+}
+
+static void freeHint(struct hint *h) {
+    /* Call the function to free the hint returned. */
+    if (h->str && freeHintsCallback) freeHintsCallback(h->str);
+}
+
+/* Append the hint, and remember it is the one on the screen. */
+static void abAppendHint(struct abuf *ab, const struct hint *h) {
+    if (h->len > 0) {
+        char seq[64];
+        if (h->color != -1 || h->bold != 0)
+            snprintf(seq,64,"\033[%d;%dm",h->bold,h->color);
+        else
+            seq[0] = '\0';
+        abAppend(ab,seq,strlen(seq));
+        abAppend(ab,h->str,h->len);
+        if (h->color != -1 || h->bold != 0)
+            abAppend(ab,"\033[0m",4);
+    }
+    ab->l->shown_hintlen = h->len;
+    ab->l->shown_hint_hash = h->hash;
 }
 
 /* Helper of refreshSingleLine() and refreshMultiLine() to show hints
  * to the right of the prompt. */
-void refreshShowHints(struct abuf *ab, const struct linenoiseState *l, int plen) {
-    if (hintsCallback && plen+l->len < l->cols) {
-        int color = -1, bold = 0;
-        char *hint = hintsCallback(l->buf,&color,&bold);
-        if (hint) {
-            char seq[64];
-            int hintlen = strlen(hint);
-            const int hintmaxlen = l->cols-(plen+l->len);
-            if (hintlen > hintmaxlen) hintlen = hintmaxlen;
-            if (bold == 1 && color == -1) color = 37;
-            if (color != -1 || bold != 0)
-                snprintf(seq,64,"\033[%d;%dm",bold,color);
-            else
-                seq[0] = '\0';
-            abAppend(ab,seq,strlen(seq));
-            abAppend(ab,hint,hintlen);
-            if (color != -1 || bold != 0)
-                abAppend(ab,"\033[0m",4);
-            /* Call the function to free the hint returned. */
-            if (freeHintsCallback) freeHintsCallback(hint);
-        }
-    }
+void refreshShowHints(struct abuf *ab, struct linenoiseState *l, int plen) {
+    struct hint h;
+    getHint(l,plen,&h);
+    abAppendHint(ab,&h);
+    freeHint(&h);
 }
 
 /* Single line low level line refresh.
@@ -528,7 +760,7 @@ void refreshShowHints(struct abuf *ab, const struct linenoiseState *l, int plen)
  *
  * Flags is REFRESH_* macros. The function can just remove the old
  * prompt, just write it, or both. */
-static void refreshSingleLine(const struct linenoiseState *l, int flags) {
+static void refreshSingleLine(struct linenoiseState *l, int flags) {
     char seq[64];
     const size_t plen = l->plen;
     const char *buf = l->buf;
@@ -545,7 +777,7 @@ static void refreshSingleLine(const struct linenoiseState *l, int flags) {
         len--;
     }
 
-    abInit(&ab);
+    abInit(&ab,l);
     /* Cursor to left edge */
     snprintf(seq,sizeof(seq),"\r");
     abAppend(&ab,seq,strlen(seq));
@@ -571,9 +803,11 @@ static void refreshSingleLine(const struct linenoiseState *l, int flags) {
         abAppend(&ab,seq,strlen(seq));
     }
 
-    if (fwrite(ab.b, ab.len, 1, stdout) == -1) {} /* Can't recover from write error. */
-    flushWrite();
-    abFree(&ab);
+    /* refreshLineFrom() can only follow a line which isn't scrolled */
+    l->shown_valid = (flags & REFRESH_WRITE) && buf == l->buf && len == l->len && plen+len < l->cols;
+    l->shown_len = l->len;
+    l->oldpos = l->pos;
+    abWrite(&ab);
 }
 
 /* Multi line low level line refresh.
@@ -595,7 +829,7 @@ static void refreshMultiLine(struct linenoiseState *l, int flags) {
 
     /* First step: clear all the lines used before. To do so start by
      * going to the last row. */
-    abInit(&ab);
+    abInit(&ab,l);
 
     if (flags & REFRESH_CLEAN) {
         if (old_rows-rpos > 0) {
@@ -660,10 +894,10 @@ static void refreshMultiLine(struct linenoiseState *l, int flags) {
     }
 
     l->oldpos = l->pos;
+    l->shown_valid = (flags & REFRESH_WRITE) != 0;
+    l->shown_len = l->len;
 
-    if (fwrite(ab.b, ab.len, 1, stdout) == -1) {} /* Can't recover from write error. */
-    flushWrite();
-    abFree(&ab);
+    abWrite(&ab);
 }
 
 /* Calls the two low level functions refreshSingleLine() or
@@ -680,6 +914,136 @@ static void refreshLine(struct linenoiseState *l) {
     refreshLineWithFlags(l,REFRESH_ALL);
 }
 
+/* Position of the cursor on the screen, relative to the start of the prompt. */
+struct cursor {
+    size_t row;
+    size_t col;
+    int pending;    /* The last column was just written: the cursor stays there
+                     * until the next character is written on the next row. */
+};
+
+/* Cursor after writing from the cell 'start' to 'end', cells being counted
+ * from the start of the prompt, row after row. */
+static void cursorAfterWrite(const struct linenoiseState *l, struct cursor *cur, size_t start, size_t end) {
+    cur->pending = end > start && end % l->cols == 0;
+    cur->row = end / l->cols - cur->pending;
+    cur->col = cur->pending ? l->cols - 1 : end % l->cols;
+}
+
+/* Append the sequences moving the cursor to the cell 'cell' of the line, on
+ * one of the 'rows' rows of the screen used by the line, or on the row after
+ * them. Characters between the cursor and the cell must be the ones of the
+ * line, which is the case before what changed and after what was written. */
+static void abMoveCursor(struct abuf *ab, struct cursor *cur, size_t cell, size_t rows) {
+    const struct linenoiseState *l = ab->l;
+    const size_t row = cell / l->cols;
+    const size_t col = cell % l->cols;
+    char seq[16];
+
+    if (row >= rows && row > cur->row) {
+        /* The row is not on the screen yet, line feeds scroll to it. They
+         * may also return to the first column, so return in any case. */
+        for (; cur->row < row; cur->row++) abAppend(ab,"\n",1);
+        abAppend(ab,"\r",1);
+        cur->col = 0;
+        cur->pending = 0;
+    } else if (cur->pending) {
+        /* Terminals don't agree on moves from a pending wrap, return first */
+        abAppend(ab,"\r",1);
+        cur->col = 0;
+        cur->pending = 0;
+    }
+    if (row != cur->row) {
+        snprintf(seq,sizeof(seq),"\x1b[%d%c",
+                 (int)(row > cur->row ? row-cur->row : cur->row-row), row > cur->row ? 'B' : 'A');
+        abAppend(ab,seq,strlen(seq));
+    }
+    cur->row = row;
+
+    if (col == cur->col) return;
+    const size_t from = row*l->cols + cur->col;
+    if (col == 0) {
+        abAppend(ab,"\r",1);
+    } else if (col+1 == cur->col) {
+        abAppend(ab,"\b",1);
+    } else if (col > cur->col && col-cur->col < 4 && from >= l->plen && cell <= l->plen+l->len) {
+        /* Writing the characters is shorter than the escape sequence */
+        abAppendLine(ab,from-l->plen,col-cur->col);
+    } else {
+        snprintf(seq,sizeof(seq),"\x1b[%d%c",
+                 (int)(col > cur->col ? col-cur->col : cur->col-col), col > cur->col ? 'C' : 'D');
+        abAppend(ab,seq,strlen(seq));
+    }
+    cur->col = col;
+}
+
+/* Refresh the line after a change starting at 'from': 'shift' characters
+ * were inserted there if positive, or deleted if negative, the rest of the
+ * line being the same; if 0, the line may have changed from 'from' to its
+ * end. Only what changed is written to the terminal: the changed part of
+ * the line, moving the cursor around it, or, when the line fits in a row,
+ * the sequences inserting or deleting characters in place.
+ *
+ * This follows what the last refresh showed, and refreshes the whole line
+ * if it isn't known, e.g. after a scrolled single line or a completion. */
+static void refreshLineFrom(struct linenoiseState *l, size_t from, int shift) {
+    const size_t plen = l->plen;
+    if (!diffmode || !l->shown_valid || (!mlmode && plen+l->len >= l->cols)) {
+        refreshLine(l);
+        return;
+    }
+    struct hint h;
+    getHint(l,plen,&h);
+    const int same_hint = h.len == l->shown_hintlen && h.hash == l->shown_hint_hash;
+    const size_t old_end = plen + l->shown_len + l->shown_hintlen;
+    const size_t end = plen + l->len + h.len;
+    size_t rows = (mlmode && l->oldrows > 1) ? l->oldrows : 1;
+    const size_t cur_cell = plen + l->oldpos;
+    struct cursor cur = { cur_cell / l->cols, cur_cell % l->cols, 0 };
+    struct abuf ab;
+    char seq[16];
+
+    abInit(&ab,l);
+    /* Characters moved by inserting or deleting, which would be written again */
+    const size_t moved = l->len - from - (shift > 0 ? shift : 0) + h.len;
+    if (shift != 0 && same_hint && old_end < l->cols && end < l->cols && moved >= 4) {
+        abMoveCursor(&ab,&cur,plen+from,rows);
+        if (shift > 0) {
+            snprintf(seq,sizeof(seq),"\x1b[%d@",shift);
+            abAppend(&ab,seq,strlen(seq));
+            abAppendLine(&ab,from,shift);
+            cur.col += shift;
+        } else {
+            snprintf(seq,sizeof(seq),"\x1b[%dP",-shift);
+            abAppend(&ab,seq,strlen(seq));
+        }
+    } else if (from < l->len || l->len != l->shown_len || !same_hint) {
+        abMoveCursor(&ab,&cur,plen+from,rows);
+        abAppendLine(&ab,from,l->len-from);
+        /* The hint moves with the end of the line */
+        const int write_hint = l->len != l->shown_len || !same_hint;
+        if (write_hint) abAppendHint(&ab,&h);
+        cursorAfterWrite(l,&cur,plen+from,write_hint ? end : plen+l->len);
+        if (cur.row+1 > rows) rows = cur.row+1;
+        if (write_hint && end < old_end) {
+            /* Erase what is left of the longer line */
+            abMoveCursor(&ab,&cur,end,rows);
+            abAppend(&ab,(old_end-1)/l->cols == cur.row ? "\x1b[0K" : "\x1b[0J",4);
+        }
+    }
+    abMoveCursor(&ab,&cur,plen+l->pos,rows);
+
+    l->shown_len = l->len;
+    l->oldpos = l->pos;
+    if (mlmode) {
+        /* Rows used, as refreshMultiLine() counts them */
+        l->oldrows = (plen+l->len+l->cols-1)/l->cols;
+        if (cur.row+1 > l->oldrows) l->oldrows = cur.row+1;
+    }
+    freeHint(&h);
+    abWrite(&ab);
+}
+
 /* Hide the current line, when using the multiplexing API. */
 void linenoiseHide(struct linenoiseState *l) {
     if (mlmode)
@@ -711,10 +1075,14 @@ int linenoiseEditInsert(struct linenoiseState *l, char c) {
                 /* Avoid a full update of the line in the
                  * trivial case. */
                 const char d = (maskmode==1) ? '*' : c;
-                if (fwrite(&d,1,1,stdout) == -1) return -1;
-                flushWrite();
+                if (fwrite(&d,1,1,l->out) == -1) return -1;
+                flushOutput(l->out);
+                l->shown_len = l->len;
+                l->oldpos = l->pos;
+                l->refresh_bytes = 1;
+                l->refresh_total++;
             } else {
-                refreshLine(l);
+                refreshLineFrom(l,l->pos-1,1);
             }
         } else {
             memmove(l->buf+l->pos+1,l->buf+l->pos,l->len-l->pos);
@@ -722,23 +1090,47 @@ int linenoiseEditInsert(struct linenoiseState *l, char c) {
             l->len++;
             l->pos++;
             l->buf[l->len] = '\0';
-            refreshLine(l);
+            refreshLineFrom(l,l->pos-1,1);
         }
     }
     return 0;
 }
 
+/* Printable characters are inserted as they are when pasted. Control
+ * characters and escape sequences are handled as keys. */
+static bool isPastedChar(char c) {
+    return (unsigned char) c >= ' ' && c != BACKSPACE;
+}
+
+/* Insert pasted text: 'c' and the run of printable characters which follow
+ * it in the input buffer are appended to the line with a single write,
+ * without refreshing the line. If the cursor is not at the end of the line,
+ * 'c' is inserted as if it was typed.
+ *
+ * On error writing to the terminal -1 is returned, otherwise 0. */
 int linenoiseInsertPastedChar(struct linenoiseState *l, char c) {
-    const int fd = fileno(stdout);
-    if (l->len < l->buflen && l->len == l->pos) {
-        l->buf[l->pos] = c;
-        l->pos++;
-        l->len++;
-        l->buf[l->len] = '\0';
-        if (write(fd, &c,1) == -1) {
+    if (l->len != l->pos || maskmode == 1) {
+        return linenoiseEditInsert(l, c);
+    }
+    const size_t start = l->len;
+    if (l->len < l->buflen) {
+        l->buf[l->len++] = c;
+    }
+    while (l->len < l->buflen && l->inbuf_len > 0 && isPastedChar(l->inbuf[l->inbuf_head])) {
+        l->buf[l->len++] = l->inbuf[l->inbuf_head++];
+        l->inbuf_len--;
+    }
+    l->pos = l->len;
+    l->buf[l->len] = '\0';
+    if (l->len > start) {
+        if (fwrite(l->buf + start, l->len - start, 1, l->out) != 1) {
             return -1;
         }
-        flushWrite();
+        flushOutput(l->out);
+        /* The text may have wrapped, or been written over the hint */
+        l->shown_valid &= !hintsCallback && l->plen+l->len < l->cols;
+        l->shown_len = l->len;
+        l->oldpos = l->pos;
     }
     return 0;
 }
@@ -747,7 +1139,7 @@ int linenoiseInsertPastedChar(struct linenoiseState *l, char c) {
 void linenoiseEditMoveLeft(struct linenoiseState *l) {
     if (l->pos > 0) {
         l->pos--;
-        refreshLine(l);
+        refreshLineFrom(l,l->len,0);
     }
 }
 
@@ -755,7 +1147,7 @@ void linenoiseEditMoveLeft(struct linenoiseState *l) {
 void linenoiseEditMoveRight(struct linenoiseState *l) {
     if (l->pos != l->len) {
         l->pos++;
-        refreshLine(l);
+        refreshLineFrom(l,l->len,0);
     }
 }
 
@@ -763,7 +1155,7 @@ void linenoiseEditMoveRight(struct linenoiseState *l) {
 void linenoiseEditMoveHome(struct linenoiseState *l) {
     if (l->pos != 0) {
         l->pos = 0;
-        refreshLine(l);
+        refreshLineFrom(l,l->len,0);
     }
 }
 
@@ -771,8 +1163,30 @@ void linenoiseEditMoveHome(struct linenoiseState *l) {
 void linenoiseEditMoveEnd(struct linenoiseState *l) {
     if (l->pos != l->len) {
         l->pos = l->len;
-        refreshLine(l);
+        refreshLineFrom(l,l->len,0);
+    }
+}
+
+/* Save the line being edited, to show it again when coming back to history
+ * index 0. Changes to the history entries are not kept. */
+static int saveEditedLine(struct linenoiseState *l) {
+    if (l->history_index != 0) return 0;
+    if (l->saved_line == NULL) {
+        l->saved_line = lnMalloc(l->buflen + 1);
+        if (l->saved_line == NULL) return -1;
+        l->saved_line_owned = 1;
     }
+    memcpy(l->saved_line, l->buf, l->len + 1);
+    return 0;
+}
+
+/* Show the line of the history index 'index' in the buffer. */
+static void showHistoryEntry(struct linenoiseState *l, int index) {
+    const struct linenoiseHistory *h = historyOf(l->history);
+    const char *entry = (index == 0) ? l->saved_line : historyAt(h, h->len - index);
+    strncpy(l->buf,entry,l->buflen);
+    l->buf[l->buflen-1] = '\0';
+    l->len = l->pos = strlen(l->buf);
 }
 
 /* Substitute the currently edited line with the next or previous history
@@ -780,25 +1194,128 @@ void linenoiseEditMoveEnd(struct linenoiseState *l) {
 #define LINENOISE_HISTORY_NEXT 0
 #define LINENOISE_HISTORY_PREV 1
 void linenoiseEditHistoryNext(struct linenoiseState *l, int dir) {
-    if (history_len > 1) {
-        /* Update the current history entry before to
-         * overwrite it with the next one. */
-        free(history[history_len - 1 - l->history_index]);
-        history[history_len - 1 - l->history_index] = strdup(l->buf);
-        /* Show the new entry */
-        l->history_index += (dir == LINENOISE_HISTORY_PREV) ? 1 : -1;
-        if (l->history_index < 0) {
-            l->history_index = 0;
-            return;
-        } else if (l->history_index >= history_len) {
-            l->history_index = history_len-1;
-            return;
+    /* Index 0 is the line being edited, index N is the Nth most recent entry
+     * of the history. The line being edited is not added to the shared
+     * history, so several lines may be edited at the same time. */
+    const int index = l->history_index + ((dir == LINENOISE_HISTORY_PREV) ? 1 : -1);
+    if (index < 0 || index > historyOf(l->history)->len) return;
+
+    if (saveEditedLine(l) != 0) return;
+
+    /* Show the new entry */
+    l->history_index = index;
+    showHistoryEntry(l, index);
+    refreshLine(l);
+}
+
+/* Clear the edited line from the screen, so that it can be written again
+ * with a prompt of another length. A single line is simply overwritten. */
+static void clearEditedLine(struct linenoiseState *l) {
+    if (!mlmode) return;
+    refreshLineWithFlags(l, REFRESH_CLEAN);
+    /* The cursor is now on the first row of the line */
+    l->oldrows = 0;
+    l->oldpos = 0;
+}
+
+/* Show the search prompt with the query, followed by the line of the history
+ * index 'index' with the cursor on the query. */
+static void refreshSearch(struct linenoiseState *l, int index) {
+    char *query = l->search_prompt + strlen(LINENOISE_SEARCH_PROMPT);
+    clearEditedLine(l);
+    memcpy(query + l->search_len, "': ", 4);
+    l->plen = strlen(l->search_prompt);
+    l->search_index = index;
+    showHistoryEntry(l, index != 0 ? index : l->history_index);
+    if (index != 0) {
+        const char *match = memmem(l->buf, l->len, query, l->search_len);
+        if (match) l->pos = match - l->buf;
+    }
+    refreshLine(l);
+}
+
+/* Start a Ctrl-R search of the history, showing the search prompt in place
+ * of the normal one. */
+static void startSearch(struct linenoiseState *l) {
+    if (saveEditedLine(l) != 0) return;
+    l->in_search = 1;
+    l->search_len = 0;
+    l->search_index = 0;
+    l->edit_prompt = l->prompt;
+    l->edit_plen = l->plen;
+    strcpy(l->search_prompt, LINENOISE_SEARCH_PROMPT);
+    l->prompt = l->search_prompt;
+    refreshSearch(l, 0);
+}
+
+/* End the search, keeping the current match in the buffer if 'accept' is
+ * set, else showing the line which was shown before the search. */
+static void stopSearch(struct linenoiseState *l, int accept) {
+    clearEditedLine(l);
+    l->in_search = 0;
+    l->prompt = l->edit_prompt;
+    l->plen = l->edit_plen;
+    if (accept && l->search_index != 0) {
+        /* Browse the history from the match */
+        l->history_index = l->search_index;
+    } else if (!accept) {
+        showHistoryEntry(l, l->history_index);
+    }
+    refreshLine(l);
+}
+
+/* This is an helper function for linenoiseEditFeed() called when the user
+ * is searching the history with Ctrl-R: typed characters refine the query,
+ * Ctrl-R looks for an older match, Ctrl-G cancels the search. Every other key
+ * ends the search, keeping the match, and is returned to be handled as usual.
+ * Returns 0 if the key was consumed.
+ *
+ * Each new character can only narrow the matches, so the search resumes from
+ * the current match instead of the most recent entry. */
+static int searchHistory(struct linenoiseState *l, int c) {
+    char *query = l->search_prompt + strlen(LINENOISE_SEARCH_PROMPT);
+    int index;
+
+    switch(c) {
+    case CTRL_R:
+        if (l->search_len == 0) break;
+        index = historySearch(historyOf(l->history), query, l->search_len, l->search_index + 1);
+        if (index == 0) {
+            linenoiseBeep(l);
+        } else {
+            refreshSearch(l, index);
         }
-        strncpy(l->buf,history[history_len - 1 - l->history_index],l->buflen);
-        l->buf[l->buflen-1] = '\0';
-        l->len = l->pos = strlen(l->buf);
-        refreshLine(l);
+        break;
+    case BACKSPACE:
+    case CTRL_H:
+        if (l->search_len == 0) break;
+        l->search_len--;
+        refreshSearch(l, l->search_len ? historySearch(historyOf(l->history), query, l->search_len, 1) : 0);
+        break;
+    case CTRL_G:
+        stopSearch(l, 0);
+        break;
+    default:
+        if (c < ' ') {
+            stopSearch(l, 1);
+            return c;
+        }
+        if (l->search_len == LINENOISE_SEARCH_MAX_LEN) {
+            linenoiseBeep(l);
+            break;
+        }
+        query[l->search_len] = c;
+        index = historySearch(historyOf(l->history), query, l->search_len + 1, l->search_index ? l->search_index : 1);
+        if (index == 0) {
+            query[l->search_len] = '\'';
+            linenoiseBeep(l);
+        } else {
+            l->search_len++;
+            refreshSearch(l, index);
+        }
+        break;
     }
+    return 0;
 }
 
 /* Delete the character at the right of the cursor without altering the cursor
@@ -808,7 +1325,7 @@ void linenoiseEditDelete(struct linenoiseState *l) {
         memmove(l->buf+l->pos,l->buf+l->pos+1,l->len-l->pos-1);
         l->len--;
         l->buf[l->len] = '\0';
-        refreshLine(l);
+        refreshLineFrom(l,l->pos,-1);
     }
 }
 
@@ -819,7 +1336,7 @@ void linenoiseEditBackspace(struct linenoiseState *l) {
         l->pos--;
         l->len--;
         l->buf[l->len] = '\0';
-        refreshLine(l);
+        refreshLineFrom(l,l->pos,-1);
     }
 }
 
@@ -835,46 +1352,118 @@ void linenoiseEditDeletePrevWord(struct linenoiseState *l) {
     const size_t diff = old_pos - l->pos;
     memmove(l->buf+l->pos,l->buf+old_pos,l->len-old_pos+1);
     l->len -= diff;
-    refreshLine(l);
+    refreshLineFrom(l,diff ? l->pos : l->len,-(int)diff);
 }
 
-// TODO: try to make a non-blocking dumb mode
-static char *linenoiseDumb(struct linenoiseState *l) {
-    /* dumb terminal, fall back to fgets */
-    // Not needed anymore, prompt is now in linenoiseEditStart
-    // fputs(l->prompt, stdout);
-    // flushWrite();
-    l->len = 0; //needed?
-    while (l->len < l->buflen) {
-        const int c = fgetc(stdin);
-        xSemaphoreTake(stdout_taken_sem, portMAX_DELAY);
-        if (c == '\n') {
-            xSemaphoreGive(stdout_taken_sem);
-            break;
-        } else if (c >= 0x1c && c <= 0x1f){
-            xSemaphoreGive(stdout_taken_sem);
-            continue; /* consume arrow keys */
-        } else if (c == BACKSPACE || c == 0x8) {
+/* Read input into l->inbuf, if it is empty. The input file descriptor is read
+ * in bulk: after waiting for one byte, all the bytes already available are read
+ * at once, so that pasted text costs one read() per chunk rather than one per
+ * byte. Returns the number of bytes in l->inbuf, 0 at the end of the input, or
+ * -1 if no byte is available or on errors; l->eof is set in the latter cases,
+ * except if reading would block. */
+int linenoiseFillInput(struct linenoiseState *l) {
+    if (l->inbuf_len > 0) {
+        return l->inbuf_len;
+    }
+    const int fd = fileno(l->in);
+    ssize_t nread;
+    if (l->read) {
+        nread = l->read(l->read_arg, l->inbuf, sizeof(l->inbuf));
+        if (nread <= 0) {
+            if (nread == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+                l->eof = 1;
+            }
+            return nread;
+        }
+    } else if (fd < 0) {
+        /* Not backed by a file descriptor, e.g. a memory stream */
+        nread = fread(l->inbuf, 1, 1, l->in);
+        if (nread <= 0) {
+            l->eof = 1;
+            return feof(l->in) ? 0 : -1;
+        }
+    } else {
+        const int flags = fcntl(fd, F_GETFL);
+        const bool blocking = (flags != -1) && !(flags & O_NONBLOCK);
+        nread = read(fd, l->inbuf, blocking ? 1 : sizeof(l->inbuf));
+        if (nread <= 0) {
+            if (nread == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+                l->eof = 1;
+            }
+            return nread;
+        }
+        /* Only wait for the first byte, then take what is available */
+        if (blocking && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0) {
+            const ssize_t more = read(fd, l->inbuf + 1, sizeof(l->inbuf) - 1);
+            if (more > 0) {
+                nread += more;
+            }
+            fcntl(fd, F_SETFL, flags);
+        }
+    }
+    l->inbuf_head = 0;
+    l->inbuf_len = nread;
+    return nread;
+}
+
+/* Read the next byte of input. Returns 1 if a byte was read, otherwise what
+ * linenoiseFillInput() returned. */
+static int readInput(struct linenoiseState *l, char *c) {
+    const int res = linenoiseFillInput(l);
+    if (res <= 0) {
+        return res;
+    }
+    *c = l->inbuf[l->inbuf_head++];
+    l->inbuf_len--;
+    return 1;
+}
+
+/* Dumb terminal, line editing is disabled. Handles one character, so that
+ * the dumb mode doesn't block the multiplexed API either. */
+static int linenoiseDumb(struct linenoiseState *l) {
+    char ch;
+    if (readInput(l, &ch) <= 0) {
+        return LINENOISE_EDIT_MORE;
+    }
+    const int c = (unsigned char) ch;
+    xSemaphoreTake(stdout_taken_sem, portMAX_DELAY);
+    if (c >= 0x1c && c <= 0x1f) {
+        xSemaphoreGive(stdout_taken_sem);
+        return LINENOISE_EDIT_MORE; /* consume arrow keys */
+    }
+    if (c != '\n') {
+        if (c == BACKSPACE || c == 0x8) {
             if (l->len > 0) {
                 l->buf[l->len - 1] = 0;
                 l->len --;
             }
-            fputs("\x08 ", stdout); /* Windows CMD: erase symbol under cursor */
-            flushWrite();
+            fputs("\x08 ", l->out); /* Windows CMD: erase symbol under cursor */
+            flushOutput(l->out);
         } else {
             l->buf[l->len] = c;
             l->len++;
+            /* Escape sequences aren't decoded, look for the switch sequence at the end of the line */
+            const size_t seq_len = sizeof(LINENOISE_SWITCH_SEQ) - 1;
+            if (c == LINENOISE_SWITCH_SEQ[seq_len - 1] && l->len >= seq_len &&
+                    memcmp(l->buf + l->len - seq_len, LINENOISE_SWITCH_SEQ, seq_len) == 0) {
+                l->len -= seq_len;
+                l->buf[l->len] = '\0';
+                xSemaphoreGive(stdout_taken_sem);
+                return LINENOISE_EDIT_SWITCH;
+            }
+        }
+        fputc(c, l->out); /* echo */
+        flushOutput(l->out);
+        if (l->len < l->buflen) {
+            xSemaphoreGive(stdout_taken_sem);
+            return LINENOISE_EDIT_MORE;
         }
-        fputc(c, stdout); /* echo */
-        flushWrite();
-        xSemaphoreGive(stdout_taken_sem);
     }
-    xSemaphoreTake(stdout_taken_sem, portMAX_DELAY);
-    fputc('\n', stdout);
-    flushWrite();
+    fputc('\n', l->out);
+    flushOutput(l->out);
     xSemaphoreGive(stdout_taken_sem);
-    // if (l->len == 0) return linenoiseEditMore;
-    return strdup(l->buf);
+    l->buf[l->len] = '\0';
+    return LINENOISE_EDIT_DONE;
 }
 
 uint32_t getMillis(void) {
@@ -903,72 +1492,64 @@ uint32_t getMillis(void) {
  * mode. This will not destroy the buffer, as long as the linenoiseState
  * is still valid in the context of the caller.
  *
- * The function returns 0 on success, or -1 if writing to standard output
- * fails. If stdin_fd or stdout_fd are set to -1, the default is to use
- * STDIN_FILENO and STDOUT_FILENO.
+ * The function returns 0 on success, or -1 if writing to the output stream
+ * fails. If l->in or l->out are NULL, the default is to use the stdin and
+ * stdout streams of the calling task. Several lines, each with its own
+ * state and streams, may be edited at the same time.
  */
 int linenoiseEditStart(struct linenoiseState *l) {
     /* Populate the linenoise state that we pass to functions implementing
      * specific editing functionalities. */
+    if (l->in == NULL) l->in = stdin;
+    if (l->out == NULL) l->out = stdout;
     l->in_completion = 0;
+    l->in_search = 0;
     // l->plen = strlen(l->prompt);
     l->oldpos = l->pos = 0;
     l->len = 0;
-    l->cols = getColumns();
+    if (l->inbuf_len > 0 || dumbmode) {
+        /* Input which follows a pasted line is already waiting, and would be
+         * mixed with the answer of the terminal. */
+        if (l->cols == 0) l->cols = 80;
+    } else if (!l->cols_known ||
+               (columns_refresh_ms && getMillis() - l->cols_probed_ms >= columns_refresh_ms)) {
+        /* Probing takes a round trip to the terminal, keep the columns found */
+        l->cols = getColumns(l);
+    }
     l->oldrows = 0;
     l->history_index = 0;
+    l->last_key_ms = getMillis();
+    /* The prompt is written below */
+    l->shown_valid = 1;
+    l->shown_len = 0;
+    l->shown_hintlen = 0;
+    l->shown_hint_hash = 0;
+    l->refresh_bytes = 0;
+    l->refresh_total = 0;
 
     /* Buffer starts empty. */
     l->buf[0] = '\0';
     l->buflen--; /* Make sure there is always space for the nulterm */
 
-    /* The latest history entry is always our current buffer, that
-     * initially is just an empty string. */
     xSemaphoreTake(stdout_taken_sem, portMAX_DELAY);
-    if (!dumbmode) {
-        linenoiseHistoryAdd("");
-        // int pos1 = getCursorPosition();
-        if (fwrite(l->prompt,l->plen,1,stdout) == -1) {
-            xSemaphoreGive(stdout_taken_sem);
-            return -1;
-        }
-        flushWrite();
-        // int pos2 = getCursorPosition();
-        // if (pos1 >= 0 && pos2 >= 0) {
-        //     l->plen = pos2 - pos1;
-        // }
-    } else {
-        if (fwrite(l->prompt,l->plen,1,stdout) == -1) {
-            xSemaphoreGive(stdout_taken_sem);
-            return -1;
-        }
-        flushWrite();
+    if (fwrite(l->prompt,strlen(l->prompt),1,l->out) == -1) {
+        xSemaphoreGive(stdout_taken_sem);
+        return -1;
     }
+    flushOutput(l->out);
     xSemaphoreGive(stdout_taken_sem);
     return 0;
 }
 
 char *linenoiseEditMore = "If you see this, you are misusing the API: when linenoiseEditFeed() is called, if it returns linenoiseEditMore the user is yet editing the line. See the README file for more information.";
 
-/* This function is part of the multiplexed API of linenoise, see the top
- * comment on linenoiseEditStart() for more information. Call this function
- * each time there is some data to read from the standard input file
- * descriptor. In the case of blocking operations, this function can just be
- * called in a loop, and block.
- *
- * The function returns linenoiseEditMore to signal that line editing is still
- * in progress, that is, the user didn't yet pressed enter / CTRL-D. Otherwise
- * the function returns the pointer to the heap-allocated buffer with the
- * edited line, that the user should free with linenoiseFree().
- *
- * On special conditions, NULL is returned and errno is populated:
- *
- * EAGAIN if the user pressed Ctrl-C
- * ENOENT if the user pressed Ctrl-D
- *
- * Some other errno: I/O error.
- */
-char *linenoiseEditFeed(struct linenoiseState *l) {
+/* Process the next key from the input stream. This is the implementation
+ * of linenoiseEditFeed(), which leaves the finished line in l->buf instead
+ * of returning a heap-allocated copy of it. Returns LINENOISE_EDIT_MORE while
+ * the line is being edited, LINENOISE_EDIT_DONE when the user pressed enter,
+ * LINENOISE_EDIT_SWITCH when LINENOISE_SWITCH_SEQ was received, or
+ * LINENOISE_EDIT_ERROR with errno set as described for linenoiseEditFeed(). */
+int linenoiseEditFeedLine(struct linenoiseState *l) {
     if (dumbmode) return linenoiseDumb(l);
     char c;
     char seq[3];
@@ -978,33 +1559,35 @@ char *linenoiseEditFeed(struct linenoiseState *l) {
      * need to calculate how many milliseconds elapsed between two key
      * presses. Indeed, if there is less than LINENOISE_PASTE_KEY_DELAY
      * (typically 30-40ms), then a paste is being performed, else, the
-     * user is typing.
+     * user is typing. The time of the previous key is kept in the state,
+     * as the caller of the multiplexed API may only call this function
+     * once the input is available.
      * NOTE: pressing a key down without releasing it will also spend
      * about 40ms (or even more)
      */
-    const uint32_t t1 = getMillis();
-    const int nread = fread(&c, 1, 1, stdin);
-    if (nread <= 0) return linenoiseEditMore;
-    const uint32_t t2 = getMillis();
+    if (readInput(l, &c) <= 0) return LINENOISE_EDIT_MORE;
+    const uint32_t now = getMillis();
+    const uint32_t elapsed = now - l->last_key_ms;
+    l->last_key_ms = now;
     xSemaphoreTake(stdout_taken_sem, portMAX_DELAY);
     // FIXME: line printed twice after pasting something that takes more than 1 line
-    if ( (t2 - t1) < LINENOISE_PASTE_KEY_DELAY && c != ENTER) {
-        /* Pasting data, insert characters without formatting.
-         * This can only be performed when the cursor is at the end of the
-         * line. */
+    if (!l->in_completion && !l->in_search && isPastedChar(c) &&
+        (elapsed < LINENOISE_PASTE_KEY_DELAY || l->inbuf_len > 0)) {
+        /* Pasting data, insert characters without formatting. More input
+         * already waiting in the buffer also means that data is pasted. */
         if (linenoiseInsertPastedChar(l,c)) {
             errno = EIO;
             xSemaphoreGive(stdout_taken_sem);
-            return NULL;
+            return LINENOISE_EDIT_ERROR;
         }
         xSemaphoreGive(stdout_taken_sem);
-        return linenoiseEditMore;
+        return LINENOISE_EDIT_MORE;
     }
 
     /* Only autocomplete when the callback is set. It returns < 0 when
      * there was an error reading from fd. Otherwise it will return the
      * character that should be handled next. */
-        if ((l->in_completion || c == 9) && completionCallback != NULL) {
+        if (!l->in_search && (l->in_completion || c == 9) && completionCallback != NULL) {
         c = completeLine(l,c);
         /* Return on errors */
         // TODO: how was it supposed to work? c can't be less than 0
@@ -1012,14 +1595,21 @@ char *linenoiseEditFeed(struct linenoiseState *l) {
         /* Read next character when 0 */
         if (c == 0) {
             xSemaphoreGive(stdout_taken_sem);
-            return linenoiseEditMore;
+            return LINENOISE_EDIT_MORE;
+        }
+    }
+
+    if (l->in_search) {
+        c = searchHistory(l,c);
+        if (c == 0) {
+            flushOutput(l->out);
+            xSemaphoreGive(stdout_taken_sem);
+            return LINENOISE_EDIT_MORE;
         }
     }
 
     switch(c) {
     case ENTER:    /* enter */
-        history_len--;
-        free(history[history_len]);
         if (mlmode) linenoiseEditMoveEnd(l);
         if (hintsCallback) {
             /* Force a refresh without hints to leave the previous
@@ -1030,11 +1620,11 @@ char *linenoiseEditFeed(struct linenoiseState *l) {
             hintsCallback = hc;
         }
         xSemaphoreGive(stdout_taken_sem);
-        return strdup(l->buf);
+        return LINENOISE_EDIT_DONE;
     case CTRL_C:     /* ctrl-c */
         errno = EAGAIN;
         xSemaphoreGive(stdout_taken_sem);
-        return NULL;
+        return LINENOISE_EDIT_ERROR;
     case BACKSPACE:   /* backspace */
     case 8:     /* ctrl-h */
         linenoiseEditBackspace(l);
@@ -1044,11 +1634,9 @@ char *linenoiseEditFeed(struct linenoiseState *l) {
         if (l->len > 0) {
             linenoiseEditDelete(l);
         } else {
-            history_len--;
-            free(history[history_len]);
             errno = ENOENT;
             xSemaphoreGive(stdout_taken_sem);
-            return NULL;
+            return LINENOISE_EDIT_ERROR;
         }
         break;
     case CTRL_T:    /* ctrl-t, swaps current character with previous. */
@@ -1056,8 +1644,9 @@ char *linenoiseEditFeed(struct linenoiseState *l) {
             const int aux = l->buf[l->pos-1];
             l->buf[l->pos-1] = l->buf[l->pos];
             l->buf[l->pos] = aux;
+            const size_t from = l->pos-1;
             if (l->pos != l->len-1) l->pos++;
-            refreshLine(l);
+            refreshLineFrom(l,from,0);
         }
         break;
     case CTRL_B:     /* ctrl-b */
@@ -1072,18 +1661,27 @@ char *linenoiseEditFeed(struct linenoiseState *l) {
     case CTRL_N:    /* ctrl-n */
         linenoiseEditHistoryNext(l, LINENOISE_HISTORY_NEXT);
         break;
+    case CTRL_R:    /* ctrl-r, search the history */
+        startSearch(l);
+        break;
     case ESC:    /* escape sequence */
         /* Read the next two bytes representing the escape sequence.
          * chars at different times. */
-        if (fread(seq, 1, 1, stdin) == -1) break;
-        if (fread(seq+1, 1, 1, stdin) == -1) break;
-        // or just if (fread(seq, 1, 2, stdin) < 2) break;
+        if (readInput(l, seq) <= 0) break;
+        if (readInput(l, seq+1) <= 0) break;
 
         /* ESC [ sequences. */
         if (seq[0] == '[') {
-            if (seq[1] >= '0' && seq[1] <= '9') {
+            if (seq[1] == '=') {
+                /* ESC [ = F, see LINENOISE_SWITCH_SEQ */
+                if (readInput(l, seq+2) <= 0) break;
+                if (seq[2] == 'F') {
+                    xSemaphoreGive(stdout_taken_sem);
+                    return LINENOISE_EDIT_SWITCH;
+                }
+            } else if (seq[1] >= '0' && seq[1] <= '9') {
                 /* Extended escape, read additional byte. */
-                if (fread(seq+2, 1, 1, stdin) == -1) break;
+                if (readInput(l, seq+2) <= 0) break;
                 if (seq[2] == '~') {
                     switch(seq[1]) {
                     case '3': /* Delete key. */
@@ -1130,18 +1728,18 @@ char *linenoiseEditFeed(struct linenoiseState *l) {
     default:
         if (linenoiseEditInsert(l,c)) {
             xSemaphoreGive(stdout_taken_sem);
-            return NULL;
+            return LINENOISE_EDIT_ERROR;
         }
         break;
     case CTRL_U: /* Ctrl+u, delete the whole line. */
         l->buf[0] = '\0';
         l->pos = l->len = 0;
-        refreshLine(l);
+        refreshLineFrom(l,0,0);
         break;
     case CTRL_K: /* Ctrl+k, delete from current to end of line. */
         l->buf[l->pos] = '\0';
         l->len = l->pos;
-        refreshLine(l);
+        refreshLineFrom(l,l->pos,0);
         break;
     case CTRL_A: /* Ctrl+a, go to the start of the line */
         linenoiseEditMoveHome(l);
@@ -1150,16 +1748,51 @@ char *linenoiseEditFeed(struct linenoiseState *l) {
         linenoiseEditMoveEnd(l);
         break;
     case CTRL_L: /* ctrl+l, clear screen */
-        linenoiseClearScreen();
+        clearScreen(l->out);
         refreshLine(l);
+        /* The terminal may have been resized, probe it at the next line */
+        linenoiseInvalidateColumns(l);
         break;
     case CTRL_W: /* ctrl+w, delete previous word */
         linenoiseEditDeletePrevWord(l);
         break;
     }
-    flushWrite();
+    flushOutput(l->out);
     xSemaphoreGive(stdout_taken_sem);
-    return linenoiseEditMore;
+    return LINENOISE_EDIT_MORE;
+}
+
+/* This function is part of the multiplexed API of linenoise, see the top
+ * comment on linenoiseEditStart() for more information. Call this function
+ * each time there is some data to read from the standard input file
+ * descriptor. In the case of blocking operations, this function can just be
+ * called in a loop, and block.
+ *
+ * The function returns linenoiseEditMore to signal that line editing is still
+ * in progress, that is, the user didn't yet pressed enter / CTRL-D. Otherwise
+ * the function returns the pointer to the heap-allocated buffer with the
+ * edited line, that the user should free with linenoiseFree().
+ *
+ * On special conditions, NULL is returned and errno is populated:
+ *
+ * EAGAIN if the user pressed Ctrl-C
+ * ENOENT if the user pressed Ctrl-D
+ *
+ * Some other errno: I/O error.
+ */
+char *linenoiseEditFeed(struct linenoiseState *l) {
+    const int res = linenoiseEditFeedLine(l);
+    /* Callers of this API don't know about switching, ignore the sequence */
+    if (res == LINENOISE_EDIT_MORE || res == LINENOISE_EDIT_SWITCH) return linenoiseEditMore;
+    if (res == LINENOISE_EDIT_ERROR) return NULL;
+    const size_t len = strlen(l->buf);
+    char *line = lnMalloc(len + 1);
+    if (line == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    memcpy(line, l->buf, len + 1);
+    return line;
 }
 
 
@@ -1168,9 +1801,20 @@ char *linenoiseEditFeed(struct linenoiseState *l) {
  * returns something different than NULL. At this point the user input
  * is in the buffer, and we can restore the terminal in normal mode. */
 void linenoiseEditStop(struct linenoiseState *l) {
+    if (l->saved_line_owned) {
+        lnFree(l->saved_line);
+        l->saved_line = NULL;
+        l->saved_line_owned = 0;
+    }
+    if (l->render_owned) {
+        lnFree(l->render_buf);
+        l->render_buf = NULL;
+        l->render_buflen = 0;
+        l->render_owned = 0;
+    }
     xSemaphoreTake(stdout_taken_sem, portMAX_DELAY);
-    fputc('\n', stdout);
-    flushWrite();
+    fputc('\n', l->out);
+    flushOutput(l->out);
     xSemaphoreGive(stdout_taken_sem);
 }
 
@@ -1194,6 +1838,26 @@ static char *linenoiseBlockingEdit(struct linenoiseState *l)
     return res;
 }
 
+/* Blocking API which edits the line in the buffer provided by the caller.
+ * The caller must set l->buf, l->buflen, l->prompt and l->plen. Nothing
+ * is allocated for the edited line: when the function returns, the line is
+ * in l->buf, zero-terminated. Returns the length of the line, or -1 with
+ * errno set as described for linenoiseEditFeed(). */
+int linenoiseEditLine(struct linenoiseState *l) {
+    if (l->buf == NULL || l->buflen == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    int res;
+    if (linenoiseEditStart(l) == -1) {
+        return -1;
+    }
+    // ReSharper disable once CppPossiblyErroneousEmptyStatements
+    while (((res = linenoiseEditFeedLine(l)) == LINENOISE_EDIT_MORE || res == LINENOISE_EDIT_SWITCH) && !l->eof);
+    linenoiseEditStop(l);
+    return (res == LINENOISE_EDIT_DONE) ? (int) l->len : -1;
+}
+
 int linenoiseProbe() {
     xSemaphoreTake(stdout_taken_sem, portMAX_DELAY);
     /* Switch to non-blocking mode */
@@ -1245,12 +1909,26 @@ int linenoiseProbe() {
 
 /* The high level function that is the main API of the linenoise library. */
 char *linenoise(const char *prompt, struct linenoiseState **ls_to_pass) {
-    struct linenoiseState *l = *ls_to_pass;
-    char *buf = calloc(1, max_cmdline_length);
+    /* Kept between calls, as it holds the input read ahead */
+    static struct linenoiseState ls_local;
+    struct linenoiseState *l = &ls_local;
+    if (ls_to_pass != NULL && *ls_to_pass != NULL) {
+        l = *ls_to_pass;
+    } else {
+        ls_local.in = ls_local.out = NULL;
+        ls_local.eof = 0;
+        ls_local.plen = strlen(prompt);
+    }
+    char *buf = lnMalloc(max_cmdline_length);
+    if (buf == NULL) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    memset(buf, 0, max_cmdline_length);
     l->prompt = prompt;
     l->buf = buf;
     char *retval = linenoiseBlockingEdit(l);
-    free(buf);
+    lnFree(buf);
     return retval;
 }
 
@@ -1260,99 +1938,264 @@ char *linenoise(const char *prompt, struct linenoiseState **ls_to_pass) {
  * allocator. */
 void linenoiseFree(void *ptr) {
     if (ptr == linenoiseEditMore) return; // Protect from API misuse.
-    free(ptr);
+    lnFree(ptr);
 }
 
 /* ================================ History ================================= */
 
+/* Return the history 'h' refers to, NULL being the global one. */
+static struct linenoiseHistory *historyOf(struct linenoiseHistory *h) {
+    return h ? h : &global_history;
+}
+
+/* Free an arena allocated by historyAlloc(). */
+static void historyFreeArena(uint64_t *arena, uint32_t caps) {
+    if (caps) {
+        heap_caps_free(arena);
+    } else {
+        lnFree(arena);
+    }
+}
+
+/* Free the arena of the history 'h', NULL being the global history, which
+ * becomes empty. Its settings are kept, the arena is allocated again when a
+ * line is added. */
+void linenoiseHistoryRelease(struct linenoiseHistory *h) {
+    h = historyOf(h);
+    historyFreeArena(h->sigs, h->arena_caps);
+    h->sigs = NULL;
+    h->entries = NULL;
+    h->lines = NULL;
+    h->lines_size = 0;
+    h->first = 0;
+    h->len = 0;
+    h->head = 0;
+}
+
 void linenoiseHistoryFree() {
-    if (history) {
-        for (int j = 0; j < history_len; j++) {
-            free(history[j]);
+    linenoiseHistoryRelease(NULL);
+}
+
+/* Set up the empty history 'h', keeping up to 'max_len' entries in an arena
+ * set like linenoiseHistorySetArena() does. Nothing is allocated until the
+ * first line is added. Returns 1 on success, 0 if 'max_len' is invalid. */
+int linenoiseHistoryInit(struct linenoiseHistory *h, int max_len, size_t arena_size, uint32_t caps) {
+    if (h == NULL || max_len < 1) return 0;
+    memset(h, 0, sizeof(*h));
+    h->max_len = max_len;
+    h->arena_size = arena_size;
+    h->caps = caps;
+    return 1;
+}
+
+/* Return the entry 'index' of the history, 0 being the oldest one. */
+static char *historyAt(const struct linenoiseHistory *h, int index) {
+    return h->entries[(h->first + index) % h->max_len];
+}
+
+static void historyEvictOldest(struct linenoiseHistory *h) {
+    h->first = (h->first + 1) % h->max_len;
+    h->len--;
+    if (h->len == 0) {
+        h->first = 0;
+        h->head = 0;
+    }
+}
+
+/* Return the signature of the first 'len' characters of 's'. */
+static uint64_t historySignature(const char *s, size_t len) {
+    uint64_t sig = 0;
+    for (size_t i = 1; i < len; i++) {
+        const unsigned pair = (unsigned char)s[i-1] * 31 + (unsigned char)s[i];
+        sig |= 1ULL << (pair % 64);
+    }
+    return sig;
+}
+
+/* Allocate the arena for 'len' entries. The signatures and the entries are
+ * at the start of the arena, followed by the lines. */
+static int historyAlloc(struct linenoiseHistory *h, int len) {
+    size_t lines_size = h->arena_size ? h->arena_size : (size_t)len * LINENOISE_HISTORY_AVG_LINE_LEN;
+    const size_t size = (sizeof(uint64_t) + sizeof(char*)) * len + lines_size;
+    uint64_t *arena = h->caps ? heap_caps_malloc(size, h->caps) : lnMalloc(size);
+    if (arena == NULL) return -1;
+    h->arena_caps = h->caps;
+    h->sigs = arena;
+    h->entries = (char**)(arena + len);
+    h->lines = (char*)(h->entries + len);
+    h->lines_size = lines_size;
+    h->max_len = len;
+    h->first = 0;
+    h->len = 0;
+    h->head = 0;
+    return 0;
+}
+
+/* Find room for a line of 'size' bytes, evicting the oldest entries as
+ * needed. The lines are never split at the end of the arena, so that each
+ * entry is a plain nul terminated string. Returns NULL if the line is bigger
+ * than the whole arena. */
+static char *historyReserve(struct linenoiseHistory *h, size_t size) {
+    if (size > h->lines_size) return NULL;
+    if (h->len == h->max_len) historyEvictOldest(h);
+    for (;;) {
+        if (h->len == 0) {
+            h->head = 0;
+            return h->lines;
+        }
+        const size_t tail = historyAt(h, 0) - h->lines;
+        if (h->head > tail) {
+            /* Used bytes are [tail, head), try after them, then before them. */
+            if (h->lines_size - h->head >= size) return h->lines + h->head;
+            if (tail >= size) {
+                h->head = 0;
+                return h->lines;
+            }
+        } else if (h->head < tail) {
+            /* Used bytes wrap around, only [head, tail) is free. */
+            if (tail - h->head >= size) return h->lines + h->head;
         }
-        free(history);
+        historyEvictOldest(h);
     }
-    history = NULL;
-    history_len = 0;
 }
 
-/* This is the API call to add a new entry in the linenoise history.
- * It uses a fixed array of char pointers that are shifted (memmoved)
- * when the history max length is reached in order to remove the older
- * entry and make room for the new one, so it is not exactly suitable for huge
- * histories, but will work well for a few hundred of entries.
- *
- * Using a circular buffer is smarter, but a bit more complex to handle. */
-int linenoiseHistoryAdd(const char *line) {
+/* Add a new entry to the history 'h', NULL being the global history.
+ * The line is copied in the arena, which is a ring of entries pointing to a
+ * ring of lines: when either of them is full, the oldest entries are dropped
+ * to make room for the new one. Nothing is allocated after the first call,
+ * so this is suitable for long histories too. */
+int linenoiseHistoryAddTo(struct linenoiseHistory *h, const char *line) {
+    h = historyOf(h);
 
-    if (history_max_len == 0) return 0;
+    if (h->max_len == 0) return 0;
 
     /* Initialization on first call. */
-    if (history == NULL) {
-        history = malloc(sizeof(char*)*history_max_len);
-        if (history == NULL) return 0;
-        memset(history,0,(sizeof(char*)*history_max_len));
-    }
+    if (h->entries == NULL && historyAlloc(h, h->max_len) != 0) return 0;
 
     /* Don't add duplicated lines. */
-    if (history_len && !strcmp(history[history_len-1], line)) return 0;
-
-    /* Add an heap allocated copy of the line in the history.
-     * If we reached the max length, remove the older line. */
-    char* linecopy = strdup(line);
-    if (!linecopy) return 0;
-    if (history_len == history_max_len) {
-        free(history[0]);
-        memmove(history,history+1,sizeof(char*)*(history_max_len-1));
-        history_len--;
-    }
-    history[history_len] = linecopy;
-    history_len++;
+    if (h->len && !strcmp(historyAt(h, h->len-1), line)) return 0;
+
+    const size_t size = strlen(line) + 1;
+    char *copy = historyReserve(h, size);
+    if (copy == NULL) return 0;
+    memcpy(copy, line, size);
+    const int slot = (h->first + h->len) % h->max_len;
+    h->entries[slot] = copy;
+    h->sigs[slot] = historySignature(line, size - 1);
+    h->len++;
+    h->head = copy - h->lines + size;
     return 1;
 }
 
+/* This is the API call to add a new entry in the global linenoise history. */
+int linenoiseHistoryAdd(const char *line) {
+    return linenoiseHistoryAddTo(NULL, line);
+}
+
+/* Add the entries of the history 'src' to the history 'dst', oldest first,
+ * NULL being the global history in both cases. Returns the number of entries
+ * added. */
+int linenoiseHistoryCopy(struct linenoiseHistory *dst, struct linenoiseHistory *src) {
+    src = historyOf(src);
+    int added = 0;
+    for (int j = 0; j < src->len; j++) {
+        added += linenoiseHistoryAddTo(dst, historyAt(src, j));
+    }
+    return added;
+}
+
+/* Return the history index, starting from 'index', of the most recent entry
+ * containing the first 'len' characters of 'query', or 0 if there is none.
+ * Index 1 is the most recent entry. */
+static int historySearch(const struct linenoiseHistory *h, const char *query, size_t len, int index) {
+    const uint64_t sig = historySignature(query, len);
+    for (; index <= h->len; index++) {
+        const int slot = (h->first + h->len - index) % h->max_len;
+        if ((h->sigs[slot] & sig) != sig) continue;
+        if (memmem(h->entries[slot], strlen(h->entries[slot]), query, len) != NULL) return index;
+    }
+    return 0;
+}
+
+/* Move the history to a new arena for 'len' entries, keeping the latest
+ * entries which fit in it. */
+static int historyRealloc(struct linenoiseHistory *h, int len) {
+    const struct linenoiseHistory old = *h;
+
+    if (historyAlloc(h, len) != 0) return -1;
+    /* Entries which don't fit are evicted by the newer ones. */
+    int j = (old.len > len) ? old.len - len : 0;
+    for (; j < old.len; j++) {
+        linenoiseHistoryAddTo(h, historyAt(&old, j));
+    }
+    historyFreeArena(old.sigs, old.arena_caps);
+    return 0;
+}
+
 /* Set the maximum length for the history. This function can be called even
  * if there is already some history, the function will make sure to retain
  * just the latest 'len' elements if the new history length value is smaller
  * than the amount of items already inside the history. */
 int linenoiseHistorySetMaxLen(int len) {
+    struct linenoiseHistory *h = &global_history;
 
     if (len < 1) return 0;
-    if (history) {
-        int tocopy = history_len;
-
-        char** new = malloc(sizeof(char*) * len);
-        if (new == NULL) return 0;
-
-        /* If we can't copy everything, free the elements we'll not use. */
-        if (len < tocopy) {
+    if (h->entries) {
+        if (historyRealloc(h, len) != 0) return 0;
+    }
+    h->max_len = len;
+    return 1;
+}
 
-            for (int j = 0; j < tocopy-len; j++) free(history[j]);
-            tocopy = len;
-        }
-        memset(new,0,sizeof(char*)*len);
-        memcpy(new,history+(history_len-tocopy), sizeof(char*)*tocopy);
-        free(history);
-        history = new;
-    }
-    history_max_len = len;
-    if (history_len > history_max_len)
-        history_len = history_max_len;
+/* Set the size of the arena storing the lines of the history, and the
+ * capabilities of the memory it is allocated from (e.g. MALLOC_CAP_SPIRAM).
+ * A 'size' of 0 selects LINENOISE_HISTORY_AVG_LINE_LEN bytes per entry, 'caps'
+ * of 0 allocates it like the rest, see linenoiseSetAllocator(). Existing
+ * entries are kept if they fit.
+ * Returns 1 on success, 0 if the new arena couldn't be allocated. */
+int linenoiseHistorySetArena(size_t size, uint32_t caps) {
+    struct linenoiseHistory *h = &global_history;
+    const size_t old_size = h->arena_size;
+    const uint32_t old_caps = h->caps;
+
+    h->arena_size = size;
+    h->caps = caps;
+    if (h->entries && historyRealloc(h, h->max_len) != 0) {
+        h->arena_size = old_size;
+        h->caps = old_caps;
+        return 0;
+    }
     return 1;
 }
 
 /* Save the history in the specified file. On success 0 is returned
  * otherwise -1 is returned. */
 int linenoiseHistorySave(const char *filename) {
+    const struct linenoiseHistory *h = &global_history;
 
     FILE* fp = fopen(filename, "w");
     if (fp == NULL) return -1;
-    for (int j = 0; j < history_len; j++)
-        fprintf(fp,"%s\n",history[j]);
+    for (int j = 0; j < h->len; j++)
+        fprintf(fp,"%s\n",historyAt(h, j));
     fclose(fp);
     return 0;
 }
 
+/* Append the 'count' latest entries of the history to the specified file,
+ * instead of rewriting all of it like linenoiseHistorySave(). On success 0 is
+ * returned otherwise -1 is returned. */
+int linenoiseHistoryAppend(const char *filename, int count) {
+    const struct linenoiseHistory *h = &global_history;
+
+    if (count > h->len) count = h->len;
+    if (count <= 0) return 0;
+    FILE* fp = fopen(filename, "a");
+    if (fp == NULL) return -1;
+    for (int j = h->len - count; j < h->len; j++)
+        fprintf(fp,"%s\n",historyAt(h, j));
+    return (fclose(fp) == 0) ? 0 : -1;
+}
+
 /* Load the history from the specified file. If the file does not exist
  * zero is returned and no operation is performed.
  *
@@ -1363,18 +2206,19 @@ int linenoiseHistoryLoad(const char *filename) {
     if (fp == NULL) {
         return -1;
     }
-    char *buf = calloc(1, max_cmdline_length);
+    char *buf = lnMalloc(max_cmdline_length);
     if (buf == NULL) {
         fclose(fp);
         return -1;
     }
+    buf[0] = '\0';
     while (fgets(buf, max_cmdline_length, fp) != NULL) {
         char* p = strchr(buf, '\r');
         if (!p) p = strchr(buf,'\n');
         if (p) *p = '\0';
         linenoiseHistoryAdd(buf);
     }
-    free(buf);
+    lnFree(buf);
     fclose(fp);
     return 0;
 }
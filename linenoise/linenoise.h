@@ -46,13 +46,44 @@ extern "C" {
 
 #include <stddef.h> /* For size_t. */
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h> /* For ssize_t. */
 // for semaphore
 #include "freertos/FreeRTOS.h"
 #include "freertos/semphr.h"
 
+#define LINENOISE_INPUT_BUF_LEN 64 /* Bytes read from the input at once */
+#define LINENOISE_RENDER_EXTRA 256 /* Bytes of a refresh besides the prompt and the line:
+                                    * the hint and the escape sequences */
+/* Size of a render buffer which doesn't need to grow, for lines of up to
+ * 'buflen' bytes and prompts of up to 'promptlen' bytes */
+#define LINENOISE_RENDER_LEN(buflen, promptlen) ((buflen) + (promptlen) + LINENOISE_RENDER_EXTRA)
+#define LINENOISE_SEARCH_MAX_LEN 32 /* Maximum length of a Ctrl-R history search */
+#define LINENOISE_SEARCH_PROMPT "(reverse-i-search)`"
+
 extern char *linenoiseEditMore;
 extern SemaphoreHandle_t stdout_taken_sem;
 
+/* A history of lines: a ring of entries pointing to a ring of lines, both
+ * stored in a single allocation starting at 'sigs'. The signature of each
+ * entry has a bit set for each pair of consecutive characters in its line,
+ * so most entries are skipped by a search without looking at their line.
+ * Set up with linenoiseHistoryInit(), see the History API. */
+struct linenoiseHistory {
+    int max_len;        /* Maximum number of entries. */
+    int len;            /* Number of entries. */
+    uint64_t *sigs;     /* Signatures of the entries, at the start of the arena. */
+    char **entries;     /* Entries, after the signatures; NULL until the first line is added. */
+    char *lines;        /* Lines of the entries, after the entries. */
+    size_t lines_size;
+    int first;          /* Index in 'entries' of the oldest entry. */
+    size_t head;        /* Offset in 'lines' where the next line goes. */
+    size_t arena_size;  /* Size of 'lines' set by the user, 0 for the default. */
+    uint32_t caps;      /* 0 if the history comes from the linenoise allocator. */
+    uint32_t arena_caps; /* 'caps' the arena was allocated with. */
+};
+
 /* The linenoiseState structure represents the state during line editing.
  * We pass this state to functions implementing specific editing
  * functionalities. */
@@ -60,6 +91,14 @@ struct linenoiseState {
     int in_completion;  /* The user pressed TAB and we are now in completion
                          * mode, so input is handled by completeLine(). */
     size_t completion_idx; /* Index of next completion to propose. */
+    int in_search;      /* The user pressed Ctrl-R and we are now searching
+                         * the history, so input is handled by searchHistory(). */
+    int search_index;   /* History index of the current match, 0 if none. */
+    size_t search_len;  /* Length of the search query. */
+    const char *edit_prompt; /* Prompt to restore when the search ends. */
+    size_t edit_plen;
+    char search_prompt[sizeof(LINENOISE_SEARCH_PROMPT) + LINENOISE_SEARCH_MAX_LEN + 3]; /* Prompt
+                         * shown while searching, including the query. */
     char *buf;          /* Edited line buffer. */
     size_t buflen;      /* Edited line buffer size. */
     const char *prompt; /* Prompt to display. */
@@ -68,28 +107,81 @@ struct linenoiseState {
     size_t oldpos;      /* Previous refresh cursor position. */
     size_t len;         /* Current edited line length. */
     size_t cols;        /* Number of columns in terminal. */
+    int cols_known;     /* cols was probed or set, and is kept for the next lines. */
+    uint32_t cols_probed_ms; /* When cols was probed or set. */
     size_t oldrows;     /* Rows used by last refrehsed line (multiline mode) */
     int history_index;  /* The history index we are currently editing. */
+    struct linenoiseHistory *history; /* History browsed and searched while editing,
+                           the global history if NULL. */
+    char *saved_line;   /* Line being edited, saved while browsing the history.
+                           Buffer as big as 'buf', allocated when needed if NULL. */
+    int saved_line_owned; /* saved_line is allocated by linenoise, and freed on stop. */
+    char *render_buf;   /* Buffer each refresh is built in, before being written at once.
+                           May be provided by the caller, see LINENOISE_RENDER_LEN; if NULL,
+                           or too small, it is allocated and grown as needed. */
+    size_t render_buflen; /* Size of render_buf. */
+    int render_owned;   /* render_buf is allocated by linenoise, and freed on stop. */
+    int shown_valid;    /* The terminal shows the prompt, then shown_len characters of
+                           the line, not scrolled, and the hint, with the cursor at oldpos. */
+    size_t shown_len;   /* Characters of the line shown by the last refresh. */
+    int shown_hintlen;  /* Characters of the hint shown by the last refresh. */
+    uint32_t shown_hint_hash; /* Hash of the hint shown, 0 if none is. */
+    size_t refresh_bytes; /* Bytes written by the last refresh of the line. */
+    size_t refresh_total; /* Bytes written by the refreshes since editing started. */
+    uint32_t last_key_ms; /* When the previous key was read, to detect pasting. */
+    FILE *in;           /* Input stream, stdin if NULL when editing starts. */
+    FILE *out;          /* Output stream, stdout if NULL when editing starts. */
+    ssize_t (*read)(void *arg, char *buf, size_t len); /* Reads the input instead of
+                         * 'in' if not NULL, e.g. to filter it. Returns like read()
+                         * on a non-blocking file descriptor. */
+    void *read_arg;     /* Argument of read. */
+    int eof;            /* End of the input was reached, or reading it failed. */
+    size_t inbuf_head;  /* Index of the next byte to process in inbuf. */
+    size_t inbuf_len;   /* Number of bytes in inbuf not processed yet. */
+    char inbuf[LINENOISE_INPUT_BUF_LEN]; /* Input read ahead. It is kept
+                         * between lines, so reuse the state to not lose
+                         * the lines which follow in a paste. */
 };
 
+/* Return values of linenoiseEditFeedLine() */
+#define LINENOISE_EDIT_ERROR (-1) /* Ctrl-C, Ctrl-D or I/O error, errno is set */
+#define LINENOISE_EDIT_MORE 0     /* The line is still being edited */
+#define LINENOISE_EDIT_DONE 1     /* The edited line is complete in l->buf */
+#define LINENOISE_EDIT_SWITCH 2   /* The peer sent LINENOISE_SWITCH_SEQ to stop line
+                                   * editing, e.g. to exchange binary data. The line
+                                   * is dropped, input read after it is in l->inbuf. */
+
+#define LINENOISE_SWITCH_SEQ "\x1b[=F"
+
 
 
 typedef struct linenoiseCompletions {
   size_t len;
   char **cvec;
+  int borrowed;     /* Entries of cvec are not owned by the table, see
+                     * linenoiseAddCompletionRef(). */
 } linenoiseCompletions;
 
 /* Non blocking API. */
 int linenoiseEditStart(struct linenoiseState *l);
 char *linenoiseEditFeed(struct linenoiseState *l);
+int linenoiseEditFeedLine(struct linenoiseState *l);
 void linenoiseEditStop(struct linenoiseState *l);
 void linenoiseHide(struct linenoiseState *l);
 void linenoiseShow(struct linenoiseState *l);
+int linenoiseFillInput(struct linenoiseState *l);
 
 /* Blocking API. */
 char *linenoise(const char *prompt, struct linenoiseState **ls_to_pass);
+int linenoiseEditLine(struct linenoiseState *l);
 void linenoiseFree(void *ptr);
 
+/* Allocator API. */
+typedef void*(linenoiseMallocFn)(size_t size);
+typedef void*(linenoiseReallocFn)(void *ptr, size_t size);
+typedef void(linenoiseFreeFn)(void *ptr);
+void linenoiseSetAllocator(linenoiseMallocFn *malloc_fn, linenoiseReallocFn *realloc_fn, linenoiseFreeFn *free_fn);
+
 /* Completion API. */
 typedef void(linenoiseCompletionCallback)(const char *, linenoiseCompletions *);
 typedef char*(linenoiseHintsCallback)(const char *, int *color, int *bold);
@@ -98,11 +190,19 @@ void linenoiseSetCompletionCallback(linenoiseCompletionCallback *);
 void linenoiseSetHintsCallback(linenoiseHintsCallback *);
 void linenoiseSetFreeHintsCallback(linenoiseFreeHintsCallback *);
 void linenoiseAddCompletion(linenoiseCompletions *, const char *);
+void linenoiseAddCompletionRef(linenoiseCompletions *, const char *);
 
-/* History API. */
+/* History API. The functions which take no history use the global one, as
+ * do the others but linenoiseHistoryInit() when given NULL. */
 int linenoiseHistoryAdd(const char *line);
+int linenoiseHistoryInit(struct linenoiseHistory *h, int max_len, size_t arena_size, uint32_t caps);
+int linenoiseHistoryAddTo(struct linenoiseHistory *h, const char *line);
+int linenoiseHistoryCopy(struct linenoiseHistory *dst, struct linenoiseHistory *src);
+void linenoiseHistoryRelease(struct linenoiseHistory *h);
 int linenoiseHistorySetMaxLen(int len);
+int linenoiseHistorySetArena(size_t size, uint32_t caps);
 int linenoiseHistorySave(const char *filename);
+int linenoiseHistoryAppend(const char *filename, int count);
 int linenoiseHistoryLoad(const char *filename);
 void linenoiseHistoryFree();
 
@@ -111,6 +211,11 @@ void linenoiseHistoryFree();
 void linenoiseClearScreen(void);
 void linenoiseSetMultiLine(int ml);
 void linenoiseSetDumbMode(int set);
+void linenoiseSetDiffRefresh(int set);
+void linenoiseSetColumnsRefresh(uint32_t interval_ms);
+void linenoiseInvalidateColumns(struct linenoiseState *l);
+void linenoiseSetColumns(struct linenoiseState *l, size_t cols);
+int linenoiseProbeColumns(struct linenoiseState *l, int timeout_ms);
 bool linenoiseIsDumbMode(void);
 int linenoiseProbe();
 void linenoiseMaskModeEnable(void);
@@ -5,108 +5,217 @@
  */
 
 #include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
 #include <ctype.h>
 #include <string.h>
+#include "esp_err.h"
+#include "esp_console.h"
+#include "console_private.h"
 
-#define SS_FLAG_ESCAPE 0x8
+#define QUOTE '"'
+#define ESCAPE '\\'
+#define SPACE ' '
+#define SEPARATOR ';'
 
-typedef enum {
-    /* parsing the space between arguments */
-    SS_SPACE = 0x0,
-    /* parsing an argument which isn't quoted */
-    SS_ARG = 0x1,
-    /* parsing a quoted argument */
-    SS_QUOTED_ARG = 0x2,
-    /* parsing an escape sequence within unquoted argument */
-    SS_ARG_ESCAPED = SS_ARG | SS_FLAG_ESCAPE,
-    /* parsing an escape sequence within a quoted argument */
-    SS_QUOTED_ARG_ESCAPED = SS_QUOTED_ARG | SS_FLAG_ESCAPE,
-} split_state_t;
-
-/* helper macro, called when done with an argument */
-#define END_ARG() do { \
-    char_out = 0; \
-    argv[argc++] = next_arg_start; \
-    state = SS_SPACE; \
-} while(0)
-
-size_t esp_console_split_argv(char *line, char **argv, size_t argv_size)
+/* Return the offset of the first 'a' or 'b' in line[pos, len), or len if there is none.
+ * Runs of other characters are skipped a word at a time: a byte of the word equals 'a'
+ * if the same byte of (word ^ a repeated) is zero, which the usual bit trick detects. */
+static size_t find_either(const char *line, size_t pos, size_t len, char a, char b)
 {
-    const int QUOTE = '"';
-    const int ESCAPE = '\\';
-    const int SPACE = ' ';
-    split_state_t state = SS_SPACE;
-    size_t argc = 0;
-    char *next_arg_start = line;
-    char *out_ptr = line;
-    for (char *in_ptr = line; argc < argv_size - 1; ++in_ptr) {
-        int char_in = (unsigned char) *in_ptr;
-        if (char_in == 0) {
+    const size_t ones = SIZE_MAX / 0xff;    // 0x01 in every byte
+    const size_t highs = ones << 7;         // 0x80 in every byte
+    const size_t pattern_a = ones * (unsigned char) a;
+    const size_t pattern_b = ones * (unsigned char) b;
+    while (len - pos >= sizeof(size_t)) {
+        size_t word;
+        memcpy(&word, line + pos, sizeof(word));
+        const size_t xa = word ^ pattern_a;
+        const size_t xb = word ^ pattern_b;
+        if ((((xa - ones) & ~xa) | ((xb - ones) & ~xb)) & highs) {
             break;
         }
-        int char_out = -1;
+        pos += sizeof(size_t);
+    }
+    while (pos < len && line[pos] != a && line[pos] != b) {
+        pos++;
+    }
+    return pos;
+}
 
-        switch (state) {
-        case SS_SPACE:
-            if (char_in == SPACE) {
-                /* skip space */
-            } else if (char_in == QUOTE) {
-                next_arg_start = out_ptr;
-                state = SS_QUOTED_ARG;
-            } else if (char_in == ESCAPE) {
-                next_arg_start = out_ptr;
-                state = SS_ARG_ESCAPED;
-            } else {
-                next_arg_start = out_ptr;
-                state = SS_ARG;
-                char_out = char_in;
-            }
-            break;
+/* Find the argument which starts at or after *pos, and move *pos after it.
+ * Arguments are delimited as documented for esp_console_split_argv.
+ * Returns false if there are no more arguments. */
+static bool split_next(const char *line, size_t len, size_t *pos, esp_console_arg_span_t *span)
+{
+    size_t p = *pos;
+    while (p < len && line[p] == SPACE) {
+        p++;
+    }
+    if (p == len) {
+        *pos = p;
+        return false;
+    }
 
-        case SS_QUOTED_ARG:
-            if (char_in == QUOTE) {
-                END_ARG();
-            } else if (char_in == ESCAPE) {
-                state = SS_QUOTED_ARG_ESCAPED;
-            } else {
-                char_out = char_in;
-            }
-            break;
+    /* A quote only opens an argument at its start, and the closing quote ends the argument */
+    const bool quoted = (line[p] == QUOTE);
+    const char delimiter = quoted ? QUOTE : SPACE;
+    if (quoted) {
+        p++;
+    }
+    span->offset = p;
+    span->escaped = false;
+    span->quoted = quoted;
+    while ((p = find_either(line, p, len, delimiter, ESCAPE)) < len && line[p] == ESCAPE) {
+        span->escaped = true;
+        /* The escaped character can't end the argument */
+        p = (len - p > 2) ? p + 2 : len;
+    }
+    span->length = p - span->offset;
+    /* Skip the delimiter */
+    *pos = (p < len) ? p + 1 : len;
+    return true;
+}
+
+esp_err_t esp_console_split_argv_spans(const char *line, size_t line_len,
+                                       esp_console_arg_span_t *spans, size_t max_spans, size_t *ret_count)
+{
+    if (line == NULL || ret_count == NULL || (spans == NULL && max_spans != 0)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    size_t count = 0;
+    size_t pos = 0;
+    esp_console_arg_span_t span;
+    while (split_next(line, line_len, &pos, &span)) {
+        if (count < max_spans) {
+            spans[count] = span;
+        }
+        count++;
+    }
+    *ret_count = count;
+    return (count > max_spans) ? ESP_ERR_INVALID_SIZE : ESP_OK;
+}
 
-        case SS_ARG_ESCAPED:
-        case SS_QUOTED_ARG_ESCAPED:
-            if (char_in == ESCAPE || char_in == QUOTE || char_in == SPACE) {
-                char_out = char_in;
-            } else {
-                /* unrecognized escape character, skip */
+size_t esp_console_unescape_arg(const char *line, const esp_console_arg_span_t *span, char *out, size_t out_size)
+{
+    const char *in = line + span->offset;
+    const char *end = in + span->length;
+    size_t len = 0;
+    while (in < end) {
+        char c = *in++;
+        if (c == ESCAPE) {
+            /* Only backslash, quote, space, separator and redirection characters may be
+             * escaped, other escape sequences are dropped */
+            if (in == end) {
+                break;
             }
-            state = (split_state_t) (state & (~SS_FLAG_ESCAPE));
-            break;
+            c = *in++;
+            if (c != ESCAPE && c != QUOTE && c != SPACE && c != SEPARATOR && strchr("|<>", c) == NULL) {
+                continue;
+            }
+        }
+        if (len + 1 < out_size) {
+            out[len] = c;
+        }
+        len++;
+    }
+    if (out_size > 0) {
+        out[(len < out_size) ? len : out_size - 1] = 0;
+    }
+    return len;
+}
 
-        case SS_ARG:
-            if (char_in == SPACE) {
-                END_ARG();
-            } else if (char_in == ESCAPE) {
-                state = SS_ARG_ESCAPED;
-            } else {
-                char_out = char_in;
+size_t esp_console_command_len(const char *line, size_t line_len)
+{
+    size_t p = 0;
+    bool arg_start = true;
+    while (p < line_len) {
+        const char c = line[p];
+        if (c == SEPARATOR) {
+            return p;
+        }
+        if (c == ESCAPE) {
+            /* The escaped character can't end the command */
+            p = (line_len - p > 2) ? p + 2 : line_len;
+            arg_start = false;
+        } else if (c == QUOTE && arg_start) {
+            /* Skip the quoted argument, up to and including its closing quote */
+            p++;
+            while ((p = find_either(line, p, line_len, QUOTE, ESCAPE)) < line_len && line[p] == ESCAPE) {
+                p = (line_len - p > 2) ? p + 2 : line_len;
             }
-            break;
+            p = (p < line_len) ? p + 1 : line_len;
+        } else {
+            arg_start = (c == SPACE);
+            p++;
         }
-        /* need to output anything? */
-        if (char_out >= 0) {
-            *out_ptr = char_out;
-            ++out_ptr;
+    }
+    return line_len;
+}
+
+const char esp_console_op_pipe[] = "|";
+const char esp_console_op_in[] = "<";
+const char esp_console_op_out[] = ">";
+const char esp_console_op_append[] = ">>";
+
+/* Return the operator the argument is, or NULL if it is a plain argument.
+ * Quoted or escaped arguments are never operators. */
+static const char *split_operator(const char *line, const esp_console_arg_span_t *span)
+{
+    static const char *const ops[] = { esp_console_op_pipe, esp_console_op_in, esp_console_op_out, esp_console_op_append };
+    if (span->quoted || span->escaped || span->length > 2) {
+        return NULL;
+    }
+    for (size_t i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+        if (strlen(ops[i]) == span->length && memcmp(line + span->offset, ops[i], span->length) == 0) {
+            return ops[i];
         }
     }
-    /* make sure the final argument is terminated */
-    *out_ptr = 0;
-    /* finalize the last argument */
-    if (state != SS_SPACE && argc < argv_size - 1) {
-        argv[argc++] = next_arg_start;
+    return NULL;
+}
+
+/* Split the line in place, and tell in *overflow whether it has more than argv_size - 1 arguments */
+static size_t split_argv(char *line, char **argv, size_t argv_size, bool operators, bool *overflow)
+{
+    const size_t len = strlen(line);
+    size_t argc = 0;
+    size_t pos = 0;
+    char *out_ptr = line;
+    esp_console_arg_span_t span;
+    /* The arguments are packed at the start of the line. Unescaping never makes
+     * an argument longer, so the output doesn't overtake the input. */
+    while (argc < argv_size - 1 && split_next(line, len, &pos, &span)) {
+        const char *op = operators ? split_operator(line, &span) : NULL;
+        if (op != NULL) {
+            argv[argc++] = (char *) op;
+            continue;
+        }
+        argv[argc++] = out_ptr;
+        if (span.escaped) {
+            out_ptr += esp_console_unescape_arg(line, &span, out_ptr, span.length + 1);
+        } else {
+            memmove(out_ptr, line + span.offset, span.length);
+            out_ptr += span.length;
+        }
+        *out_ptr++ = 0;
     }
+    /* The arguments left are still in place, after the packed ones */
+    *overflow = (argc == argv_size - 1 && split_next(line, len, &pos, &span));
     /* add a NULL at the end of argv */
     argv[argc] = NULL;
 
     return argc;
 }
+
+size_t esp_console_split_argv(char *line, char **argv, size_t argv_size)
+{
+    bool overflow;
+    return split_argv(line, argv, argv_size, false, &overflow);
+}
+
+esp_err_t esp_console_split_command(char *line, char **argv, size_t argv_size, size_t *ret_argc)
+{
+    bool overflow;
+    *ret_argc = split_argv(line, argv, argv_size, true, &overflow);
+    return overflow ? ESP_ERR_INVALID_SIZE : ESP_OK;
+}
@@ -4,14 +4,20 @@
  * SPDX-License-Identifier: Apache-2.0
  */
 #include <stdio.h>
+#include <limits.h>
+#include <stdlib.h>
 #include <string.h>
 #include "sdkconfig.h"
 #include "unity.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
 #include "esp_console.h"
+#include "console_private.h"
 #include "argtable3/argtable3.h"
 #include "linenoise/linenoise.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/semphr.h"
 
 static int do_hello_cmd(int argc, char **argv)
 {
@@ -82,6 +88,38 @@ TEST_CASE("esp console help command", "[console][ignore]")
     vTaskDelay(pdMS_TO_TICKS(5000));
 }
 
+// Connect with "telnet <address>" and enter "quit" to exit REPL environment
+/* Marked as ignore since it needs a network connection */
+TEST_CASE("esp console tcp repl test", "[console][ignore]")
+{
+    esp_console_repl_config_t repl_config = ESP_CONSOLE_REPL_CONFIG_DEFAULT();
+    esp_console_dev_tcp_config_t tcp_config = ESP_CONSOLE_DEV_TCP_CONFIG_DEFAULT();
+    TEST_ESP_OK(esp_console_new_repl_tcp(&tcp_config, &repl_config, &s_repl));
+
+    TEST_ESP_OK(esp_console_cmd_register(&s_quit_cmd));
+
+    TEST_ESP_OK(esp_console_start_repl(s_repl));
+    vTaskDelay(pdMS_TO_TICKS(2000));
+}
+
+#if CONFIG_ESP_CONSOLE_UART_DEFAULT || CONFIG_ESP_CONSOLE_UART_CUSTOM
+TEST_CASE("esp console deletes a REPL which waits for input", "[console]")
+{
+    esp_console_repl_config_t repl_config = ESP_CONSOLE_REPL_CONFIG_DEFAULT();
+    esp_console_dev_uart_config_t uart_config = ESP_CONSOLE_DEV_UART_CONFIG_DEFAULT();
+    esp_console_repl_t *repl = NULL;
+    TEST_ESP_OK(esp_console_new_repl_uart(&uart_config, &repl_config, &repl));
+    TEST_ESP_OK(esp_console_start_repl(repl));
+    vTaskDelay(pdMS_TO_TICKS(200));
+
+    /* The REPL task is woken up from its wait, no input is needed */
+    const TickType_t start = xTaskGetTickCount();
+    TEST_ESP_OK(repl->del(repl));
+    TEST_ASSERT_LESS_THAN(pdMS_TO_TICKS(500), xTaskGetTickCount() - start);
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_STATE, esp_console_deinit());
+}
+#endif
+
 TEST_CASE("esp console init/deinit test, minimal config", "[console]")
 {
     /* Test with minimal init config */
@@ -102,3 +140,2028 @@ TEST_CASE("esp console init/deinit test, minimal config", "[console]")
     TEST_ESP_OK(esp_console_cmd_register(&cmd));
     TEST_ESP_OK(esp_console_deinit());
 }
+
+static int s_dispatch_count;
+
+static int do_count_cmd(int argc, char **argv)
+{
+    s_dispatch_count++;
+    return argc;
+}
+
+TEST_CASE("esp console run dispatches many registered commands", "[console]")
+{
+    esp_console_config_t console_config = ESP_CONSOLE_CONFIG_DEFAULT();
+    TEST_ESP_OK(esp_console_init(&console_config));
+
+    static char names[64][8];
+    for (int i = 0; i < 64; i++) {
+        snprintf(names[i], sizeof(names[i]), "cmd%d", i);
+        const esp_console_cmd_t cmd = {
+            .command = names[i],
+            .help = "Count invocations",
+            .func = do_count_cmd,
+        };
+        TEST_ESP_OK(esp_console_cmd_register(&cmd));
+    }
+
+    s_dispatch_count = 0;
+    int ret = 0;
+    char line[32];
+    for (int i = 0; i < 64; i++) {
+        snprintf(line, sizeof(line), "cmd%d a b", i);
+        TEST_ESP_OK(esp_console_run(line, &ret));
+        TEST_ASSERT_EQUAL(3, ret);
+    }
+    TEST_ASSERT_EQUAL(64, s_dispatch_count);
+    TEST_ASSERT_EQUAL(ESP_ERR_NOT_FOUND, esp_console_run("cmd64", &ret));
+    TEST_ASSERT_EQUAL(ESP_ERR_NOT_FOUND, esp_console_run("cmd", &ret));
+    TEST_ESP_OK(esp_console_deinit());
+}
+
+TEST_CASE("esp console completion returns commands with given prefix", "[console]")
+{
+    esp_console_config_t console_config = ESP_CONSOLE_CONFIG_DEFAULT();
+    TEST_ESP_OK(esp_console_init(&console_config));
+
+    const char *names[] = { "wifi_scan", "heap", "wifi", "wifz", "wifi_connect", "w" };
+    for (int i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        const esp_console_cmd_t cmd = {
+            .command = names[i],
+            .help = "Completion test",
+            .func = do_hello_cmd,
+        };
+        TEST_ESP_OK(esp_console_cmd_register(&cmd));
+    }
+
+    linenoiseCompletions lc = { 0 };
+    esp_console_get_completion("wifi", &lc);
+    TEST_ASSERT_EQUAL(3, lc.len);
+    TEST_ASSERT_EQUAL_STRING("wifi", lc.cvec[0]);
+    TEST_ASSERT_EQUAL_STRING("wifi_connect", lc.cvec[1]);
+    TEST_ASSERT_EQUAL_STRING("wifi_scan", lc.cvec[2]);
+    /* Names are borrowed from the registry, not copied */
+    TEST_ASSERT_EQUAL_PTR(names[0], lc.cvec[2]);
+    free(lc.cvec);
+
+    linenoiseCompletions none = { 0 };
+    esp_console_get_completion("x", &none);
+    TEST_ASSERT_EQUAL(0, none.len);
+    TEST_ESP_OK(esp_console_deinit());
+}
+
+TEST_CASE("linenoise completion table keeps every entry while it grows", "[console]")
+{
+    static char names[9][4];
+    linenoiseCompletions lc = { 0 };
+    for (int i = 0; i < 9; i++) {
+        snprintf(names[i], sizeof(names[i]), "c%d", i);
+        linenoiseAddCompletion(&lc, names[i]);
+        TEST_ASSERT_EQUAL(i + 1, lc.len);
+    }
+    for (int i = 0; i < 9; i++) {
+        TEST_ASSERT_EQUAL_STRING(names[i], lc.cvec[i]);
+        free(lc.cvec[i]);
+    }
+    free(lc.cvec);
+}
+
+static int do_argc_cmd(int argc, char **argv)
+{
+    return argc;
+}
+
+TEST_CASE("esp console run_ex uses caller provided buffers", "[console]")
+{
+    esp_console_config_t console_config = ESP_CONSOLE_CONFIG_DEFAULT();
+    TEST_ESP_OK(esp_console_init(&console_config));
+    const esp_console_cmd_t cmd = {
+        .command = "argc",
+        .help = "Return the number of arguments",
+        .func = do_argc_cmd,
+    };
+    TEST_ESP_OK(esp_console_cmd_register(&cmd));
+
+    char buf[32];
+    char *argv[4];
+    int ret = 0;
+    TEST_ESP_OK(esp_console_run_ex("argc a b", buf, sizeof(buf), argv, 4, &ret));
+    TEST_ASSERT_EQUAL(3, ret);
+    /* At most argv_size - 1 arguments are passed, a command with more isn't run */
+    TEST_ESP_OK(esp_console_run_ex("argc a b  ", buf, sizeof(buf), argv, 4, &ret));
+    TEST_ASSERT_EQUAL(3, ret);
+    ret = 0;
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_SIZE, esp_console_run_ex("argc a b c", buf, sizeof(buf), argv, 4, &ret));
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_SIZE, esp_console_run_ex("argc a b c d e", buf, sizeof(buf), argv, 4, &ret));
+    TEST_ASSERT_EQUAL(0, ret);
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_SIZE, esp_console_run_ex("argc 0123456789abcdef0123456789abcdef",
+                                                               buf, sizeof(buf), argv, 4, &ret));
+    TEST_ASSERT_EQUAL(0, ret);
+    /* Parse in place */
+    strlcpy(buf, "argc \"a b\"", sizeof(buf));
+    TEST_ESP_OK(esp_console_run_ex(buf, buf, sizeof(buf), argv, 4, &ret));
+    TEST_ASSERT_EQUAL(2, ret);
+    TEST_ASSERT_EQUAL_STRING("a b", argv[1]);
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, esp_console_run_ex("  ", buf, sizeof(buf), argv, 4, &ret));
+
+    /* The preallocated argument array must not leak or be reallocated per call */
+    size_t free_before = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    TEST_ESP_OK(esp_console_run("argc x", &ret));
+    TEST_ASSERT_EQUAL(free_before, heap_caps_get_free_size(MALLOC_CAP_8BIT));
+    TEST_ESP_OK(esp_console_deinit());
+}
+
+static struct {
+    struct arg_lit *verbose;
+    struct arg_int *count;
+    struct arg_str *name;
+    struct arg_end *end;
+} s_opt_args;
+
+static int do_opt_cmd(int argc, char **argv)
+{
+    if (arg_parse(argc, argv, (void **) &s_opt_args) != 0) {
+        return -1;
+    }
+    return s_opt_args.verbose->count * 100 + (s_opt_args.count->count ? s_opt_args.count->ival[0] : 0);
+}
+
+TEST_CASE("esp console parses options of registered argtables", "[console]")
+{
+    esp_console_config_t console_config = ESP_CONSOLE_CONFIG_DEFAULT();
+    TEST_ESP_OK(esp_console_init(&console_config));
+    s_opt_args.verbose = arg_litn("v", "verbose", 0, 2, "verbose");
+    s_opt_args.count = arg_int0("c", "count", "<n>", "count");
+    s_opt_args.name = arg_str0(NULL, NULL, "<name>", "name");
+    s_opt_args.end = arg_end(2);
+    const esp_console_cmd_t cmd = {
+        .command = "opt",
+        .help = "Return the parsed options",
+        .func = do_opt_cmd,
+        .argtable = &s_opt_args,
+    };
+    TEST_ESP_OK(esp_console_cmd_register(&cmd));
+
+    /* The option tables compiled at registration are reused by every call */
+    int ret = 0;
+    for (int i = 0; i < 2; i++) {
+        TEST_ESP_OK(esp_console_run("opt -v --count=7 foo", &ret));
+        TEST_ASSERT_EQUAL(107, ret);
+        TEST_ESP_OK(esp_console_run("opt -c 3 --verbose -v", &ret));
+        TEST_ASSERT_EQUAL(203, ret);
+        TEST_ESP_OK(esp_console_run("opt -x", &ret));
+        TEST_ASSERT_EQUAL(-1, ret);
+    }
+    TEST_ESP_OK(esp_console_deinit());
+
+    /* Parsing still works once the tables are released */
+    char *argv[] = {"opt", "-v"};
+    TEST_ASSERT_EQUAL(0, arg_parse(2, argv, (void **) &s_opt_args));
+    arg_freetable((void **) &s_opt_args, sizeof(s_opt_args) / sizeof(s_opt_args.verbose));
+}
+
+TEST_CASE("argtable keeps compiled option tables until the last arg_uncompile", "[console]")
+{
+    s_opt_args.verbose = arg_litn("v", "verbose", 0, 2, "verbose");
+    s_opt_args.count = arg_int0("c", "count", "<n>", "count");
+    s_opt_args.name = arg_str0(NULL, NULL, "<name>", "name");
+    s_opt_args.end = arg_end(2);
+    TEST_ASSERT_NULL(s_opt_args.end->compiled);
+    TEST_ASSERT_EQUAL(0, arg_compile((void **) &s_opt_args));
+    struct arg_compiled *compiled = s_opt_args.end->compiled;
+    TEST_ASSERT_NOT_NULL(compiled);
+
+    /* e.g. two commands registered with the same argtable */
+    TEST_ASSERT_EQUAL(0, arg_compile((void **) &s_opt_args));
+    TEST_ASSERT_EQUAL_PTR(compiled, s_opt_args.end->compiled);
+    arg_uncompile((void **) &s_opt_args);
+    TEST_ASSERT_EQUAL_PTR(compiled, s_opt_args.end->compiled);
+    char *argv[] = {"opt", "-c", "5"};
+    TEST_ASSERT_EQUAL(0, arg_parse(3, argv, (void **) &s_opt_args));
+    TEST_ASSERT_EQUAL(5, s_opt_args.count->ival[0]);
+
+    arg_uncompile((void **) &s_opt_args);
+    TEST_ASSERT_NULL(s_opt_args.end->compiled);
+    arg_freetable((void **) &s_opt_args, sizeof(s_opt_args) / sizeof(s_opt_args.verbose));
+}
+
+/* Run the command line, and return what it printed */
+static const char *run_printed(const char *cmdline, char *output, size_t output_size)
+{
+    memset(output, 0, output_size);
+    FILE *task_out = stdout;
+    stdout = fmemopen(output, output_size, "w");
+    TEST_ASSERT_NOT_NULL(stdout);
+    int ret = -1;
+    TEST_ESP_OK(esp_console_run(cmdline, &ret));
+    fclose(stdout);
+    stdout = task_out;
+    TEST_ASSERT_EQUAL(0, ret);
+    return output;
+}
+
+TEST_CASE("esp console generates hints and help when first needed", "[console]")
+{
+    static const char opt_help[] = "opt  <pregenerated help>\n\n";
+    esp_console_config_t console_config = ESP_CONSOLE_CONFIG_DEFAULT();
+    console_config.help_cache_size = 150;
+    TEST_ESP_OK(esp_console_init(&console_config));
+    TEST_ESP_OK(esp_console_register_help_command());
+    s_opt_args.verbose = arg_litn("v", "verbose", 0, 2, "verbose");
+    s_opt_args.count = arg_int0("c", "count", "<n>", "count");
+    s_opt_args.name = arg_str0(NULL, NULL, "<name>", "name");
+    s_opt_args.end = arg_end(2);
+    esp_console_cmd_t cmd = {
+        .command = "opt",
+        .help = "Return the parsed options",
+        .func = do_opt_cmd,
+        .argtable = &s_opt_args,
+    };
+    TEST_ESP_OK(esp_console_cmd_register(&cmd));
+    const esp_console_cmd_t hello_cmd = {
+        .command = "hello",
+        .help = "Print Hello World",
+        .hint = "[name]",
+        .func = do_hello_cmd,
+    };
+    TEST_ESP_OK(esp_console_cmd_register(&hello_cmd));
+
+    int color = 0;
+    int bold = 0;
+    TEST_ASSERT_EQUAL_STRING(" [name]", esp_console_get_hint("hello", &color, &bold));
+    const char *hint = esp_console_get_hint("opt", &color, &bold);
+    TEST_ASSERT_NOT_NULL(hint);
+    TEST_ASSERT_NOT_NULL(strstr(hint, "<name>"));
+    TEST_ASSERT_EQUAL_PTR(hint, esp_console_get_hint("opt", &color, &bold));
+
+    /* The cache only has room for one of the commands, the output stays the same */
+    char output[512];
+    char first[512];
+    strcpy(first, run_printed("help opt", output, sizeof(output)));
+    TEST_ASSERT_NOT_NULL(strstr(first, "Return the parsed options"));
+    TEST_ASSERT_NOT_NULL(strstr(first, "--count=<n>"));
+    TEST_ASSERT_EQUAL_STRING(first, run_printed("help opt", output, sizeof(output)));
+    TEST_ASSERT_NOT_NULL(strstr(run_printed("help", output, sizeof(output)), "Print Hello World"));
+    TEST_ASSERT_NOT_NULL(strstr(output, first));
+    TEST_ASSERT_EQUAL_STRING(first, run_printed("help opt", output, sizeof(output)));
+
+    /* Help given at registration is printed as is */
+    cmd.help_formatted = opt_help;
+    TEST_ESP_OK(esp_console_cmd_register(&cmd));
+    TEST_ASSERT_EQUAL_STRING(opt_help, run_printed("help opt", output, sizeof(output)));
+    TEST_ESP_OK(esp_console_deinit());
+    arg_freetable((void **) &s_opt_args, sizeof(s_opt_args) / sizeof(s_opt_args.verbose));
+}
+
+TEST_CASE("esp console records statistics of commands", "[console]")
+{
+    esp_console_config_t console_config = ESP_CONSOLE_CONFIG_DEFAULT();
+    TEST_ESP_OK(esp_console_init(&console_config));
+    s_opt_args.verbose = arg_litn("v", "verbose", 0, 2, "verbose");
+    s_opt_args.count = arg_int0("c", "count", "<n>", "count");
+    s_opt_args.name = arg_str0(NULL, NULL, "<name>", "name");
+    s_opt_args.end = arg_end(2);
+    const esp_console_cmd_t cmd = {
+        .command = "opt",
+        .help = "Return the parsed options",
+        .func = do_opt_cmd,
+        .argtable = &s_opt_args,
+    };
+    TEST_ESP_OK(esp_console_cmd_register(&cmd));
+    esp_console_cmd_stats_t stats;
+#if CONFIG_CONSOLE_CMD_STATS
+    TEST_ESP_OK(esp_console_register_stats_command());
+    TEST_ESP_OK(esp_console_get_cmd_stats("opt", &stats));
+    TEST_ASSERT_EQUAL(0, stats.calls);
+    TEST_ASSERT_EQUAL(ESP_ERR_NOT_FOUND, esp_console_get_cmd_stats("unknown", &stats));
+
+    int ret = 0;
+    for (int i = 0; i < 10; i++) {
+        TEST_ESP_OK(esp_console_run("opt -v --count=7 foo", &ret));
+    }
+    TEST_ESP_OK(esp_console_get_cmd_stats("opt", &stats));
+    TEST_ASSERT_EQUAL(10, stats.calls);
+    TEST_ASSERT_TRUE(stats.time_min_us <= stats.time_avg_us);
+    TEST_ASSERT_TRUE(stats.time_avg_us <= stats.time_max_us);
+    TEST_ASSERT_TRUE(stats.time_p99_us <= stats.time_max_us);
+    TEST_ASSERT_TRUE(stats.arg_parse_avg_us <= stats.time_avg_us);
+    TEST_ASSERT_TRUE(stats.stack_free_min > 0);
+
+    char output[512];
+    TEST_ASSERT_NOT_NULL(strstr(run_printed("console_stats", output, sizeof(output)), "opt"));
+    TEST_ASSERT_NOT_NULL(strstr(run_printed("console_stats -r opt", output, sizeof(output)), "opt"));
+    TEST_ESP_OK(esp_console_get_cmd_stats("opt", &stats));
+    TEST_ASSERT_EQUAL(0, stats.calls);
+
+    /* Registering it again keeps its argtable, which is freed by deinit */
+    TEST_ESP_OK(esp_console_register_stats_command());
+    TEST_ASSERT_NOT_NULL(strstr(run_printed("console_stats opt", output, sizeof(output)), "opt"));
+#else
+    TEST_ASSERT_EQUAL(ESP_ERR_NOT_SUPPORTED, esp_console_register_stats_command());
+    TEST_ASSERT_EQUAL(ESP_ERR_NOT_SUPPORTED, esp_console_get_cmd_stats("opt", &stats));
+#endif
+    TEST_ESP_OK(esp_console_deinit());
+    arg_freetable((void **) &s_opt_args, sizeof(s_opt_args) / sizeof(s_opt_args.verbose));
+}
+
+ESP_CONSOLE_CMD_REGISTER(static_sync, NULL, "", &do_argc_cmd, NULL, .flags = ESP_CONSOLE_CMD_FLAG_SYNC_ONLY);
+ESP_CONSOLE_CMD_REGISTER(static_argc, "Return the number of arguments", "[args]", &do_argc_cmd, NULL);
+
+TEST_CASE("esp console runs commands defined at compile time", "[console]")
+{
+    esp_console_config_t console_config = ESP_CONSOLE_CONFIG_DEFAULT();
+    TEST_ESP_OK(esp_console_init(&console_config));
+    TEST_ESP_OK(esp_console_register_help_command());
+
+    int ret = 0;
+    TEST_ESP_OK(esp_console_run("static_argc 1 2", &ret));
+    TEST_ASSERT_EQUAL(3, ret);
+    int color = 0;
+    int bold = 0;
+    TEST_ASSERT_EQUAL_STRING(" [args]", esp_console_get_hint("static_argc", &color, &bold));
+    TEST_ASSERT_NULL(esp_console_get_hint("static_sync", &color, &bold));
+
+    linenoiseCompletions lc = { 0 };
+    esp_console_get_completion("static_", &lc);
+    TEST_ASSERT_EQUAL(2, lc.len);
+    TEST_ASSERT_EQUAL_STRING("static_argc", lc.cvec[0]);
+    TEST_ASSERT_EQUAL_STRING("static_sync", lc.cvec[1]);
+    free(lc.cvec);
+
+    char output[512];
+    TEST_ASSERT_NOT_NULL(strstr(run_printed("help static_argc", output, sizeof(output)), "static_argc  [args]"));
+    TEST_ASSERT_NOT_NULL(strstr(run_printed("help", output, sizeof(output)), "Return the number of arguments"));
+    /* Commands without help are hidden */
+    TEST_ASSERT_NULL(strstr(output, "static_sync"));
+
+    /* A command registered with the same name replaces it */
+    const esp_console_cmd_t cmd = {
+        .command = "static_argc",
+        .help = "Print Hello World",
+        .func = do_hello_cmd,
+    };
+    TEST_ESP_OK(esp_console_cmd_register(&cmd));
+    TEST_ESP_OK(esp_console_run("static_argc 1 2", &ret));
+    TEST_ASSERT_EQUAL(0, ret);
+    TEST_ASSERT_NULL(esp_console_get_hint("static_argc", &color, &bold));
+    linenoiseCompletions replaced = { 0 };
+    esp_console_get_completion("static_", &replaced);
+    TEST_ASSERT_EQUAL(2, replaced.len);
+    free(replaced.cvec);
+    TEST_ASSERT_NULL(strstr(run_printed("help", output, sizeof(output)), "Return the number of arguments"));
+    TEST_ESP_OK(esp_console_deinit());
+}
+
+static struct {
+    struct arg_int *count;
+    struct arg_end *end;
+} s_static_args;
+
+static int do_static_opt_cmd(int argc, char **argv)
+{
+    if (arg_parse(argc, argv, (void **) &s_static_args) != 0) {
+        return -1;
+    }
+    return s_static_args.count->count ? s_static_args.count->ival[0] : 0;
+}
+
+/* Hidden from 'help', its argtable only exists in the test below */
+ESP_CONSOLE_CMD_REGISTER(compiled_opt, NULL, "", &do_static_opt_cmd, &s_static_args);
+
+TEST_CASE("esp console compiles the argtables of commands defined at compile time", "[console]")
+{
+    esp_console_config_t console_config = ESP_CONSOLE_CONFIG_DEFAULT();
+    /* Argtables created after esp_console_init are parsed without compiled tables */
+    TEST_ESP_OK(esp_console_init(&console_config));
+    s_static_args.count = arg_int0("c", "count", "<n>", "count");
+    s_static_args.end = arg_end(2);
+    TEST_ASSERT_NULL(s_static_args.end->compiled);
+    int ret = 0;
+    TEST_ESP_OK(esp_console_run("compiled_opt -c 4", &ret));
+    TEST_ASSERT_EQUAL(4, ret);
+    TEST_ESP_OK(esp_console_deinit());
+    TEST_ASSERT_NULL(s_static_args.end->compiled);
+
+    /* The ones created before are compiled once, until esp_console_deinit */
+    TEST_ESP_OK(esp_console_init(&console_config));
+    TEST_ASSERT_NOT_NULL(s_static_args.end->compiled);
+    TEST_ESP_OK(esp_console_run("compiled_opt --count=5", &ret));
+    TEST_ASSERT_EQUAL(5, ret);
+    TEST_ESP_OK(esp_console_run("compiled_opt -x", &ret));
+    TEST_ASSERT_EQUAL(-1, ret);
+    TEST_ESP_OK(esp_console_deinit());
+    TEST_ASSERT_NULL(s_static_args.end->compiled);
+    arg_freetable((void **) &s_static_args, sizeof(s_static_args) / sizeof(s_static_args.count));
+}
+
+typedef struct {
+    esp_console_context_t *ctx;
+    TaskHandle_t parent;
+} run_ctx_task_arg_t;
+
+static void run_ctx_task(void *arg)
+{
+    run_ctx_task_arg_t *task_arg = (run_ctx_task_arg_t *) arg;
+    int ret = 0;
+    for (int i = 0; i < 100; i++) {
+        TEST_ESP_OK(esp_console_run_ctx(task_arg->ctx, "argc 1 2 3", &ret));
+        TEST_ASSERT_EQUAL(4, ret);
+    }
+    xTaskNotifyGive(task_arg->parent);
+    vTaskDelete(NULL);
+}
+
+TEST_CASE("esp console contexts run commands concurrently", "[console]")
+{
+    esp_console_config_t console_config = ESP_CONSOLE_CONFIG_DEFAULT();
+    TEST_ESP_OK(esp_console_init(&console_config));
+    const esp_console_cmd_t cmd = {
+        .command = "argc",
+        .help = "Return the number of arguments",
+        .func = do_argc_cmd,
+    };
+    TEST_ESP_OK(esp_console_cmd_register(&cmd));
+
+    esp_console_context_config_t ctx_config = ESP_CONSOLE_CONTEXT_CONFIG_DEFAULT();
+    esp_console_context_t *ctx = NULL;
+    TEST_ESP_OK(esp_console_context_create(&ctx_config, &ctx));
+
+    run_ctx_task_arg_t task_arg = {
+        .ctx = ctx,
+        .parent = xTaskGetCurrentTaskHandle(),
+    };
+    TEST_ASSERT_EQUAL(pdPASS, xTaskCreate(run_ctx_task, "run_ctx", 4096, &task_arg, 5, NULL));
+
+    /* Meanwhile, register more commands and run them with the global buffers */
+    static char names[32][8];
+    int ret = 0;
+    for (int i = 0; i < 32; i++) {
+        snprintf(names[i], sizeof(names[i]), "new%d", i);
+        const esp_console_cmd_t new_cmd = {
+            .command = names[i],
+            .func = do_argc_cmd,
+        };
+        TEST_ESP_OK(esp_console_cmd_register(&new_cmd));
+        TEST_ESP_OK(esp_console_run(names[i], &ret));
+        TEST_ASSERT_EQUAL(1, ret);
+    }
+    TEST_ASSERT_NOT_EQUAL(0, ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(5000)));
+
+    TEST_ESP_OK(esp_console_context_delete(ctx));
+    TEST_ESP_OK(esp_console_deinit());
+}
+
+static int do_ret1_cmd(int argc, char **argv)
+{
+    return 1;
+}
+
+static int do_ret2_cmd(int argc, char **argv)
+{
+    return 2;
+}
+
+typedef struct {
+    TaskHandle_t parent;
+    int errors;
+} lookup_task_arg_t;
+
+/* Look up, run and get the hint of a command which is being replaced */
+static void lookup_task(void *arg)
+{
+    lookup_task_arg_t *task_arg = (lookup_task_arg_t *) arg;
+    esp_console_context_config_t ctx_config = ESP_CONSOLE_CONTEXT_CONFIG_DEFAULT();
+    esp_console_context_t *ctx = NULL;
+    TEST_ESP_OK(esp_console_context_create(&ctx_config, &ctx));
+    for (int i = 0; i < 200; i++) {
+        int color = 0, bold = 0, ret = 0;
+        const char *hint = esp_console_get_hint("swap", &color, &bold);
+        /* Either registration, never a freed or partly written one */
+        if (hint == NULL || (strcmp(hint, " <one>") != 0 && strcmp(hint, " <two>") != 0)) {
+            task_arg->errors++;
+        }
+        if (esp_console_run_ctx(ctx, "swap", &ret) != ESP_OK || (ret != 1 && ret != 2)) {
+            task_arg->errors++;
+        }
+        taskYIELD();
+    }
+    TEST_ESP_OK(esp_console_context_delete(ctx));
+    xTaskNotifyGive(task_arg->parent);
+    vTaskDelete(NULL);
+}
+
+TEST_CASE("esp console replaces a command while other tasks look it up", "[console]")
+{
+    esp_console_config_t console_config = ESP_CONSOLE_CONFIG_DEFAULT();
+    TEST_ESP_OK(esp_console_init(&console_config));
+    esp_console_cmd_t cmd = {
+        .command = "swap",
+        .hint = "<one>",
+        .func = do_ret1_cmd,
+    };
+    TEST_ESP_OK(esp_console_cmd_register(&cmd));
+    lookup_task_arg_t task_arg = {
+        .parent = xTaskGetCurrentTaskHandle(),
+    };
+    TEST_ASSERT_EQUAL(pdPASS, xTaskCreate(lookup_task, "lookup", 4096, &task_arg, 5, NULL));
+    for (int i = 0; i < 100; i++) {
+        cmd.hint = (i % 2) ? "<one>" : "<two>";
+        cmd.func = (i % 2) ? do_ret1_cmd : do_ret2_cmd;
+        TEST_ESP_OK(esp_console_cmd_register(&cmd));
+        taskYIELD();
+    }
+    TEST_ASSERT_NOT_EQUAL(0, ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(5000)));
+    TEST_ASSERT_EQUAL(0, task_arg.errors);
+
+    /* The last registration wins */
+    int ret = 0;
+    TEST_ESP_OK(esp_console_run("swap", &ret));
+    TEST_ASSERT_EQUAL(1, ret);
+    TEST_ESP_OK(esp_console_deinit());
+}
+
+TEST_CASE("esp console frees commands replaced by registering them again", "[console]")
+{
+    esp_console_config_t console_config = ESP_CONSOLE_CONFIG_DEFAULT();
+    TEST_ESP_OK(esp_console_init(&console_config));
+    esp_console_cmd_t cmd = {
+        .command = "swap",
+        .hint = "<one>",
+        .func = do_ret1_cmd,
+    };
+    TEST_ESP_OK(esp_console_cmd_register(&cmd));
+    int color = 0, bold = 0, ret = 0;
+    const char *hint = esp_console_get_hint("swap", &color, &bold);
+    TEST_ASSERT_EQUAL_STRING(" <one>", hint);
+
+    /* The same registration again and again doesn't use more memory */
+    TEST_ESP_OK(esp_console_cmd_register(&cmd));
+    const size_t heap_before = heap_caps_get_free_size(MALLOC_CAP_DEFAULT);
+    for (int i = 0; i < 100; i++) {
+        TEST_ESP_OK(esp_console_cmd_register(&cmd));
+    }
+    TEST_ASSERT_EQUAL(heap_before, heap_caps_get_free_size(MALLOC_CAP_DEFAULT));
+    TEST_ASSERT_EQUAL_PTR(hint, esp_console_get_hint("swap", &color, &bold));
+
+    /* A hint which was shown stays valid once the command has another one */
+    cmd.hint = "<two>";
+    cmd.func = do_ret2_cmd;
+    TEST_ESP_OK(esp_console_cmd_register(&cmd));
+    TEST_ASSERT_EQUAL_STRING(" <one>", hint);
+    TEST_ASSERT_EQUAL_STRING(" <two>", esp_console_get_hint("swap", &color, &bold));
+    TEST_ESP_OK(esp_console_run("swap", &ret));
+    TEST_ASSERT_EQUAL(2, ret);
+    TEST_ESP_OK(esp_console_deinit());
+}
+
+static SemaphoreHandle_t s_job_gate;
+static SemaphoreHandle_t s_job_done;
+static esp_console_executor_t *s_executor;
+static int s_jobs_ran;
+static int s_jobs_cancelled;
+static int s_jobs_saw_cancel;
+
+/* Blocks until the test lets it go, then returns the number of arguments */
+static int do_blocking_cmd(int argc, char **argv)
+{
+    xSemaphoreTake(s_job_gate, portMAX_DELAY);
+    if (esp_console_executor_is_cancelled(s_executor)) {
+        s_jobs_saw_cancel++;
+    }
+    return argc;
+}
+
+static void job_done(esp_console_job_id_t id, esp_err_t err, int cmd_ret, void *arg)
+{
+    if (err == ESP_OK) {
+        TEST_ASSERT_EQUAL(2, cmd_ret);
+        s_jobs_ran++;
+    } else {
+        TEST_ASSERT_EQUAL(ESP_ERR_INVALID_STATE, err);
+        s_jobs_cancelled++;
+    }
+    xSemaphoreGive(s_job_done);
+}
+
+TEST_CASE("esp console executor runs, lists and cancels jobs", "[console]")
+{
+    esp_console_config_t console_config = ESP_CONSOLE_CONFIG_DEFAULT();
+    TEST_ESP_OK(esp_console_init(&console_config));
+    const esp_console_cmd_t cmd = {
+        .command = "block",
+        .help = "Wait until the test is done",
+        .func = do_blocking_cmd,
+    };
+    TEST_ESP_OK(esp_console_cmd_register(&cmd));
+    const esp_console_cmd_t sync_cmd = {
+        .command = "sync",
+        .help = "Command which is never run by the executor",
+        .func = do_hello_cmd,
+        .flags = ESP_CONSOLE_CMD_FLAG_SYNC_ONLY,
+    };
+    TEST_ESP_OK(esp_console_cmd_register(&sync_cmd));
+
+    s_job_gate = xSemaphoreCreateCounting(4, 0);
+    s_job_done = xSemaphoreCreateCounting(4, 0);
+    TEST_ASSERT_NOT_NULL(s_job_gate);
+    TEST_ASSERT_NOT_NULL(s_job_done);
+    s_jobs_ran = s_jobs_cancelled = s_jobs_saw_cancel = 0;
+
+    esp_console_executor_config_t executor_config = ESP_CONSOLE_EXECUTOR_CONFIG_DEFAULT();
+    executor_config.num_workers = 2;
+    executor_config.queue_len = 4;
+    TEST_ESP_OK(esp_console_executor_create(&executor_config, &s_executor));
+
+    TEST_ASSERT_EQUAL(ESP_ERR_NOT_SUPPORTED, esp_console_executor_submit(s_executor, "sync", job_done, NULL, NULL));
+    TEST_ASSERT_EQUAL(ESP_ERR_NOT_FOUND, esp_console_executor_submit(s_executor, "unknown", job_done, NULL, NULL));
+
+    esp_console_job_id_t ids[4];
+    for (int i = 0; i < 4; i++) {
+        TEST_ESP_OK(esp_console_executor_submit(s_executor, "block 1", job_done, NULL, &ids[i]));
+    }
+    TEST_ASSERT_EQUAL(ESP_ERR_NO_MEM, esp_console_executor_submit(s_executor, "block 1", job_done, NULL, NULL));
+    vTaskDelay(pdMS_TO_TICKS(50));
+
+    /* Both workers are busy with the first two jobs */
+    esp_console_job_info_t jobs[4];
+    size_t num_jobs = 0;
+    TEST_ESP_OK(esp_console_executor_list_jobs(s_executor, jobs, 4, &num_jobs));
+    TEST_ASSERT_EQUAL(4, num_jobs);
+    int running = 0;
+    for (size_t i = 0; i < num_jobs; i++) {
+        TEST_ASSERT_EQUAL_STRING("block", jobs[i].command);
+        running += (jobs[i].state == ESP_CONSOLE_JOB_RUNNING);
+    }
+    TEST_ASSERT_EQUAL(2, running);
+
+    TEST_ESP_OK(esp_console_executor_cancel(s_executor, ids[3]));
+    TEST_ESP_OK(esp_console_executor_cancel(s_executor, ids[0]));
+    for (int i = 0; i < 3; i++) {
+        xSemaphoreGive(s_job_gate);
+    }
+    for (int i = 0; i < 4; i++) {
+        TEST_ASSERT_EQUAL(pdTRUE, xSemaphoreTake(s_job_done, pdMS_TO_TICKS(5000)));
+    }
+    TEST_ASSERT_EQUAL(3, s_jobs_ran);
+    TEST_ASSERT_EQUAL(1, s_jobs_cancelled);
+    TEST_ASSERT_EQUAL(1, s_jobs_saw_cancel);
+    TEST_ASSERT_EQUAL(ESP_ERR_NOT_FOUND, esp_console_executor_cancel(s_executor, ids[3]));
+
+    TEST_ESP_OK(esp_console_executor_delete(s_executor));
+    vSemaphoreDelete(s_job_gate);
+    vSemaphoreDelete(s_job_done);
+    TEST_ESP_OK(esp_console_deinit());
+}
+
+static void job_printed(esp_console_job_id_t id, esp_err_t err, int cmd_ret, void *arg)
+{
+    TEST_ASSERT_EQUAL(ESP_OK, err);
+    xSemaphoreGive(s_job_done);
+}
+
+TEST_CASE("esp console executor runs jobs with the streams of the submitting task", "[console]")
+{
+    esp_console_config_t console_config = ESP_CONSOLE_CONFIG_DEFAULT();
+    TEST_ESP_OK(esp_console_init(&console_config));
+    const esp_console_cmd_t cmd = {
+        .command = "hello",
+        .help = "Print Hello World",
+        .func = do_hello_cmd,
+    };
+    TEST_ESP_OK(esp_console_cmd_register(&cmd));
+    s_job_done = xSemaphoreCreateCounting(1, 0);
+    TEST_ASSERT_NOT_NULL(s_job_done);
+    esp_console_executor_config_t executor_config = ESP_CONSOLE_EXECUTOR_CONFIG_DEFAULT();
+    TEST_ESP_OK(esp_console_executor_create(&executor_config, &s_executor));
+
+    char output[32] = { 0 };
+    FILE *task_out = stdout;
+    stdout = fmemopen(output, sizeof(output), "w");
+    TEST_ASSERT_NOT_NULL(stdout);
+    TEST_ESP_OK(esp_console_executor_submit(s_executor, "hello", job_printed, NULL, NULL));
+    TEST_ASSERT_EQUAL(pdTRUE, xSemaphoreTake(s_job_done, pdMS_TO_TICKS(5000)));
+    fclose(stdout);
+    stdout = task_out;
+    TEST_ASSERT_EQUAL_STRING("Hello World\n", output);
+
+    TEST_ESP_OK(esp_console_executor_delete(s_executor));
+    vSemaphoreDelete(s_job_done);
+    TEST_ESP_OK(esp_console_deinit());
+}
+
+TEST_CASE("esp console output sends buffered output from its writer task", "[console]")
+{
+    const char line[] = "esp console output: this line is longer than the buffer of the output\n";
+    esp_console_output_config_t config = ESP_CONSOLE_OUTPUT_CONFIG_DEFAULT(fileno(stdout));
+    config.buffer_size = 32;
+    config.chunk_size = 16;
+    esp_console_output_t *output = NULL;
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, esp_console_output_create(&config, NULL));
+    config.chunk_size = 17;
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, esp_console_output_create(&config, &output));
+    TEST_ASSERT_NULL(output);
+    config.chunk_size = 16;
+    fflush(stdout);
+
+    /* Blocking writers wait for the writer task to make room */
+    TEST_ESP_OK(esp_console_output_create(&config, &output));
+    FILE *stream = esp_console_output_get_stream(output);
+    TEST_ASSERT_NOT_NULL(stream);
+    TEST_ASSERT_EQUAL(strlen(line), fwrite(line, 1, strlen(line), stream));
+    TEST_ESP_OK(esp_console_output_flush(output, 1000));
+    esp_console_output_stats_t stats;
+    TEST_ESP_OK(esp_console_output_get_stats(output, &stats));
+    TEST_ASSERT_EQUAL(strlen(line), stats.bytes_sent);
+    TEST_ASSERT_EQUAL(0, stats.bytes_dropped);
+    TEST_ASSERT_EQUAL(config.buffer_size, stats.max_used);
+    TEST_ESP_OK(esp_console_output_delete(output));
+
+    /* What doesn't fit is dropped right away */
+    config.policy = ESP_CONSOLE_OUTPUT_DROP_NEWEST;
+    TEST_ESP_OK(esp_console_output_create(&config, &output));
+    TEST_ASSERT_EQUAL(config.buffer_size, esp_console_output_write(output, line, strlen(line)));
+    TEST_ESP_OK(esp_console_output_flush(output, 1000));
+    TEST_ESP_OK(esp_console_output_get_stats(output, &stats));
+    TEST_ASSERT_EQUAL(config.buffer_size, stats.bytes_sent);
+    TEST_ASSERT_EQUAL(strlen(line) - config.buffer_size, stats.bytes_dropped);
+    TEST_ESP_OK(esp_console_output_delete(output));
+
+    /* The end of the line is kept, in place of its start */
+    config.policy = ESP_CONSOLE_OUTPUT_DROP_OLDEST;
+    TEST_ESP_OK(esp_console_output_create(&config, &output));
+    TEST_ASSERT_EQUAL(config.buffer_size, esp_console_output_write(output, line, strlen(line)));
+    TEST_ESP_OK(esp_console_output_delete(output));
+}
+
+TEST_CASE("linenoise edits several lines at the same time", "[console]")
+{
+    if (stdout_taken_sem == NULL) {
+        stdout_taken_sem = xSemaphoreCreateMutex();
+        TEST_ASSERT_NOT_NULL(stdout_taken_sem);
+    }
+    char input_a[] = "hello\n";
+    char input_b[] = "world\n";
+    char output[64];
+    FILE *out = fmemopen(output, sizeof(output), "w");
+    TEST_ASSERT_NOT_NULL(out);
+
+    char buf_a[32];
+    char buf_b[32];
+    struct linenoiseState ls_a = {
+        .buf = buf_a, .buflen = sizeof(buf_a), .prompt = "a> ", .plen = 3,
+        .in = fmemopen(input_a, strlen(input_a), "r"), .out = out,
+    };
+    struct linenoiseState ls_b = {
+        .buf = buf_b, .buflen = sizeof(buf_b), .prompt = "b> ", .plen = 3,
+        .in = fmemopen(input_b, strlen(input_b), "r"), .out = out,
+    };
+    TEST_ASSERT_NOT_NULL(ls_a.in);
+    TEST_ASSERT_NOT_NULL(ls_b.in);
+    TEST_ASSERT_EQUAL(0, linenoiseEditStart(&ls_a));
+    TEST_ASSERT_EQUAL(0, linenoiseEditStart(&ls_b));
+
+    /* Feed one key to each line in turn */
+    int res_a = LINENOISE_EDIT_MORE;
+    int res_b = LINENOISE_EDIT_MORE;
+    for (int i = 0; i < strlen(input_a); i++) {
+        res_a = linenoiseEditFeedLine(&ls_a);
+        res_b = linenoiseEditFeedLine(&ls_b);
+    }
+    TEST_ASSERT_EQUAL(LINENOISE_EDIT_DONE, res_a);
+    TEST_ASSERT_EQUAL(LINENOISE_EDIT_DONE, res_b);
+    TEST_ASSERT_EQUAL_STRING("hello", buf_a);
+    TEST_ASSERT_EQUAL_STRING("world", buf_b);
+    linenoiseEditStop(&ls_a);
+    linenoiseEditStop(&ls_b);
+
+    fclose(ls_a.in);
+    fclose(ls_b.in);
+    fclose(out);
+}
+
+typedef struct {
+    int count;                  // value of the -n option parsed by the task
+    TaskHandle_t parent;
+    int errors;
+} parse_task_arg_t;
+
+/* Parse options with its own argtable, while other tasks do the same */
+static void parse_task(void *arg)
+{
+    parse_task_arg_t *task_arg = (parse_task_arg_t *) arg;
+    struct {
+        struct arg_int *count;
+        struct arg_lit *verbose;
+        struct arg_str *name;
+        struct arg_end *end;
+    } args = {
+        .count = arg_int1("n", "count", "<n>", "count"),
+        .verbose = arg_lit0("v", "verbose", "verbose"),
+        .name = arg_str1(NULL, NULL, "<name>", "name"),
+        .end = arg_end(2),
+    };
+    char count[8];
+    snprintf(count, sizeof(count), "%d", task_arg->count);
+    char *argv[] = {"cmd", "-v", "--count", count, "name"};
+    for (int i = 0; i < 200; i++) {
+        if (arg_parse(5, argv, (void **) &args) != 0 || args.count->ival[0] != task_arg->count ||
+                args.verbose->count != 1 || strcmp(args.name->sval[0], "name") != 0) {
+            task_arg->errors++;
+        }
+        taskYIELD();
+    }
+    arg_freetable((void **) &args, sizeof(args) / sizeof(args.count));
+    xTaskNotifyGive(task_arg->parent);
+    vTaskDelete(NULL);
+}
+
+TEST_CASE("argtable parses the options of several tasks at the same time", "[console]")
+{
+    parse_task_arg_t task_args[2] = {
+        { .count = 1, .parent = xTaskGetCurrentTaskHandle() },
+        { .count = 2, .parent = xTaskGetCurrentTaskHandle() },
+    };
+    for (int i = 0; i < 2; i++) {
+        TEST_ASSERT_EQUAL(pdPASS, xTaskCreate(parse_task, "parse", 4096, &task_args[i], 5, NULL));
+    }
+    for (int i = 0; i < 2; i++) {
+        TEST_ASSERT_NOT_EQUAL(0, ulTaskNotifyTake(pdFALSE, pdMS_TO_TICKS(5000)));
+    }
+    TEST_ASSERT_EQUAL(0, task_args[0].errors);
+    TEST_ASSERT_EQUAL(0, task_args[1].errors);
+}
+
+TEST_CASE("linenoise history stays in its arena", "[console]")
+{
+    TEST_ASSERT_EQUAL(1, linenoiseHistorySetArena(256, MALLOC_CAP_DEFAULT));
+    TEST_ASSERT_EQUAL(1, linenoiseHistorySetMaxLen(8));
+    TEST_ASSERT_EQUAL(1, linenoiseHistoryAdd("first"));
+    TEST_ASSERT_EQUAL(0, linenoiseHistoryAdd("first"));
+
+    /* Older entries are evicted, without allocating anything */
+    size_t free_before = heap_caps_get_free_size(MALLOC_CAP_DEFAULT);
+    char line[32];
+    for (int i = 0; i < 100; i++) {
+        snprintf(line, sizeof(line), "command %d", i);
+        TEST_ASSERT_EQUAL(1, linenoiseHistoryAdd(line));
+    }
+    TEST_ASSERT_EQUAL(free_before, heap_caps_get_free_size(MALLOC_CAP_DEFAULT));
+
+    /* Lines bigger than the arena are not added */
+    char long_line[300];
+    memset(long_line, 'x', sizeof(long_line) - 1);
+    long_line[sizeof(long_line) - 1] = '\0';
+    TEST_ASSERT_EQUAL(0, linenoiseHistoryAdd(long_line));
+
+    linenoiseHistoryFree();
+    TEST_ASSERT_EQUAL(1, linenoiseHistorySetArena(0, 0));
+}
+
+/* Edit a line of the given input, in dumb mode so that the terminal isn't probed, until it is done */
+static int edit_line(struct linenoiseState *ls, const char *input)
+{
+    ls->in = fmemopen((void *) input, strlen(input), "r");
+    TEST_ASSERT_NOT_NULL(ls->in);
+    linenoiseSetDumbMode(1);
+    TEST_ASSERT_EQUAL(0, linenoiseEditStart(ls));
+    linenoiseSetDumbMode(0);
+    ls->cols = 80;
+    int res = LINENOISE_EDIT_MORE;
+    for (int i = 0; i < strlen(input) && res == LINENOISE_EDIT_MORE; i++) {
+        res = linenoiseEditFeedLine(ls);
+    }
+    linenoiseEditStop(ls);
+    fclose(ls->in);
+    return res;
+}
+
+#if CONFIG_IDF_TARGET_LINUX
+/* Load the history file into the empty history, and return the number of lines of the file */
+static int load_history_file(const char *path)
+{
+    linenoiseHistoryFree();
+    TEST_ASSERT_EQUAL(0, linenoiseHistoryLoad(path));
+    FILE *f = fopen(path, "r");
+    TEST_ASSERT_NOT_NULL(f);
+    int lines = 0;
+    for (int c = fgetc(f); c != EOF; c = fgetc(f)) {
+        lines += (c == '\n');
+    }
+    fclose(f);
+    return lines;
+}
+
+/* Check that the history of 4 entries holds cmd<first> to cmd<first + 3>, oldest first */
+static void check_history(int first)
+{
+    struct linenoiseHistory copy;
+    TEST_ASSERT_EQUAL(1, linenoiseHistoryInit(&copy, 4, 0, 0));
+    TEST_ASSERT_EQUAL(4, linenoiseHistoryCopy(&copy, NULL));
+    char line[8];
+    for (int i = 0; i < 4; i++) {
+        snprintf(line, sizeof(line), "cmd%d", first + i);
+        TEST_ASSERT_EQUAL_STRING(line, copy.entries[i]);
+    }
+    linenoiseHistoryRelease(&copy);
+}
+
+TEST_CASE("esp console appends to the history file and compacts it", "[console]")
+{
+    const char *path = "/tmp/console_history_test.txt";
+    remove(path);
+    TEST_ASSERT_EQUAL(1, linenoiseHistorySetMaxLen(4));
+    char line[8];
+    uint32_t file_lines = 0;
+    /* Lines are appended while the file has less than twice the length of the history */
+    for (int i = 0; i < 7; i++) {
+        snprintf(line, sizeof(line), "cmd%d", i);
+        TEST_ASSERT_EQUAL(1, linenoiseHistoryAdd(line));
+        TEST_ESP_OK(esp_console_history_write(path, 4, true, 1, &file_lines));
+    }
+    TEST_ASSERT_EQUAL(7, file_lines);
+    TEST_ASSERT_EQUAL(7, load_history_file(path));
+    check_history(3);
+
+    /* The lines which would reach the threshold make it rewritten with the history only */
+    TEST_ASSERT_EQUAL(1, linenoiseHistoryAdd("cmd7"));
+    TEST_ASSERT_EQUAL(1, linenoiseHistoryAdd("cmd8"));
+    TEST_ESP_OK(esp_console_history_write(path, 4, true, 2, &file_lines));
+    TEST_ASSERT_EQUAL(4, file_lines);
+    TEST_ASSERT_EQUAL(4, load_history_file(path));
+    check_history(5);
+
+    /* Appending starts over from the compacted file */
+    TEST_ASSERT_EQUAL(1, linenoiseHistoryAdd("cmd9"));
+    TEST_ESP_OK(esp_console_history_write(path, 4, true, 1, &file_lines));
+    TEST_ASSERT_EQUAL(5, file_lines);
+    TEST_ASSERT_EQUAL(5, load_history_file(path));
+    check_history(6);
+
+    remove(path);
+    linenoiseHistoryFree();
+}
+#endif
+
+TEST_CASE("linenoise browses the history of the state of each line", "[console]")
+{
+    if (stdout_taken_sem == NULL) {
+        stdout_taken_sem = xSemaphoreCreateMutex();
+        TEST_ASSERT_NOT_NULL(stdout_taken_sem);
+    }
+    TEST_ASSERT_EQUAL(1, linenoiseHistoryAdd("global"));
+    struct linenoiseHistory history_a;
+    struct linenoiseHistory history_b;
+    TEST_ASSERT_EQUAL(1, linenoiseHistoryInit(&history_a, 8, 0, 0));
+    TEST_ASSERT_EQUAL(1, linenoiseHistoryInit(&history_b, 8, 0, 0));
+    TEST_ASSERT_EQUAL(0, linenoiseHistoryInit(&history_b, 0, 0, 0));
+    TEST_ASSERT_EQUAL(1, linenoiseHistoryInit(&history_b, 8, 0, 0));
+
+    /* A starts with a copy of the global history, B with nothing */
+    TEST_ASSERT_EQUAL(1, linenoiseHistoryCopy(&history_a, NULL));
+    TEST_ASSERT_EQUAL(1, linenoiseHistoryAddTo(&history_a, "only a"));
+    TEST_ASSERT_EQUAL(1, linenoiseHistoryAddTo(&history_b, "only b"));
+    TEST_ASSERT_EQUAL(2, history_a.len);
+    TEST_ASSERT_EQUAL(1, history_b.len);
+
+    char output[256];
+    FILE *out = fmemopen(output, sizeof(output), "w");
+    TEST_ASSERT_NOT_NULL(out);
+    char buf[32];
+    struct linenoiseState ls = {
+        .buf = buf, .buflen = sizeof(buf), .prompt = "esp> ", .plen = 5, .out = out,
+    };
+
+    /* Each line browses and searches its own history, and the global one if it has none */
+    ls.history = &history_a;
+    TEST_ASSERT_EQUAL(LINENOISE_EDIT_DONE, edit_line(&ls, "\x10\x10\n"));
+    TEST_ASSERT_EQUAL_STRING("global", buf);
+    ls.history = &history_b;
+    TEST_ASSERT_EQUAL(LINENOISE_EDIT_DONE, edit_line(&ls, "\x10\x10\n"));
+    TEST_ASSERT_EQUAL_STRING("only b", buf);
+    TEST_ASSERT_EQUAL(LINENOISE_EDIT_DONE, edit_line(&ls, "\x12" "a" "\x07\n"));
+    TEST_ASSERT_EQUAL_STRING("", buf);
+    ls.history = NULL;
+    TEST_ASSERT_EQUAL(LINENOISE_EDIT_DONE, edit_line(&ls, "\x10\n"));
+    TEST_ASSERT_EQUAL_STRING("global", buf);
+
+    fclose(out);
+    linenoiseHistoryRelease(&history_a);
+    linenoiseHistoryRelease(&history_b);
+    TEST_ASSERT_NULL(history_a.entries);
+    linenoiseHistoryFree();
+}
+
+TEST_CASE("linenoise searches the history with ctrl-r", "[console]")
+{
+    if (stdout_taken_sem == NULL) {
+        stdout_taken_sem = xSemaphoreCreateMutex();
+        TEST_ASSERT_NOT_NULL(stdout_taken_sem);
+    }
+    TEST_ASSERT_EQUAL(1, linenoiseHistoryAdd("wifi start"));
+    TEST_ASSERT_EQUAL(1, linenoiseHistoryAdd("free"));
+    TEST_ASSERT_EQUAL(1, linenoiseHistoryAdd("wifi status"));
+
+    /* Search "wifi", then an older match, then run it */
+    char input[] = "\x12" "wifi" "\x12" "\n";
+    char output[256];
+    FILE *out = fmemopen(output, sizeof(output), "w");
+    TEST_ASSERT_NOT_NULL(out);
+    char buf[32];
+    struct linenoiseState ls = {
+        .buf = buf, .buflen = sizeof(buf), .prompt = "esp> ", .plen = 5,
+        .in = fmemopen(input, strlen(input), "r"), .out = out,
+    };
+    TEST_ASSERT_NOT_NULL(ls.in);
+    /* Don't probe the terminal size, the input has no answer */
+    linenoiseSetDumbMode(1);
+    TEST_ASSERT_EQUAL(0, linenoiseEditStart(&ls));
+    linenoiseSetDumbMode(0);
+
+    int res = LINENOISE_EDIT_MORE;
+    for (int i = 0; i < strlen(input) && res == LINENOISE_EDIT_MORE; i++) {
+        res = linenoiseEditFeedLine(&ls);
+    }
+    TEST_ASSERT_EQUAL(LINENOISE_EDIT_DONE, res);
+    TEST_ASSERT_EQUAL_STRING("wifi start", buf);
+    linenoiseEditStop(&ls);
+
+    fclose(ls.in);
+    fclose(out);
+    linenoiseHistoryFree();
+}
+
+TEST_CASE("linenoise redraws lines in its render buffer", "[console]")
+{
+    if (stdout_taken_sem == NULL) {
+        stdout_taken_sem = xSemaphoreCreateMutex();
+        TEST_ASSERT_NOT_NULL(stdout_taken_sem);
+    }
+    char input[] = "hello world\x02\x02\x0c\n";
+    char output[512];
+    FILE *out = fmemopen(output, sizeof(output), "w");
+    TEST_ASSERT_NOT_NULL(out);
+    char buf[32];
+    char render_buf[LINENOISE_RENDER_LEN(sizeof(buf), 5)];
+    struct linenoiseState ls = {
+        .buf = buf, .buflen = sizeof(buf), .prompt = "esp> ", .plen = 5,
+        .render_buf = render_buf, .render_buflen = sizeof(render_buf),
+        .in = fmemopen(input, strlen(input), "r"), .out = out,
+    };
+    TEST_ASSERT_NOT_NULL(ls.in);
+    linenoiseSetDumbMode(1);
+    TEST_ASSERT_EQUAL(0, linenoiseEditStart(&ls));
+    linenoiseSetDumbMode(0);
+    ls.cols = 80;
+
+    /* Each key redraws the line, Ctrl-L all of it, without allocating anything */
+    size_t free_before = heap_caps_get_free_size(MALLOC_CAP_DEFAULT);
+    int res = LINENOISE_EDIT_MORE;
+    for (int i = 0; i < strlen(input) && res == LINENOISE_EDIT_MORE; i++) {
+        res = linenoiseEditFeedLine(&ls);
+    }
+    TEST_ASSERT_EQUAL(free_before, heap_caps_get_free_size(MALLOC_CAP_DEFAULT));
+    TEST_ASSERT_EQUAL(LINENOISE_EDIT_DONE, res);
+    TEST_ASSERT_EQUAL_STRING("hello world", buf);
+    TEST_ASSERT_EQUAL_PTR(render_buf, ls.render_buf);
+    linenoiseEditStop(&ls);
+    fflush(out);
+    TEST_ASSERT_NOT_NULL(strstr(output, "esp> hello world"));
+
+    /* A buffer too small is replaced, and the replacement is freed on stop */
+    rewind(ls.in);
+    ls.render_buf = render_buf;
+    ls.render_buflen = 8;
+    linenoiseSetDumbMode(1);
+    TEST_ASSERT_EQUAL(0, linenoiseEditStart(&ls));
+    linenoiseSetDumbMode(0);
+    ls.cols = 80;
+    res = LINENOISE_EDIT_MORE;
+    for (int i = 0; i < strlen(input) && res == LINENOISE_EDIT_MORE; i++) {
+        res = linenoiseEditFeedLine(&ls);
+    }
+    TEST_ASSERT_EQUAL(LINENOISE_EDIT_DONE, res);
+    TEST_ASSERT_NOT_EQUAL(render_buf, ls.render_buf);
+    TEST_ASSERT_TRUE(ls.render_buflen > 8);
+    linenoiseEditStop(&ls);
+    TEST_ASSERT_NULL(ls.render_buf);
+
+    fclose(ls.in);
+    fclose(out);
+}
+
+TEST_CASE("linenoise refreshes only what changed in the line", "[console]")
+{
+    if (stdout_taken_sem == NULL) {
+        stdout_taken_sem = xSemaphoreCreateMutex();
+        TEST_ASSERT_NOT_NULL(stdout_taken_sem);
+    }
+    /* Type a line, go 5 characters back, insert one and delete it */
+    char input[] = "abcdefghij\x02\x02\x02\x02\x02" "X" "\x7f\n";
+    char output[512];
+    FILE *out = fmemopen(output, sizeof(output), "w");
+    TEST_ASSERT_NOT_NULL(out);
+    char buf[32];
+    struct linenoiseState ls = {
+        .buf = buf, .buflen = sizeof(buf), .prompt = "esp> ", .plen = 5,
+        .in = fmemopen(input, strlen(input), "r"), .out = out,
+    };
+    TEST_ASSERT_NOT_NULL(ls.in);
+    linenoiseSetDumbMode(1);
+    TEST_ASSERT_EQUAL(0, linenoiseEditStart(&ls));
+    linenoiseSetDumbMode(0);
+    ls.cols = 80;
+
+    while (ls.pos < 10 || ls.len < 10) {
+        TEST_ASSERT_EQUAL(LINENOISE_EDIT_MORE, linenoiseEditFeedLine(&ls));
+    }
+    /* Moving left is a backspace */
+    for (int i = 0; i < 5; i++) {
+        TEST_ASSERT_EQUAL(LINENOISE_EDIT_MORE, linenoiseEditFeedLine(&ls));
+        TEST_ASSERT_EQUAL(1, ls.refresh_bytes);
+    }
+    /* Inserting and deleting in the middle don't write the rest of the line again */
+    TEST_ASSERT_EQUAL(LINENOISE_EDIT_MORE, linenoiseEditFeedLine(&ls));
+    TEST_ASSERT_EQUAL_STRING("abcdeXfghij", buf);
+    TEST_ASSERT_EQUAL(strlen("\x1b[1@X"), ls.refresh_bytes);
+    TEST_ASSERT_EQUAL(LINENOISE_EDIT_MORE, linenoiseEditFeedLine(&ls));
+    TEST_ASSERT_EQUAL(strlen("\b\x1b[1P"), ls.refresh_bytes);
+    TEST_ASSERT_EQUAL(LINENOISE_EDIT_DONE, linenoiseEditFeedLine(&ls));
+    TEST_ASSERT_EQUAL_STRING("abcdefghij", buf);
+    linenoiseEditStop(&ls);
+
+    fclose(ls.in);
+    fclose(out);
+}
+
+TEST_CASE("linenoise keeps the columns of the terminal between lines", "[console]")
+{
+    if (stdout_taken_sem == NULL) {
+        stdout_taken_sem = xSemaphoreCreateMutex();
+        TEST_ASSERT_NOT_NULL(stdout_taken_sem);
+    }
+    char input[] = "a\nb\nc\n";
+    char output[256];
+    FILE *out = fmemopen(output, sizeof(output), "w");
+    TEST_ASSERT_NOT_NULL(out);
+    char buf[32];
+    struct linenoiseState ls = {
+        .prompt = "esp> ", .plen = 5,
+        .in = fmemopen(input, strlen(input), "r"), .out = out,
+    };
+    TEST_ASSERT_NOT_NULL(ls.in);
+
+    /* The streams can't answer the probe, the terminal is assumed to have 80 columns */
+    TEST_ASSERT_EQUAL(-1, linenoiseProbeColumns(&ls, 10));
+    const char *lines[] = { "a", "b", "c" };
+    const size_t cols[] = { 132, 132, 80 };
+    linenoiseSetColumns(&ls, 132);
+    for (int i = 0; i < 3; i++) {
+        if (i == 2) {
+            linenoiseInvalidateColumns(&ls);
+        }
+        ls.buf = buf;
+        ls.buflen = sizeof(buf);
+        TEST_ASSERT_EQUAL(0, linenoiseEditStart(&ls));
+        TEST_ASSERT_EQUAL(cols[i], ls.cols);
+        int res = LINENOISE_EDIT_MORE;
+        while (res == LINENOISE_EDIT_MORE) {
+            res = linenoiseEditFeedLine(&ls);
+        }
+        TEST_ASSERT_EQUAL(LINENOISE_EDIT_DONE, res);
+        TEST_ASSERT_EQUAL_STRING(lines[i], buf);
+        linenoiseEditStop(&ls);
+    }
+
+    fclose(ls.in);
+    fclose(out);
+}
+
+TEST_CASE("argtable rex options match with the pattern compiled once", "[console]")
+{
+    struct {
+        struct arg_rex *mac;
+        struct arg_end *end;
+    } args = {
+        .mac = arg_rex1("m", "mac", "[0-9a-f][0-9a-f]:[0-9a-f][0-9a-f]", "<mac>", ARG_REX_ICASE, "MAC address"),
+        .end = arg_end(2),
+    };
+    TEST_ASSERT_EQUAL(0, arg_nullcheck((void **) &args));
+
+    char *valid[] = {"cmd", "--mac", "0A:1b"};
+    char *invalid[] = {"cmd", "-m", "0a:1"};
+    for (int i = 0; i < 3; i++) {
+        TEST_ASSERT_EQUAL(0, arg_parse(3, valid, (void **) &args));
+        TEST_ASSERT_EQUAL_STRING("0A:1b", args.mac->sval[0]);
+        TEST_ASSERT_EQUAL(1, arg_parse(3, invalid, (void **) &args));
+    }
+    arg_freetable((void **) &args, 2);
+}
+
+static int arg_cmd_index(int argc, char *argv[], arg_dstr_t res)
+{
+    return atoi(argv[0] + 1);
+}
+
+TEST_CASE("argtable command table finds, replaces and iterates commands", "[console]")
+{
+    arg_cmd_init();
+    char name[8];
+    for (int i = 0; i < 200; i++) {
+        snprintf(name, sizeof(name), "c%d", i);
+        arg_cmd_register(name, arg_cmd_index, "index");
+    }
+    /* Replaced, not added again */
+    arg_cmd_register("c7", arg_cmd_index, "replaced");
+    TEST_ASSERT_EQUAL(200, arg_cmd_count());
+    TEST_ASSERT_EQUAL_STRING("replaced", arg_cmd_info("c7")->description);
+
+    /* Remove every other command, the others are still found */
+    for (int i = 0; i < 200; i += 2) {
+        snprintf(name, sizeof(name), "c%d", i);
+        arg_cmd_unregister(name);
+    }
+    TEST_ASSERT_EQUAL(100, arg_cmd_count());
+    for (int i = 0; i < 200; i++) {
+        snprintf(name, sizeof(name), "c%d", i);
+        if (i % 2) {
+            char *argv[] = { name };
+            TEST_ASSERT_EQUAL(i, arg_cmd_dispatch(name, 1, argv, NULL));
+        } else {
+            TEST_ASSERT_NULL(arg_cmd_info(name));
+        }
+    }
+
+    /* Each command is visited once */
+    int sum = 0;
+    int visited = 0;
+    arg_cmd_itr_t itr = arg_cmd_itr_create();
+    do {
+        TEST_ASSERT_EQUAL_STRING(arg_cmd_itr_key(itr), arg_cmd_itr_value(itr)->name);
+        sum += atoi(arg_cmd_itr_key(itr) + 1);
+        visited++;
+    } while (arg_cmd_itr_advance(itr));
+    TEST_ASSERT_EQUAL(100, visited);
+    TEST_ASSERT_EQUAL(100 * 100, sum);
+    TEST_ASSERT_TRUE(arg_cmd_itr_search(itr, "c99"));
+    TEST_ASSERT_EQUAL_STRING("c99", arg_cmd_itr_key(itr));
+    TEST_ASSERT_FALSE(arg_cmd_itr_search(itr, "c98"));
+    arg_cmd_itr_destroy(itr);
+    arg_cmd_uninit();
+}
+
+TEST_CASE("argtable scans integers and comma separated lists of numbers", "[console]")
+{
+    int regs[4];
+    double gains[3];
+    struct {
+        struct arg_int *value;
+        struct arg_int *regs;
+        struct arg_dbl *gains;
+        struct arg_end *end;
+    } args = {
+        .value = arg_int0("v", "value", "<n>", "value"),
+        .regs = arg_int_list("r", "regs", NULL, regs, 0, 4, "registers"),
+        .gains = arg_dbl_list("g", "gains", NULL, gains, 0, 3, "gains"),
+        .end = arg_end(2),
+    };
+    TEST_ASSERT_EQUAL(0, arg_nullcheck((void **) &args));
+
+    static const struct {
+        const char *arg;
+        int value;
+    } valid[] = {
+        {"-v1234", 1234}, {"-v-0x1f", -31}, {"-v+0o17", 15}, {"-v0B101", 5}, {"-v010", 10},
+        {"-v 3kb ", 3072}, {"-v2MB", 2 << 20}, {"-v1GB", 1 << 30}, {"-v2147483647", INT_MAX},
+        {"-v-2147483648", INT_MIN}, {"-v0x7fffffff", INT_MAX},
+    };
+    for (size_t i = 0; i < sizeof(valid) / sizeof(valid[0]); i++) {
+        char *argv[] = {"cmd", (char *) valid[i].arg};
+        TEST_ASSERT_EQUAL(0, arg_parse(2, argv, (void **) &args));
+        TEST_ASSERT_EQUAL(valid[i].value, args.value->ival[0]);
+    }
+    static const char *invalid[] = {"-v", "-vx", "-v0x", "-v12a", "-v0b12", "-v1TB", "-v2147483648", "-v-2147483649",
+                                    "-v0x80000000", "-v2GB", "-v-3GB"
+                                   };
+    for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++) {
+        char *argv[] = {"cmd", (char *) invalid[i]};
+        TEST_ASSERT_EQUAL(1, arg_parse(2, argv, (void **) &args));
+    }
+
+    /* Lists fill the caller's arrays, each argument adding its values */
+    char *lists[] = {"cmd", "--regs=0x10,0x20", "-r", "4KB", "--gains", "1.5, -2,1e3"};
+    TEST_ASSERT_EQUAL(0, arg_parse(6, lists, (void **) &args));
+    TEST_ASSERT_EQUAL(3, args.regs->count);
+    TEST_ASSERT_EQUAL(0x10, regs[0]);
+    TEST_ASSERT_EQUAL(0x20, regs[1]);
+    TEST_ASSERT_EQUAL(4096, regs[2]);
+    TEST_ASSERT_EQUAL(3, args.gains->count);
+    TEST_ASSERT_TRUE(gains[0] == 1.5 && gains[1] == -2 && gains[2] == 1e3);
+    char *too_many[] = {"cmd", "-r1,2,3", "-r4,5"};
+    TEST_ASSERT_EQUAL(1, arg_parse(3, too_many, (void **) &args));
+    char *bad_lists[][2] = {{"cmd", "-r1,,2"}, {"cmd", "-r1,"}, {"cmd", "-r1;2"}, {"cmd", "-g1,x"}};
+    for (size_t i = 0; i < sizeof(bad_lists) / sizeof(bad_lists[0]); i++) {
+        TEST_ASSERT_EQUAL(1, arg_parse(2, bad_lists[i], (void **) &args));
+    }
+    arg_freetable((void **) &args, 4);
+}
+
+TEST_CASE("esp console splits arguments into spans of the line", "[console]")
+{
+    const char line[] = "set \"key name\" a\\ b value";
+    esp_console_arg_span_t spans[3];
+    size_t count = 0;
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_SIZE, esp_console_split_argv_spans(line, strlen(line), spans, 3, &count));
+    TEST_ASSERT_EQUAL(4, count);
+
+    esp_console_arg_span_t all[4];
+    TEST_ESP_OK(esp_console_split_argv_spans(line, strlen(line), all, 4, &count));
+    TEST_ASSERT_EQUAL(4, count);
+    TEST_ASSERT_EQUAL(0, all[0].offset);
+    TEST_ASSERT_EQUAL(3, all[0].length);
+    TEST_ASSERT_FALSE(all[1].escaped);
+    TEST_ASSERT_TRUE(all[1].quoted);
+    TEST_ASSERT_EQUAL(0, strncmp(line + all[1].offset, "key name", all[1].length));
+    TEST_ASSERT_TRUE(all[2].escaped);
+    TEST_ASSERT_FALSE(all[2].quoted);
+
+    char arg[8];
+    TEST_ASSERT_EQUAL(3, esp_console_unescape_arg(line, &all[2], arg, sizeof(arg)));
+    TEST_ASSERT_EQUAL_STRING("a b", arg);
+    /* Truncated arguments report their full length */
+    TEST_ASSERT_EQUAL(8, esp_console_unescape_arg(line, &all[1], arg, 4));
+    TEST_ASSERT_EQUAL_STRING("key", arg);
+
+    /* An operator right after a closing quote is an operator, a quoted one is not */
+    char command[] = "echo \"abc\"> out \">\" \"a\"|";
+    char *argv[8];
+    size_t argc = 0;
+    TEST_ESP_OK(esp_console_split_command(command, argv, 8, &argc));
+    TEST_ASSERT_EQUAL(7, argc);
+    TEST_ASSERT_EQUAL_STRING("abc", argv[1]);
+    TEST_ASSERT_EQUAL_PTR(esp_console_op_out, argv[2]);
+    TEST_ASSERT_EQUAL_STRING("out", argv[3]);
+    TEST_ASSERT_FALSE(esp_console_is_operator(argv[4]));
+    TEST_ASSERT_EQUAL_STRING(">", argv[4]);
+    TEST_ASSERT_EQUAL_STRING("a", argv[5]);
+    TEST_ASSERT_EQUAL_PTR(esp_console_op_pipe, argv[6]);
+}
+
+/* Replies of a telnet parser, appended to a buffer */
+typedef struct {
+    uint8_t data[16];
+    size_t len;
+} telnet_replies_t;
+
+static void telnet_reply(void *arg, const uint8_t *data, size_t len)
+{
+    telnet_replies_t *replies = (telnet_replies_t *) arg;
+    TEST_ASSERT_LESS_OR_EQUAL(sizeof(replies->data), replies->len + len);
+    memcpy(replies->data + replies->len, data, len);
+    replies->len += len;
+}
+
+TEST_CASE("esp console removes telnet commands from the input of a session", "[console]")
+{
+    telnet_replies_t replies = { 0 };
+    esp_console_telnet_t telnet = { .reply = telnet_reply, .reply_arg = &replies };
+
+    /* Options are answered, a doubled IAC is data, CR LF and CR NUL become LF */
+    char input[] = "ls\xff\xfd\x18\xff\xfb\x01\xff\xfb\x1f\r\n\xff\xff\r\0x\xff\xf1y";
+    size_t len = esp_console_telnet_filter(&telnet, input, sizeof(input) - 1, false);
+    TEST_ASSERT_EQUAL(7, len);
+    TEST_ASSERT_EQUAL_MEMORY("ls\n\xff\nxy", input, len);
+    TEST_ASSERT_EQUAL(6, replies.len);
+    TEST_ASSERT_EQUAL_MEMORY("\xff\xfc\x18\xff\xfe\x01", replies.data, replies.len);
+    TEST_ASSERT_EQUAL(0, telnet.cols);
+
+    /* A window size split across reads, its width has an escaped IAC */
+    char part1[] = "a\xff\xfa\x1f\x01";
+    char part2[] = "\xff\xff\x00\x18\xff";
+    char part3[] = "\xf0" "b";
+    TEST_ASSERT_EQUAL(1, esp_console_telnet_filter(&telnet, part1, sizeof(part1) - 1, false));
+    TEST_ASSERT_EQUAL('a', part1[0]);
+    TEST_ASSERT_EQUAL(0, esp_console_telnet_filter(&telnet, part2, sizeof(part2) - 1, false));
+    TEST_ASSERT_EQUAL(0, telnet.cols);
+    TEST_ASSERT_EQUAL(1, esp_console_telnet_filter(&telnet, part3, sizeof(part3) - 1, false));
+    TEST_ASSERT_EQUAL('b', part3[0]);
+    TEST_ASSERT_EQUAL(0x1ff, telnet.cols);
+
+    /* A window size one byte at a time, and a CR split from its LF; binary data keeps its CR */
+    const char naws[] = "\xff\xfa\x1f\x00\x50\x00\x18\xff\xf0\r";
+    for (size_t i = 0; i < sizeof(naws) - 1; i++) {
+        char c = naws[i];
+        TEST_ASSERT_EQUAL(i == sizeof(naws) - 2, esp_console_telnet_filter(&telnet, &c, 1, false));
+    }
+    TEST_ASSERT_EQUAL(80, telnet.cols);
+    char lf[] = "\n\r";
+    TEST_ASSERT_EQUAL(1, esp_console_telnet_filter(&telnet, lf, 2, true));
+    TEST_ASSERT_EQUAL('\r', lf[0]);
+    TEST_ASSERT_EQUAL(6, replies.len);
+}
+
+TEST_CASE("esp console keeps the telnet state of each session apart", "[console]")
+{
+    esp_console_telnet_t first = { 0 };
+    esp_console_telnet_t second = { 0 };
+
+    /* A window size of the first session is interrupted by input of the second one */
+    char part1[] = "\xff\xfa\x1f\x00\x64";
+    TEST_ASSERT_EQUAL(0, esp_console_telnet_filter(&first, part1, sizeof(part1) - 1, false));
+    char other[] = "\x1f\x00\x28\r";
+    TEST_ASSERT_EQUAL(4, esp_console_telnet_filter(&second, other, sizeof(other) - 1, false));
+    TEST_ASSERT_EQUAL_MEMORY("\x1f\x00\x28\n", other, 4);
+    TEST_ASSERT_EQUAL(0, second.cols);
+    char part2[] = "\x00\x18\xff\xf0\n";
+    TEST_ASSERT_EQUAL(1, esp_console_telnet_filter(&first, part2, sizeof(part2) - 1, false));
+    TEST_ASSERT_EQUAL(100, first.cols);
+
+    /* The LF after the CR of the second session is dropped there only */
+    char lf[] = "\n";
+    TEST_ASSERT_EQUAL(0, esp_console_telnet_filter(&second, lf, 1, false));
+    TEST_ASSERT_EQUAL(1, esp_console_telnet_filter(&first, lf, 1, false));
+}
+
+static int32_t frame_le32(const uint8_t *data)
+{
+    return data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t) data[3] << 24);
+}
+
+TEST_CASE("esp console runs commands received in frames", "[console]")
+{
+    esp_console_config_t console_config = ESP_CONSOLE_CONFIG_DEFAULT();
+    TEST_ESP_OK(esp_console_init(&console_config));
+    const esp_console_cmd_t cmd = {
+        .command = "hello",
+        .help = "Print Hello World",
+        .func = do_hello_cmd,
+    };
+    TEST_ESP_OK(esp_console_cmd_register(&cmd));
+    esp_console_context_config_t ctx_config = ESP_CONSOLE_CONTEXT_CONFIG_DEFAULT();
+    esp_console_context_t *ctx = NULL;
+    TEST_ESP_OK(esp_console_context_create(&ctx_config, &ctx));
+
+    uint8_t request[ESP_CONSOLE_FRAME_REQUEST_LEN(16)];
+    uint8_t response[ESP_CONSOLE_FRAME_RESPONSE_LEN(32)];
+    size_t request_len, response_len;
+    uint8_t type, seq, *data;
+    size_t data_len;
+    TEST_ESP_OK(esp_console_frame_encode(ESP_CONSOLE_FRAME_TYPE_RUN, 7, "hello", 5, request, sizeof(request), &request_len));
+    TEST_ASSERT_EQUAL(0, request[request_len - 1]);
+    TEST_ASSERT_NULL(memchr(request, 0, request_len - 1));
+    TEST_ESP_OK(esp_console_frame_run(ctx, request, request_len - 1, response, sizeof(response), &response_len, &type));
+    TEST_ASSERT_EQUAL(ESP_CONSOLE_FRAME_TYPE_RUN, type);
+    TEST_ESP_OK(esp_console_frame_decode(response, response_len - 1, &type, &seq, &data, &data_len));
+    TEST_ASSERT_EQUAL(ESP_CONSOLE_FRAME_TYPE_RUN | ESP_CONSOLE_FRAME_RESPONSE, type);
+    TEST_ASSERT_EQUAL(7, seq);
+    TEST_ASSERT_EQUAL(ESP_OK, frame_le32(data));
+    TEST_ASSERT_EQUAL(0, frame_le32(data + 4));
+    TEST_ASSERT_EQUAL(0, data[8]);
+    TEST_ASSERT_EQUAL_STRING("Hello World\n", (const char *) data + ESP_CONSOLE_FRAME_RESULT_LEN);
+
+    /* Output which doesn't fit is truncated */
+    TEST_ESP_OK(esp_console_frame_encode(ESP_CONSOLE_FRAME_TYPE_RUN, 8, "hello", 5, request, sizeof(request), &request_len));
+    TEST_ESP_OK(esp_console_frame_run(ctx, request, request_len - 1, response, ESP_CONSOLE_FRAME_RESPONSE_LEN(5), &response_len, NULL));
+    TEST_ESP_OK(esp_console_frame_decode(response, response_len - 1, &type, &seq, &data, &data_len));
+    TEST_ASSERT_EQUAL(ESP_CONSOLE_FRAME_FLAG_TRUNCATED, data[8]);
+    TEST_ASSERT_EQUAL_STRING("Hello", (const char *) data + ESP_CONSOLE_FRAME_RESULT_LEN);
+
+    /* Corrupted requests get an error response */
+    TEST_ESP_OK(esp_console_frame_encode(ESP_CONSOLE_FRAME_TYPE_RUN, 9, "hello", 5, request, sizeof(request), &request_len));
+    request[3] ^= 0x20;
+    TEST_ESP_OK(esp_console_frame_run(ctx, request, request_len - 1, response, sizeof(response), &response_len, &type));
+    TEST_ASSERT_EQUAL(ESP_CONSOLE_FRAME_TYPE_ERROR, type);
+    TEST_ESP_OK(esp_console_frame_decode(response, response_len - 1, &type, &seq, &data, &data_len));
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_CRC, frame_le32(data));
+
+    TEST_ESP_OK(esp_console_context_delete(ctx));
+    TEST_ESP_OK(esp_console_deinit());
+}
+
+static int s_script_sum;
+
+static int do_add_cmd(int argc, char **argv)
+{
+    if (argc != 2) {
+        return 1;
+    }
+    s_script_sum += atoi(argv[1]);
+    return 0;
+}
+
+TEST_CASE("esp console runs scripts of commands separated by semicolons", "[console]")
+{
+    /* Quoted and escaped semicolons don't separate commands */
+    const char line[] = "add 1; add \"2;3\"; add 4\\;5";
+    TEST_ASSERT_EQUAL(5, esp_console_command_len(line, strlen(line)));
+    TEST_ASSERT_EQUAL(10, esp_console_command_len(line + 6, strlen(line) - 6));
+    TEST_ASSERT_EQUAL(strlen(line) - 17, esp_console_command_len(line + 17, strlen(line) - 17));
+
+    esp_console_config_t console_config = ESP_CONSOLE_CONFIG_DEFAULT();
+    TEST_ESP_OK(esp_console_init(&console_config));
+    const esp_console_cmd_t cmd = {
+        .command = "add",
+        .help = "Add the argument to the sum",
+        .func = do_add_cmd,
+    };
+    TEST_ESP_OK(esp_console_cmd_register(&cmd));
+    esp_console_context_config_t ctx_config = ESP_CONSOLE_CONTEXT_CONFIG_DEFAULT();
+    ctx_config.max_cmdline_length = 32;
+    esp_console_context_t *ctx = NULL;
+    TEST_ESP_OK(esp_console_context_create(&ctx_config, &ctx));
+
+    const char script[] = "# comment\nadd 1; add 2;\r\n\nadd 3 3\nnope\nadd 100000000000000000000000000000000\nadd 4";
+    esp_console_script_config_t config = ESP_CONSOLE_SCRIPT_CONFIG_DEFAULT();
+    esp_console_script_result_t result;
+    s_script_sum = 0;
+    TEST_ASSERT_EQUAL(ESP_FAIL, esp_console_run_script_buf(ctx, script, strlen(script), &config, &result));
+    TEST_ASSERT_EQUAL(3, s_script_sum);
+    TEST_ASSERT_EQUAL(3, result.commands_run);
+    TEST_ASSERT_EQUAL(1, result.errors);
+    TEST_ASSERT_EQUAL(4, result.error_line);
+    TEST_ASSERT_EQUAL(1, result.cmd_ret);
+
+    /* Keep going after errors, reading the script from a stream */
+    config.stop_on_error = false;
+    s_script_sum = 0;
+    FILE *f = fmemopen((void *) script, strlen(script), "r");
+    TEST_ASSERT_NOT_NULL(f);
+    TEST_ASSERT_EQUAL(ESP_FAIL, esp_console_run_script(ctx, f, &config, &result));
+    fclose(f);
+    TEST_ASSERT_EQUAL(7, s_script_sum);
+    TEST_ASSERT_EQUAL(4, result.commands_run);
+    TEST_ASSERT_EQUAL(3, result.errors);
+    TEST_ASSERT_EQUAL(4, result.error_line);
+    TEST_ASSERT_EQUAL(0, result.cmd_ret);
+
+    TEST_ASSERT_EQUAL(ESP_ERR_NOT_FOUND, esp_console_run_script_buf(ctx, "nope; add 1", 11, &config, NULL));
+
+    /* Empty commands are skipped, invalid ones are errors of their line */
+    const char invalid[] = "add 1;  ;add 2\nadd 3 >\n ; add 4";
+    s_script_sum = 0;
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, esp_console_run_script_buf(ctx, invalid, strlen(invalid), &config, &result));
+    TEST_ASSERT_EQUAL(7, s_script_sum);
+    TEST_ASSERT_EQUAL(3, result.commands_run);
+    TEST_ASSERT_EQUAL(1, result.errors);
+    TEST_ASSERT_EQUAL(2, result.error_line);
+    TEST_ESP_OK(esp_console_context_delete(ctx));
+    TEST_ESP_OK(esp_console_deinit());
+}
+
+static int do_echo_cmd(int argc, char **argv)
+{
+    for (int i = 1; i < argc; i++) {
+        printf("%s%s", argv[i], i < argc - 1 ? " " : "\n");
+    }
+    return 0;
+}
+
+/* Return the number of bytes read from stdin */
+static int do_wc_cmd(int argc, char **argv)
+{
+    int count = 0;
+    while (getchar() != EOF) {
+        count++;
+    }
+    return count;
+}
+
+TEST_CASE("esp console redirects the streams of commands", "[console]")
+{
+    esp_console_config_t console_config = ESP_CONSOLE_CONFIG_DEFAULT();
+    /* Smaller than what goes through it, so that writers wait for readers */
+    console_config.pipe_buffer_size = 16;
+    TEST_ESP_OK(esp_console_init(&console_config));
+    const esp_console_cmd_t cmds[] = {
+        { .command = "echo", .help = "Print the arguments", .func = do_echo_cmd },
+        { .command = "wc", .help = "Count the bytes of the input", .func = do_wc_cmd },
+        { .command = "argc", .help = "Return the number of arguments", .func = do_argc_cmd },
+    };
+    for (size_t i = 0; i < sizeof(cmds) / sizeof(cmds[0]); i++) {
+        TEST_ESP_OK(esp_console_cmd_register(&cmds[i]));
+    }
+
+    /* Quoted and escaped operators are arguments */
+    int ret = 0;
+    TEST_ESP_OK(esp_console_run("argc \">\" \\| \"<\"", &ret));
+    TEST_ASSERT_EQUAL(4, ret);
+
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, esp_console_run("echo a >", &ret));
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, esp_console_run("echo a > x > y", &ret));
+    TEST_ASSERT_EQUAL(ESP_ERR_NOT_FOUND, esp_console_run("nope > x", &ret));
+    TEST_ASSERT_EQUAL(ESP_FAIL, esp_console_run("wc < /nonexistent/file", &ret));
+
+#if CONFIG_IDF_TARGET_LINUX
+    const char *path = "/tmp/console_redirect_test.txt";
+    TEST_ESP_OK(esp_console_run("echo a b > /tmp/console_redirect_test.txt", &ret));
+    TEST_ESP_OK(esp_console_run("echo c >> /tmp/console_redirect_test.txt", &ret));
+    TEST_ESP_OK(esp_console_run("wc < /tmp/console_redirect_test.txt", &ret));
+    TEST_ASSERT_EQUAL(6, ret);
+    remove(path);
+    /* The standard streams are shared by all threads */
+    TEST_ASSERT_EQUAL(ESP_ERR_NOT_SUPPORTED, esp_console_run("echo a | wc", &ret));
+#else
+    TEST_ESP_OK(esp_console_run("echo a b | wc", &ret));
+    TEST_ASSERT_EQUAL(4, ret);
+    TEST_ESP_OK(esp_console_run("echo 0123456789 0123456789 0123456789 0123456789 | wc", &ret));
+    TEST_ASSERT_EQUAL(44, ret);
+    TEST_ESP_OK(esp_console_run("echo a b c | echo d | wc", &ret));
+    TEST_ASSERT_EQUAL(2, ret);
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, esp_console_run("echo a | wc < x", &ret));
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, esp_console_run("echo a > x | wc", &ret));
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, esp_console_run("echo a | | wc", &ret));
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, esp_console_run("echo a > |", &ret));
+    TEST_ASSERT_EQUAL(ESP_ERR_NOT_FOUND, esp_console_run("echo a | nope", &ret));
+#endif
+    TEST_ESP_OK(esp_console_deinit());
+}
+
+typedef struct {
+    char output[64];
+    size_t len;
+} capture_sink_t;
+
+static esp_err_t capture_cb(const char *data, size_t len, void *arg)
+{
+    capture_sink_t *sink = (capture_sink_t *) arg;
+    TEST_ASSERT_TRUE(sink->len + len < sizeof(sink->output));
+    memcpy(sink->output + sink->len, data, len);
+    sink->len += len;
+    sink->output[sink->len] = 0;
+    /* Drop what comes after the first few bytes */
+    return sink->len > 4 ? ESP_FAIL : ESP_OK;
+}
+
+TEST_CASE("esp console captures the output of commands", "[console]")
+{
+    esp_console_config_t console_config = ESP_CONSOLE_CONFIG_DEFAULT();
+    TEST_ESP_OK(esp_console_init(&console_config));
+    const esp_console_cmd_t cmd = {
+        .command = "echo",
+        .help = "Print the arguments",
+        .func = do_echo_cmd,
+    };
+    TEST_ESP_OK(esp_console_cmd_register(&cmd));
+    esp_console_context_config_t ctx_config = ESP_CONSOLE_CONTEXT_CONFIG_DEFAULT();
+    esp_console_context_t *ctx = NULL;
+    TEST_ESP_OK(esp_console_context_create(&ctx_config, &ctx));
+
+    char buf[8];
+    esp_console_capture_t capture = {
+        .buf = buf,
+        .buf_size = sizeof(buf),
+    };
+    int ret = -1;
+    TEST_ESP_OK(esp_console_run_capture(ctx, "echo abc", &capture, &ret));
+    TEST_ASSERT_EQUAL(0, ret);
+    TEST_ASSERT_EQUAL(4, capture.len);
+    TEST_ASSERT_FALSE(capture.truncated);
+    TEST_ASSERT_EQUAL_MEMORY("abc\n", buf, 4);
+    TEST_ESP_OK(esp_console_run_capture(ctx, "echo abcdef ghi", &capture, &ret));
+    TEST_ASSERT_EQUAL(8, capture.len);
+    TEST_ASSERT_TRUE(capture.truncated);
+    TEST_ASSERT_EQUAL_MEMORY("abcdef g", buf, 8);
+
+    /* Through the buffer a line at a time, until the callback stops it */
+    capture_sink_t sink = { 0 };
+    capture.cb = capture_cb;
+    capture.arg = &sink;
+    TEST_ESP_OK(esp_console_run_capture(ctx, "echo a b", &capture, &ret));
+    TEST_ASSERT_EQUAL_STRING("a b\n", sink.output);
+    TEST_ASSERT_FALSE(capture.truncated);
+    memset(&sink, 0, sizeof(sink));
+    TEST_ESP_OK(esp_console_run_capture(ctx, "echo abcdef ghi", &capture, &ret));
+    TEST_ASSERT_TRUE(capture.truncated);
+    TEST_ASSERT_TRUE(sink.len < strlen("abcdef ghi\n"));
+    TEST_ASSERT_EQUAL_MEMORY("abcde", sink.output, 5);
+
+    /* Straight from the command without a buffer */
+    memset(&sink, 0, sizeof(sink));
+    capture.buf = NULL;
+    TEST_ESP_OK(esp_console_run_capture(ctx, "echo 0123456789", &capture, &ret));
+    TEST_ASSERT_EQUAL_STRING("0123456789\n", sink.output);
+    TEST_ASSERT_EQUAL(ESP_ERR_NOT_FOUND, esp_console_run_capture(ctx, "nope", &capture, &ret));
+    capture.cb = NULL;
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, esp_console_run_capture(ctx, "echo a", &capture, &ret));
+
+    TEST_ESP_OK(esp_console_context_delete(ctx));
+    TEST_ESP_OK(esp_console_deinit());
+}
+
+/* Allocator counting the blocks it holds */
+static void *counting_malloc(size_t size, void *arg)
+{
+    void *ptr = malloc(size);
+    if (ptr) {
+        (*(int *) arg)++;
+    }
+    return ptr;
+}
+
+static void *counting_realloc(void *ptr, size_t size, void *arg)
+{
+    void *new_ptr = realloc(ptr, size);
+    if (ptr == NULL && new_ptr) {
+        (*(int *) arg)++;
+    }
+    return new_ptr;
+}
+
+static void counting_free(void *ptr, void *arg)
+{
+    if (ptr) {
+        (*(int *) arg)--;
+    }
+    free(ptr);
+}
+
+TEST_CASE("esp console allocates its memory with the given allocator", "[console]")
+{
+    int blocks = 0;
+    const esp_console_allocator_t allocator = {
+        .malloc = counting_malloc,
+        .realloc = counting_realloc,
+        .free = counting_free,
+        .arg = &blocks,
+    };
+    esp_console_config_t console_config = ESP_CONSOLE_CONFIG_DEFAULT();
+    console_config.allocator = &allocator;
+    TEST_ESP_OK(esp_console_init(&console_config));
+    const int init_blocks = blocks;
+    TEST_ASSERT_GREATER_THAN(0, init_blocks);
+
+    /* Argtables created from now on come from the allocator as well */
+    s_opt_args.verbose = arg_litn("v", "verbose", 0, 2, "verbose");
+    s_opt_args.count = arg_int0("c", "count", "<n>", "count");
+    s_opt_args.name = arg_str0(NULL, NULL, "<name>", "name");
+    s_opt_args.end = arg_end(2);
+    const int table_blocks = blocks - init_blocks;
+    TEST_ASSERT_GREATER_THAN(0, table_blocks);
+    const esp_console_cmd_t cmd = {
+        .command = "opt",
+        .help = "Return the parsed options",
+        .func = do_opt_cmd,
+        .argtable = &s_opt_args,
+    };
+    TEST_ESP_OK(esp_console_cmd_register(&cmd));
+    TEST_ESP_OK(esp_console_register_help_command());
+    int color = 0, bold = 0;
+    TEST_ASSERT_EQUAL_STRING(" [-v] [-c <n>] [<name>]", esp_console_get_hint("opt", &color, &bold));
+    char output[256];
+    TEST_ASSERT_NOT_NULL(strstr(run_printed("help opt", output, sizeof(output)), "Return the parsed options"));
+
+    esp_console_config_t invalid_config = console_config;
+    invalid_config.pool_size = 4096;
+    TEST_ESP_OK(esp_console_deinit());
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, esp_console_init(&invalid_config));
+    TEST_ASSERT_EQUAL(table_blocks, blocks);
+
+    /* Once deinitialized, argtable allocates and frees with the defaults again */
+    struct arg_end *end = arg_end(2);
+    TEST_ASSERT_NOT_NULL(end);
+    arg_freetable((void **) &end, 1);
+    arg_freetable((void **) &s_opt_args, sizeof(s_opt_args) / sizeof(s_opt_args.verbose));
+    TEST_ASSERT_EQUAL(table_blocks, blocks);
+}
+
+/* Allocator which fails once it allocated budget blocks */
+typedef struct {
+    int blocks;
+    int budget;
+} budget_alloc_t;
+
+static void *budget_malloc(size_t size, void *arg)
+{
+    budget_alloc_t *alloc = (budget_alloc_t *) arg;
+    if (alloc->budget == 0) {
+        return NULL;
+    }
+    alloc->budget--;
+    return counting_malloc(size, &alloc->blocks);
+}
+
+static void *budget_realloc(void *ptr, size_t size, void *arg)
+{
+    budget_alloc_t *alloc = (budget_alloc_t *) arg;
+    if (ptr == NULL) {
+        return budget_malloc(size, arg);
+    }
+    return counting_realloc(ptr, size, &alloc->blocks);
+}
+
+static void budget_free(void *ptr, void *arg)
+{
+    counting_free(ptr, &((budget_alloc_t *) arg)->blocks);
+}
+
+TEST_CASE("esp console fails to register a command when out of memory", "[console]")
+{
+    budget_alloc_t alloc = { .budget = -1 };
+    const esp_console_allocator_t allocator = {
+        .malloc = budget_malloc,
+        .realloc = budget_realloc,
+        .free = budget_free,
+        .arg = &alloc,
+    };
+    esp_console_config_t console_config = ESP_CONSOLE_CONFIG_DEFAULT();
+    console_config.allocator = &allocator;
+    TEST_ESP_OK(esp_console_init(&console_config));
+    const int init_blocks = alloc.blocks;
+    s_opt_args.verbose = arg_litn("v", "verbose", 0, 2, "verbose");
+    s_opt_args.count = arg_int0("c", "count", "<n>", "count");
+    s_opt_args.name = arg_str0(NULL, NULL, "<name>", "name");
+    s_opt_args.end = arg_end(2);
+    const int table_blocks = alloc.blocks - init_blocks;
+    const esp_console_cmd_t cmd = {
+        .command = "opt",
+        .help = "Return the parsed options",
+        .func = do_opt_cmd,
+        .argtable = &s_opt_args,
+    };
+
+    /* Each allocation of the registration fails in turn, rather than the argtable panic handler being called */
+    int budget = 0;
+    int ret = 0;
+    esp_err_t err;
+    do {
+        alloc.budget = budget++;
+        err = esp_console_cmd_register(&cmd);
+        if (err != ESP_OK) {
+            TEST_ASSERT_EQUAL(ESP_ERR_NO_MEM, err);
+            TEST_ASSERT_NULL(s_opt_args.end->compiled);
+            TEST_ASSERT_EQUAL(ESP_ERR_NOT_FOUND, esp_console_run("opt", &ret));
+        }
+    } while (err != ESP_OK);
+    TEST_ASSERT_GREATER_THAN(1, budget);
+    alloc.budget = -1;
+    TEST_ESP_OK(esp_console_run("opt -v --count=7 foo", &ret));
+    TEST_ASSERT_EQUAL(107, ret);
+
+    /* Nothing the failed registrations allocated is left */
+    TEST_ESP_OK(esp_console_deinit());
+    TEST_ASSERT_EQUAL(table_blocks, alloc.blocks);
+    arg_freetable((void **) &s_opt_args, sizeof(s_opt_args) / sizeof(s_opt_args.verbose));
+}
+
+#if !CONFIG_IDF_TARGET_LINUX
+TEST_CASE("esp console allocates its memory from a fixed pool", "[console]")
+{
+    const size_t pool_size = 8 * 1024;
+    esp_console_config_t console_config = ESP_CONSOLE_CONFIG_DEFAULT();
+    console_config.pool_size = pool_size;
+    TEST_ESP_OK(esp_console_init(&console_config));
+    size_t free_bytes = 0, min_free_bytes = 0;
+    TEST_ESP_OK(esp_console_get_pool_info(&free_bytes, NULL));
+    const size_t init_free = free_bytes;
+    TEST_ASSERT_LESS_THAN(pool_size, init_free);
+
+    s_opt_args.verbose = arg_litn("v", "verbose", 0, 2, "verbose");
+    s_opt_args.count = arg_int0("c", "count", "<n>", "count");
+    s_opt_args.name = arg_str0(NULL, NULL, "<name>", "name");
+    s_opt_args.end = arg_end(2);
+    const esp_console_cmd_t cmd = {
+        .command = "opt",
+        .help = "Return the parsed options",
+        .func = do_opt_cmd,
+        .argtable = &s_opt_args,
+    };
+    TEST_ESP_OK(esp_console_cmd_register(&cmd));
+    TEST_ESP_OK(esp_console_register_help_command());
+    int ret = 0;
+    TEST_ESP_OK(esp_console_run("opt -v --count=7 foo", &ret));
+    TEST_ASSERT_EQUAL(107, ret);
+    char output[256];
+    TEST_ASSERT_NOT_NULL(strstr(run_printed("help opt", output, sizeof(output)), "Return the parsed options"));
+    TEST_ESP_OK(esp_console_get_pool_info(&free_bytes, &min_free_bytes));
+    TEST_ASSERT_LESS_THAN(init_free, free_bytes);
+    TEST_ASSERT_LESS_OR_EQUAL(free_bytes, min_free_bytes);
+
+    /* The pool outlives the console until the argtables are freed */
+    TEST_ESP_OK(esp_console_deinit());
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_STATE, esp_console_get_pool_info(&free_bytes, NULL));
+    arg_freetable((void **) &s_opt_args, sizeof(s_opt_args) / sizeof(s_opt_args.verbose));
+}
+
+TEST_CASE("esp console fails to create a REPL or an executor which doesn't fit in the pool", "[console]")
+{
+    /* The REPL and its buffers don't fit, it gives the console back */
+    esp_console_repl_config_t repl_config = ESP_CONSOLE_REPL_CONFIG_DEFAULT();
+    repl_config.pool_size = 2 * 1024;
+    esp_console_dev_tcp_config_t tcp_config = ESP_CONSOLE_DEV_TCP_CONFIG_DEFAULT();
+    esp_console_repl_t *repl = NULL;
+    TEST_ASSERT_EQUAL(ESP_ERR_NO_MEM, esp_console_new_repl_tcp(&tcp_config, &repl_config, &repl));
+    TEST_ASSERT_NULL(repl);
+
+    esp_console_config_t console_config = ESP_CONSOLE_CONFIG_DEFAULT();
+    console_config.pool_size = 8 * 1024;
+    TEST_ESP_OK(esp_console_init(&console_config));
+    size_t init_free = 0, free_bytes = 0;
+    TEST_ESP_OK(esp_console_get_pool_info(&init_free, NULL));
+
+    /* Too many jobs for the pool, and then too many contexts */
+    esp_console_executor_config_t executor_config = ESP_CONSOLE_EXECUTOR_CONFIG_DEFAULT();
+    executor_config.queue_len = 256;
+    esp_console_executor_t *executor = NULL;
+    TEST_ASSERT_EQUAL(ESP_ERR_NO_MEM, esp_console_executor_create(&executor_config, &executor));
+    TEST_ASSERT_NULL(executor);
+    executor_config.queue_len = 16;
+    executor_config.max_cmdline_length = 1024;
+    TEST_ASSERT_EQUAL(ESP_ERR_NO_MEM, esp_console_executor_create(&executor_config, &executor));
+    TEST_ASSERT_NULL(executor);
+    TEST_ESP_OK(esp_console_get_pool_info(&free_bytes, NULL));
+    TEST_ASSERT_EQUAL(init_free, free_bytes);
+
+    executor_config.queue_len = 1;
+    executor_config.max_cmdline_length = 0;
+    TEST_ESP_OK(esp_console_executor_create(&executor_config, &executor));
+    TEST_ESP_OK(esp_console_get_pool_info(&free_bytes, NULL));
+    TEST_ASSERT_LESS_THAN(init_free, free_bytes);
+    TEST_ESP_OK(esp_console_executor_delete(executor));
+    TEST_ESP_OK(esp_console_deinit());
+}
+#endif
+
+static void log_lines(int first, int last)
+{
+    for (int i = first; i <= last; i++) {
+        esp_log_write(ESP_LOG_INFO, "test", "line %d\n", i);
+    }
+}
+
+TEST_CASE("esp console batches the logs printed while a line is edited", "[console]")
+{
+    if (stdout_taken_sem == NULL) {
+        stdout_taken_sem = xSemaphoreCreateMutex();
+        TEST_ASSERT_NOT_NULL(stdout_taken_sem);
+    }
+    char output[512];
+    FILE *out = fmemopen(output, sizeof(output), "w");
+    TEST_ASSERT_NOT_NULL(out);
+    char input[] = "ab";
+    char buf[32];
+    char render_buf[LINENOISE_RENDER_LEN(sizeof(buf), 5)];
+    struct linenoiseState ls = {
+        .buf = buf, .buflen = sizeof(buf), .prompt = "esp> ", .plen = 5,
+        .render_buf = render_buf, .render_buflen = sizeof(render_buf),
+        .in = fmemopen(input, strlen(input), "r"), .out = out,
+    };
+    TEST_ASSERT_NOT_NULL(ls.in);
+    linenoiseSetDumbMode(1);
+    TEST_ASSERT_EQUAL(0, linenoiseEditStart(&ls));
+    esp_console_log_batch_config_t config = ESP_CONSOLE_LOG_BATCH_CONFIG_DEFAULT();
+    config.buffer_size = 32;    // room for 3 lines
+    config.coalesce_ms = 1000;
+    TEST_ESP_OK(esp_console_log_batch_start(&config));
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_STATE, esp_console_log_batch_start(&config));
+    TEST_ASSERT_EQUAL(ESP_ERR_NOT_SUPPORTED, esp_console_log_batch_begin(&ls));
+    linenoiseSetDumbMode(0);
+    ls.cols = 80;
+    TEST_ASSERT_EQUAL(LINENOISE_EDIT_MORE, linenoiseEditFeedLine(&ls));
+    TEST_ASSERT_EQUAL(LINENOISE_EDIT_MORE, linenoiseEditFeedLine(&ls));
+    TEST_ESP_OK(esp_console_log_batch_begin(&ls));
+
+    /* The oldest lines are dropped, the others are printed at once and the line is shown again */
+    fflush(out);
+    const long edited = ftell(out);
+    log_lines(1, 9);
+    fflush(out);
+    TEST_ASSERT_EQUAL(edited, ftell(out));
+    uint32_t wait_ms = 0;
+    esp_console_log_batch_flush(false, &wait_ms);
+    TEST_ASSERT_TRUE(wait_ms > 0 && wait_ms <= 1000);
+    esp_console_log_batch_flush(true, &wait_ms);
+    TEST_ASSERT_EQUAL(UINT32_MAX, wait_ms);
+    fflush(out);
+    TEST_ASSERT_NULL(strstr(output, "line 6"));
+    const char *logs = strstr(output, "line 7\nline 8\nline 9\n(6 log lines dropped)\n");
+    TEST_ASSERT_NOT_NULL(logs);
+    TEST_ASSERT_NOT_NULL(strstr(logs, "esp> ab"));
+
+    /* Once the line is done, the lines kept are printed and the next ones aren't kept */
+    log_lines(10, 10);
+    TEST_ASSERT_EQUAL(LINENOISE_EDIT_MORE, linenoiseEditFeedLine(&ls));
+    TEST_ASSERT_TRUE(ls.eof);
+    linenoiseEditStop(&ls);
+    esp_console_log_batch_end();
+    log_lines(11, 11);
+    fflush(out);
+    TEST_ASSERT_NOT_NULL(strstr(logs, "line 10\n"));
+    TEST_ASSERT_NULL(strstr(logs, "line 11"));
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, esp_console_log_batch_begin(NULL));
+    TEST_ESP_OK(esp_console_log_batch_stop());
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_STATE, esp_console_log_batch_stop());
+
+    /* With DROP_NEWEST, the lines which don't fit are dropped; stopping prints the others */
+    rewind(out);
+    memset(output, 0, sizeof(output));
+    config.policy = ESP_CONSOLE_OUTPUT_DROP_NEWEST;
+    TEST_ESP_OK(esp_console_log_batch_start(&config));
+    TEST_ESP_OK(esp_console_log_batch_begin(&ls));
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_STATE, esp_console_log_batch_begin(&ls));
+    log_lines(1, 9);
+    TEST_ESP_OK(esp_console_log_batch_stop());
+    fflush(out);
+    TEST_ASSERT_EQUAL_STRING("line 1\nline 2\nline 3\n(6 log lines dropped)\n", output);
+
+    fclose(ls.in);
+    fclose(out);
+}
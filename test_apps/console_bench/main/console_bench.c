@@ -0,0 +1,354 @@
+/*
+ * SPDX-FileCopyrightText: 2022-2023 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "sdkconfig.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "esp_console.h"
+#include "argtable3/argtable3.h"
+#include "linenoise/linenoise.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#if !CONFIG_IDF_TARGET_LINUX
+#include "esp_cpu.h"
+#endif
+
+#define BENCH_NUM_COMMANDS  150     // commands registered for the dispatch and completion workloads
+#define BENCH_HISTORY_LEN   1000    // lines kept in the history
+#define BENCH_LINE_LEN      240     // length of the pasted lines
+
+/* Allocations made by the code being measured, see main/CMakeLists.txt */
+static volatile uint32_t s_allocs;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+    s_allocs++;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t n, size_t size)
+{
+    s_allocs++;
+    return __real_calloc(n, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    s_allocs++;
+    return __real_realloc(ptr, size);
+}
+
+#if !CONFIG_IDF_TARGET_LINUX
+void *__real_heap_caps_malloc(size_t size, uint32_t caps);
+void *__real_heap_caps_calloc(size_t n, size_t size, uint32_t caps);
+void *__real_heap_caps_realloc(void *ptr, size_t size, uint32_t caps);
+
+void *__wrap_heap_caps_malloc(size_t size, uint32_t caps)
+{
+    s_allocs++;
+    return __real_heap_caps_malloc(size, caps);
+}
+
+void *__wrap_heap_caps_calloc(size_t n, size_t size, uint32_t caps)
+{
+    s_allocs++;
+    return __real_heap_caps_calloc(n, size, caps);
+}
+
+void *__wrap_heap_caps_realloc(void *ptr, size_t size, uint32_t caps)
+{
+    s_allocs++;
+    return __real_heap_caps_realloc(ptr, size, caps);
+}
+#endif
+
+typedef struct {
+    const char *name;
+    uint32_t iterations;
+    void (*setup)(void);        // may be NULL, not measured
+    void (*run)(void);          // one operation
+    void (*teardown)(void);     // may be NULL, not measured
+} bench_t;
+
+static void bench_run(const bench_t *bench)
+{
+    if (bench->setup) {
+        bench->setup();
+    }
+    /* Once, so that what is allocated on first use isn't counted */
+    bench->run();
+
+    s_allocs = 0;
+#if !CONFIG_IDF_TARGET_LINUX
+    const uint32_t start_cycles = esp_cpu_get_cycle_count();
+#endif
+    const int64_t start_us = esp_timer_get_time();
+    for (uint32_t i = 0; i < bench->iterations; i++) {
+        bench->run();
+    }
+    const int64_t elapsed_us = esp_timer_get_time() - start_us;
+#if !CONFIG_IDF_TARGET_LINUX
+    const uint32_t cycles = esp_cpu_get_cycle_count() - start_cycles;
+#endif
+    const uint32_t allocs = s_allocs;
+
+    const uint64_t allocs_x100 = (uint64_t) allocs * 100 / bench->iterations;
+    printf("%-32s %8" PRIu64 " ns/op %5" PRIu64 ".%02u allocs/op", bench->name,
+           (uint64_t) elapsed_us * 1000 / bench->iterations, allocs_x100 / 100, (unsigned)(allocs_x100 % 100));
+#if !CONFIG_IDF_TARGET_LINUX
+    printf(" %8" PRIu32 " cycles/op", cycles / bench->iterations);
+#endif
+    printf("\n");
+
+    if (bench->teardown) {
+        bench->teardown();
+    }
+}
+
+/* A pasted line with quoted and escaped arguments */
+static char s_long_line[BENCH_LINE_LEN + 1];
+static char s_split_buf[BENCH_LINE_LEN + 1];
+static char *s_argv[64];
+
+static void make_long_line(void)
+{
+    static const char *const words[] = { "set", "\"quoted value\"", "esc\\ aped", "--opt=42", "0x1f", "path/to/file" };
+    size_t len = 0;
+    for (size_t i = 0; len + 20 < BENCH_LINE_LEN; i++) {
+        len += snprintf(s_long_line + len, sizeof(s_long_line) - len, "%s ", words[i % (sizeof(words) / sizeof(words[0]))]);
+    }
+}
+
+static void split_run(void)
+{
+    memcpy(s_split_buf, s_long_line, sizeof(s_split_buf));
+    esp_console_split_argv(s_split_buf, s_argv, sizeof(s_argv) / sizeof(s_argv[0]));
+}
+
+static void split_spans_run(void)
+{
+    esp_console_arg_span_t spans[64];
+    size_t count;
+    esp_console_split_argv_spans(s_long_line, strlen(s_long_line), spans, 64, &count);
+}
+
+/* Registry of many commands */
+static char s_command_names[BENCH_NUM_COMMANDS][12];
+static char s_run_buf[64];
+static char *s_run_argv[8];
+
+static int noop_cmd(int argc, char **argv)
+{
+    return 0;
+}
+
+static void registry_setup(void)
+{
+    esp_console_config_t config = ESP_CONSOLE_CONFIG_DEFAULT();
+    ESP_ERROR_CHECK(esp_console_init(&config));
+    for (int i = 0; i < BENCH_NUM_COMMANDS; i++) {
+        snprintf(s_command_names[i], sizeof(s_command_names[i]), "cmd_%03d", i);
+        const esp_console_cmd_t cmd = {
+            .command = s_command_names[i],
+            .help = "Do nothing",
+            .hint = "[args]",
+            .func = noop_cmd,
+        };
+        ESP_ERROR_CHECK(esp_console_cmd_register(&cmd));
+    }
+}
+
+static void registry_teardown(void)
+{
+    ESP_ERROR_CHECK(esp_console_deinit());
+}
+
+static void register_run(void)
+{
+    registry_setup();
+    registry_teardown();
+}
+
+static void dispatch_run(void)
+{
+    int ret;
+    esp_console_run_ex("cmd_075 a b c", s_run_buf, sizeof(s_run_buf), s_run_argv, 8, &ret);
+}
+
+static void completion_run(void)
+{
+    linenoiseCompletions lc = { 0 };
+    esp_console_get_completion("cmd_1", &lc);
+    free(lc.cvec);
+}
+
+static void hint_run(void)
+{
+    int color;
+    int bold;
+    esp_console_get_hint("cmd_075", &color, &bold);
+}
+
+/* Commands of the argtable dispatcher */
+static int arg_noop_cmd(int argc, char *argv[], arg_dstr_t res)
+{
+    return 0;
+}
+
+static void arg_cmd_setup(void)
+{
+    arg_cmd_init();
+    for (int i = 0; i < BENCH_NUM_COMMANDS; i++) {
+        snprintf(s_command_names[i], sizeof(s_command_names[i]), "cmd_%03d", i);
+        arg_cmd_register(s_command_names[i], arg_noop_cmd, "Do nothing");
+    }
+}
+
+static void arg_cmd_run(void)
+{
+    char *argv[] = { "cmd_075" };
+    arg_cmd_dispatch("cmd_075", 1, argv, NULL);
+}
+
+static void arg_cmd_teardown(void)
+{
+    arg_cmd_uninit();
+}
+
+/* Arguments of most types */
+static struct {
+    struct arg_int *count;
+    struct arg_str *name;
+    struct arg_rex *match;
+    struct arg_date *date;
+    struct arg_lit *verbose;
+    struct arg_end *end;
+} s_args;
+
+static char *s_parse_argv[] = {
+    "cmd", "-c", "42", "--name", "sensor", "--match", "abc123", "--date", "2024-01-02", "-v",
+};
+
+static void parse_setup(void)
+{
+    s_args.count = arg_int0("c", "count", "<n>", "count");
+    s_args.name = arg_str0(NULL, "name", "<name>", "name");
+    s_args.match = arg_rex0(NULL, "match", "^[a-z]+[0-9]+$", "<id>", 0, "identifier");
+    s_args.date = arg_date0(NULL, "date", "%Y-%m-%d", "<date>", "date");
+    s_args.verbose = arg_lit0("v", "verbose", "verbose");
+    s_args.end = arg_end(4);
+    arg_compile((void **) &s_args);
+}
+
+static void parse_run(void)
+{
+    arg_parse(sizeof(s_parse_argv) / sizeof(s_parse_argv[0]), s_parse_argv, (void **) &s_args);
+}
+
+static void parse_teardown(void)
+{
+    arg_uncompile((void **) &s_args);
+    arg_freetable((void **) &s_args, sizeof(s_args) / sizeof(s_args.count));
+}
+
+/* Full history */
+static uint32_t s_history_count;
+
+static void history_setup(void)
+{
+    linenoiseHistorySetMaxLen(BENCH_HISTORY_LEN);
+    for (int i = 0; i < BENCH_HISTORY_LEN; i++) {
+        char line[32];
+        snprintf(line, sizeof(line), "wifi connect ap_%d", i);
+        linenoiseHistoryAdd(line);
+    }
+}
+
+static void history_run(void)
+{
+    char line[32];
+    snprintf(line, sizeof(line), "wifi connect ap_%" PRIu32, s_history_count++);
+    linenoiseHistoryAdd(line);
+}
+
+static void history_teardown(void)
+{
+    linenoiseHistoryFree();
+}
+
+/* Line editing of a pasted line */
+static char s_paste[BENCH_LINE_LEN + 2];
+static char s_edit_buf[BENCH_LINE_LEN + 1];
+static char s_edit_out[4 * BENCH_LINE_LEN];
+static FILE *s_edit_in;
+static FILE *s_edit_out_file;
+
+static void edit_setup(void)
+{
+    if (stdout_taken_sem == NULL) {
+        stdout_taken_sem = xSemaphoreCreateMutex();
+    }
+    snprintf(s_paste, sizeof(s_paste), "%s\n", s_long_line);
+    s_edit_in = fmemopen(s_paste, strlen(s_paste), "r");
+    s_edit_out_file = fmemopen(s_edit_out, sizeof(s_edit_out), "w");
+}
+
+static void edit_run(void)
+{
+    rewind(s_edit_in);
+    rewind(s_edit_out_file);
+    struct linenoiseState ls = {
+        .buf = s_edit_buf, .buflen = sizeof(s_edit_buf), .prompt = "esp> ", .plen = 5,
+        .in = s_edit_in, .out = s_edit_out_file,
+    };
+    /* Don't probe the terminal size, the input has no answer */
+    linenoiseSetDumbMode(1);
+    linenoiseEditStart(&ls);
+    linenoiseSetDumbMode(0);
+    linenoiseSetColumns(&ls, 80);
+    while (linenoiseEditFeedLine(&ls) == LINENOISE_EDIT_MORE) {
+    }
+    linenoiseEditStop(&ls);
+}
+
+static void edit_teardown(void)
+{
+    fclose(s_edit_in);
+    fclose(s_edit_out_file);
+}
+
+static const bench_t s_benches[] = {
+    { "split_argv long line", 20000, NULL, split_run, NULL },
+    { "split_argv_spans long line", 20000, NULL, split_spans_run, NULL },
+    { "register 150 commands", 20, NULL, register_run, NULL },
+    { "run among 150 commands", 100000, registry_setup, dispatch_run, registry_teardown },
+    { "complete among 150 commands", 20000, registry_setup, completion_run, registry_teardown },
+    { "hint among 150 commands", 100000, registry_setup, hint_run, registry_teardown },
+    { "arg_cmd_dispatch among 150", 100000, arg_cmd_setup, arg_cmd_run, arg_cmd_teardown },
+    { "arg_parse int/str/rex/date/lit", 20000, parse_setup, parse_run, parse_teardown },
+    { "history add, full", 20000, history_setup, history_run, history_teardown },
+    { "edit pasted line", 2000, edit_setup, edit_run, edit_teardown },
+};
+
+void app_main(void)
+{
+    make_long_line();
+    printf("Console benchmarks, %u byte lines\n", (unsigned) strlen(s_long_line));
+    for (size_t i = 0; i < sizeof(s_benches) / sizeof(s_benches[0]); i++) {
+        bench_run(&s_benches[i]);
+    }
+    printf("Done\n");
+#if CONFIG_IDF_TARGET_LINUX
+    exit(0);
+#endif
+}
@@ -0,0 +1,25 @@
+# SPDX-FileCopyrightText: 2022-2023 Espressif Systems (Shanghai) CO LTD
+# SPDX-License-Identifier: CC0-1.0
+
+import pytest
+from pytest_embedded import Dut
+
+
+def do_test_bench(dut: Dut) -> None:
+    dut.expect_exact('Console benchmarks')
+    for name in ('split_argv long line', 'run among 150 commands', 'arg_parse int/str/rex/date/lit',
+                 'history add, full', 'edit pasted line'):
+        dut.expect(name + r'\s+\d+ ns/op\s+\d+\.\d+ allocs/op', timeout=60)
+    dut.expect_exact('Done', timeout=120)
+
+
+@pytest.mark.generic
+@pytest.mark.supported_targets
+def test_console_bench(dut: Dut) -> None:
+    do_test_bench(dut)
+
+
+@pytest.mark.host_test
+@pytest.mark.linux
+def test_console_bench_linux(dut: Dut) -> None:
+    do_test_bench(dut)